@@ -7,9 +7,21 @@ CPP_SRCS += \
 ../source/Arcball.cpp \
 ../source/DeviceMemoryLogger.cpp \
 ../source/ImageLoader.cpp \
+../source/cParticleCache.cpp \
+../source/cAsciiParticleSource.cpp \
+../source/particleSort.cpp \
+../source/benchmarks.cpp \
+../source/cSphereBVH.cpp \
+../source/cWideBVH.cpp \
+../source/cWideBVH_avx2.cpp \
+../source/pixelConvert.cpp \
+../source/pixelConvert_avx2.cpp \
+../source/cCpuParticlesRenderer.cpp \
+../source/cRenderScheduler.cpp \
 ../source/PPMLoader.cpp \
 ../source/cOptixParticlesRenderer.cpp \
 ../source/loaders.cpp \
+../source/offline.cpp \
 ../source/main.cpp \
 ../source/sutil.cpp 
 
@@ -17,9 +29,21 @@ OBJS += \
 ./source/Arcball.o \
 ./source/DeviceMemoryLogger.o \
 ./source/ImageLoader.o \
+./source/cParticleCache.o \
+./source/cAsciiParticleSource.o \
+./source/particleSort.o \
+./source/benchmarks.o \
+./source/cSphereBVH.o \
+./source/cWideBVH.o \
+./source/cWideBVH_avx2.o \
+./source/pixelConvert.o \
+./source/pixelConvert_avx2.o \
+./source/cCpuParticlesRenderer.o \
+./source/cRenderScheduler.o \
 ./source/PPMLoader.o \
 ./source/cOptixParticlesRenderer.o \
 ./source/loaders.o \
+./source/offline.o \
 ./source/main.o \
 ./source/sutil.o 
 
@@ -27,9 +51,21 @@ CPP_DEPS += \
 ./source/Arcball.d \
 ./source/DeviceMemoryLogger.d \
 ./source/ImageLoader.d \
+./source/cParticleCache.d \
+./source/cAsciiParticleSource.d \
+./source/particleSort.d \
+./source/benchmarks.d \
+./source/cSphereBVH.d \
+./source/cWideBVH.d \
+./source/cWideBVH_avx2.d \
+./source/pixelConvert.d \
+./source/pixelConvert_avx2.d \
+./source/cCpuParticlesRenderer.d \
+./source/cRenderScheduler.d \
 ./source/PPMLoader.d \
 ./source/cOptixParticlesRenderer.d \
 ./source/loaders.d \
+./source/offline.d \
 ./source/main.d \
 ./source/sutil.d 
 
@@ -18,6 +18,41 @@ var jpegCompression = false;
 var h264Compression = true;
 var noCompression   = false;
 var playerH264; 
+// Frames start with a binary header (frame id, render and encode time, codec, size) when
+// PIPELINE is enabled in the server in cBroadcastServer.h, see cProtocol.h
+var frameHeader		= true;
+var FRAME_HEADER_SIZE	= 24;
+// Frames with FRAME_FLAG_PATCHES only update tiles of the image, DIRTY_TILES in the server.
+// They are drawn onto the image kept at the frame's resolution, which is scaled to the canvas.
+var FRAME_FLAG_PATCHES	= 1;
+var PATCH_BASE_SIZE		= 4;
+var PATCH_HEADER_SIZE	= 12;
+var frameCanvas			= null;
+var frameCtx;
+var drawing				= false;
+// Credit flow control: the server keeps up to creditWindow frames in flight and every frame
+// is acked with its id. Otherwise the next frame is requested after each frame.
+// CREDIT_FLOW should be enabled in the server in cBroadcastServer.h, it needs frameHeader
+var creditFlow		= true;
+var creditWindow	= 4;
+// frames received while the FileReader is busy, and the frame being shown
+var pendingFrames	= [];
+var currentFrame	= null;
+// This client's JPEG quality and resolution in percent of the rendered one, 0 leaves them to
+// the server's rate control. The server encodes once for all clients with the same settings.
+// CREDIT_FLOW
+var sessionQuality	= 0;
+var sessionScale	= 0;
+
+// Binary control messages, u8 type, 3 bytes padding, u32 value (cProtocol.h)
+var CONTROL_START		= 16;
+var CONTROL_STOP		= 17;
+var CONTROL_NEXT_FRAME	= 18;
+var CONTROL_SAVE		= 19;
+var CONTROL_CREDIT		= 20;
+var CONTROL_ACK			= 21;
+var CONTROL_QUALITY		= 22;
+var CONTROL_SCALE		= 23;
 
 //var imageheight = 512;
 //var imagewidth	= 512;
@@ -55,6 +90,9 @@ function createMainCanvasAndContext ()
     canvas.style = "-moz-transform: scale(-1, 1); -webkit-transform: scale(1, -1); -o-transform: scale(1, -1); transform: scale(1, -1);"        
     document.getElementById('main').appendChild(canvas);
     ctx = canvas.getContext('2d');     
+    // frames rendered at a lower resolution while the view moves are scaled up to the canvas
+    ctx.imageSmoothingEnabled = true;
+    ctx.imageSmoothingQuality = "high";
 }
 
 function init() 
@@ -96,7 +134,8 @@ function init()
 
 function loadPixels ()
 {
-	ctx.drawImage(jpegImg, 0, 0);
+	// frames below the canvas resolution are scaled up
+	ctx.drawImage(jpegImg, 0, 0, canvas.width, canvas.height);
    
 //	console.log ("Load pixels");
 }
@@ -115,7 +154,11 @@ function connectAndCallbacks ()
 	websocket.onerror 	= function(evt) { onError	(evt)	};
 
 	// sets websocket's binary messages as ArrayBuffer type
-    	//websocket.binaryType = "arraybuffer";	
+	// the frame header is read from the ArrayBuffer
+	if (frameHeader)
+	{
+		websocket.binaryType = "arraybuffer";
+	}
 	// sets websocket's binary messages as Blob type by default is Blob type
 	//websocket.binaryType = "blob";
 	
@@ -139,16 +182,35 @@ function fileReaderError (e)
 	console.error("FileReader error. Code " + event.target.error.code);
 }
 
+function sendControl (type, value)
+{
+	var event = new CompositeStream();
+
+	event.appendBytes(type, 0, 0, 0);
+	event.appendUint32(value);
+	if (websocket.readyState == WebSocket.OPEN)
+	{
+		websocket.send (event.consume(event.length));
+	}
+}
+
 // this method is launched when FileReader ends loading the blob
 function nextBlob (e)
 {
 	if (!stop)
 	{
-		//var event = new CompositeStream();
-		//event.appendBytes(0);     // type (u8 0)  0 identifies an event of type MESSAGE 
-		//event.appendBytes ("NXTFR");
-		//websocket.send (event.consume(event.length));
-		websocket.send ("NXTFR");
+		if (creditFlow)
+		{
+			sendControl (CONTROL_ACK, currentFrame.frameId);
+		}
+		else
+		{
+			sendControl (CONTROL_NEXT_FRAME, 0);
+		}
+	}
+	if (pendingFrames.length > 0)
+	{
+		readNextBlob ();
 	}
 	//console.log (stop);
 }
@@ -209,19 +271,103 @@ function onMessage(e)
 	{
 		console.log ("String msg: ", e, e.data);
 	}
-	else if (e.data instanceof Blob)
+	else
 	{
-		var blob = e.data;
-		
-		if (jpegCompression)
+		var frame = { frameId: 0, blob: e.data };
+
+		if (e.data instanceof ArrayBuffer)
 		{
-		    reader.readAsDataURL(blob);
+			// big endian, as written by cProtocol::writeFrameHeader
+			var header 			= new DataView(e.data, 0, FRAME_HEADER_SIZE);
+			frame.codec			= header.getUint8(2);
+			frame.flags			= header.getUint8(3);
+			frame.frameId		= header.getUint32(4);
+			frame.renderTime	= header.getUint32(8) * 4294967296 + header.getUint32(12);
+			frame.encodeTime	= header.getUint32(16);
+			frame.width			= header.getUint16(20);
+			frame.height		= header.getUint16(22);
+			frame.blob			= new Blob([new Uint8Array(e.data, FRAME_HEADER_SIZE)]);
+			frame.patches		= readPatches (e.data, frame);
 		}
-		else if (h264Compression || noCompression)
+		pendingFrames.push (frame);
+		if (reader.readyState != FileReader.LOADING && !drawing)
 		{
-            reader.readAsArrayBuffer(blob);
+			readNextBlob ();
 		}
-        
+	}
+}
+
+// The JPEGs of a frame and where they go, the whole image or the patches of FRAME_FLAG_PATCHES
+function readPatches (buffer, frame)
+{
+	if (!(frame.flags & FRAME_FLAG_PATCHES))
+	{
+		return [{ x: 0, y: 0, width: frame.width, height: frame.height,
+				  blob: new Blob([new Uint8Array(buffer, FRAME_HEADER_SIZE)], { type: "image/jpeg" }) }];
+	}
+	var patches	= [];
+	var view	= new DataView(buffer);
+	var p		= FRAME_HEADER_SIZE + PATCH_BASE_SIZE;
+	while (p + PATCH_HEADER_SIZE <= buffer.byteLength)
+	{
+		var size = view.getUint32(p + 8);
+		patches.push({ x: view.getUint16(p), y: view.getUint16(p + 2), width: view.getUint16(p + 4), height: view.getUint16(p + 6),
+					   blob: new Blob([new Uint8Array(buffer, p + PATCH_HEADER_SIZE, size)], { type: "image/jpeg" }) });
+		p += PATCH_HEADER_SIZE + size;
+	}
+	return patches;
+}
+
+// Decodes the JPEGs of a frame and draws them at their pixel position. One frame is drawn after
+// the other, so patches always land on the image they were made for.
+function drawPatches (frame)
+{
+	drawing = true;
+	Promise.all(frame.patches.map(function (patch) { return createImageBitmap(patch.blob); })).then(function (images)
+	{
+		if (!frameCanvas)
+		{
+			frameCanvas	= document.createElement('canvas');
+			frameCtx	= frameCanvas.getContext('2d');
+		}
+		// a new resolution always comes as a whole frame
+		if (frameCanvas.width != frame.width || frameCanvas.height != frame.height)
+		{
+			frameCanvas.width	= frame.width;
+			frameCanvas.height	= frame.height;
+		}
+		for (var i = 0; i < images.length; i++)
+		{
+			frameCtx.drawImage(images[i], frame.patches[i].x, frame.patches[i].y);
+			images[i].close();
+		}
+		ctx.drawImage(frameCanvas, 0, 0, canvas.width, canvas.height);
+	}).catch(function (e)
+	{
+		console.log ("Frame " + frame.frameId + " could not be decoded", e);
+	}).then(function ()
+	{
+		drawing = false;
+		nextBlob ();
+	});
+}
+
+// frames arrive in order and are read one at a time
+function readNextBlob ()
+{
+	currentFrame = pendingFrames.shift();
+
+	if (jpegCompression && currentFrame.patches)
+	{
+		drawPatches (currentFrame);
+	}
+	else if (jpegCompression)
+	{
+	    reader.readAsDataURL(currentFrame.blob);
+	}
+	else if (h264Compression || noCompression)
+	{
+        reader.readAsArrayBuffer(currentFrame.blob);
 	}
 }
 
@@ -245,7 +391,16 @@ function startingConnection()
 {
 	alert('Streaming ON...');
 
-	websocket.send ("STVIS");
+	if (creditFlow)
+	{
+		sendControl (CONTROL_QUALITY, sessionQuality);
+		sendControl (CONTROL_SCALE, sessionScale);
+	}
+	sendControl (CONTROL_START, 0);
+	if (creditFlow)
+	{
+		sendControl (CONTROL_CREDIT, creditWindow);
+	}
 	stop = false;
 }
 
@@ -261,13 +416,13 @@ function closeConnection ( )
 function captureFrame ()
 {
 	alert('Frame Saved!.');
-	websocket.send ("SAVE ");
+	sendControl (CONTROL_SAVE, 0);
 }
     
 function closingConnection()
 {
     alert('Streaming OFF...');
-	websocket.send ("END  ");
+	sendControl (CONTROL_STOP, 0);
 	stop = true;
 	//websocket.close ();
 }
@@ -11,6 +11,7 @@
 // WebSockets
 #include <set>
 #include <memory>
+#include <atomic>
 #include <iostream>
 #include <websocketpp/config/asio_no_tls.hpp>
 #include <websocketpp/server.hpp>
@@ -18,6 +19,8 @@
 
 #include "cTimer.h"
 #include "cStats.h"
+#include "cProtocol.h"
+#include "cMessagePool.h"
 
 #define STATS
 #define REMOTE
@@ -44,6 +47,27 @@
 
 #ifdef REMOTE
         #define JPEG_ENCODING
+        // JPEG stripes compressed in parallel and joined with restart markers (cParallelJpegEncoder)
+        #define PARALLEL_JPEG
+        // threads of the striped encoder, 0 for one per core
+        #define JPEG_THREADS            0
+        // render, JPEG encode and send on separate threads through cFrameQueue rings
+        #define PIPELINE
+        // clients grant frame credits and ack frames instead of NXTFR stop-and-wait (cFlowControl),
+        // each in its own session with its own JPEG quality and resolution (cClientSession)
+        #define CREDIT_FLOW
+        // sessions pick JPEG quality, subsampling and resolution from their link (cRateControl)
+        #define RATE_CONTROL
+        // render fewer pixels while the camera moves and the full resolution once it stands
+        // still (cRenderScheduler), the encode groups take frames of any size. Needs CREDIT_FLOW.
+        #define DYNAMIC_RESOLUTION
+        // frames that look like the one encoded last are neither encoded nor sent, the client
+        // keeps showing its last frame (cFrameHash)
+        #define SKIP_UNCHANGED
+        // only the tiles changed since the frame the clients show are encoded and sent, as JPEG
+        // patches the client draws over its image (cEncodeGroup). Needs CREDIT_FLOW.
+        #define DIRTY_TILES
+        // every frame is scaled by RESOLUTION_FACTOR before it is encoded (cResampler)
         //#define CHANGE_RESOLUTION
         #define RESOLUTION_FACTOR       1.0f
         #define FULLHD
@@ -86,14 +110,52 @@ class cMessageHandler;
 	#define TIME_RESPONSE		30
 	#include <chrono>
 	using namespace std::chrono;
+#ifdef PARALLEL_JPEG
+	class cParallelJpegEncoder;
+	typedef cParallelJpegEncoder	jpeg_encoder;
+#else
 	class cTurboJpegEncoder;
+	typedef cTurboJpegEncoder		jpeg_encoder;
+#endif
 #endif
 
 #ifdef NVPIPE_ENCODING
 	class cNvPipeEncoderWrapper;
 #endif
 
-class cPNGEncoder;
+#ifdef PIPELINE
+	#include <thread>
+	#include <mutex>
+	#include <condition_variable>
+	#include <vector>
+	#include "cFrameQueue.h"
+	// encoded frames start with a cProtocol frame header
+	// raw frames: the renderer never waits, the encoder takes the newest one
+	#define PIPELINE_RAW_FRAMES		3
+	// encoded frames: the encoder replaces the ones the client has not asked for yet
+	#define PIPELINE_JPEG_FRAMES	2
+#endif
+
+#ifdef CREDIT_FLOW
+	#include <map>
+	#include <vector>
+	#include "cClientSession.h"
+	template <class Encoder> class cEncodeGroup;
+	// how often the send thread checks whether a socket buffer has drained
+	#define FLOW_POLL_MS			2
+#endif
+
+#ifdef CHANGE_RESOLUTION
+	#include "cResampler.h"
+#endif
+
+#ifdef SKIP_UNCHANGED
+	#include <atomic>
+	#include "cFrameHash.h"
+#endif
+
+class cSnapshotWriter;
+class cThreadPool;
 
 class broadcast_server {
 public:
@@ -115,36 +177,52 @@ public:
     void 	setMouseHandler				( cMouseHandler			*mouseH							);
     void 	setKeyboardHandler			( cKeyboardHandler		*keyboardH						);
     void 	setMessageHandler			( cMessageHandler		*messageH						);
+    // Called on the network thread for new connections, input and stream requests
+    void	setWakeHandler				( std::function<void()>	handler							) {m_wakeHandler = handler; };
 
     bool	sendMoreFrames				(	) 				{return needMoreFrames; };
+    bool	streaming					(	)				{return !stop; };
+#ifdef PIPELINE
+    // Ring the render thread fills with RGB frames while streaming()
+    cFrameQueue*	frameQueue			(	)				{return m_rawFrames; };
+#endif
     bool 	saveFrame					( 	)				{return m_saveFrame; };
     void	save						( unsigned char *img);
     void	printStats					( );
 
 private:
 
-    void	parse 					( int type, std::stringstream *value 	);
-    void	scale 					( unsigned char *in, unsigned char *out, float factor );
+    void	parse 					( const sControlMessage &msg 	);
     void	sendJPEGFrame 			( unsigned char *rgb ); // img must be RGB 8 bits per channel
     void	sendNvPipeFrame 		( unsigned char *rgba ); // img must be RGBA 8 bits per channel
     void	sendNvPipeFrame 		(void *rgbaDevice ); //
-    bool				needMoreFrames, stop, m_saveFrame;
+    void	requestFrame			(	);
+    bool				m_saveFrame;
+    // read by the render thread; with PIPELINE written under m_demandMutex, where the send thread
+    // takes the request
+    std::atomic<bool>	needMoreFrames;
+    // read by the render and send threads; with CREDIT_FLOW only updateStreaming() writes it
+    std::atomic<bool>	stop;
     typedef	std::set<connection_hdl,std::owner_less<connection_hdl>> con_list;
     server 				m_server;
     con_list 			m_connections;
+    // every frame is written once into a pooled message shared by all connections
+    cMessagePool<server::message_ptr::element_type>	m_messages;
     std::stringstream 	string;
 
     cMouseHandler		*mouseHandler;
     cKeyboardHandler	*keyboardHandler;
     cMessageHandler		*messageHandler;
+    std::function<void()>	m_wakeHandler;
 
-    // PNG Encoder
-	cPNGEncoder								*pngEncoder;
+    // PNG snapshots, written in the background
+	cSnapshotWriter							*m_snapshots;
 	cTimer									m_netStatsTimer, m_statsTimer;
 	cTimer									m_sendTimer,	 m_encTimer;
-	AverageStats							m_netStats; // reports round-trip latency encode -> send (server) -> receive (client) -> decoding (client) -> send Next_frame msg (client) -> receive Next_frame msg (server)
-	AverageStats							m_encStats; // reports encoder latency
-	AverageStats							m_sendStats; // reports send latency
+	// latency distributions, added to from any thread and rotated by printStats()
+	LatencyStats							m_netStats; // reports round-trip latency encode -> send (server) -> receive (client) -> decoding (client) -> send Next_frame msg (client) -> receive Next_frame msg (server)
+	LatencyStats							m_encStats; // reports encoder latency
+	LatencyStats							m_sendStats; // reports send latency
 	AverageStats							m_decStats;  // reports an approximate of decoding latency
 
 
@@ -158,8 +236,9 @@ private:
     // Adjust quality of the JPEG according to the
     // image transport throughput
     void adjustJpegQuality			( 	);
+    jpeg_encoder*	createJpegEncoder	(	);
 	// JPEG m_encoder
-	cTurboJpegEncoder						*jpegEncoder;
+	jpeg_encoder							*jpegEncoder;
 	// JPEG encoding quality
 	unsigned int							jpegQuality;
 	// Specify the desired time response for image transport in milliseconds
@@ -169,8 +248,40 @@ private:
 	// image transport duration in microiseconds
 	std::chrono::microseconds				stDuration;
 #endif
-#ifdef SAVE_IMG
-    void	scale				( unsigned char *in, unsigned char *out, float factor );
+#ifdef PIPELINE
+    void	encodeLoop				(	);
+    void	sendLoop				(	);
+	cFrameQueue								*m_rawFrames, *m_jpegFrames;
+	std::thread								m_encodeThread, m_sendThread;
+	// needMoreFrames is signalled to the send thread
+	std::mutex								m_demandMutex;
+	std::condition_variable					m_demandCond;
+	bool									m_pipelineQuit;
+#endif
+#ifdef CREDIT_FLOW
+    bool	sessionMessage			( connection_hdl hdl, const sControlMessage &msg );
+    void	updateStreaming			(	);
+    size_t	bufferedAmount			( connection_hdl hdl );
+	// guarded by m_demandMutex: one session per connection, one encode per distinct settings of
+	// the streaming sessions, and a counter of frames encoded, acks and credits for the send thread
+	std::map<connection_hdl, cClientSession, std::owner_less<connection_hdl>>	m_sessions;
+	std::vector<std::shared_ptr<cEncodeGroup<jpeg_encoder>>>					m_groups;
+	uint64_t								m_sendEvents;
+#ifdef PARALLEL_JPEG
+	// the encode thread runs the groups one after the other, their encoders share the threads
+	cThreadPool								*m_encodePool;
+#endif
+#endif
+#ifdef CHANGE_RESOLUTION
+	cResampler								m_resampler;
+#endif
+#ifdef SKIP_UNCHANGED
+	// hash of the frame being encoded and, without encode groups, of the one encoded last
+	cFrameHash								m_frameHash, m_encodedHash;
+	// a client started streaming, the next frame is encoded even when unchanged. Sessions know
+	// whether their client has an image with CREDIT_FLOW.
+	std::atomic<bool>						m_refresh;
+	std::atomic<uint64_t>					m_unchanged;
 #endif
 };
 
@@ -0,0 +1,186 @@
+/*
+ * Distributed under the OSI-approved Apache License, Version 2.0.  See
+ * accompanying file Copyright.txt for details.
+ */
+#ifndef CCLIENTSESSION_H_
+#define CCLIENTSESSION_H_
+
+#include <stdint.h>
+#include <algorithm>
+#include "cTurboJpegEncoder.h"
+#include "cProtocol.h"
+#include "cFlowControl.h"
+#include "cRateControl.h"
+#include "cStats.h"
+
+// Lowest resolution a client may ask for, percent of the rendered one
+#define SESSION_MIN_SCALE			10
+
+// How a client wants its frames encoded. Sessions with equal settings share one encode.
+struct sEncodeSettings
+{
+	int		quality;
+	int		scale;			// percent of the rendered resolution
+	int		subsampling;	// TJSAMP_*
+
+	bool	operator==		( const sEncodeSettings &o ) const
+	{
+		return quality == o.quality && scale == o.scale && subsampling == o.subsampling;
+	};
+	bool	operator<		( const sEncodeSettings &o ) const
+	{
+		if (quality != o.quality)
+			return quality < o.quality;
+		if (scale != o.scale)
+			return scale < o.scale;
+		return subsampling < o.subsampling;
+	};
+};
+
+/*
+ * State of one connection: whether it streams, its encode settings, its flow control and its
+ * stats. The broadcast server keeps one per connection, guarded by its demand mutex.
+ * With adaptive set, cRateControl picks the settings the client did not fix.
+ * The send thread records the last frame sent, the image the client shows once it has drawn
+ * the frames before; websocket messages arrive in order, so patches sent after it apply to it.
+ */
+class cClientSession
+{
+public:
+				cClientSession				(	)
+				{
+					settings.quality		= TJPEG_QUALITY;
+					settings.scale			= 100;
+					settings.subsampling	= TJSAMP_444;
+					streaming				= false;
+					adaptive				= false;
+					hasImage				= false;
+					imageFrame				= 0;
+					imageSettings			= settings;
+					framesSent				= 0;
+					bytesSent				= 0;
+					m_quality				= 0;
+					m_scale					= 0;
+					m_renderTime			= 0;
+					m_bytes					= 0;
+					m_share					= 1.0;
+				};
+
+	/*
+	 * Applies a control message to the session. Returns true when the message only concerns
+	 * this session; stream requests return false, they are handled by the server as well.
+	 */
+	bool		control						( const sControlMessage &msg )
+	{
+		switch (msg.type)
+		{
+		case CONTROL_CREDIT:
+			flow.grant(msg.value);
+			return true;
+		case CONTROL_ACK:
+			acked(flow.ack(msg.value, &m_renderTime, &m_bytes, &m_share));
+			return true;
+		case CONTROL_QUALITY:
+			m_quality = msg.value > 0 ? std::min(std::max((int) msg.value, 1), 100) : 0;
+			adapt();
+			return true;
+		case CONTROL_SCALE:
+			m_scale = msg.value > 0 ? std::min(std::max((int) msg.value, SESSION_MIN_SCALE), 100) : 0;
+			adapt();
+			return true;
+		case CONTROL_NEXT_FRAME:
+			acked(flow.ackLatest(&m_renderTime, &m_bytes, &m_share));
+			// falls through
+		case CONTROL_START:
+			if (msg.type == CONTROL_START)
+			{
+				// a client starting over may have cleared its canvas
+				hasImage = false;
+			}
+			// NXTFR from clients without credits acks everything and grants one frame,
+			// which is the old stop-and-wait
+			streaming = true;
+			flow.ack(UINT64_MAX);
+			flow.grant(1);
+			break;
+		case CONTROL_STOP:
+			streaming = false;
+			flow.reset();
+			break;
+		}
+		return false;
+	};
+
+	// A frame of the encode group with these settings was sent, patches with the given flag
+	void		sent						( const sEncodeSettings &frameSettings, uint32_t frameId, bool patches )
+	{
+		if (!patches)
+		{
+			hasImage		= true;
+			imageSettings	= frameSettings;
+		}
+		imageFrame = frameId;
+	};
+
+	// Whether patches of the group with these settings made after frame base apply to the image
+	bool		shows						( const sEncodeSettings &frameSettings, uint32_t base ) const
+	{
+		return hasImage && imageSettings == frameSettings && imageFrame >= base;
+	};
+
+	// Input of any client moves the view of all of them
+	void		interaction					(	)
+	{
+		rate.interaction(cProtocol::now() * 0.001);
+		adapt();
+	};
+
+	// Settings from the rate control and the ones the client fixed
+	void		adapt						(	)
+	{
+		if (adaptive)
+		{
+			rate.update(cProtocol::now() * 0.001, flow.inFlight());
+		}
+		const sRateLevel &level	= rate.current();
+		settings.quality		= m_quality > 0 ? m_quality : adaptive ? level.quality : TJPEG_QUALITY;
+		settings.scale			= m_scale > 0 ? m_scale : adaptive ? level.scale : 100;
+		settings.subsampling	= adaptive && m_quality == 0 ? level.subsampling : TJSAMP_444;
+	};
+
+	sEncodeSettings		settings;
+	cFlowControl		flow;
+	bool				streaming;
+	bool				adaptive;
+	cRateControl		rate;
+	LatencyStats		netStats;		// frame sent -> acked by the client
+	LatencyStats		latencyStats;	// frame rendered -> acked by the client
+	uint64_t			framesSent;
+	uint64_t			bytesSent;
+	// the image shown: its group's settings and the last frame sent to it
+	bool				hasImage;
+	uint32_t			imageFrame;
+	sEncodeSettings		imageSettings;
+
+private:
+
+	void		acked						( double rtt )
+	{
+		if (rtt < 0.0)
+			return;
+		netStats.add(rtt);
+		latencyStats.record(cProtocol::now() - m_renderTime);
+		if (adaptive)
+		{
+			rate.acked(m_bytes, rtt, cProtocol::now() * 0.001, m_share);
+			adapt();
+		}
+	};
+
+	int					m_quality, m_scale;		// fixed by the client, 0 for adaptive
+	uint64_t			m_renderTime;			// of the frame acked last
+	size_t				m_bytes;
+	double				m_share;				// of a whole frame, 0 for patches
+};
+
+#endif /* CCLIENTSESSION_H_ */
@@ -0,0 +1,262 @@
+/*
+ * Distributed under the OSI-approved Apache License, Version 2.0.  See
+ * accompanying file Copyright.txt for details.
+ */
+#ifndef CENCODEGROUP_H_
+#define CENCODEGROUP_H_
+
+#include <iostream>
+#include <chrono>
+#include <memory>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include "cTimer.h"
+#include "cProtocol.h"
+#include "cFrameQueue.h"
+#include "cResampler.h"
+#include "cFrameHash.h"
+#include "cClientSession.h"
+
+// Encoded frames kept per group, the send thread reads one while the encoder writes the next
+#define ENCODE_GROUP_FRAMES			2
+// Frames with a larger share of tiles to update are sent whole, one JPEG is cheaper then
+#define ENCODE_PATCH_MAX_SHARE		0.5f
+
+/*
+ * The encode shared by all sessions with the same sEncodeSettings. Rendered frames are resampled
+ * to the group's resolution, compressed at its quality into its own ring and sent from there to
+ * every session of the group. The ring keeps only the newest frames, a group never waits for
+ * its slowest client. Encoder is cTurboJpegEncoder or cParallelJpegEncoder, owned by the group.
+ * Frames rendered below the group's resolution while the view moves are encoded as they are,
+ * the client scales them up to the size of its canvas.
+ * Given the hash of the frame, the group remembers it and changed() tells whether the next one
+ * would look different; a frame equal to the one encoded last need not be encoded again.
+ * With patches enabled the group keeps the frame every FRAME_HASH_TILE tile of its image last
+ * changed in. When every client of the group shows frame base or a later one, only the tiles
+ * changed since base are encoded, as the FRAME_FLAG_PATCHES rectangles of cProtocol.
+ */
+template <class Encoder>
+class cEncodeGroup
+{
+public:
+					cEncodeGroup				( const sEncodeSettings &settings, int width, int height, Encoder *encoder )
+					: m_encoder(encoder)
+					{
+						m_settings	= settings;
+						m_encodeMs	= 0.0f;
+						m_bytes		= 0;
+						m_patched	= false;
+						m_patches	= false;
+						m_keyframe	= false;
+						m_outWidth	= 0;
+						m_outHeight	= 0;
+						m_width		= std::max(1, width  * settings.scale / 100);
+						m_height	= std::max(1, height * settings.scale / 100);
+
+						m_encoder->setEncoderParams(settings.quality);
+						// the largest frame sizes the ring, smaller ones re-initialize the encoder
+						resize(m_width, m_height);
+						m_frames.reset(new cFrameQueue(ENCODE_GROUP_FRAMES, FRAME_HEADER_SIZE + m_encoder->maxSize(), FRAME_QUEUE_LATEST));
+					};
+
+	/*
+	 * Encodes a width x height RGB frame and publishes it, false on encoding errors. base is the
+	 * oldest frame the clients of the group show, -1 while one of them has no image.
+	 */
+	bool			encode						( unsigned char *rgb, int width, int height, uint32_t frameId, uint64_t renderTime,
+												  const cFrameHash *hash = 0, int64_t base = -1 )
+	{
+		// never above the rendered resolution, nor above the group's
+		resize(std::min(width, m_width), std::min(height, m_height));
+		m_resampler.setup(width, height, m_outWidth, m_outHeight);
+
+		cTimer			encTimer;
+		unsigned char	*image		= m_resampler.resample(rgb);
+		const bool		keyframe	= m_keyframe.exchange(false) || base < 0;
+		bool			patched		= false;
+		if (m_patches)
+		{
+			// the frame's own tile hashes when it is not resampled
+			if (!hash || !m_resampler.identity())
+			{
+				m_tiles.compute(image, m_outWidth, m_outHeight);
+				hash = &m_tiles;
+			}
+			const size_t dirty = track(*hash, frameId, keyframe ? -1 : base);
+			if (!keyframe && dirty == 0)
+			{
+				// the clients show all of it already
+				m_encoded	= *hash;
+				m_encodeMs	= (float) encTimer.getElapsedMilliseconds();
+				m_bytes		= 0;
+				return true;
+			}
+			patched = !keyframe && dirty <= ENCODE_PATCH_MAX_SHARE * m_tileFrames.size();
+		}
+
+		int slot = m_frames->acquire();
+		if (slot < 0)
+			return false;
+
+		unsigned long	size = 0;
+		sFrameHeader	header;
+		unsigned char	*payload = m_frames->data(slot) + FRAME_HEADER_SIZE;
+		bool			ok;
+		if (patched)
+		{
+			cProtocol::writePatchBase((uint32_t) base, payload);
+			ok = m_encoder->encodePatches(image, m_rects, payload + PATCH_BASE_SIZE,
+										  m_frames->capacity() - FRAME_HEADER_SIZE - PATCH_BASE_SIZE, size);
+			size += PATCH_BASE_SIZE;
+		}
+		else
+		{
+			ok = m_encoder->encode(image, payload, size);
+		}
+
+		header.codec		= CODEC_JPEG;
+		header.flags		= patched ? FRAME_FLAG_PATCHES : 0;
+		header.frameId		= frameId;
+		header.renderTime	= renderTime;
+		header.encodeTime	= (uint32_t)(encTimer.getElapsedMilliseconds() * 1000.0);
+		header.width		= (uint16_t) m_outWidth;
+		header.height		= (uint16_t) m_outHeight;
+		cProtocol::writeFrameHeader(header, m_frames->data(slot));
+		m_encodeMs = header.encodeTime * 0.001f;
+
+		if (!ok)
+		{
+			// an empty slot is not sent, but it keeps the frame ids in order
+			size = 0;
+		}
+		m_bytes		= size > 0 ? FRAME_HEADER_SIZE + size : 0;
+		m_patched	= patched;
+		m_frames->setSize(slot, m_bytes);
+		m_frames->publish(slot);
+
+		// a frame that failed is encoded again
+		if (ok && hash)
+			m_encoded = *hash;
+		else
+			m_encoded.clear();
+		return ok;
+	};
+
+	// False when the frame of this hash looks like the one encoded last
+	bool			changed						( const cFrameHash &hash ) const
+	{
+		return m_encoded.empty() || m_encoded != hash || m_keyframe;
+	};
+	// The next frame is encoded whole, whatever it shows. Any thread.
+	void			refresh						(	)		{ m_keyframe = true; };
+	// Keeps track of the tiles of every frame, encode() sends patches from the next one on
+	void			enablePatches				( bool enable )
+	{
+		m_patches = enable;
+		m_shown.clear();
+	};
+
+	const sEncodeSettings&	settings			(	) const	{ return m_settings; };
+	// Resolution of a whole frame rendered at full size, the frames of a lower one are smaller
+	int						width				(	) const	{ return m_width; };
+	int						height				(	) const	{ return m_height; };
+	cFrameQueue*			frames				(	)		{ return m_frames.get(); };
+	float					encodeMs			(	) const	{ return m_encodeMs; };
+	// Bytes of the frame published last with its header, and whether they were patches
+	size_t					encodedBytes		(	) const	{ return m_bytes; };
+	bool					patched				(	) const	{ return m_patched; };
+
+private:
+
+	void			resize						( int width, int height )
+	{
+		if (width == m_outWidth && height == m_outHeight)
+			return;
+
+		m_outWidth	= width;
+		m_outHeight	= height;
+		m_encoder->setImageParams(m_outWidth, m_outHeight, TJPEG_COLOR_COMPONENTS, TJPF_RGB, m_settings.subsampling);
+		if (!m_encoder->initEncoder())
+		{
+			std::cout << "Sight@Frameserver. Warning: JPEG Encoder failed at initialization \n";
+		}
+	};
+
+	/*
+	 * Records the tiles that changed with this frame and collects the ones changed after base
+	 * into m_rects: runs of tiles along a row, stacked onto the rectangle ending right above
+	 * that covers the same columns. Returns the number of tiles changed after base.
+	 */
+	size_t			track						( const cFrameHash &tiles, uint32_t frameId, int64_t base )
+	{
+		const int	tilesX	= tiles.tilesX(), tilesY = tiles.tilesY();
+		const bool	same	= !m_shown.empty() && m_shown.width() == tiles.width() && m_shown.height() == tiles.height();
+
+		m_tileFrames.resize((size_t) tilesX * tilesY);
+		for (int y = 0; y < tilesY; y++)
+		{
+			for (int x = 0; x < tilesX; x++)
+			{
+				if (!same || tiles.tile(x, y) != m_shown.tile(x, y))
+					m_tileFrames[(size_t) y * tilesX + x] = frameId;
+			}
+		}
+		m_shown = tiles;
+
+		size_t dirty = 0;
+		m_rects.clear();
+		for (int y = 0; y < tilesY; y++)
+		{
+			const uint32_t *row = &m_tileFrames[(size_t) y * tilesX];
+			for (int x = 0; x < tilesX; x++)
+			{
+				if ((int64_t) row[x] <= base)
+					continue;
+
+				int end = x + 1;
+				while (end < tilesX && (int64_t) row[end] > base)
+					end++;
+				dirty += end - x;
+
+				sPatchHeader patch;
+				patch.x			= (uint16_t)(x * FRAME_HASH_TILE);
+				patch.y			= (uint16_t)(y * FRAME_HASH_TILE);
+				patch.width		= (uint16_t)(std::min(end * FRAME_HASH_TILE, m_outWidth) - patch.x);
+				patch.height	= (uint16_t)(std::min((y + 1) * FRAME_HASH_TILE, m_outHeight) - patch.y);
+				patch.size		= 0;
+				x = end;
+
+				size_t r = 0;
+				while (r < m_rects.size() && !(m_rects[r].x == patch.x && m_rects[r].width == patch.width &&
+											   m_rects[r].y + m_rects[r].height == patch.y))
+					r++;
+				if (r < m_rects.size())
+					m_rects[r].height += patch.height;
+				else
+					m_rects.push_back(patch);
+			}
+		}
+		return dirty;
+	};
+
+	sEncodeSettings					m_settings;
+	int								m_width, m_height;			// at full render resolution
+	int								m_outWidth, m_outHeight;	// of the last frame
+	std::unique_ptr<Encoder>		m_encoder;
+	std::unique_ptr<cFrameQueue>	m_frames;
+	cResampler						m_resampler;
+	cFrameHash						m_encoded;
+	std::atomic<bool>				m_keyframe;
+	// patches: tile hashes of the resampled frame and of the previous one, the frame every tile
+	// changed in last and the rectangles of the next patches
+	bool							m_patches;
+	cFrameHash						m_tiles, m_shown;
+	std::vector<uint32_t>			m_tileFrames;
+	std::vector<sPatchHeader>		m_rects;
+	float							m_encodeMs;
+	size_t							m_bytes;
+	bool							m_patched;
+};
+
+#endif /* CENCODEGROUP_H_ */
@@ -0,0 +1,142 @@
+/*
+ * Distributed under the OSI-approved Apache License, Version 2.0.  See
+ * accompanying file Copyright.txt for details.
+ */
+#ifndef CFLOWCONTROL_H_
+#define CFLOWCONTROL_H_
+
+#include <stdint.h>
+#include <chrono>
+#include <deque>
+#include <cmath>
+#include <algorithm>
+#include "cTimer.h"
+
+// Frames a client may grant at most
+#define FLOW_MAX_CREDITS			16
+// No new frame while the socket still buffers more than this many average frames
+#define FLOW_MAX_BUFFERED_FRAMES	1.5
+// Weight of a new sample in the smoothed RTT and send interval
+#define FLOW_SMOOTHING				0.125
+
+/*
+ * Credit based flow control of one connection.
+ * The client grants a window of frames ("CREDT<n>") and acks every frame it has shown
+ * (CONTROL_ACK with the frame id of its header, cProtocol.h). Websocket messages arrive in
+ * order, so acks are cumulative.
+ * Frames in flight are limited by window(): the bandwidth-delay product in frames, from the
+ * smoothed RTT and send interval, capped by the granted credits. No frame is sent while the
+ * socket has not written out the previous ones (get_buffered_amount()).
+ */
+class cFlowControl
+{
+public:
+				cFlowControl				(	)
+				{
+					m_credits		= 0;
+					m_rtt			= 0.0;
+					m_interval		= 0.0;
+					m_frameBytes	= 0.0;
+				};
+
+	void		grant						( unsigned int credits )
+	{
+		m_credits = std::min(credits, (unsigned int) FLOW_MAX_CREDITS);
+	};
+
+	// Frames in flight are not acked after the client stops streaming
+	void		reset						(	)
+	{
+		m_credits = 0;
+		m_inFlight.clear();
+	};
+
+	// Returns the round trip time of the acked frame in ms, or -1 for an unknown id.
+	// renderTime, bytes and share are set to the ones the frame was sent with.
+	double		ack							( uint64_t id, uint64_t *renderTime = 0, size_t *bytes = 0, double *share = 0 )
+	{
+		double rtt = -1.0;
+		while (!m_inFlight.empty() && m_inFlight.front().id <= id)
+		{
+			if (m_inFlight.front().id == id)
+			{
+				if (renderTime)
+					*renderTime = m_inFlight.front().renderTime;
+				if (bytes)
+					*bytes = m_inFlight.front().bytes;
+				if (share)
+					*share = m_inFlight.front().share;
+				rtt		= m_inFlight.front().sent.getElapsedMilliseconds();
+				m_rtt	= m_rtt > 0.0 ? m_rtt + FLOW_SMOOTHING * (rtt - m_rtt) : rtt;
+			}
+			m_inFlight.pop_front();
+		}
+		return rtt;
+	};
+
+	// Acks the last frame sent, the one a stop-and-wait client asks past with NXTFR
+	double		ackLatest					( uint64_t *renderTime = 0, size_t *bytes = 0, double *share = 0 )
+	{
+		return m_inFlight.empty() ? -1.0 : ack(m_inFlight.back().id, renderTime, bytes, share);
+	};
+
+	unsigned int window						(	) const
+	{
+		unsigned int frames = m_credits;
+		if (m_rtt > 0.0 && m_interval > 0.0)
+		{
+			frames = std::min(frames, (unsigned int) std::ceil(m_rtt / m_interval) + 1);
+		}
+		return frames;
+	};
+
+	bool		canSend						( size_t bufferedBytes ) const
+	{
+		if (m_inFlight.size() >= window())
+			return false;
+		return m_inFlight.empty() || bufferedBytes <= FLOW_MAX_BUFFERED_FRAMES * m_frameBytes;
+	};
+
+	// Registers a frame about to be sent, ids have to grow. share is the part of a whole frame
+	// at full resolution it carries, 0 for patches.
+	void		sent						( uint64_t id, size_t bytes, uint64_t renderTime = 0, double share = 1.0 )
+	{
+		if (!m_inFlight.empty())
+		{
+			double interval = m_sendTimer.getElapsedMilliseconds();
+			m_interval		= m_interval > 0.0 ? m_interval + FLOW_SMOOTHING * (interval - m_interval) : interval;
+		}
+		m_sendTimer.reset();
+		m_frameBytes = m_frameBytes > 0.0 ? m_frameBytes + FLOW_SMOOTHING * (bytes - m_frameBytes) : bytes;
+
+		sInFlight frame;
+		frame.id			= id;
+		frame.renderTime	= renderTime;
+		frame.bytes			= bytes;
+		frame.share			= share;
+		m_inFlight.push_back(frame);
+	};
+
+	unsigned int inFlight					(	) const	{ return (unsigned int) m_inFlight.size(); };
+	double		rtt							(	) const	{ return m_rtt; };
+
+private:
+
+	struct sInFlight
+	{
+		uint64_t	id;
+		uint64_t	renderTime;
+		size_t		bytes;
+		double		share;
+		cTimer		sent;
+	};
+
+	unsigned int			m_credits;
+	std::deque<sInFlight>	m_inFlight;
+	double					m_rtt;			// ms
+	double					m_interval;		// ms between frames sent back to back
+	double					m_frameBytes;
+	cTimer					m_sendTimer;
+};
+
+#endif /* CFLOWCONTROL_H_ */
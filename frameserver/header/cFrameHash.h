@@ -0,0 +1,115 @@
+/*
+ * Distributed under the OSI-approved Apache License, Version 2.0.  See
+ * accompanying file Copyright.txt for details.
+ */
+#ifndef CFRAMEHASH_H_
+#define CFRAMEHASH_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+// Tiles hashed on their own, in pixels per side
+#define FRAME_HASH_TILE				64
+
+/*
+ * 64 bit hashes of the FRAME_HASH_TILE x FRAME_HASH_TILE tiles of an RGB8 frame, to tell a frame
+ * that changed from one that did not without keeping the pixels. The frame is read once, row by
+ * row; every row segment of a tile goes through four independent multiply-xor lanes, so the
+ * multiplications overlap and the pass runs at memory speed. Every step is invertible, a single
+ * differing word always changes the tile's hash.
+ */
+class cFrameHash
+{
+public:
+				cFrameHash					(	)
+				{
+					m_width = m_height = 0;
+					m_tilesX = m_tilesY = 0;
+				};
+
+	void		compute						( const unsigned char *rgb, int width, int height )
+	{
+		m_width		= width;
+		m_height	= height;
+		m_tilesX	= (width  + FRAME_HASH_TILE - 1) / FRAME_HASH_TILE;
+		m_tilesY	= (height + FRAME_HASH_TILE - 1) / FRAME_HASH_TILE;
+		m_tiles.assign((size_t) m_tilesX * m_tilesY, 0);
+
+		const size_t rowBytes = (size_t) width * 3;
+		for (int y = 0; y < height; y++)
+		{
+			const unsigned char	*row	= rgb + (size_t) y * rowBytes;
+			uint64_t			*tiles	= &m_tiles[(size_t)(y / FRAME_HASH_TILE) * m_tilesX];
+			for (int tx = 0; tx < m_tilesX; tx++)
+			{
+				const size_t begin	= (size_t) tx * FRAME_HASH_TILE * 3;
+				const size_t end	= std::min(begin + FRAME_HASH_TILE * 3, rowBytes);
+				tiles[tx] = mix(tiles[tx], segment(row + begin, end - begin));
+			}
+		}
+	};
+
+	// Hashes of the same frame size compare tile by tile, any other size differs
+	bool		operator==					( const cFrameHash &o ) const
+	{
+		return m_width == o.m_width && m_height == o.m_height && m_tiles == o.m_tiles;
+	};
+	bool		operator!=					( const cFrameHash &o ) const	{ return !(*this == o); };
+
+	// Forgets the frame, the next one compares as changed
+	void		clear						(	)
+	{
+		m_width = m_height = 0;
+		m_tilesX = m_tilesY = 0;
+		m_tiles.clear();
+	};
+
+	bool		empty						(	) const	{ return m_tiles.empty(); };
+	int			width						(	) const	{ return m_width; };
+	int			height						(	) const	{ return m_height; };
+	int			tilesX						(	) const	{ return m_tilesX; };
+	int			tilesY						(	) const	{ return m_tilesY; };
+	uint64_t	tile						( int x, int y ) const	{ return m_tiles[(size_t) y * m_tilesX + x]; };
+
+private:
+
+	static uint64_t	mix						( uint64_t h, uint64_t v )
+	{
+		h = (h ^ v) * 0x9E3779B97F4A7C15ull;
+		return h ^ (h >> 29);
+	};
+
+	static uint64_t	segment					( const unsigned char *p, size_t bytes )
+	{
+		uint64_t	a = 1, b = 2, c = 3, d = 4;
+		uint64_t	w[4];
+		size_t		i = 0;
+		for (; i + 32 <= bytes; i += 32)
+		{
+			memcpy(w, p + i, 32);
+			a = mix(a, w[0]);
+			b = mix(b, w[1]);
+			c = mix(c, w[2]);
+			d = mix(d, w[3]);
+		}
+		// tiles at the right border end within a block, the rest is zero padded
+		if (i < bytes)
+		{
+			memset(w, 0, sizeof(w));
+			memcpy(w, p + i, bytes - i);
+			a = mix(a, w[0]);
+			b = mix(b, w[1]);
+			c = mix(c, w[2]);
+			d = mix(d, w[3]);
+		}
+		return mix(mix(mix(a, b), c), d);
+	};
+
+	int						m_width, m_height;
+	int						m_tilesX, m_tilesY;
+	std::vector<uint64_t>	m_tiles;
+};
+
+#endif /* CFRAMEHASH_H_ */
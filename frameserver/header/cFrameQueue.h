@@ -0,0 +1,215 @@
+/*
+ * Distributed under the OSI-approved Apache License, Version 2.0.  See
+ * accompanying file Copyright.txt for details.
+ */
+#ifndef CFRAMEQUEUE_H_
+#define CFRAMEQUEUE_H_
+
+#include <stdint.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+enum eFrameQueuePolicy
+{
+	FRAME_QUEUE_BLOCK,		// acquire() waits for a free slot, frames are consumed in order
+	FRAME_QUEUE_LATEST		// acquire() reclaims the oldest unread frame, consume() skips to the newest
+};
+
+/*
+ * Bounded ring of frame buffers between two pipeline stages, one producer and one consumer.
+ * The producer acquires a slot, fills it and publishes it; the consumer takes a published frame
+ * and releases it once done. Frames reclaimed or skipped under FRAME_QUEUE_LATEST are counted
+ * as dropped. close() wakes both sides, which then get -1.
+ */
+class cFrameQueue
+{
+public:
+			cFrameQueue					( unsigned int numSlots, size_t slotBytes, eFrameQueuePolicy policy )
+			{
+				m_slotBytes	= slotBytes;
+				m_policy	= policy;
+				m_nextSeq	= 0;
+				m_dropped	= 0;
+				m_closed	= false;
+				m_buffer.resize(numSlots * slotBytes);
+				m_state.assign(numSlots, SLOT_FREE);
+				m_seq.assign(numSlots, 0);
+				m_published.assign(numSlots, 0);
+				m_sizes.assign(numSlots, 0);
+				m_widths.assign(numSlots, 0);
+				m_heights.assign(numSlots, 0);
+			};
+
+	// Slot to write the next frame into, -1 once closed
+	int		acquire						(	)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		for (;;)
+		{
+			if (m_closed)
+				return -1;
+
+			int slot = find(SLOT_FREE, true);
+			if (slot < 0 && m_policy == FRAME_QUEUE_LATEST)
+			{
+				slot = find(SLOT_READY, true);
+				if (slot >= 0)
+					m_dropped++;
+			}
+			if (slot >= 0)
+			{
+				m_state[slot] = SLOT_WRITING;
+				return slot;
+			}
+			m_cond.wait(lock);
+		}
+	};
+
+	void	publish						( int slot )
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_state[slot]		= SLOT_READY;
+			m_seq[slot]			= m_nextSeq++;
+			m_published[slot]	= std::chrono::duration_cast<std::chrono::microseconds>(
+									std::chrono::steady_clock::now().time_since_epoch()).count();
+		}
+		m_cond.notify_all();
+	};
+
+	// Waits for a published frame, -1 once closed
+	int		consume						(	)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		for (;;)
+		{
+			if (m_closed)
+				return -1;
+
+			int slot = take();
+			if (slot >= 0)
+			{
+				lock.unlock();
+				m_cond.notify_all();
+				return slot;
+			}
+			m_cond.wait(lock);
+		}
+	};
+
+	// A published frame if there is one, -1 otherwise
+	int		tryConsume					(	)
+	{
+		int slot;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_closed)
+				return -1;
+			slot = take();
+		}
+		if (slot >= 0)
+			m_cond.notify_all();
+		return slot;
+	};
+
+	void	release						( int slot )
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_state[slot] = SLOT_FREE;
+		}
+		m_cond.notify_all();
+	};
+
+	void	close						(	)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_closed = true;
+		}
+		m_cond.notify_all();
+	};
+
+	unsigned char*	data				( int slot )				{ return &m_buffer[(size_t)slot * m_slotBytes]; };
+	size_t			capacity			(	) const					{ return m_slotBytes; };
+	// Bytes used by the frame in a slot, set by the producer before publish()
+	void			setSize				( int slot, size_t bytes )	{ m_sizes[slot] = bytes; };
+	size_t			size				( int slot ) const			{ return m_sizes[slot]; };
+	// Pixel size of the image in a slot when frames vary in size, set like setSize()
+	void			setImageSize		( int slot, int width, int height )
+	{
+		m_widths[slot]	= width;
+		m_heights[slot]	= height;
+	};
+	int				width				( int slot ) const			{ return m_widths[slot]; };
+	int				height				( int slot ) const			{ return m_heights[slot]; };
+	// Number of the frame in a slot, counting every published frame, and the steady clock time
+	// it was published at in us. Valid while the slot is being consumed.
+	uint64_t		sequence			( int slot ) const			{ return m_seq[slot]; };
+	uint64_t		publishedAt			( int slot ) const			{ return m_published[slot]; };
+
+	uint64_t		dropped				(	)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_dropped;
+	};
+
+private:
+
+	enum eSlotState { SLOT_FREE, SLOT_WRITING, SLOT_READY, SLOT_READING };
+
+	// Marks the next frame to consume as being read, called with m_mutex held
+	int		take						(	)
+	{
+		int slot = find(SLOT_READY, m_policy == FRAME_QUEUE_BLOCK);
+		if (slot >= 0)
+		{
+			if (m_policy == FRAME_QUEUE_LATEST)
+			{
+				// older frames are stale once a newer one is ready
+				for (size_t i = 0; i < m_state.size(); i++)
+				{
+					if (m_state[i] == SLOT_READY && (int) i != slot)
+					{
+						m_state[i] = SLOT_FREE;
+						m_dropped++;
+					}
+				}
+			}
+			m_state[slot] = SLOT_READING;
+		}
+		return slot;
+	};
+
+	// Oldest or newest slot in a state, -1 if there is none
+	int		find						( eSlotState state, bool oldest ) const
+	{
+		int slot = -1;
+		for (size_t i = 0; i < m_state.size(); i++)
+		{
+			if (m_state[i] != state)
+				continue;
+			if (slot < 0 || (oldest ? m_seq[i] < m_seq[slot] : m_seq[i] > m_seq[slot]))
+				slot = (int) i;
+		}
+		return slot;
+	};
+
+	size_t							m_slotBytes;
+	eFrameQueuePolicy				m_policy;
+	std::vector<unsigned char>		m_buffer;
+	std::vector<eSlotState>			m_state;
+	std::vector<uint64_t>			m_seq;
+	std::vector<uint64_t>			m_published;
+	std::vector<size_t>				m_sizes;
+	std::vector<int>				m_widths, m_heights;
+	uint64_t						m_nextSeq;
+	uint64_t						m_dropped;
+	bool							m_closed;
+	std::mutex						m_mutex;
+	std::condition_variable			m_cond;
+};
+
+#endif /* CFRAMEQUEUE_H_ */
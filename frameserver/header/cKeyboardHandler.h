@@ -8,6 +8,19 @@
 
 #define KEY_EVENT   4  // according to the RFB protocol
 
+#include <atomic>
+#include "cProtocol.h"
+#include "cSPSCQueue.h"
+
+#define KEY_EVENT_QUEUE		64
+
+struct sKeyEvent
+{
+	uint64_t	time;		// arrival, cProtocol::now()
+	int			key;
+	int			state;
+};
+
 class cKeyboardHandler {
 public:
 	enum {
@@ -16,6 +29,7 @@ public:
 
 	cKeyboardHandler() {
 		key = -1, state = UP;
+		time = 0, firstTime = 0, dropped = 0;
 	}
 	;
 	~cKeyboardHandler() {
@@ -31,16 +45,6 @@ public:
 		key = keyMask;
 	};
 
-	void refresh(bool flag)
-	{
-		if (flag == false) // reset keyboard state
-		{
-			key = -1, state = UP;
-		}
-		isRefresh = flag;
-	}
-	;
-
 	int getState() {
 		return state;
 	}
@@ -49,30 +53,63 @@ public:
 		return key;
 	}
 	;
-	bool refreshed() {
-		return isRefresh;
+	// arrival of the last event taken by poll()
+	uint64_t getTime() {
+		return time;
+	}
+	;
+	// Render thread: arrival of the oldest event poll() took since the last call, 0 for none
+	uint64_t takeFirstTime() {
+		uint64_t first = firstTime;
+		firstTime = 0;
+		return first;
+	}
+	;
+	// events lost to a full queue
+	uint64_t getDropped() {
+		return dropped.load();
 	}
 	;
 
-	void parse(std::stringstream *value) {
-		int keyMask = (unsigned char) value->str().data()[4] * 255
-				+ (unsigned char) value->str().data()[5] * 255
-				+ (unsigned char) value->str().data()[6] * 255
-				+ (unsigned char) value->str().data()[7];
+	// Network thread: queues the event for the render thread
+	void parse(const sControlMessage &msg) {
+		sKeyEvent event;
+		event.time = cProtocol::now();
+		event.key = msg.value;
+		event.state = msg.down;
+		if (!events.push(event)) {
+			dropped++;
+		}
 
-		setState(value->str().data()[1]);
-		setKey(keyMask);
-		refresh(true);
+		//if (event.state == cKeyboardHandler::DOWN)
+		//	std::cout << "cKeyboardHandler Key: " << event.key << std::endl;
+	}
+	;
 
-		//if (getState() == cKeyboardHandler::DOWN)
-		//	std::cout << "cKeyboardHandler Key: " << getKey() << std::endl;
+	// Render thread: makes the next event the current state, false once the queue is empty.
+	// Key events are never coalesced.
+	bool poll() {
+		sKeyEvent event;
+		if (!events.pop(event)) {
+			return false;
+		}
+		time = event.time;
+		if (firstTime == 0) {
+			firstTime = event.time;
+		}
+		setState(event.state);
+		setKey(event.key);
+		return true;
 	}
 	;
 
 private:
 	int key;
 	int state;
-	bool isRefresh;
+	uint64_t time;
+	uint64_t firstTime;
+	std::atomic<uint64_t> dropped;
+	cSPSCQueue<sKeyEvent, KEY_EVENT_QUEUE> events;
 };
 
 #endif /* CKEYBOARDHANDLER_H_ */
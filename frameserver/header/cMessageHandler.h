@@ -13,10 +13,12 @@ public:
 				cMessageHandler			(	) { };
 				~cMessageHandler 		(	) { };
 
-	void		parse 					( std::stringstream *value )
+	void		parse 					( const char *data, size_t size )
 	{
-		std::cout << value->str().data()[0] << std::endl;
-		std::cout << value->str().data()[1] << std::endl;
+		for (size_t i = 0; i < size && i < 2; i++)
+		{
+			std::cout << data[i] << std::endl;
+		}
 	};
 
 private:
@@ -0,0 +1,112 @@
+/*
+ * Distributed under the OSI-approved Apache License, Version 2.0.  See
+ * accompanying file Copyright.txt for details.
+ */
+#ifndef CMESSAGEPOOL_H_
+#define CMESSAGEPOOL_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <memory>
+#include <atomic>
+#include <websocketpp/frame.hpp>
+
+// Free messages kept for reuse, more than the frames the send thread has in flight
+#define MESSAGE_POOL_FREE			8
+
+/*
+ * Recycled websocket messages for frames sent to many connections. send(hdl, data, size) copies
+ * the payload into a new message and the connection copies it again into the framed message it
+ * writes, two allocations and two copies of the frame per connection. A message from frame()
+ * holds the frame once, framed and marked prepared: server frames are not masked, so the same
+ * bytes go to every connection and send(hdl, msg) only queues the pointer. The connection that
+ * writes it last drops the last reference, which returns the message to the pool with the
+ * capacity of its payload. Message is the endpoint's message type. Any thread.
+ */
+template <class Message>
+class cMessagePool
+{
+public:
+	typedef typename Message::ptr	message_ptr;
+
+					cMessagePool				( size_t maxFree = MESSAGE_POOL_FREE )
+					: m_shared(std::make_shared<sShared>())
+					{
+						m_shared->maxFree	= maxFree;
+						m_shared->allocated	= 0;
+						m_shared->reused	= 0;
+					};
+
+	// A prepared binary message with size bytes from data
+	message_ptr		frame						( const void *data, size_t size )
+	{
+		Message *msg = take();
+		// within the capacity of a recycled payload nothing is allocated
+		msg->get_raw_payload().assign((const char*) data, size);
+
+		websocketpp::frame::basic_header	header(websocketpp::frame::opcode::BINARY, size, true, false);
+		websocketpp::frame::extended_header	extended(size);
+		msg->set_header(websocketpp::frame::prepare_header(header, extended));
+		msg->set_opcode(websocketpp::frame::opcode::BINARY);
+		msg->set_prepared(true);
+
+		// the pool may be gone before the connections are done with the message
+		std::shared_ptr<sShared> shared = m_shared;
+		return message_ptr(msg, [shared](Message *m) { shared->recycle(m); });
+	};
+
+	// Messages created, and frames that got a recycled one
+	uint64_t		allocated					(	) const	{ return m_shared->allocated; };
+	uint64_t		reused						(	) const	{ return m_shared->reused; };
+
+private:
+
+	struct sShared
+	{
+		std::mutex				mutex;
+		std::vector<Message*>	free;
+		size_t					maxFree;
+		std::atomic<uint64_t>	allocated, reused;
+
+		void	recycle							( Message *msg )
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (free.size() < maxFree)
+				{
+					free.push_back(msg);
+					return;
+				}
+			}
+			delete msg;
+		};
+
+				~sShared						(	)
+		{
+			for (size_t i = 0; i < free.size(); i++)
+				delete free[i];
+		};
+	};
+
+	Message*		take						(	)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_shared->mutex);
+			if (!m_shared->free.empty())
+			{
+				Message *msg = m_shared->free.back();
+				m_shared->free.pop_back();
+				m_shared->reused++;
+				return msg;
+			}
+		}
+		m_shared->allocated++;
+		return new Message(typename Message::con_msg_man_ptr());
+	};
+
+	std::shared_ptr<sShared>	m_shared;
+};
+
+#endif /* CMESSAGEPOOL_H_ */
@@ -9,7 +9,19 @@
 #define MOUSE_EVENT 5 // according to the RFB protocol
 
 #include <iostream>
-#include <sstream>
+#include <atomic>
+#include "cProtocol.h"
+#include "cSPSCQueue.h"
+
+// Mouse events waiting for the render thread, more than a frame's worth of moves
+#define MOUSE_EVENT_QUEUE		256
+
+struct sMouseEvent
+{
+	uint64_t	time;		// arrival, cProtocol::now()
+	int			x, y;
+	int			buttonMask;
+};
 
 class cMouseHandler
 {
@@ -23,7 +35,7 @@ public:
 		UP,
 	};
 
-	cMouseHandler						(	) { x = 0, y = 0, button = -1, state = UP;	isRefresh = false;};
+	cMouseHandler						(	) { x = 0, y = 0, button = -1, state = UP;	time = 0; firstTime = 0; dropped = 0;};
 	~cMouseHandler 						(	) {	};
 
 	void 	setCoords						( int x_, int y_				)	{ x = x_, y = y_; 					};
@@ -55,35 +67,62 @@ public:
 
 	};
 
-	void	refresh							( bool flag 					)
-	{
-		if (flag == false) // reset mouse state
-		{
-			 button = -1;
-			 state = UP;
-		}
-		isRefresh = flag;
-	};
-
 	int 	getX							(	) 		{ return x; 			};
 	int 	getY							(	)		{ return y; 			};
 	int		getState						(	)		{ return state;			};
 	int		getButton						(	)		{ return button;		};
-
-	bool	refreshed						(	)		{ return isRefresh;	};
-
-	void	parse							(std::stringstream *value)
+	// arrival of the last event taken by poll()
+	uint64_t getTime						(	)		{ return time;			};
+	// Render thread: arrival of the oldest event poll() took since the last call, coalesced
+	// moves included, 0 for none
+	uint64_t takeFirstTime					(	)
 	{
-		int buttonMask, x, y;
+		uint64_t first	= firstTime;
+		firstTime		= 0;
+		return first;
+	};
+	// events lost to a full queue
+	uint64_t getDropped						(	)		{ return dropped.load();	};
 
-		buttonMask = value->str().data()[1];
-		x = (unsigned char)value->str().data()[2]*255 + (unsigned char)value->str().data()[3];
-		y = (unsigned char)value->str().data()[4]*255 + (unsigned char)value->str().data()[5];
+	// Network thread: queues the event for the render thread
+	void	parse							(const sControlMessage &msg)
+	{
+		sMouseEvent event;
+		event.time			= cProtocol::now();
+		event.x				= msg.x;
+		event.y				= msg.y;
+		event.buttonMask	= msg.buttons;
+		if (!events.push(event))
+		{
+			dropped++;
+		}
+	};
 
-		setCoords 	( x, y		 );
-		setButton 	( buttonMask );
-		refresh		( true 		 );
+	/*
+	 * Render thread: takes the next event and makes it the current state. Consecutive moves with
+	 * the same buttons are coalesced into their last position, so a drag is one camera update
+	 * per frame while presses and releases still come one by one. False once the queue is empty.
+	 */
+	bool	poll							(	)
+	{
+		sMouseEvent			event;
+		const sMouseEvent	*next;
+
+		if (!events.pop(event))
+			return false;
+		if (firstTime == 0)
+			firstTime = event.time;
+		while ((next = events.front()) && next->buttonMask == event.buttonMask)
+		{
+			events.pop(event);
+		}
 
+		button	= -1;
+		state	= UP;
+		time	= event.time;
+		setCoords 	( event.x, event.y	);
+		setButton 	( event.buttonMask	);
+		return true;
 	};
 
 
@@ -92,7 +131,10 @@ private:
 	int 	x, y;
 	int 	button;
 	int		state;
-	bool	isRefresh;
+	uint64_t time;
+	uint64_t firstTime;
+	std::atomic<uint64_t> dropped;
+	cSPSCQueue<sMouseEvent, MOUSE_EVENT_QUEUE> events;
 
 };
 
@@ -0,0 +1,347 @@
+/*
+ * Distributed under the OSI-approved Apache License, Version 2.0.  See
+ * accompanying file Copyright.txt for details.
+ */
+#ifndef CPARALLELJPEGENCODER_H_
+#define CPARALLELJPEGENCODER_H_
+
+#include <string.h>
+#include <iostream>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <turbojpeg.h>
+#include "cThreadPool.h"
+#include "cTurboJpegEncoder.h"
+
+// Stripes per thread, a few more than one so uneven stripes balance out
+#define PJPEG_STRIPES_PER_THREAD	2
+
+/*
+ * Multithreaded drop-in for cTurboJpegEncoder. The image is split into horizontal stripes of
+ * whole MCU rows that are compressed in parallel, one TurboJPEG handle each. The stripes are
+ * stitched into a single baseline JPEG: the headers of the first stripe with the full height and
+ * a DRI marker, then the entropy coded data of every stripe separated by RSTn markers. A restart
+ * resets the DC predictors exactly like the start of a new image, and all stripes use the same
+ * standard tables, so any decoder reads the result as one frame.
+ * Patches are independent JPEGs already, they are spread over the handles as they come.
+ */
+class cParallelJpegEncoder
+{
+public:
+				cParallelJpegEncoder		( unsigned int numThreads = 0 )
+				: m_ownPool(new cThreadPool(numThreads)), m_pool(m_ownPool.get())
+				{
+					reset();
+				};
+
+				// On a pool shared with other encoders, which never encode at the same time
+				cParallelJpegEncoder		( cThreadPool &pool ) : m_pool(&pool)
+				{
+					reset();
+				};
+
+				~cParallelJpegEncoder		(	)
+				{
+					for (size_t i = 0; i < compressors.size(); i++)
+					{
+						tjDestroy(compressors[i]);
+					}
+				}
+
+		// restart_interval is derived from the stripe height
+		void	setEncoderParams		( int quality_ = TJPEG_QUALITY, int restart_interval  = 8, int interleaved = 0)
+		{
+			quality = quality_;
+		};
+
+		void	setImageParams			( int width_, int height_, int color_components = TJPEG_COLOR_COMPONENTS,
+										  int color_space 		= TJPF_RGB,
+										  int sampling_factor 	= TJSAMP_444 )
+		{
+			width = width_;
+			height = height_;
+
+			colorSpace 		= color_space;
+			samplingFactor	= sampling_factor;
+		};
+
+		bool	initEncoder ( )
+		{
+			if (width <= 0 || height <= 0 )
+			{
+				std::cerr << "Invalid image size or image parameters not set\n";
+				return false;
+			}
+
+			// equal stripes of whole MCU rows, the restart interval has to fit 16 bits
+			int mcuRows		= (height + tjMCUHeight[samplingFactor] - 1) / tjMCUHeight[samplingFactor];
+			int mcusPerRow	= (width  + tjMCUWidth[samplingFactor]  - 1) / tjMCUWidth[samplingFactor];
+			int numStripes	= std::min<int>(m_pool->size() * PJPEG_STRIPES_PER_THREAD, mcuRows);
+			stripeRows		= (mcuRows + numStripes - 1) / numStripes;
+			stripeRows		= std::max(1, std::min(stripeRows, 0xFFFF / mcusPerRow));
+			numStripes		= (mcuRows + stripeRows - 1) / stripeRows;
+
+			for (size_t i = 0; i < compressors.size(); i++)
+			{
+				tjDestroy(compressors[i]);
+			}
+			compressors.assign(numStripes, (tjhandle) 0);
+			stripes.resize(numStripes);
+			stripeSizes.assign(numStripes, 0);
+			for (int i = 0; i < numStripes; i++)
+			{
+				compressors[i] = tjInitCompress ();
+				if (!compressors[i])
+				{
+					std::cout << tjGetErrorStr ();
+					return false;
+				}
+				stripes[i].resize(tjBufSize(width, stripeHeight(i), samplingFactor));
+			}
+			output.resize(maxSize());
+			compressedImg = output.data();
+			return true;
+		};
+
+		unsigned long maxSize		(	)
+		{
+			unsigned long size = 6;		// DRI
+			for (size_t i = 0; i < stripes.size(); i++)
+			{
+				size += stripes[i].size() + 2;
+			}
+			return size;
+		};
+
+		bool encode 				( unsigned char* img )
+		{
+			unsigned long size;
+			return encode(img, output.data(), size);
+		};
+
+		// Compresses into dst, which holds at least maxSize() bytes
+		bool encode 				( unsigned char* img, unsigned char* dst, unsigned long &size )
+		{
+			if (compressors.empty())
+			{
+				std::cerr << "Encoder not initialized\n";
+				return false;
+			}
+
+			const int			pitch	= width * tjPixelSize[colorSpace];
+			std::vector<int>	failed(compressors.size(), 0);
+
+			m_pool->run((unsigned int) compressors.size(), [&](unsigned int i)
+			{
+				unsigned char	*buf = stripes[i].data();
+				unsigned long	bytes = stripes[i].size();
+				int				y0 = (int) i * stripeRows * tjMCUHeight[samplingFactor];
+
+				failed[i] = tjCompress2 (compressors[i], img + (size_t)y0 * pitch, width, pitch, stripeHeight(i),
+										 colorSpace, &buf, &bytes, samplingFactor, quality,
+										 TJFLAG_FASTDCT | TJFLAG_NOREALLOC) != 0;
+				stripeSizes[i] = bytes;
+			});
+			for (size_t i = 0; i < failed.size(); i++)
+			{
+				if (failed[i])
+				{
+					std::cout << tjGetErrorStr ();
+					return false;
+				}
+			}
+
+			if (!stitch(dst, size))
+			{
+				std::cout << "Sight@Frameserver: JPEG stripes could not be stitched\n";
+				return false;
+			}
+			jpegSize = size;
+			return true;
+		};
+
+		// Same as cTurboJpegEncoder::encodePatches(), every handle compresses every n-th patch
+		bool encodePatches			( unsigned char* img, const std::vector<sPatchHeader> &patches, unsigned char* dst,
+									  unsigned long capacity, unsigned long &size )
+		{
+			if (compressors.empty())
+			{
+				std::cerr << "Encoder not initialized\n";
+				return false;
+			}
+
+			const int			pitch	= width * tjPixelSize[colorSpace];
+			const unsigned int	tasks	= (unsigned int) std::min(patches.size(), compressors.size());
+			std::vector<int>	failed(tasks, 0);
+
+			if (patchBuffers.size() < patches.size())
+			{
+				patchBuffers.resize(patches.size());
+			}
+			patchSizes.assign(patches.size(), 0);
+			m_pool->run(tasks, [&](unsigned int t)
+			{
+				for (size_t i = t; i < patches.size(); i += tasks)
+				{
+					const sPatchHeader	&patch	= patches[i];
+					unsigned long		bytes	= tjBufSize(patch.width, patch.height, samplingFactor);
+					if (patchBuffers[i].size() < bytes)
+					{
+						patchBuffers[i].resize(bytes);
+					}
+					unsigned char *buf = patchBuffers[i].data();
+
+					failed[t] |= tjCompress2 (compressors[t], img + (size_t)patch.y * pitch + patch.x * tjPixelSize[colorSpace],
+											  patch.width, pitch, patch.height, colorSpace, &buf, &bytes, samplingFactor, quality,
+											  TJFLAG_FASTDCT | TJFLAG_NOREALLOC) != 0;
+					patchSizes[i] = bytes;
+				}
+			});
+			for (size_t i = 0; i < failed.size(); i++)
+			{
+				if (failed[i])
+				{
+					std::cout << tjGetErrorStr ();
+					return false;
+				}
+			}
+
+			size = 0;
+			for (size_t i = 0; i < patches.size(); i++)
+			{
+				if (size + PATCH_HEADER_SIZE + patchSizes[i] > capacity)
+					return false;
+
+				sPatchHeader patch = patches[i];
+				patch.size = (uint32_t) patchSizes[i];
+				cProtocol::writePatchHeader(patch, dst + size);
+				memcpy(dst + size + PATCH_HEADER_SIZE, patchBuffers[i].data(), patchSizes[i]);
+				size += PATCH_HEADER_SIZE + patchSizes[i];
+			}
+			jpegSize = size;
+			return true;
+		};
+
+		unsigned char *getImg 		(	)
+		{
+			return  compressedImg;
+		}
+
+		int	getJpegSize 			(	) 	{ return jpegSize; }
+		int	numStripes				(	)	{ return (int) stripes.size(); }
+
+		// Stores the compressed image.
+		unsigned char			*compressedImg;
+
+private:
+
+		void	reset				(	)
+		{
+			jpegSize 		= 0;
+			compressedImg 	= 0;
+			width			= 0;
+			height			= 0;
+			samplingFactor	= TJSAMP_444;
+			colorSpace		= TJPF_RGB;
+			quality			= TJPEG_QUALITY;
+			stripeRows		= 0;
+		};
+
+		int		stripeHeight		( int i )
+		{
+			int rows = stripeRows * tjMCUHeight[samplingFactor];
+			return std::min(rows, height - i * rows);
+		};
+
+		// Offsets of the SOF and SOS markers and of the first entropy coded byte
+		static bool	findSegments	( const unsigned char *jpeg, unsigned long size, unsigned long &sof,
+									  unsigned long &sos, unsigned long &data )
+		{
+			unsigned long p = 2;
+			sof = 0;
+			while (p + 4 <= size && jpeg[p] == 0xFF)
+			{
+				unsigned char	marker	= jpeg[p + 1];
+				unsigned long	length	= (jpeg[p + 2] << 8) | jpeg[p + 3];
+				if (marker >= 0xC0 && marker <= 0xC2)
+				{
+					sof = p;
+				}
+				if (marker == 0xDA)
+				{
+					sos		= p;
+					data	= p + 2 + length;
+					return sof > 0 && data <= size;
+				}
+				p += 2 + length;
+			}
+			return false;
+		};
+
+		bool	stitch				( unsigned char *dst, unsigned long &size )
+		{
+			unsigned long sof, sos, data;
+			unsigned long p = 0;
+
+			for (size_t i = 0; i < stripes.size(); i++)
+			{
+				const unsigned char	*jpeg	= stripes[i].data();
+				unsigned long		bytes	= stripeSizes[i];
+
+				if (!findSegments(jpeg, bytes, sof, sos, data) || jpeg[bytes - 2] != 0xFF || jpeg[bytes - 1] != 0xD9)
+					return false;
+
+				if (i == 0)
+				{
+					// headers up to SOS with the full image height, then the restart interval
+					memcpy(dst, jpeg, sos);
+					dst[sof + 5] = (unsigned char)(height >> 8);
+					dst[sof + 6] = (unsigned char)(height & 0xFF);
+					p = sos;
+					if (stripes.size() > 1)
+					{
+						unsigned int interval = stripeRows * ((width + tjMCUWidth[samplingFactor] - 1) / tjMCUWidth[samplingFactor]);
+						const unsigned char dri[6] = { 0xFF, 0xDD, 0x00, 0x04,
+													   (unsigned char)(interval >> 8), (unsigned char)(interval & 0xFF) };
+						memcpy(dst + p, dri, 6);
+						p += 6;
+					}
+					memcpy(dst + p, jpeg + sos, data - sos);
+					p += data - sos;
+				}
+				else
+				{
+					dst[p++] = 0xFF;
+					dst[p++] = (unsigned char)(0xD0 + ((i - 1) & 7));
+				}
+				// entropy coded data without EOI
+				memcpy(dst + p, jpeg + data, bytes - 2 - data);
+				p += bytes - 2 - data;
+			}
+			dst[p++] = 0xFF;
+			dst[p++] = 0xD9;
+			size = p;
+			return true;
+		};
+
+		std::unique_ptr<cThreadPool>			m_ownPool;
+		cThreadPool								*m_pool;
+		std::vector<tjhandle>					compressors;
+		std::vector<std::vector<unsigned char> >	stripes;
+		std::vector<unsigned long>				stripeSizes;
+		std::vector<std::vector<unsigned char> >	patchBuffers;
+		std::vector<unsigned long>				patchSizes;
+		std::vector<unsigned char>				output;
+		// Width and height of the compressed image
+		int						width, height;
+		int						quality;
+		int 					colorSpace;
+		int						samplingFactor;
+		// MCU rows per stripe, every stripe but the last one
+		int						stripeRows;
+		// Stores image size after compression
+		unsigned long			jpegSize;
+};
+
+#endif /* CPARALLELJPEGENCODER_H_ */
@@ -0,0 +1,531 @@
+/*
+ * Distributed under the OSI-approved Apache License, Version 2.0.  See
+ * accompanying file Copyright.txt for details.
+ */
+#ifndef CPARALLELPNGENCODER_H_
+#define CPARALLELPNGENCODER_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <zlib.h>
+#include "cThreadPool.h"
+
+// Filtered bytes deflated per block, the block size of pigz
+#define PPNG_BLOCK_BYTES			(128 * 1024)
+// Bytes of the previous block every block is primed with, the deflate window
+#define PPNG_DICTIONARY_BYTES		32768
+#define PPNG_COMPRESSION_LEVEL		6
+// Every how many rows of a block the filter types are tried on
+#define PPNG_SAMPLE_ROWS			4
+
+enum ePngFilter
+{
+	PPNG_FILTER_NONE,
+	PPNG_FILTER_SUB,
+	PPNG_FILTER_UP,
+	PPNG_FILTER_AVERAGE,
+	PPNG_FILTER_PAETH,
+	PPNG_FILTERS
+};
+
+/*
+ * Multithreaded drop-in for cPNGEncoder. The rows are split into blocks of about
+ * PPNG_BLOCK_BYTES that are filtered and deflated in parallel. Every block takes the filter type
+ * whose output has the smallest sum of absolute values over every PPNG_SAMPLE_ROWS-th row, the
+ * heuristic libpng applies to each row. Each block is a raw deflate stream primed with the last
+ * 32 KB of the block before and ended by a sync flush, the last one by the final block, so behind
+ * one zlib header the blocks read as a single stream (as in pigz); the Adler-32 of the image is
+ * combined from theirs. Every block is written as its own IDAT chunk. Like cPNGEncoder it takes
+ * bottom-up RGB8 images.
+ * Images too large for memory are streamed: open() the file, writeRows() top-down stripes of any
+ * height and close() it. Only the last row and the last 32 KB of filtered bytes of a stripe are
+ * kept for the next one.
+ */
+class cParallelPngEncoder
+{
+public:
+				cParallelPngEncoder			( unsigned int numThreads = 0 ) : m_pool(numThreads)
+				{
+					m_width		= 0;
+					m_height	= 0;
+					m_rowBytes	= 0;
+					m_blockRows	= 0;
+					m_numBlocks	= 0;
+					m_blockBound	= 0;
+					m_level		= PPNG_COMPRESSION_LEVEL;
+					m_size		= 0;
+					m_file		= 0;
+					m_rows		= 0;
+					m_stride	= 0;
+					m_count		= 0;
+					m_rowsDone	= 0;
+					m_blocksDone	= 0;
+					m_history	= 0;
+					m_adler		= 0;
+				};
+
+				~cParallelPngEncoder		(	)
+				{
+					if (m_file)
+						fclose(m_file);
+					release();
+				};
+
+		void	setImageParams				( int width, int height )
+		{
+			m_width		= width;
+			m_height	= height;
+		};
+
+		// zlib level 0 - 9, set before initEncoder()
+		void	setCompressionLevel			( int level )
+		{
+			m_level = std::min(std::max(level, 0), 9);
+		};
+
+		bool	initEncoder					(	)
+		{
+			release();
+			if (m_width <= 0 || m_height <= 0)
+			{
+				std::cerr << "Invalid image size or image parameters not set\n";
+				return false;
+			}
+
+			m_rowBytes	= (size_t) m_width * 3;
+			m_blockRows	= std::max<int>(1, (int)(PPNG_BLOCK_BYTES / (m_rowBytes + 1)));
+			m_numBlocks	= (m_height + m_blockRows - 1) / m_blockRows;
+			m_zeros.assign(m_rowBytes, 0);
+			m_lastRow.resize(m_rowBytes);
+
+			// one stream per thread, reset for every block
+			m_streams.resize(std::min<size_t>(m_pool.size(), m_numBlocks));
+			for (size_t t = 0; t < m_streams.size(); t++)
+			{
+				memset(&m_streams[t], 0, sizeof(z_stream));
+				if (deflateInit2(&m_streams[t], m_level, Z_DEFLATED, -MAX_WBITS, 8, Z_FILTERED) != Z_OK)
+				{
+					m_streams.resize(t);
+					release();
+					std::cerr << "zlib stream initialization failed\n";
+					return false;
+				}
+			}
+			// the sync flush adds an empty stored block
+			m_blockBound = deflateBound(&m_streams[0], (uLong)(m_blockRows * (m_rowBytes + 1))) + 16;
+			m_blocks.clear();
+			return true;
+		};
+
+		// Encodes the image into the buffer returned by getImg()
+		bool	encode						( const unsigned char *img )
+		{
+			if (!begin())
+				return false;
+			// PNG rows run from the last row of the bottom-up image to its first
+			if (!compress(img + (m_height - 1) * m_rowBytes, -(ptrdiff_t) m_rowBytes, m_height))
+				return false;
+			finish();
+			return true;
+		};
+
+		bool	savePNG						( std::string filename, unsigned char *img )
+		{
+			if (!encode(img))
+				return false;
+
+			FILE *fp = fopen(filename.data(), "wb");
+			if (!fp)
+				return false;
+			const bool ok = fwrite(m_png.data(), 1, m_size, fp) == m_size;
+			return fclose(fp) == 0 && ok;
+		};
+
+		// Starts streaming an image of the size set to filename
+		bool	open						( const std::string &filename )
+		{
+			if (m_file)
+			{
+				std::cerr << "A PNG file is already open\n";
+				return false;
+			}
+			if (!begin())
+				return false;
+			m_file = fopen(filename.data(), "wb");
+			if (!m_file)
+			{
+				std::cerr << "Could not open " << filename << "\n";
+				return false;
+			}
+			return flush();
+		};
+
+		// Compresses and writes the next count top-down RGB8 rows of the image
+		bool	writeRows					( const unsigned char *rows, int count )
+		{
+			if (!m_file)
+			{
+				std::cerr << "PNG file not open\n";
+				return false;
+			}
+			if (count <= 0 || m_rowsDone + count > m_height)
+			{
+				std::cerr << "PNG rows beyond the image\n";
+				return false;
+			}
+			return compress(rows, (ptrdiff_t) m_rowBytes, count) && flush();
+		};
+
+		// Ends the file, false when rows are missing or it could not be written
+		bool	close						(	)
+		{
+			if (!m_file)
+				return false;
+			bool ok = m_rowsDone == m_height;
+			if (ok)
+			{
+				finish();
+				ok = flush();
+			}
+			ok		= fclose(m_file) == 0 && ok;
+			m_file	= 0;
+			return ok;
+		};
+
+		const unsigned char*	getImg		(	) const	{ return m_png.data(); };
+		size_t					getSize		(	) const	{ return m_size; };
+		int						numBlocks	(	) const	{ return m_numBlocks; };
+		// Filter type the block used in the last image
+		int						filter		( int block ) const	{ return m_filters[block]; };
+
+private:
+
+		// Signature and IHDR of a new image
+		bool	begin						(	)
+		{
+			if (m_streams.empty())
+			{
+				std::cerr << "Encoder not initialized\n";
+				return false;
+			}
+			m_size			= 0;
+			m_rowsDone		= 0;
+			m_blocksDone	= 0;
+			m_history		= 0;
+			m_adler			= adler32(0, Z_NULL, 0);
+			m_filters.clear();
+
+			static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+			unsigned char ihdr[13];
+			put32(ihdr, (uint32_t) m_width);
+			put32(ihdr + 4, (uint32_t) m_height);
+			ihdr[8]		= 8;	// bits per channel
+			ihdr[9]		= 2;	// RGB
+			ihdr[10]	= 0;	// deflate
+			ihdr[11]	= 0;	// adaptive filters
+			ihdr[12]	= 0;	// not interlaced
+
+			memcpy(append(8), signature, 8);
+			writeChunk(append(12 + sizeof(ihdr)), "IHDR", ihdr, sizeof(ihdr));
+			return true;
+		};
+
+		void	finish						(	)
+		{
+			writeChunk(append(12), "IEND", 0, 0);
+		};
+
+		/*
+		 * Filters and deflates the next count PNG rows, row i at first + i * stride, and appends
+		 * their IDAT chunks to m_png.
+		 */
+		bool	compress					( const unsigned char *first, ptrdiff_t stride, int count )
+		{
+			const int		blocks		= (count + m_blockRows - 1) / m_blockRows;
+			const size_t	stripeBytes	= (size_t) count * (m_rowBytes + 1);
+			const bool		ends		= m_rowsDone + count == m_height;
+
+			// the filtered rows follow the history of the stripe before
+			if (m_filtered.size() < PPNG_DICTIONARY_BYTES + stripeBytes)
+				m_filtered.resize(PPNG_DICTIONARY_BYTES + stripeBytes);
+			while ((int) m_blocks.size() < blocks)
+				m_blocks.push_back(std::vector<unsigned char>(m_blockBound));
+			m_blockSizes.assign(blocks, 0);
+			m_adlers.assign(blocks, 0);
+			m_crcs.assign(blocks, 0);
+			m_filters.resize(m_blocksDone + blocks, PPNG_FILTER_NONE);
+			m_rows		= first;
+			m_stride	= stride;
+			m_count		= count;
+
+			const unsigned int tasks = (unsigned int) std::min<size_t>(m_streams.size(), blocks);
+			// every block needs the filtered end of the one before as its dictionary
+			m_pool.run(tasks, [&](unsigned int t)
+			{
+				for (int b = t; b < blocks; b += tasks)
+					filterBlock(b);
+			});
+			std::vector<int> failed(tasks, 0);
+			m_pool.run(tasks, [&](unsigned int t)
+			{
+				for (int b = t; b < blocks; b += tasks)
+					failed[t] |= !deflateBlock(m_streams[t], b, ends && b == blocks - 1);
+			});
+			for (unsigned int t = 0; t < tasks; t++)
+			{
+				if (failed[t])
+				{
+					std::cerr << "PNG block could not be deflated\n";
+					return false;
+				}
+			}
+
+			for (int b = 0; b < blocks; b++)
+			{
+				m_adler = adler32_combine(m_adler, m_adlers[b], (z_off_t) blockBytes(b));
+			}
+			for (int b = 0; b < blocks; b++)
+			{
+				const bool		head	= m_blocksDone + b == 0, tail = ends && b == blocks - 1;
+				const size_t	length	= m_blockSizes[b] + (head ? 2 : 0) + (tail ? 4 : 0);
+				unsigned char	*dst	= append(12 + length);
+				put32(dst, (uint32_t) length);
+				memcpy(dst + 4, "IDAT", 4);
+				dst += 8;
+				if (head)
+				{
+					zlibHeader(dst);
+					dst += 2;
+				}
+				memcpy(dst, m_blocks[b].data(), m_blockSizes[b]);
+				dst += m_blockSizes[b];
+				uLong crc = m_crcs[b];
+				if (tail)
+				{
+					put32(dst, (uint32_t) m_adler);
+					crc = crc32(crc, dst, 4);
+					dst += 4;
+				}
+				put32(dst, (uint32_t) crc);
+			}
+
+			// the next stripe filters against this last row and deflates after these bytes
+			memcpy(m_lastRow.data(), first + (count - 1) * stride, m_rowBytes);
+			const size_t keep = std::min<size_t>(PPNG_DICTIONARY_BYTES, m_history + stripeBytes);
+			memmove(&m_filtered[PPNG_DICTIONARY_BYTES - keep], &m_filtered[PPNG_DICTIONARY_BYTES + stripeBytes - keep], keep);
+			m_history		= keep;
+			m_rowsDone		+= count;
+			m_blocksDone	+= blocks;
+			return true;
+		};
+
+		size_t	blockBytes					( int b ) const
+		{
+			const int rows = std::min(m_blockRows, m_count - b * m_blockRows);
+			return (size_t) rows * (m_rowBytes + 1);
+		};
+
+		// Tries each filter type on the sample rows of block b and filters the block with the cheapest
+		void	filterBlock					( int b )
+		{
+			const int	y0		= b * m_blockRows;
+			const int	y1		= std::min(y0 + m_blockRows, m_count);
+			uint64_t	best	= UINT64_MAX;
+			int			bestType = PPNG_FILTER_NONE;
+
+			for (int type = 0; type < PPNG_FILTERS; type++)
+			{
+				uint64_t cost = 0;
+				for (int y = y0; y < y1 && cost < best; y += PPNG_SAMPLE_ROWS)
+					cost += filterRow(type, y);
+				if (cost < best)
+				{
+					best		= cost;
+					bestType	= type;
+				}
+			}
+			for (int y = y0; y < y1; y++)
+				filterRow(bestType, y);
+			m_filters[m_blocksDone + b] = bestType;
+		};
+
+		// Filters row y of the stripe into m_filtered, returns the sum of the absolute filtered values
+		uint64_t	filterRow				( int type, int y )
+		{
+			const size_t		n		= m_rowBytes;
+			const unsigned char	*cur	= m_rows + y * m_stride;
+			const unsigned char	*prev	= y > 0 ? cur - m_stride : m_rowsDone > 0 ? m_lastRow.data() : m_zeros.data();
+			unsigned char		*out	= &m_filtered[PPNG_DICTIONARY_BYTES + (size_t) y * (n + 1)];
+
+			*out++ = (unsigned char) type;
+			switch (type)
+			{
+			case PPNG_FILTER_NONE:
+				memcpy(out, cur, n);
+				break;
+			case PPNG_FILTER_SUB:
+				for (size_t i = 0; i < 3; i++)
+					out[i] = cur[i];
+				for (size_t i = 3; i < n; i++)
+					out[i] = (unsigned char)(cur[i] - cur[i - 3]);
+				break;
+			case PPNG_FILTER_UP:
+				for (size_t i = 0; i < n; i++)
+					out[i] = (unsigned char)(cur[i] - prev[i]);
+				break;
+			case PPNG_FILTER_AVERAGE:
+				for (size_t i = 0; i < 3; i++)
+					out[i] = (unsigned char)(cur[i] - (prev[i] >> 1));
+				for (size_t i = 3; i < n; i++)
+					out[i] = (unsigned char)(cur[i] - ((cur[i - 3] + prev[i]) >> 1));
+				break;
+			case PPNG_FILTER_PAETH:
+				// with nothing to the left the predictor is the byte above
+				for (size_t i = 0; i < 3; i++)
+					out[i] = (unsigned char)(cur[i] - prev[i]);
+				for (size_t i = 3; i < n; i++)
+				{
+					const int a		= cur[i - 3];
+					const int up	= prev[i];
+					const int c		= prev[i - 3];
+					const int p		= a + up - c;
+					const int pa	= abs(p - a), pb = abs(p - up), pc = abs(p - c);
+					const int pred	= pa <= pb && pa <= pc ? a : pb <= pc ? up : c;
+					out[i] = (unsigned char)(cur[i] - pred);
+				}
+				break;
+			}
+
+			// bytes as signed values, small either way is cheap to code
+			uint64_t cost = 0;
+			for (size_t i = 0; i < n; i++)
+				cost += out[i] < 128 ? out[i] : 256 - out[i];
+			return cost;
+		};
+
+		bool	deflateBlock				( z_stream &stream, int b, bool last )
+		{
+			const size_t	start	= PPNG_DICTIONARY_BYTES + (size_t) b * m_blockRows * (m_rowBytes + 1);
+			const size_t	bytes	= blockBytes(b);
+			unsigned char	*in		= &m_filtered[start];
+
+			if (deflateReset(&stream) != Z_OK)
+				return false;
+			const size_t dictionary = std::min<size_t>(PPNG_DICTIONARY_BYTES, m_history + start - PPNG_DICTIONARY_BYTES);
+			if (dictionary > 0)
+				deflateSetDictionary(&stream, in - dictionary, (uInt) dictionary);
+
+			stream.next_in		= in;
+			stream.avail_in		= (uInt) bytes;
+			stream.next_out		= m_blocks[b].data();
+			stream.avail_out	= (uInt) m_blocks[b].size();
+			const int ret = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+			if ((last && ret != Z_STREAM_END) || (!last && ret != Z_OK) || stream.avail_in != 0 || stream.avail_out == 0)
+				return false;
+
+			m_blockSizes[b]	= m_blocks[b].size() - stream.avail_out;
+			m_adlers[b]		= adler32(adler32(0, Z_NULL, 0), in, (uInt) bytes);
+
+			// the chunk's CRC covers its type and the zlib header in front of the first block
+			uLong crc = crc32(0, (const Bytef*) "IDAT", 4);
+			if (m_blocksDone + b == 0)
+			{
+				unsigned char header[2];
+				zlibHeader(header);
+				crc = crc32(crc, header, 2);
+			}
+			m_crcs[b] = crc32(crc, m_blocks[b].data(), (uInt) m_blockSizes[b]);
+			return true;
+		};
+
+		// CMF and FLG of a stream with a 32 KB window at the encoder's level
+		void	zlibHeader					( unsigned char *dst ) const
+		{
+			const int level = m_level < 2 ? 0 : m_level < 6 ? 1 : m_level == 6 ? 2 : 3;
+			const int cmf	= 0x78;
+			int flg			= level << 6;
+			flg += 31 - (cmf * 256 + flg) % 31;
+			dst[0] = (unsigned char) cmf;
+			dst[1] = (unsigned char) flg;
+		};
+
+		// bytes more at the end of m_png
+		unsigned char*	append				( size_t bytes )
+		{
+			if (m_png.size() < m_size + bytes)
+				m_png.resize(std::max(m_size + bytes, m_png.size() * 2));
+			unsigned char *dst = &m_png[m_size];
+			m_size += bytes;
+			return dst;
+		};
+
+		// Writes what is in m_png to the open file
+		bool	flush						(	)
+		{
+			const bool ok = fwrite(m_png.data(), 1, m_size, m_file) == m_size;
+			m_size = 0;
+			return ok;
+		};
+
+		static unsigned char*	writeChunk	( unsigned char *dst, const char *type, const unsigned char *data, size_t size )
+		{
+			put32(dst, (uint32_t) size);
+			memcpy(dst + 4, type, 4);
+			if (size > 0)
+				memcpy(dst + 8, data, size);
+			put32(dst + 8 + size, (uint32_t) crc32(0, dst + 4, (uInt)(size + 4)));
+			return dst + 12 + size;
+		};
+
+		static void	put32					( unsigned char *p, uint32_t v )
+		{
+			p[0] = (unsigned char)(v >> 24);
+			p[1] = (unsigned char)(v >> 16);
+			p[2] = (unsigned char)(v >> 8);
+			p[3] = (unsigned char) v;
+		};
+
+		void	release						(	)
+		{
+			for (size_t t = 0; t < m_streams.size(); t++)
+				deflateEnd(&m_streams[t]);
+			m_streams.clear();
+		};
+
+		cThreadPool									m_pool;
+		int											m_width, m_height;
+		size_t										m_rowBytes;
+		int											m_blockRows, m_numBlocks;
+		uLong										m_blockBound;
+		int											m_level;
+		std::vector<z_stream>						m_streams;
+		// the stripe being compressed: its rows, their filter byte and filtered bytes behind up to
+		// PPNG_DICTIONARY_BYTES of history, and the deflated blocks
+		const unsigned char							*m_rows;
+		ptrdiff_t									m_stride;
+		int											m_count;
+		std::vector<unsigned char>					m_filtered;
+		std::vector<std::vector<unsigned char> >	m_blocks;
+		std::vector<size_t>							m_blockSizes;
+		std::vector<uLong>							m_adlers, m_crcs;
+		// the image so far: rows and blocks done, their Adler-32, the bytes of history in front of
+		// the next stripe, its last row and the row above the first
+		int											m_rowsDone, m_blocksDone;
+		uLong										m_adler;
+		size_t										m_history;
+		std::vector<unsigned char>					m_lastRow, m_zeros;
+		std::vector<int>							m_filters;
+		// the PNG of encode(), or the bytes not yet written to m_file
+		std::vector<unsigned char>					m_png;
+		size_t										m_size;
+		FILE										*m_file;
+};
+
+#endif /* CPARALLELPNGENCODER_H_ */
@@ -0,0 +1,269 @@
+/*
+ * Distributed under the OSI-approved Apache License, Version 2.0.  See
+ * accompanying file Copyright.txt for details.
+ */
+#ifndef CPROTOCOL_H_
+#define CPROTOCOL_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <chrono>
+
+#define PROTOCOL_MAGIC				0x53	// 'S'
+#define PROTOCOL_VERSION			1
+#define FRAME_HEADER_SIZE			24
+#define CONTROL_SIZE				8
+#define PATCH_BASE_SIZE				4
+#define PATCH_HEADER_SIZE			12
+
+// sFrameHeader::flags
+#define FRAME_FLAG_PATCHES			0x01
+
+enum eCodec
+{
+	CODEC_RAW,
+	CODEC_JPEG,
+	CODEC_H264,
+	CODEC_PNG
+};
+
+/*
+ * Header in front of every encoded frame sent to the client, big endian like the RFB messages:
+ *   0  u8  PROTOCOL_MAGIC		 1  u8  PROTOCOL_VERSION	 2  u8  codec		 3  u8  flags
+ *   4  u32 frame id			 8  u64 render time in us	16  u32 encode time in us
+ *  20  u16 width				22  u16 height
+ * Frame ids grow with every rendered frame, gaps are frames dropped before encoding. Render
+ * times are on the server's steady clock and only meaningful relative to each other.
+ * With FRAME_FLAG_PATCHES the frame updates parts of the image shown. The payload is the u32 id
+ * of the oldest frame the patches apply to, then every patch as
+ *   0  u16 x					 2  u16 y					 4  u16 width		 6  u16 height
+ *   8  u32 size of the JPEG that follows
+ * up to the end of the message. Positions are in pixels of the width x height image.
+ */
+struct sFrameHeader
+{
+	uint8_t		codec;
+	uint8_t		flags;
+	uint32_t	frameId;
+	uint64_t	renderTime;
+	uint32_t	encodeTime;
+	uint16_t	width;
+	uint16_t	height;
+};
+
+// A rectangle of the image and the size of its JPEG
+struct sPatchHeader
+{
+	uint16_t	x, y;
+	uint16_t	width, height;
+	uint32_t	size;
+};
+
+/*
+ * Client to server messages, the first byte is the type. Mouse and key events keep their RFB
+ * layout (RFC 6143, 7.5.4 and 7.5.5):
+ *   CONTROL_MOUSE	u8 type, u8 button mask, u16 x, u16 y
+ *   CONTROL_KEY	u8 type, u8 down flag, 2 bytes padding, u32 keysym
+ * The other types are CONTROL_SIZE bytes: u8 type, 3 bytes padding, u32 value (credits of
+ * CONTROL_CREDIT, frame id of CONTROL_ACK, JPEG quality, resolution in percent, 0 otherwise).
+ * Quality and resolution 0 leave them to the server's rate control.
+ */
+enum eControlType
+{
+	CONTROL_MESSAGE		= 0,
+	CONTROL_KEY			= 4,
+	CONTROL_MOUSE		= 5,
+	CONTROL_START		= 16,		// start streaming, "STVIS"
+	CONTROL_STOP,					// "END  "
+	CONTROL_NEXT_FRAME,				// stop-and-wait request, "NXTFR"
+	CONTROL_SAVE,					// save the next frame as PNG, "SAVE "
+	CONTROL_CREDIT,					// grant a window of frames, "CREDT<n>"
+	CONTROL_ACK,					// frame shown, "ACKFR<id>"
+	CONTROL_QUALITY,				// JPEG quality of this client's frames
+	CONTROL_SCALE					// resolution of this client's frames, percent of the rendered one
+};
+
+// A parsed control message, pointing into the payload it was parsed from
+struct sControlMessage
+{
+	uint8_t		type;
+	uint8_t		buttons;
+	uint8_t		down;
+	uint16_t	x, y;
+	uint32_t	value;
+	const char	*data;
+	size_t		size;
+};
+
+/*
+ * Reads and writes the messages above in place, without allocations, so the network thread
+ * never copies a payload. The text commands of older clients map to the same messages.
+ */
+class cProtocol
+{
+public:
+
+	static void		writeFrameHeader		( const sFrameHeader &header, unsigned char *dst )
+	{
+		dst[0] = PROTOCOL_MAGIC;
+		dst[1] = PROTOCOL_VERSION;
+		dst[2] = header.codec;
+		dst[3] = header.flags;
+		put32(dst + 4,  header.frameId);
+		put32(dst + 8,  (uint32_t)(header.renderTime >> 32));
+		put32(dst + 12, (uint32_t) header.renderTime);
+		put32(dst + 16, header.encodeTime);
+		put16(dst + 20, header.width);
+		put16(dst + 22, header.height);
+	};
+
+	static bool		readFrameHeader			( const unsigned char *src, size_t size, sFrameHeader &header )
+	{
+		if (size < FRAME_HEADER_SIZE || src[0] != PROTOCOL_MAGIC || src[1] != PROTOCOL_VERSION)
+			return false;
+
+		header.codec		= src[2];
+		header.flags		= src[3];
+		header.frameId		= get32(src + 4);
+		header.renderTime	= ((uint64_t) get32(src + 8) << 32) | get32(src + 12);
+		header.encodeTime	= get32(src + 16);
+		header.width		= get16(src + 20);
+		header.height		= get16(src + 22);
+		return true;
+	};
+
+	static void		writePatchBase			( uint32_t frameId, unsigned char *dst )	{ put32(dst, frameId); };
+	static uint32_t	readPatchBase			( const unsigned char *src )				{ return get32(src); };
+
+	static void		writePatchHeader		( const sPatchHeader &patch, unsigned char *dst )
+	{
+		put16(dst,     patch.x);
+		put16(dst + 2, patch.y);
+		put16(dst + 4, patch.width);
+		put16(dst + 6, patch.height);
+		put32(dst + 8, patch.size);
+	};
+
+	static bool		readPatchHeader			( const unsigned char *src, size_t size, sPatchHeader &patch )
+	{
+		if (size < PATCH_HEADER_SIZE)
+			return false;
+
+		patch.x			= get16(src);
+		patch.y			= get16(src + 2);
+		patch.width		= get16(src + 4);
+		patch.height	= get16(src + 6);
+		patch.size		= get32(src + 8);
+		return patch.size <= size - PATCH_HEADER_SIZE;
+	};
+
+	// False for truncated or unknown messages
+	static bool		parseControl			( const char *data, size_t size, sControlMessage &msg )
+	{
+		const unsigned char *p = (const unsigned char*) data;
+
+		memset(&msg, 0, sizeof(msg));
+		msg.data = data;
+		msg.size = size;
+		if (size == 0)
+			return false;
+
+		msg.type = p[0];
+		switch (p[0])
+		{
+			case CONTROL_MESSAGE:
+				return true;
+			case CONTROL_MOUSE:
+				if (size < 6)
+					return false;
+				msg.buttons	= p[1];
+				msg.x		= get16(p + 2);
+				msg.y		= get16(p + 4);
+				return true;
+			case CONTROL_KEY:
+				if (size < 8)
+					return false;
+				msg.down	= p[1];
+				msg.value	= get32(p + 4);
+				return true;
+			case CONTROL_START:
+			case CONTROL_STOP:
+			case CONTROL_NEXT_FRAME:
+			case CONTROL_SAVE:
+			case CONTROL_CREDIT:
+			case CONTROL_ACK:
+			case CONTROL_QUALITY:
+			case CONTROL_SCALE:
+				if (size < CONTROL_SIZE)
+					return false;
+				msg.value = get32(p + 4);
+				return true;
+		}
+		return parseText(data, size, msg);
+	};
+
+	static void		writeControl			( eControlType type, uint32_t value, unsigned char *dst )
+	{
+		dst[0] = (unsigned char) type;
+		dst[1] = dst[2] = dst[3] = 0;
+		put32(dst + 4, value);
+	};
+
+	// Microseconds on the steady clock, the time base of sFrameHeader::renderTime
+	static uint64_t	now						(	)
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
+	};
+
+private:
+
+	static bool		parseText				( const char *data, size_t size, sControlMessage &msg )
+	{
+		static const struct { const char *text; uint8_t type; } commands[] =
+		{
+			{ "STVIS", CONTROL_START },
+			{ "END  ", CONTROL_STOP },
+			{ "NXTFR", CONTROL_NEXT_FRAME },
+			{ "SAVE ", CONTROL_SAVE },
+			{ "CREDT", CONTROL_CREDIT },
+			{ "ACKFR", CONTROL_ACK }
+		};
+
+		if (size < 5)
+			return false;
+		for (size_t i = 0; i < sizeof(commands) / sizeof(commands[0]); i++)
+		{
+			if (memcmp(data, commands[i].text, 5) != 0)
+				continue;
+
+			msg.type = commands[i].type;
+			for (size_t c = 5; c < size && data[c] >= '0' && data[c] <= '9'; c++)
+			{
+				msg.value = msg.value * 10 + (data[c] - '0');
+			}
+			return true;
+		}
+		return false;
+	};
+
+	static uint16_t	get16					( const unsigned char *p )	{ return (uint16_t)((p[0] << 8) | p[1]); };
+	static uint32_t	get32					( const unsigned char *p )
+	{
+		return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+	};
+	static void		put16					( unsigned char *p, uint16_t v )
+	{
+		p[0] = (unsigned char)(v >> 8);
+		p[1] = (unsigned char) v;
+	};
+	static void		put32					( unsigned char *p, uint32_t v )
+	{
+		p[0] = (unsigned char)(v >> 24);
+		p[1] = (unsigned char)(v >> 16);
+		p[2] = (unsigned char)(v >> 8);
+		p[3] = (unsigned char) v;
+	};
+};
+
+#endif /* CPROTOCOL_H_ */
@@ -0,0 +1,300 @@
+/*
+ * Distributed under the OSI-approved Apache License, Version 2.0.  See
+ * accompanying file Copyright.txt for details.
+ */
+#ifndef CRATECONTROL_H_
+#define CRATECONTROL_H_
+
+#include <stddef.h>
+#include <deque>
+#include <algorithm>
+#include <turbojpeg.h>
+
+// Frame rate the controller aims for
+#define RATE_TARGET_FPS				30
+// Share of the link capacity the frames may take
+#define RATE_HEADROOM				0.8
+// Tighter share while the user interacts, so the frames following the input leave room
+#define RATE_INTERACTIVE_HEADROOM	0.6
+// Input within this time counts as interaction
+#define RATE_INTERACTION_MS			500
+// Round trip above the smallest recent one that means frames queue on the link
+#define RATE_QUEUE_MS				20.0
+// How long a worse level has to be needed before it is taken, and a better one to fit. While
+// interacting worse levels are taken at once.
+#define RATE_DOWNSHIFT_HOLD_MS		150
+#define RATE_UPSHIFT_HOLD_MS		500
+// While the link does not queue the next better level is tried after the upshift hold. When it
+// is given up within RATE_PROBE_MS, the next try waits twice as long, up to the maximum.
+#define RATE_PROBE_MS				1000
+#define RATE_MAX_PROBE_HOLD_MS		4000
+// Time the smallest round trip is taken over, longer than a queue may stand, and the time the
+// delivery rate is measured over, which is also how long a queue may stand before it is trusted
+#define RATE_MIN_RTT_MS				10000
+#define RATE_DELIVERY_MS			500
+// Weight of a new sample in the smoothed round trip and frame size
+#define RATE_SMOOTHING				0.25
+// Frames with less of a whole frame's pixels do not tell the size of a whole one, nor whether
+// the link carries a better level
+#define RATE_MIN_SHARE				0.05
+
+// One rung of the quality ladder and its frame size relative to the first one
+struct sRateLevel
+{
+	int		quality;
+	int		subsampling;
+	int		scale;
+	float	cost;
+};
+
+/*
+ * Picks JPEG quality, chroma subsampling and resolution of one client's frames so they arrive
+ * at RATE_TARGET_FPS, from the size and round trip of every acked frame.
+ * Once the round trip grows by RATE_QUEUE_MS over the smallest recent one frames queue, the
+ * link is saturated and the bytes acked per second are its capacity. While interacting, a new
+ * queue is answered at once with the next worse level. Otherwise the controller keeps the
+ * best level whose frames fit in the capacity at the target rate; frame sizes of the other
+ * levels are predicted from the acked ones with the costs of the ladder. While the link does
+ * not queue, its capacity is unknown and now and then the next better level is tried.
+ * Stop-and-wait clients never queue more than one frame, their frame rate is bound by the round
+ * trip and they only leave the best level through the probes of pipelined clients.
+ * Times are in ms on the caller's clock.
+ */
+class cRateControl
+{
+public:
+				cRateControl				( double targetFps = RATE_TARGET_FPS )
+				{
+					m_targetFps		= targetFps;
+					m_level			= 0;
+					m_srtt			= 0.0;
+					m_capacity		= 0.0;
+					m_measured		= false;
+					m_delivered		= 0.0;
+					m_bytesPerCost	= 0.0;
+					m_skip			= 0;
+					m_lastInput		= -1.0e9;
+					m_candidate		= 0;
+					m_since			= 0.0;
+					m_clearSince	= 0.0;
+					m_queueSince	= -1.0;
+					m_probeHold		= RATE_UPSHIFT_HOLD_MS;
+					m_probeAt		= -1.0;
+				};
+
+	// Best quality first. Costs are the sizes of the synthetic frame of "sight -bench rate".
+	static const sRateLevel*	levels		( int &count )
+	{
+		static const sRateLevel ladder[] =
+		{
+			{ 90, TJSAMP_444, 100, 1.00f },
+			{ 80, TJSAMP_444, 100, 0.72f },
+			{ 80, TJSAMP_420, 100, 0.58f },
+			{ 70, TJSAMP_420, 100, 0.48f },
+			{ 60, TJSAMP_420, 100, 0.41f },
+			{ 60, TJSAMP_420,  75, 0.28f },
+			{ 50, TJSAMP_420,  75, 0.25f },
+			{ 50, TJSAMP_420,  50, 0.14f },
+			{ 40, TJSAMP_420,  50, 0.12f },
+			{ 40, TJSAMP_420,  35, 0.07f },
+			{ 30, TJSAMP_420,  25, 0.033f }
+		};
+		count = (int)(sizeof(ladder) / sizeof(ladder[0]));
+		return ladder;
+	};
+
+	/*
+	 * An acked frame of bytes, share the part of a whole frame of its level it carried: frames
+	 * rendered at a lower resolution count as that share of the pixels, patches (share 0) only
+	 * count towards the delivery rate.
+	 */
+	void		acked						( size_t bytes, double rttMs, double nowMs, double share = 1.0 )
+	{
+		if (bytes == 0 || rttMs < 0.0)
+			return;
+
+		m_srtt = m_srtt > 0.0 ? m_srtt + RATE_SMOOTHING * (rttMs - m_srtt) : rttMs;
+		// sliding minimum: the round trips left are increasing, the smallest is the first
+		while (!m_rtts.empty() && m_rtts.back().value >= rttMs)
+			m_rtts.pop_back();
+		m_rtts.push_back(sAck{ nowMs, rttMs });
+		while (m_rtts.front().time < nowMs - RATE_MIN_RTT_MS)
+			m_rtts.pop_front();
+
+		m_acks.push_back(sAck{ nowMs, (double) bytes });
+		m_delivered += bytes;
+		while (m_acks.front().time < nowMs - RATE_DELIVERY_MS)
+		{
+			m_delivered -= m_acks.front().value;
+			m_acks.pop_front();
+		}
+
+		// frames encoded before the last switch still arrive, they do not tell the cost
+		if (m_skip > 0)
+		{
+			m_skip--;
+			return;
+		}
+		if (share < RATE_MIN_SHARE)
+		{
+			// a link that carries patches without queueing need not carry the whole frames of a
+			// better level, they do not make it worth a probe either
+			m_clearSince = std::max(m_clearSince, nowMs);
+			return;
+		}
+		int					count;
+		const sRateLevel	*ladder = levels(count);
+		double				perCost = bytes / (ladder[m_level].cost * std::min(share, 1.0));
+		m_bytesPerCost = m_bytesPerCost > 0.0 ? m_bytesPerCost + RATE_SMOOTHING * (perCost - m_bytesPerCost) : perCost;
+	};
+
+	void		interaction					( double nowMs )	{ m_lastInput = nowMs; };
+
+	/*
+	 * Moves to the level the link carries, true when the level changed. inFlight is the number
+	 * of frames sent and not yet acked, the frames of the old level still to come.
+	 */
+	bool		update						( double nowMs, unsigned int inFlight )
+	{
+		if (m_bytesPerCost <= 0.0 || m_acks.size() < 2)
+			return false;
+
+		const bool		interacting	= nowMs - m_lastInput < RATE_INTERACTION_MS;
+		const double	headroom	= interacting ? RATE_INTERACTIVE_HEADROOM : RATE_HEADROOM;
+		const bool		queueing	= m_srtt - m_rtts.front().value > RATE_QUEUE_MS;
+
+		// the first ack of the window was transferred before it
+		const double delivered = (m_delivered - m_acks.front().value) / std::max(nowMs - m_acks.front().time, 1.0);
+		bool freshQueue = false;
+		if (queueing)
+		{
+			if (m_queueSince < 0.0)
+				m_queueSince = nowMs;
+			m_clearSince = nowMs;
+			freshQueue = nowMs - m_queueSince < RATE_DELIVERY_MS;
+		}
+		else
+		{
+			m_queueSince = -1.0;
+		}
+		if (queueing && !freshQueue)
+		{
+			// the link was saturated over the whole delivery window
+			m_capacity = delivered;
+			m_measured = true;
+		}
+		else
+		{
+			// a link that carries more than it was measured at has more capacity
+			m_capacity = std::max(m_capacity, delivered);
+		}
+
+		// worse levels only for a link that queues, its capacity is a lower bound otherwise
+		int target = m_level;
+		if (m_measured)
+		{
+			int fit = best(headroom);
+			if (fit < m_level || (queueing && !freshQueue))
+				target = fit;
+		}
+		int count;
+		levels(count);
+		if (freshQueue && interacting)
+		{
+			// the interaction must not wait for the capacity
+			target = std::min(std::max(target, m_level + 1), count - 1);
+		}
+		if (target != m_candidate)
+		{
+			m_candidate	= target;
+			m_since		= nowMs;
+		}
+		const double held = nowMs - m_since;
+		if (target > m_level)
+		{
+			// one step while the frames of the last one drain
+			if (m_skip > 0 || (!interacting && held < RATE_DOWNSHIFT_HOLD_MS))
+				target = m_level;
+			else if (m_probeAt >= 0.0 && nowMs - m_probeAt < RATE_PROBE_MS)
+				m_probeHold = std::min(2.0 * m_probeHold, (double) RATE_MAX_PROBE_HOLD_MS);
+		}
+		else if (target < m_level && held < RATE_UPSHIFT_HOLD_MS)
+		{
+			target = m_level;
+		}
+
+		if (m_probeAt >= 0.0 && nowMs - m_probeAt >= RATE_PROBE_MS)
+		{
+			// the level tried last held
+			m_probeHold	= RATE_UPSHIFT_HOLD_MS;
+			m_probeAt	= -1.0;
+		}
+		if (target == m_level && m_level > 0 && nowMs - m_clearSince >= m_probeHold)
+		{
+			// the link does not queue, it may carry the next better level
+			target		= m_level - 1;
+			m_probeAt	= nowMs;
+		}
+		if (target == m_level)
+			return false;
+
+		if (target > m_level)
+			m_probeAt = -1.0;
+		m_level			= target;
+		m_skip			= inFlight;
+		m_clearSince	= nowMs;
+		return true;
+	};
+
+	int			level						(	) const	{ return m_level; };
+	const sRateLevel&	current				(	) const
+	{
+		int count;
+		return levels(count)[m_level];
+	};
+	// Link capacity in MB/s: the bytes acked per second when it last queued, or more if it
+	// carried more since
+	double		capacity					(	) const	{ return m_capacity * 0.001; };
+	double		rtt							(	) const	{ return m_srtt; };
+
+private:
+
+	// an acked frame's size or round trip
+	struct sAck
+	{
+		double	time;
+		double	value;
+	};
+
+	// Best level whose frames fit in the capacity at the target rate
+	int			best						( double headroom ) const
+	{
+		int					count;
+		const sRateLevel	*ladder	= levels(count);
+		const double		budget	= headroom * m_capacity * 1000.0 / m_targetFps;
+
+		for (int l = 0; l < count; l++)
+		{
+			if (m_bytesPerCost * ladder[l].cost <= budget)
+				return l;
+		}
+		return count - 1;
+	};
+
+	double				m_targetFps;
+	int					m_level;
+	double				m_srtt;
+	std::deque<sAck>	m_rtts;				// round trips of the last RATE_MIN_RTT_MS
+	std::deque<sAck>	m_acks;				// sizes of the last RATE_DELIVERY_MS
+	double				m_capacity;			// bytes per ms
+	bool				m_measured;			// m_capacity was measured on a saturated link
+	double				m_delivered;		// bytes of m_acks
+	double				m_bytesPerCost;
+	unsigned int		m_skip;
+	double				m_lastInput;
+	int					m_candidate;		// level the link asks for, since m_since
+	double				m_since, m_clearSince, m_queueSince;
+	double				m_probeHold, m_probeAt;
+};
+
+#endif /* CRATECONTROL_H_ */
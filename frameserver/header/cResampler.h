@@ -0,0 +1,206 @@
+/*
+ * Distributed under the OSI-approved Apache License, Version 2.0.  See
+ * accompanying file Copyright.txt for details.
+ */
+#ifndef CRESAMPLER_H_
+#define CRESAMPLER_H_
+
+#include <stdint.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+// Filter weights are fixed point, the weights of one output pixel add up to this
+#define RESAMPLE_ONE				256
+
+/*
+ * Scales RGB8 images between two sizes set up once, into a buffer it owns, so streaming never
+ * allocates per frame. Shrinking averages the source pixels each output pixel covers (box
+ * filter), growing interpolates between the nearest two (bilinear). The filter is separable:
+ * the source rows an output row covers are blended into a 16 bit row first, in plain loops over
+ * whole rows the compiler turns into SIMD multiply-adds, then every output pixel takes its
+ * taps from that row. Weights and taps are computed in setup().
+ */
+class cResampler
+{
+public:
+				cResampler					(	)
+				{
+					m_srcWidth	= m_srcHeight = 0;
+					m_dstWidth	= m_dstHeight = 0;
+					m_tapsX		= m_tapsY = 0;
+				};
+
+	// Prepares the filters, cheap when the sizes did not change
+	void		setup						( int srcWidth, int srcHeight, int dstWidth, int dstHeight )
+	{
+		if (srcWidth == m_srcWidth && srcHeight == m_srcHeight && dstWidth == m_dstWidth && dstHeight == m_dstHeight)
+			return;
+
+		m_srcWidth	= srcWidth;
+		m_srcHeight	= srcHeight;
+		m_dstWidth	= dstWidth;
+		m_dstHeight	= dstHeight;
+		m_tapsX		= filter(srcWidth,  dstWidth,  m_startX, m_weightsX);
+		m_tapsY		= filter(srcHeight, dstHeight, m_startY, m_weightsY);
+		for (int x = 0; x < dstWidth; x++)
+		{
+			// taps address the channels of the blended row
+			m_startX[x] *= 3;
+		}
+		m_row.resize((size_t) srcWidth * 3);
+		m_out.resize(identity() ? 0 : (size_t) dstWidth * dstHeight * 3);
+	};
+
+	// The scaled image, src itself when the sizes are equal. Valid until the next call.
+	unsigned char*	resample				( unsigned char *src )
+	{
+		if (identity())
+			return src;
+		resample(src, m_out.data());
+		return m_out.data();
+	};
+
+	// Scales src into dst, which holds dstWidth * dstHeight * 3 bytes
+	void		resample					( const unsigned char *src, unsigned char *dst )
+	{
+		const size_t	rowBytes	= (size_t) m_srcWidth * 3;
+		uint16_t		*row		= m_row.data();
+
+		for (int y = 0; y < m_dstHeight; y++)
+		{
+			const uint16_t		*wy = &m_weightsY[(size_t) y * m_tapsY];
+			const unsigned char	*in = src + (size_t) m_startY[y] * rowBytes;
+
+			// vertical: weighted sum of the covered rows, at most RESAMPLE_ONE * 255
+			const uint16_t w0 = wy[0];
+			for (size_t i = 0; i < rowBytes; i++)
+				row[i] = (uint16_t)(w0 * in[i]);
+			for (int t = 1; t < m_tapsY; t++)
+			{
+				const uint16_t		w = wy[t];
+				const unsigned char	*tap = in + t * rowBytes;
+				if (w == 0)
+					continue;
+				for (size_t i = 0; i < rowBytes; i++)
+					row[i] = (uint16_t)(row[i] + w * tap[i]);
+			}
+
+			// horizontal: weighted sum of the covered pixels of the blended row, unrolled for
+			// the tap counts of the usual factors
+			unsigned char *out = dst + (size_t) y * m_dstWidth * 3;
+			switch (m_tapsX)
+			{
+				case 1:		horizontal<1>(row, out);	break;
+				case 2:		horizontal<2>(row, out);	break;
+				case 3:		horizontal<3>(row, out);	break;
+				case 4:		horizontal<4>(row, out);	break;
+				default:	horizontal<0>(row, out);	break;
+			}
+		}
+	};
+
+	bool		identity					(	) const
+	{
+		return m_srcWidth == m_dstWidth && m_srcHeight == m_dstHeight;
+	};
+	int			width						(	) const	{ return m_dstWidth; };
+	int			height						(	) const	{ return m_dstHeight; };
+
+private:
+
+	// One output row from the blended row, TAPS = 0 for m_tapsX taps
+	template <int TAPS>
+	void		horizontal					( const uint16_t *row, unsigned char *out ) const
+	{
+		const int taps = TAPS > 0 ? TAPS : m_tapsX;
+		for (int x = 0; x < m_dstWidth; x++, out += 3)
+		{
+			const uint16_t	*wx = &m_weightsX[(size_t) x * taps];
+			const uint16_t	*px = row + m_startX[x];
+			uint32_t		r = RESAMPLE_ONE * RESAMPLE_ONE / 2, g = r, b = r;
+			for (int t = 0; t < taps; t++, px += 3)
+			{
+				r += (uint32_t) wx[t] * px[0];
+				g += (uint32_t) wx[t] * px[1];
+				b += (uint32_t) wx[t] * px[2];
+			}
+			out[0] = (unsigned char)(r / (RESAMPLE_ONE * RESAMPLE_ONE));
+			out[1] = (unsigned char)(g / (RESAMPLE_ONE * RESAMPLE_ONE));
+			out[2] = (unsigned char)(b / (RESAMPLE_ONE * RESAMPLE_ONE));
+		}
+	};
+
+	/*
+	 * Filter of one axis: the first source index of every output index and as many weights as
+	 * the widest output needs, zero padded. Returns that number of taps.
+	 */
+	static int	filter						( int src, int dst, std::vector<int> &start, std::vector<uint16_t> &weights )
+	{
+		const double		scale = (double) src / dst;
+		std::vector<double>	w;
+		std::vector<int>	first(dst), count(dst);
+		std::vector<double>	all;
+
+		for (int i = 0; i < dst; i++)
+		{
+			w.clear();
+			if (scale > 1.0)
+			{
+				// box: the overlap of every source pixel with [i, i + 1) * scale
+				const double lo = i * scale, hi = (i + 1) * scale;
+				first[i] = (int) floor(lo);
+				for (int j = first[i]; j < src && j < hi; j++)
+					w.push_back(std::min<double>(j + 1, hi) - std::max<double>(j, lo));
+			}
+			else
+			{
+				// bilinear around the output pixel's center, clamped at the edges
+				const double c = std::min(std::max((i + 0.5) * scale - 0.5, 0.0), src - 1.0);
+				first[i] = std::min((int) c, std::max(src - 2, 0));
+				const double f = c - first[i];
+				w.push_back(1.0 - f);
+				if (first[i] + 1 < src)
+					w.push_back(f);
+			}
+			count[i] = (int) w.size();
+			all.insert(all.end(), w.begin(), w.end());
+		}
+
+		const int taps = *std::max_element(count.begin(), count.end());
+		start.assign(dst, 0);
+		weights.assign((size_t) dst * taps, 0);
+		for (int i = 0, k = 0; i < dst; k += count[i], i++)
+		{
+			// taps past the image move the first one back, so every tap reads inside the image
+			start[i] = std::min(first[i], src - taps);
+			const int shift = first[i] - start[i];
+
+			double sum = 0.0;
+			for (int t = 0; t < count[i]; t++)
+				sum += all[k + t];
+			int total = 0, largest = 0;
+			for (int t = 0; t < count[i]; t++)
+			{
+				uint16_t q = (uint16_t) floor(all[k + t] / sum * RESAMPLE_ONE + 0.5);
+				weights[(size_t) i * taps + shift + t] = q;
+				total += q;
+				if (q > weights[(size_t) i * taps + shift + largest])
+					largest = t;
+			}
+			// the rounding error goes to the largest weight, so flat areas keep their value
+			weights[(size_t) i * taps + shift + largest] += (uint16_t)(RESAMPLE_ONE - total);
+		}
+		return taps;
+	};
+
+	int							m_srcWidth, m_srcHeight;
+	int							m_dstWidth, m_dstHeight;
+	int							m_tapsX, m_tapsY;
+	std::vector<int>			m_startX, m_startY;
+	std::vector<uint16_t>		m_weightsX, m_weightsY;
+	std::vector<uint16_t>		m_row;
+	std::vector<unsigned char>	m_out;
+};
+
+#endif /* CRESAMPLER_H_ */
@@ -0,0 +1,72 @@
+/*
+ * Distributed under the OSI-approved Apache License, Version 2.0.  See
+ * accompanying file Copyright.txt for details.
+ */
+#ifndef CSPSCQUEUE_H_
+#define CSPSCQUEUE_H_
+
+#include <stddef.h>
+#include <atomic>
+
+/*
+ * Bounded lock-free queue between one producer thread and one consumer thread. Each side owns
+ * one index and only reads the other one, the release stores publish the element written
+ * before them. Capacity has to be a power of two; push() fails when the queue is full.
+ */
+template <typename T, size_t Capacity>
+class cSPSCQueue
+{
+	static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "cSPSCQueue capacity must be a power of two");
+
+public:
+				cSPSCQueue					(	) : m_head(0), m_tail(0) { };
+
+	// Producer
+	bool		push						( const T &item )
+	{
+		const size_t tail = m_tail.load(std::memory_order_relaxed);
+		if (tail - m_head.load(std::memory_order_acquire) == Capacity)
+			return false;
+
+		m_items[tail & (Capacity - 1)] = item;
+		m_tail.store(tail + 1, std::memory_order_release);
+		return true;
+	};
+
+	// Consumer, the next item without removing it or 0 if the queue is empty
+	const T*	front						(	)
+	{
+		const size_t head = m_head.load(std::memory_order_relaxed);
+		if (head == m_tail.load(std::memory_order_acquire))
+			return 0;
+		return &m_items[head & (Capacity - 1)];
+	};
+
+	// Consumer
+	bool		pop							( T &item )
+	{
+		const T *next = front();
+		if (!next)
+			return false;
+
+		item = *next;
+		m_head.store(m_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+		return true;
+	};
+
+	bool		empty						(	) const
+	{
+		return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_acquire);
+	};
+
+private:
+	// the indices are on separate cache lines, each is written by one thread only. Padded
+	// rather than aligned, C++11 new does not honour alignments above the default.
+	T						m_items[Capacity];
+	char					m_pad0[64];
+	std::atomic<size_t>		m_head;
+	char					m_pad1[64 - sizeof(std::atomic<size_t>)];
+	std::atomic<size_t>		m_tail;
+};
+
+#endif /* CSPSCQUEUE_H_ */
@@ -0,0 +1,251 @@
+/*
+ * Distributed under the OSI-approved Apache License, Version 2.0.  See
+ * accompanying file Copyright.txt for details.
+ */
+#ifndef CSNAPSHOTWRITER_H_
+#define CSNAPSHOTWRITER_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <algorithm>
+#include "cTimer.h"
+#include "cStats.h"
+#include "cProtocol.h"
+#include "cPNGEncoder.h"
+#include "cParallelPngEncoder.h"
+
+// Frames waiting or being written; a save beyond them is dropped
+#define SNAPSHOT_QUEUE_FRAMES		4
+#define SNAPSHOT_WRITER_THREADS		1
+// rows filtered and deflated in parallel blocks (cParallelPngEncoder) instead of by libpng
+#define PARALLEL_PNG
+// threads of the block encoder, 0 for one per core
+#define PNG_THREADS					0
+
+#ifdef PARALLEL_PNG
+	typedef cParallelPngEncoder		png_encoder;
+#else
+	typedef cPNGEncoder				png_encoder;
+#endif
+
+/*
+ * Writes RGB8 frames to PNG files on background threads, so a snapshot never stalls the render
+ * loop. save() copies the frame into one of a fixed set of buffers allocated up front and
+ * returns; the writer threads, each with its own png_encoder, take the requests in order and
+ * hand the buffers back. When every buffer is in use the request is dropped and counted, the
+ * renderer never waits for the disk, unless it asks to wait for a buffer as the batch renderer
+ * does. The destructor writes what is queued before it returns.
+ */
+class cSnapshotWriter
+{
+public:
+					cSnapshotWriter				( int width, int height, unsigned int threads = SNAPSHOT_WRITER_THREADS,
+												  unsigned int frames = SNAPSHOT_QUEUE_FRAMES )
+					{
+						m_width		= width;
+						m_height	= height;
+						m_quit		= false;
+						m_busy		= 0;
+						m_maxDepth	= 0;
+						m_written	= 0;
+						m_dropped	= 0;
+						m_failed	= 0;
+						m_frames.resize(frames);
+						for (unsigned int i = 0; i < frames; i++)
+						{
+							m_frames[i].resize((size_t) width * height * 3);
+							m_free.push_back(i);
+						}
+						for (unsigned int t = 0; t < std::max(threads, 1u); t++)
+						{
+							m_threads.push_back(std::thread(&cSnapshotWriter::writeLoop, this));
+						}
+					};
+
+					~cSnapshotWriter			(	)
+					{
+						{
+							std::lock_guard<std::mutex> lock(m_mutex);
+							m_quit = true;
+						}
+						m_cond.notify_all();
+						for (size_t t = 0; t < m_threads.size(); t++)
+						{
+							m_threads[t].join();
+						}
+					};
+
+	/*
+	 * Queues a copy of the width x height frame, bottom-up RGB8 as read back from the frame
+	 * buffer or top-down with topDown, to be written to filename. False when all buffers are in
+	 * use and the snapshot is dropped, with wait it waits for a buffer instead.
+	 */
+	bool			save						( const std::string &filename, const unsigned char *img, bool wait = false,
+												  bool topDown = false )
+	{
+		unsigned int frame;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			if (wait)
+				m_freed.wait(lock, [this] { return !m_free.empty(); });
+			if (m_free.empty())
+			{
+				m_dropped++;
+				return false;
+			}
+			frame = m_free.back();
+			m_free.pop_back();
+		}
+
+		// the render thread reuses img as soon as save() returns
+		if (topDown)
+		{
+			// the encoders take the rows bottom-up
+			const size_t stride = (size_t) m_width * 3;
+			for (int y = 0; y < m_height; y++)
+			{
+				memcpy(m_frames[frame].data() + (m_height - 1 - y) * stride, img + y * stride, stride);
+			}
+		}
+		else
+		{
+			memcpy(m_frames[frame].data(), img, m_frames[frame].size());
+		}
+
+		sRequest request;
+		request.frame		= frame;
+		request.filename	= filename;
+		request.queued		= cProtocol::now();
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_pending.push_back(request);
+			m_maxDepth = std::max(m_maxDepth, m_pending.size() + m_busy);
+		}
+		m_cond.notify_one();
+		return true;
+	};
+
+	// Waits until every queued snapshot is written
+	void			flush						(	)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_idle.wait(lock, [this] { return m_pending.empty() && m_busy == 0; });
+	};
+
+	// Snapshots queued or being written, and the most there were since the last call
+	size_t			depth						(	)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_pending.size() + m_busy;
+	};
+	size_t			maxDepth					(	)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		size_t depth	= m_maxDepth;
+		m_maxDepth		= m_pending.size() + m_busy;
+		return depth;
+	};
+	// Average ms from save() to the file being closed, and of the PNG write alone, over interval
+	float			latencyMs					( float interval )
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_latencyStats.getAverage(interval);
+	};
+	float			writeMs						( float interval )
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_writeStats.getAverage(interval);
+	};
+	uint64_t		written						(	)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_written;
+	};
+	uint64_t		dropped						(	)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_dropped;
+	};
+	uint64_t		failed						(	)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_failed;
+	};
+
+private:
+
+	struct sRequest
+	{
+		unsigned int	frame;
+		std::string		filename;
+		uint64_t		queued;		// cProtocol::now()
+	};
+
+	void			writeLoop					(	)
+	{
+#ifdef PARALLEL_PNG
+		png_encoder png(PNG_THREADS);
+#else
+		png_encoder png;
+#endif
+		png.setImageParams(m_width, m_height);
+		png.initEncoder();
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		for (;;)
+		{
+			m_cond.wait(lock, [this] { return m_quit || !m_pending.empty(); });
+			if (m_pending.empty())
+				return;
+
+			sRequest request = m_pending.front();
+			m_pending.pop_front();
+			m_busy++;
+			lock.unlock();
+
+			cTimer		timer;
+			const bool	ok = png.savePNG(request.filename, m_frames[request.frame].data());
+			const float	writeMs = (float) timer.getElapsedMilliseconds();
+			if (ok)
+				std::cout << "Sight@Frameserver: " << request.filename << " saved!\n";
+			else
+				std::cout << "Sight@Frameserver: " << request.filename << " could not be written\n";
+
+			lock.lock();
+			m_writeStats.add(writeMs);
+			m_latencyStats.add((cProtocol::now() - request.queued) * 0.001f);
+			if (ok)
+				m_written++;
+			else
+				m_failed++;
+			m_free.push_back(request.frame);
+			m_busy--;
+			m_freed.notify_one();
+			if (m_pending.empty() && m_busy == 0)
+				m_idle.notify_all();
+		}
+	};
+
+	int										m_width, m_height;
+	std::vector<std::vector<unsigned char>>	m_frames;
+	std::vector<std::thread>				m_threads;
+	// guarded by m_mutex: free buffers, requests in order, the ones being written and the metrics
+	std::mutex								m_mutex;
+	std::condition_variable					m_cond, m_idle, m_freed;
+	std::vector<unsigned int>				m_free;
+	std::deque<sRequest>					m_pending;
+	size_t									m_busy, m_maxDepth;
+	bool									m_quit;
+	AverageStats							m_latencyStats, m_writeStats;
+	uint64_t								m_written, m_dropped, m_failed;
+};
+
+#endif /* CSNAPSHOTWRITER_H_ */
@@ -1,7 +1,19 @@
 #pragma once
 
+#include <stdint.h>
+#include <atomic>
+#include <algorithm>
+#include <ostream>
 #include "cTimer.h"
 
+// Linear sub-buckets per power of two of LatencyStats, 2^n: a value is known within 1/2^(n-1)
+#define LATENCY_SUB_BITS        6
+// Largest value kept apart, 2^n - 1 us, about 12 days
+#define LATENCY_MAX_BITS        40
+// Windows kept, one being recorded and the closed ones summaries can span
+#define LATENCY_WINDOWS         11
+#define LATENCY_BUCKETS         ((LATENCY_MAX_BITS - LATENCY_SUB_BITS + 2) << (LATENCY_SUB_BITS - 1))
+
 
 /**
  * Author: Tim Biedert
@@ -90,3 +102,164 @@ private:
 };
 
 
+
+/**
+ * @brief Latency distribution as an HdrHistogram: log-linear buckets of microseconds, so the
+ * percentiles are known within 3% from 1 us to days in 4.5 KB per window. Recording is lock-free and
+ * may come from any thread, a relaxed atomic increment and rarely a compare-exchange for the
+ * maximum. The buckets form a ring of windows: one thread closes the window being recorded
+ * with rotate(), once per interval, and summarizes the last closed windows, a sliding window
+ * of that many intervals.
+ */
+class LatencyStats
+{
+public:
+    /** Percentiles and maximum in ms, 0 when nothing was recorded */
+    struct Summary
+    {
+        uint64_t count;
+        float p50, p90, p99, max;
+    };
+
+    LatencyStats()
+    {
+        this->current.store(0, std::memory_order_relaxed);
+        for (unsigned int w = 0; w < LATENCY_WINDOWS; w++)
+        {
+            this->clear(w);
+        }
+    }
+
+    // the sessions holding them are copied into their map
+    LatencyStats(const LatencyStats &other)
+    {
+        *this = other;
+    }
+
+    LatencyStats &operator=(const LatencyStats &other)
+    {
+        for (unsigned int w = 0; w < LATENCY_WINDOWS; w++)
+        {
+            for (unsigned int b = 0; b < LATENCY_BUCKETS; b++)
+            {
+                this->counts[w][b].store(other.counts[w][b].load(std::memory_order_relaxed), std::memory_order_relaxed);
+            }
+            this->max[w].store(other.max[w].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+        this->current.store(other.current.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        return *this;
+    }
+
+    void add(float ms)
+    {
+        this->record(ms > 0.0f ? (uint64_t)(ms * 1000.0f + 0.5f) : 0);
+    }
+
+    /** Any thread */
+    void record(uint64_t us)
+    {
+        us = std::min(us, (uint64_t(1) << LATENCY_MAX_BITS) - 1);
+        const unsigned int w = this->current.load(std::memory_order_relaxed);
+        this->counts[w][bucket(us)].fetch_add(1, std::memory_order_relaxed);
+        uint64_t m = this->max[w].load(std::memory_order_relaxed);
+        while (us > m && !this->max[w].compare_exchange_weak(m, us, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    /**
+     * One thread, every interval: closes the window being recorded and reopens the oldest one.
+     * A sample still being added to the oldest window while it is cleared would be lost, its
+     * thread had to stall for LATENCY_WINDOWS - 1 intervals.
+     */
+    void rotate()
+    {
+        const unsigned int next = (this->current.load(std::memory_order_relaxed) + 1) % LATENCY_WINDOWS;
+        this->clear(next);
+        this->current.store(next, std::memory_order_relaxed);
+    }
+
+    /** The thread calling rotate(): distribution over the last closed windows */
+    Summary getSummary(unsigned int windows) const
+    {
+        windows = std::min(std::max(windows, 1u), (unsigned int) LATENCY_WINDOWS - 1);
+        const unsigned int current = this->current.load(std::memory_order_relaxed);
+
+        uint32_t sum[LATENCY_BUCKETS] = { 0 };
+        uint64_t count = 0, max = 0;
+        for (unsigned int i = 1; i <= windows; i++)
+        {
+            const unsigned int w = (current + LATENCY_WINDOWS - i) % LATENCY_WINDOWS;
+            for (unsigned int b = 0; b < LATENCY_BUCKETS; b++)
+            {
+                const uint32_t n = this->counts[w][b].load(std::memory_order_relaxed);
+                sum[b] += n;
+                count += n;
+            }
+            max = std::max(max, this->max[w].load(std::memory_order_relaxed));
+        }
+
+        Summary summary;
+        summary.count = count;
+        summary.p50 = 0.001f * percentile(sum, count, 0.50, max);
+        summary.p90 = 0.001f * percentile(sum, count, 0.90, max);
+        summary.p99 = 0.001f * percentile(sum, count, 0.99, max);
+        summary.max = 0.001f * max;
+        return summary;
+    }
+
+    /** Bucket of a value below 2^LATENCY_MAX_BITS: the values below 2^LATENCY_SUB_BITS have one
+     *  each, above that each power of two is split into 2^(LATENCY_SUB_BITS-1) equal parts */
+    static unsigned int bucket(uint64_t us)
+    {
+        const int msb = 63 - __builtin_clzll(us | 1);
+        const int shift = std::max(msb - (LATENCY_SUB_BITS - 1), 0);
+        return (unsigned int)((shift << (LATENCY_SUB_BITS - 1)) + (us >> shift));
+    }
+
+    /** Largest value of a bucket */
+    static uint64_t highest(unsigned int bucket)
+    {
+        const unsigned int half = 1u << (LATENCY_SUB_BITS - 1);
+        if (bucket < 2 * half)
+            return bucket;
+        const unsigned int shift = bucket / half - 1;
+        return ((uint64_t)(bucket - shift * half + 1) << shift) - 1;
+    }
+
+private:
+    void clear(unsigned int w)
+    {
+        for (unsigned int b = 0; b < LATENCY_BUCKETS; b++)
+        {
+            this->counts[w][b].store(0, std::memory_order_relaxed);
+        }
+        this->max[w].store(0, std::memory_order_relaxed);
+    }
+
+    /** Reported as the largest value of its bucket, but never above the largest value seen */
+    static uint64_t percentile(const uint32_t *sum, uint64_t count, double p, uint64_t max)
+    {
+        if (count == 0)
+            return 0;
+        const uint64_t rank = std::max((uint64_t)(p * count + 0.999999), (uint64_t) 1);
+        uint64_t seen = 0;
+        for (unsigned int b = 0; b < LATENCY_BUCKETS; b++)
+        {
+            seen += sum[b];
+            if (seen >= rank)
+                return std::min(highest(b), max);
+        }
+        return max;
+    }
+
+    std::atomic<uint32_t> counts[LATENCY_WINDOWS][LATENCY_BUCKETS];
+    std::atomic<uint64_t> max[LATENCY_WINDOWS];
+    std::atomic<unsigned int> current;
+};
+
+inline std::ostream &operator<<(std::ostream &out, const LatencyStats::Summary &summary)
+{
+    return out << "p50 " << summary.p50 << " p90 " << summary.p90 << " p99 " << summary.p99
+               << " max " << summary.max << " ms (" << summary.count << ")";
+}
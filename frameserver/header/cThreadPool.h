@@ -0,0 +1,135 @@
+/*
+ * Distributed under the OSI-approved Apache License, Version 2.0.  See
+ * accompanying file Copyright.txt for details.
+ */
+#ifndef CTHREADPOOL_H_
+#define CTHREADPOOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * Fixed size pool of worker threads used to split a job into independent tasks.
+ * The calling thread takes part in the work, so a pool of N threads spawns N-1 workers.
+ * run() blocks until every task of the job has finished; only one job runs at a time.
+ */
+class cThreadPool
+{
+public:
+			cThreadPool					( unsigned int numThreads = 0 )
+			{
+				if (numThreads == 0)
+				{
+					numThreads = std::thread::hardware_concurrency();
+				}
+				m_numThreads	= numThreads > 0 ? numThreads : 1;
+				m_task			= 0;
+				m_numTasks		= 0;
+				m_generation	= 0;
+				m_busyWorkers	= 0;
+				m_quit			= false;
+				m_nextTask		= 0;
+
+				for (unsigned int i = 1; i < m_numThreads; i++)
+				{
+					m_workers.push_back(std::thread(&cThreadPool::workerLoop, this));
+				}
+			};
+
+			~cThreadPool				(	)
+			{
+				{
+					std::lock_guard<std::mutex> lock(m_mutex);
+					m_quit = true;
+				}
+				m_wakeCond.notify_all();
+				for (size_t i = 0; i < m_workers.size(); i++)
+				{
+					m_workers[i].join();
+				}
+			};
+
+	unsigned int	size				(	) const { return m_numThreads; };
+
+	// Executes task(i) for every i in [0, numTasks)
+	void	run							( unsigned int numTasks, const std::function<void(unsigned int)> &task )
+	{
+		if (numTasks == 0)
+			return;
+
+		if (m_workers.empty() || numTasks == 1)
+		{
+			for (unsigned int i = 0; i < numTasks; i++)
+				task(i);
+			return;
+		}
+
+		std::lock_guard<std::mutex> jobLock(m_jobMutex);
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_task			= &task;
+			m_numTasks		= numTasks;
+			m_nextTask		= 0;
+			m_busyWorkers	= (unsigned int) m_workers.size();
+			m_generation++;
+		}
+		m_wakeCond.notify_all();
+
+		drain();
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_doneCond.wait(lock, [this] { return m_busyWorkers == 0; });
+		m_task = 0;
+	};
+
+private:
+
+	void	drain						(	)
+	{
+		unsigned int i;
+		while ((i = m_nextTask.fetch_add(1)) < m_numTasks)
+		{
+			(*m_task)(i);
+		}
+	};
+
+	void	workerLoop					(	)
+	{
+		unsigned long long seen = 0;
+		for (;;)
+		{
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_wakeCond.wait(lock, [this, seen] { return m_quit || m_generation != seen; });
+				if (m_quit)
+					return;
+				seen = m_generation;
+			}
+
+			drain();
+
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (--m_busyWorkers == 0)
+			{
+				m_doneCond.notify_one();
+			}
+		}
+	};
+
+	unsigned int								m_numThreads;
+	std::vector<std::thread>					m_workers;
+	std::mutex									m_mutex, m_jobMutex;
+	std::condition_variable						m_wakeCond, m_doneCond;
+	const std::function<void(unsigned int)>		*m_task;
+	unsigned int								m_numTasks;
+	unsigned long long							m_generation;
+	unsigned int								m_busyWorkers;
+	bool										m_quit;
+	std::atomic<unsigned int>					m_nextTask;
+};
+
+#endif /* CTHREADPOOL_H_ */
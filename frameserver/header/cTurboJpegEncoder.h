@@ -5,7 +5,9 @@
 #pragma once
 
 #include <iostream>
+#include <vector>
 #include <turbojpeg.h>
+#include "cProtocol.h"
 
 using namespace std;
 
@@ -52,8 +54,13 @@ public:
 
 		};
 
+		// Again after setImageParams() is fine, the previous handle is released
 		bool	initEncoder ( )
 		{
+			if (compressor)
+			{
+				tjDestroy (compressor);
+			}
 			compressor = tjInitCompress ();
 			if (!compressor)
 			{
@@ -82,6 +89,64 @@ public:
 			return true;
 		};
 
+		// Worst case compressed size, for output buffers owned by the caller
+		unsigned long maxSize		(	)
+		{
+			return tjBufSize(width, height, samplingFactor);
+		};
+
+		// Compresses into dst, which holds at least maxSize() bytes
+		bool encode 				( unsigned char* img, unsigned char* dst, unsigned long &size )
+		{
+			if (width <= 0 || height <= 0 )
+			{
+				std::cerr << "Invalid image size or image parameters not set\n";
+				return false;
+			}
+
+			size = maxSize();
+			if ( tjCompress2 (compressor, img, width, 0, height, colorSpace, &dst, &size, samplingFactor, quality, TJFLAG_FASTDCT | TJFLAG_NOREALLOC) != 0 )
+			{
+				cout << tjGetErrorStr ();
+				return false;
+			}
+			jpegSize = size;
+
+			return true;
+		};
+
+		/*
+		 * Compresses rectangles of the image as separate JPEGs into dst, every one behind its
+		 * patch header (cProtocol). False when one fails or they do not fit in capacity bytes.
+		 */
+		bool encodePatches			( unsigned char* img, const std::vector<sPatchHeader> &patches, unsigned char* dst,
+									  unsigned long capacity, unsigned long &size )
+		{
+			const int pitch = width * tjPixelSize[colorSpace];
+
+			size = 0;
+			for (size_t i = 0; i < patches.size(); i++)
+			{
+				sPatchHeader	patch = patches[i];
+				unsigned long	bytes = tjBufSize(patch.width, patch.height, samplingFactor);
+				unsigned char	*out  = dst + size + PATCH_HEADER_SIZE;
+				if (size + PATCH_HEADER_SIZE + bytes > capacity)
+					return false;
+
+				if ( tjCompress2 (compressor, img + (size_t)patch.y * pitch + patch.x * tjPixelSize[colorSpace], patch.width, pitch,
+								  patch.height, colorSpace, &out, &bytes, samplingFactor, quality, TJFLAG_FASTDCT | TJFLAG_NOREALLOC) != 0 )
+				{
+					cout << tjGetErrorStr ();
+					return false;
+				}
+				patch.size = (uint32_t) bytes;
+				cProtocol::writePatchHeader(patch, dst + size);
+				size += PATCH_HEADER_SIZE + bytes;
+			}
+			jpegSize = size;
+			return true;
+		};
+
 		unsigned char *getImg 		(	)
 		{
 			return  compressedImg;
@@ -9,11 +9,17 @@
 #include <cKeyboardHandler.h>
 #include <cMessageHandler.h>
 
-#include "cPNGEncoder.h"
+#include "cSnapshotWriter.h"
 
 
 #ifdef JPEG_ENCODING
 #include "cTurboJpegEncoder.h"
+#include "cParallelJpegEncoder.h"
+#endif
+
+#ifdef CREDIT_FLOW
+#include <algorithm>
+#include "cEncodeGroup.h"
 #endif
 
 #ifdef NVPIPE_ENCODING
@@ -53,13 +59,27 @@ broadcast_server::broadcast_server() {
 	mouseHandler = 0;
 	keyboardHandler = 0;
 	messageHandler = 0;
+#ifdef SKIP_UNCHANGED
+	m_refresh	= true;
+	m_unchanged	= 0;
+#endif
 
 #ifdef	JPEG_ENCODING
 	targetTime = TIME_RESPONSE;
 	jpegQuality = TJPEG_QUALITY;
 	stTimer1 = high_resolution_clock::now();
 	stTimer2 = stTimer1;
-	jpegEncoder = new cTurboJpegEncoder();
+#ifdef CHANGE_RESOLUTION
+	m_resampler.setup(IMAGE_WIDTH, IMAGE_HEIGHT, IMAGE_WIDTH*RESOLUTION_FACTOR, IMAGE_HEIGHT*RESOLUTION_FACTOR);
+#endif
+#ifdef CREDIT_FLOW
+	// only the encode groups encode
+	jpegEncoder = 0;
+#ifdef PARALLEL_JPEG
+	m_encodePool = new cThreadPool(JPEG_THREADS);
+#endif
+#else
+	jpegEncoder = createJpegEncoder();
 	jpegEncoder->setEncoderParams(jpegQuality);
 	jpegEncoder->setImageParams(IMAGE_WIDTH*RESOLUTION_FACTOR, IMAGE_HEIGHT*RESOLUTION_FACTOR, 4);
 	if (!(jpegEncoder->initEncoder())) {
@@ -70,6 +90,21 @@ broadcast_server::broadcast_server() {
 		std::cout << "Sight@Frameserver: JPEG Encoder initialized\n";
 	}
 #endif
+#endif
+
+#ifdef PIPELINE
+	m_pipelineQuit	= false;
+	m_rawFrames		= new cFrameQueue(PIPELINE_RAW_FRAMES, (size_t)IMAGE_WIDTH * IMAGE_HEIGHT * 3, FRAME_QUEUE_LATEST);
+#ifdef CREDIT_FLOW
+	// every encode group has its own ring
+	m_jpegFrames	= 0;
+	m_sendEvents	= 0;
+#else
+	m_jpegFrames	= new cFrameQueue(PIPELINE_JPEG_FRAMES, FRAME_HEADER_SIZE + jpegEncoder->maxSize(), FRAME_QUEUE_LATEST);
+#endif
+	m_encodeThread	= std::thread(&broadcast_server::encodeLoop, this);
+	m_sendThread	= std::thread(&broadcast_server::sendLoop, this);
+#endif
 
 #ifdef NVPIPE_ENCODING
 	m_nvpipe = new cNvPipeEncoderWrapper ( );
@@ -85,20 +120,10 @@ broadcast_server::broadcast_server() {
 	 }
 #endif
 
-	pngEncoder = new cPNGEncoder ();
-	pngEncoder->setImageParams(IMAGE_WIDTH, IMAGE_HEIGHT);
-	if (!(pngEncoder->initEncoder()))
-	{
-		std::cout << "Warning: PNG Encoder failed at initialization \n";
-	}
-	else
-	{
-		std::cout << "Sight@Frameserver: PNG Encoder initialized\n";
-	}
+	m_snapshots = new cSnapshotWriter (IMAGE_WIDTH, IMAGE_HEIGHT);
+	std::cout << "Sight@Frameserver: PNG snapshot writer initialized\n";
 #ifdef STATS
     m_statsTimer.reset();
-    m_encStats.reset();
-    m_sendStats.reset();
     m_decStats.reset ();
 #endif
 }
@@ -107,24 +132,64 @@ broadcast_server::broadcast_server() {
 //
 broadcast_server::~broadcast_server() {
 	// TODO: stop the server
+#ifdef PIPELINE
+	{
+		std::lock_guard<std::mutex> lock(m_demandMutex);
+		m_pipelineQuit = true;
+	}
+	m_demandCond.notify_all();
+	m_rawFrames->close();
+	if (m_jpegFrames)
+		m_jpegFrames->close();
+	m_encodeThread.join();
+	m_sendThread.join();
+	delete m_rawFrames;
+	delete m_jpegFrames;
+#endif
 #ifdef JPEG_ENCODING
 	delete jpegEncoder;
 	jpegEncoder = 0;
 #endif
+#if defined(CREDIT_FLOW) && defined(PARALLEL_JPEG)
+	// the encoders of the groups run on the pool
+	m_groups.clear();
+	delete m_encodePool;
+	m_encodePool = 0;
+#endif
 
 #ifdef NVPIPE_ENCODING
 	delete m_nvpipe;
 	m_nvpipe = 0;
 #endif
 
-	delete pngEncoder;
-	pngEncoder = 0;
+	// snapshots still queued are written first
+	delete m_snapshots;
+	m_snapshots = 0;
 }
 
 void broadcast_server::on_open(connection_hdl hdl)
 {
 	std::cout << "Sight@Frameserver: Web browser opened.\n";
+#ifdef PIPELINE
+	{
+		// the send thread walks the connections
+		std::lock_guard<std::mutex> lock(m_demandMutex);
+		m_connections.insert(hdl);
+#ifdef CREDIT_FLOW
+		m_sessions[hdl] = cClientSession();
+#ifdef RATE_CONTROL
+		m_sessions[hdl].adaptive = true;
+		m_sessions[hdl].adapt();
+#endif
+#endif
+	}
+#else
 	m_connections.insert(hdl);
+#endif
+	if (m_wakeHandler)
+	{
+		m_wakeHandler();
+	}
 
 #ifdef NVPIPE_ENCODING
 	// Need to reset GPU encoder for new connection
@@ -146,12 +211,33 @@ void broadcast_server::on_open(connection_hdl hdl)
 void broadcast_server::on_close(connection_hdl hdl)
 {
 	// TODO: these should be in messageHandler
-	needMoreFrames = false;
+#ifndef CREDIT_FLOW
 	stop = true;
+#endif
 	// END TODO
 	std::cout << "Sight@Frameserver: Web browser closed\n";
 
+#ifdef PIPELINE
+	{
+		// the send thread takes requests under the same lock
+		std::lock_guard<std::mutex> lock(m_demandMutex);
+		needMoreFrames = false;
+		m_connections.erase(hdl);
+	}
+#else
+	needMoreFrames = false;
 	m_connections.erase(hdl);
+#endif
+#ifdef CREDIT_FLOW
+	{
+		// the other clients keep streaming
+		std::lock_guard<std::mutex> lock(m_demandMutex);
+		m_sessions.erase(hdl);
+		updateStreaming();
+		m_sendEvents++;
+	}
+	m_demandCond.notify_all();
+#endif
 #ifdef NVPIPE_ENCODING
 	m_clientClosed = true;
 #endif
@@ -161,54 +247,82 @@ void broadcast_server::on_close(connection_hdl hdl)
  *
  */
 void broadcast_server::on_message(connection_hdl hdl, server::message_ptr msg) {
-	// TODO: Process Interaction msgs
-	std::stringstream val;
-	int type;
-	//int buttonMask;
-	//int xPosition;
-	//int yPosition;
+	// parsed in place, the payload is not copied
+	const std::string	&payload = msg->get_payload();
+	sControlMessage		ctrl;
 
-	for (auto it : m_connections) {
-		try {
-			val << msg->get_payload();
+	if (!cProtocol::parseControl(payload.data(), payload.size(), ctrl))
+	{
+		return;
+	}
+#ifdef CREDIT_FLOW
+	const bool sessionOnly = sessionMessage(hdl, ctrl);
+#endif
+	// frame requests and acks do not wake a renderer that has nothing new to show
+	if (m_wakeHandler && ctrl.type != CONTROL_NEXT_FRAME && ctrl.type != CONTROL_ACK && ctrl.type != CONTROL_CREDIT)
+	{
+		m_wakeHandler();
+	}
+#ifdef CREDIT_FLOW
+	if (sessionOnly)
+	{
+		return;
+	}
+#endif
 
-			if (!stop) {
-				type = val.str().data()[0];
-				// check what kind of message received.
-				parse(type, &val);
-			}
-			// TODO: put the next code in  MESSAGE_EVENT/messageHandler
-			// These strings come from HTML viewer
-			if (val.str().compare("NXTFR") == 0
-					|| val.str().compare("STVIS") == 0) {
+	switch (ctrl.type)
+	{
+	case CONTROL_MESSAGE:
+	case CONTROL_KEY:
+	case CONTROL_MOUSE:
+		if (!stop) {
+			parse(ctrl);
+		}
+		break;
+	case CONTROL_START:
+	case CONTROL_NEXT_FRAME:
 #ifdef	STATS
-				m_netStats.add(m_netStatsTimer.getElapsedMilliseconds());
+		m_netStats.add(m_netStatsTimer.getElapsedMilliseconds());
 #endif
 
 #ifdef	JPEG_ENCODING
-				stTimer2 = high_resolution_clock::now();
-//				adjustJpegQuality();
+		stTimer2 = high_resolution_clock::now();
+//		adjustJpegQuality();
 #endif
-				needMoreFrames = true;
-				stop = false;
-				//std::cout << "NXTFR" << std::endl;
-			}
-			if (val.str().compare("SAVE ") == 0)
-			{
-				m_saveFrame = true;
-			}
-			if (val.str().compare("END  ") == 0)
-			{
-				stop = true;
-				needMoreFrames = false;
-			}
-			// END TODO
-		} catch (const websocketpp::lib::error_code& e) {
-			std::cout << "Sight@Frameserver: SEND failed because: " << e << "(" << e.message()
-					<< ")" << std::endl;
+#ifndef CREDIT_FLOW
+		stop = false;
+#endif
+#if defined(SKIP_UNCHANGED) && !defined(CREDIT_FLOW)
+		// the client has no frame yet, sessions keep track of it with CREDIT_FLOW
+		if (ctrl.type == CONTROL_START)
+			m_refresh = true;
+#endif
+		requestFrame();
+		break;
+	case CONTROL_SAVE:
+		m_saveFrame = true;
+		break;
+	case CONTROL_STOP:
+#ifndef CREDIT_FLOW
+		stop = true;
+#endif
+#ifdef PIPELINE
+		{
+			std::lock_guard<std::mutex> lock(m_demandMutex);
+			needMoreFrames = false;
 		}
+#else
+		needMoreFrames = false;
+#endif
+		break;
 	}
-
+#ifdef CREDIT_FLOW
+	{
+		// one client stopping does not stop the others
+		std::lock_guard<std::mutex> lock(m_demandMutex);
+		updateStreaming();
+	}
+#endif
 }
 //
 //=======================================================================================
@@ -243,25 +357,25 @@ void broadcast_server::stop_listening( )
 //
 //=======================================================================================
 //
-void broadcast_server::parse(int type, std::stringstream *value) {
-	switch (type) {
-	case MOUSE_EVENT:
+void broadcast_server::parse(const sControlMessage &msg) {
+	switch (msg.type) {
+	case CONTROL_MOUSE:
 		if (mouseHandler) {
-			mouseHandler->parse(value);
+			mouseHandler->parse(msg);
 		} else {
 			std::cout << "Sight@Frameserver: Is Mouse handler initialized? \n";
 		}
 		break;
-	case KEY_EVENT:
+	case CONTROL_KEY:
 		if (keyboardHandler) {
-			keyboardHandler->parse(value);
+			keyboardHandler->parse(msg);
 		} else {
 			std::cout << "Sight@Frameserver: Is keyboard handler initialized? \n";
 		}
 		break;
-	case MESSAGE_EVENT:
+	case CONTROL_MESSAGE:
 		if (messageHandler) {
-			messageHandler->parse(value);
+			messageHandler->parse(msg.data, msg.size);
 			//needMoreFrames	= messageHandler->getFrameFlag 	(	);
 			//stop			= messageHandler->stopStreaming (	);
 		} else {
@@ -321,10 +435,6 @@ void broadcast_server::sendJPEGFrame (unsigned char *rgb)
 	high_resolution_clock::time_point t1 = high_resolution_clock::now();
 #endif
 
-#ifdef CHANGE_RESOLUTION
-	if (!jpegEncoder->encode(halfImg))
-#else
-
 #ifdef STATS
 
 	m_netStatsTimer.reset();
@@ -336,7 +446,6 @@ void broadcast_server::sendJPEGFrame (unsigned char *rgb)
 #endif //STATS
 
     if (!jpegEncoder->encode(rgb))
-#endif // CHANGE RESOLUTION
 	{
 			std::cout << "Sight@Frameserver: Encoding error \n";
 	}
@@ -352,15 +461,14 @@ void broadcast_server::sendJPEGFrame (unsigned char *rgb)
 	std::cout << "JPEG compression: " << duration/1000 << std::endl;
 #endif
 	stTimer1 = high_resolution_clock::now();
+	server::message_ptr frame = m_messages.frame(jpegEncoder->compressedImg, (size_t) jpegEncoder->getJpegSize());
 	for (auto it : m_connections) {
 		try {
 
 #ifdef STATS
 			m_sendTimer.reset();
 #endif
-			m_server.send(it, jpegEncoder->compressedImg,
-					(size_t) jpegEncoder->getJpegSize(),
-					websocketpp::frame::opcode::BINARY);
+			m_server.send(it, frame);
 #ifdef STATS
 			m_sendStats.add (m_sendTimer.getElapsedMilliseconds());
 #endif
@@ -381,13 +489,442 @@ void broadcast_server::sendJPEGFrame (unsigned char *rgb)
 //
 //=======================================================================================
 //
+void broadcast_server::requestFrame()
+{
+#ifdef PIPELINE
+	{
+		std::lock_guard<std::mutex> lock(m_demandMutex);
+		needMoreFrames = true;
+	}
+	m_demandCond.notify_one();
+#else
+	needMoreFrames = true;
+#endif
+}
+//
+//=======================================================================================
+//
+#ifdef PIPELINE
+#ifdef CREDIT_FLOW
+// Encodes the newest rendered frame once per distinct settings of the streaming sessions. Every
+// group gets every frame, a client behind its window still receives the last one rendered.
+void broadcast_server::encodeLoop()
+{
+	std::vector<sEncodeSettings>								settings;
+	std::vector<std::pair<sEncodeSettings, int64_t>>			shown;
+	std::vector<std::shared_ptr<cEncodeGroup<jpeg_encoder>>>	groups, previous;
+	int raw;
+	while ((raw = m_rawFrames->consume()) >= 0)
+	{
+		settings.clear();
+		shown.clear();
+		{
+			std::lock_guard<std::mutex> lock(m_demandMutex);
+			for (auto &session : m_sessions)
+			{
+				const cClientSession &s = session.second;
+				if (!s.streaming)
+					continue;
+				settings.push_back(s.settings);
+				// the frame of its group the client shows, -1 for none
+				shown.push_back(std::make_pair(s.settings, s.hasImage && s.imageSettings == s.settings ? (int64_t) s.imageFrame : -1));
+			}
+			previous = m_groups;
+		}
+		std::sort(settings.begin(), settings.end());
+		settings.erase(std::unique(settings.begin(), settings.end()), settings.end());
+
+		// groups nobody uses any more are dropped, encoders are only created for new settings
+		groups.clear();
+		for (size_t i = 0; i < settings.size(); i++)
+		{
+			auto group = std::find_if(previous.begin(), previous.end(),
+					[&](const std::shared_ptr<cEncodeGroup<jpeg_encoder>> &g) { return g->settings() == settings[i]; });
+			if (group != previous.end())
+			{
+				groups.push_back(*group);
+				continue;
+			}
+			groups.push_back(std::make_shared<cEncodeGroup<jpeg_encoder>>(settings[i],
+					IMAGE_WIDTH*RESOLUTION_FACTOR, IMAGE_HEIGHT*RESOLUTION_FACTOR, createJpegEncoder()));
+#ifdef DIRTY_TILES
+			groups.back()->enablePatches(true);
+#endif
+		}
+
+		const cFrameHash	*hash		= 0;
+		size_t				encoded		= 0;
+#ifdef SKIP_UNCHANGED
+		// hashed once for all groups, a group whose client has the same image skips the encode
+		if (!groups.empty())
+		{
+			m_frameHash.compute(m_rawFrames->data(raw), m_rawFrames->width(raw), m_rawFrames->height(raw));
+			hash = &m_frameHash;
+		}
+#endif
+		for (size_t i = 0; i < groups.size(); i++)
+		{
+			// oldest frame the clients of the group show, patches since then bring all of them up to date
+			int64_t base = INT64_MAX;
+			for (size_t s = 0; s < shown.size(); s++)
+			{
+				if (shown[s].first == groups[i]->settings())
+					base = std::min(base, shown[s].second);
+			}
+#ifdef SKIP_UNCHANGED
+			// a client without an image gets one, even when it did not change
+			if (base >= 0 && !groups[i]->changed(m_frameHash))
+				continue;
+#endif
+#ifndef DIRTY_TILES
+			base = -1;
+#endif
+			if (!groups[i]->encode(m_rawFrames->data(raw), m_rawFrames->width(raw), m_rawFrames->height(raw),
+					(uint32_t) m_rawFrames->sequence(raw), m_rawFrames->publishedAt(raw), hash, base))
+			{
+				std::cout << "Sight@Frameserver: Encoding error \n";
+			}
+			encoded++;
+#ifdef STATS
+			m_encStats.add(groups[i]->encodeMs());
+#endif
+		}
+		m_rawFrames->release(raw);
+#ifdef SKIP_UNCHANGED
+		if (encoded == 0 && !groups.empty())
+			m_unchanged++;
+#endif
+
+		{
+			std::lock_guard<std::mutex> lock(m_demandMutex);
+			m_groups = groups;
+			m_sendEvents++;
+		}
+		m_demandCond.notify_all();
+	}
+}
+//
+//=======================================================================================
+//
+// Sends the newest frame of every encode group to the sessions of the group with an open window.
+// Frames nobody can take yet stay in the group's ring until a newer one replaces them.
+void broadcast_server::sendLoop()
+{
+	std::vector<std::shared_ptr<cEncodeGroup<jpeg_encoder>>>	groups;
+	std::vector<connection_hdl>									targets;
+	uint64_t													events = 0;
+	bool														wake;
+
+	for (;;)
+	{
+		{
+			// socket buffers drain without an event, so the windows are polled while streaming
+			std::unique_lock<std::mutex> lock(m_demandMutex);
+			auto woken = [&] { return m_pipelineQuit || m_sendEvents != events; };
+			if (stop)
+				m_demandCond.wait(lock, woken);
+			else
+				m_demandCond.wait_for(lock, std::chrono::milliseconds(FLOW_POLL_MS), woken);
+			if (m_pipelineQuit)
+				return;
+			events = m_sendEvents;
+			groups = m_groups;
+			wake = false;
+		}
+
+		for (size_t g = 0; g < groups.size(); g++)
+		{
+			cFrameQueue		*frames = groups[g]->frames();
+			int				jpeg = -1;
+			size_t			size = 0;
+			sFrameHeader	header;
+			{
+				std::lock_guard<std::mutex> lock(m_demandMutex);
+				targets.clear();
+				for (auto &session : m_sessions)
+				{
+					if (session.second.streaming && session.second.settings == groups[g]->settings() &&
+						session.second.flow.canSend(bufferedAmount(session.first)))
+					{
+						targets.push_back(session.first);
+					}
+				}
+				if (targets.empty() || (jpeg = frames->tryConsume()) < 0)
+					continue;
+
+				size = frames->size(jpeg);
+				if (!cProtocol::readFrameHeader(frames->data(jpeg), size, header))
+				{
+					frames->release(jpeg);
+					continue;
+				}
+				const bool patches = (header.flags & FRAME_FLAG_PATCHES) != 0;
+				if (patches)
+				{
+					// clients that joined the group after the patches were made wait for a whole frame
+					const uint32_t base = cProtocol::readPatchBase(frames->data(jpeg) + FRAME_HEADER_SIZE);
+					const size_t count = targets.size();
+					targets.erase(std::remove_if(targets.begin(), targets.end(), [&](const connection_hdl &hdl)
+						{ return !m_sessions[hdl].shows(groups[g]->settings(), base); }), targets.end());
+					if (targets.size() < count)
+					{
+						groups[g]->refresh();
+						wake = true;
+					}
+				}
+				// patches and frames rendered at a lower resolution while the view moves do not
+				// tell the rate control the size of the whole frames of its level
+				const double share = patches ? 0.0 : (double) header.width * header.height /
+												   ((double) groups[g]->width() * groups[g]->height());
+				for (size_t i = 0; i < targets.size(); i++)
+				{
+					cClientSession &session = m_sessions[targets[i]];
+					session.flow.sent(header.frameId, size, header.renderTime, share);
+					session.sent(groups[g]->settings(), header.frameId, patches);
+					session.framesSent++;
+					session.bytesSent += size;
+				}
+			}
+
+#ifdef STATS
+			// round trip of stop-and-wait clients, acks report it per session
+			m_netStatsTimer.reset();
+#endif
+			stTimer1 = high_resolution_clock::now();
+			// the slot is free for the encoder again once the frame is in its message
+			server::message_ptr frame = m_messages.frame(frames->data(jpeg), size);
+			frames->release(jpeg);
+			for (size_t i = 0; i < targets.size(); i++)
+			{
+				try
+				{
+#ifdef STATS
+					m_sendTimer.reset();
+#endif
+					m_server.send(targets[i], frame);
+#ifdef STATS
+					m_sendStats.add (m_sendTimer.getElapsedMilliseconds());
+#endif
+				}
+				catch (const websocketpp::lib::error_code& e)
+				{
+					std::cout << "Sight@Frameserver: SEND failed because: " << e << "(" << e.message()
+							<< ")" << std::endl;
+				}
+			}
+		}
+		// a converged renderer renders the whole frame they wait for
+		if (wake && m_wakeHandler)
+		{
+			m_wakeHandler();
+		}
+	}
+}
+//
+//=======================================================================================
+//
+// Session only messages (credits, acks, quality and resolution) return true, stream requests
+// update the session and go on to on_message.
+bool broadcast_server::sessionMessage(connection_hdl hdl, const sControlMessage &msg)
+{
+	bool sessionOnly, changed = false;
+	{
+		std::lock_guard<std::mutex> lock(m_demandMutex);
+		auto session = m_sessions.find(hdl);
+		if (session == m_sessions.end())
+			return false;
+
+		sEncodeSettings settings	= session->second.settings;
+		const bool		streaming	= session->second.streaming;
+		sessionOnly	= session->second.control(msg);
+		changed		= !(settings == session->second.settings);
+		if (!streaming && session->second.streaming)
+		{
+			// a client that starts streaming has no image yet, the renderer may have converged
+			changed = true;
+		}
+
+		// the rate control of every client hurries while the view moves
+		if ((msg.type == CONTROL_MOUSE && msg.buttons) || msg.type == CONTROL_KEY)
+		{
+			for (auto &other : m_sessions)
+			{
+				settings = other.second.settings;
+				other.second.interaction();
+				changed = changed || !(settings == other.second.settings);
+			}
+		}
+		updateStreaming();
+		m_sendEvents++;
+	}
+	m_demandCond.notify_all();
+	// a converged image is encoded again at the new settings, or for the new client
+	if (changed && m_wakeHandler)
+	{
+		m_wakeHandler();
+	}
+	return sessionOnly;
+}
+//
+//=======================================================================================
+//
+// The renderer streams while any session does. Called with m_demandMutex held.
+void broadcast_server::updateStreaming()
+{
+	bool streaming = false;
+	for (auto &session : m_sessions)
+	{
+		streaming = streaming || session.second.streaming;
+	}
+	stop = !streaming;
+}
+//
+//=======================================================================================
+//
+size_t broadcast_server::bufferedAmount(connection_hdl hdl)
+{
+	websocketpp::lib::error_code	ec;
+	server::connection_ptr			con = m_server.get_con_from_hdl(hdl, ec);
+	// closing connection, nothing more is sent to it
+	return ec ? SIZE_MAX : con->get_buffered_amount();
+}
+#else
+// Encodes the newest rendered frame while the previous one is being sent
+void broadcast_server::encodeLoop()
+{
+	int raw;
+	while ((raw = m_rawFrames->consume()) >= 0)
+	{
+#ifdef SKIP_UNCHANGED
+		// the client keeps its frame, it gets the next one that differs
+		m_frameHash.compute(m_rawFrames->data(raw), m_rawFrames->width(raw), m_rawFrames->height(raw));
+		if (!m_refresh.exchange(false) && m_frameHash == m_encodedHash)
+		{
+			m_unchanged++;
+			m_rawFrames->release(raw);
+			continue;
+		}
+#endif
+		int jpeg = m_jpegFrames->acquire();
+		if (jpeg < 0)
+		{
+			m_rawFrames->release(raw);
+			break;
+		}
+
+		unsigned long	size = 0;
+		sFrameHeader	header;
+		cTimer			encTimer;
+		unsigned char *rgb = m_rawFrames->data(raw);
+#ifdef CHANGE_RESOLUTION
+		rgb = m_resampler.resample(rgb);
+#endif
+		if (!jpegEncoder->encode(rgb, m_jpegFrames->data(jpeg) + FRAME_HEADER_SIZE, size))
+		{
+			std::cout << "Sight@Frameserver: Encoding error \n";
+			size = 0;
+		}
+#ifdef SKIP_UNCHANGED
+		if (size > 0)
+			m_encodedHash = m_frameHash;
+		else
+			m_encodedHash.clear();
+#endif
+		header.codec		= CODEC_JPEG;
+		header.flags		= 0;
+		header.frameId		= (uint32_t) m_rawFrames->sequence(raw);
+		header.renderTime	= m_rawFrames->publishedAt(raw);
+		header.encodeTime	= (uint32_t)(encTimer.getElapsedMilliseconds() * 1000.0);
+		header.width		= (uint16_t)(IMAGE_WIDTH*RESOLUTION_FACTOR);
+		header.height		= (uint16_t)(IMAGE_HEIGHT*RESOLUTION_FACTOR);
+		cProtocol::writeFrameHeader(header, m_jpegFrames->data(jpeg));
+#ifdef STATS
+		m_encStats.add(header.encodeTime * 0.001f);
+#endif
+		m_rawFrames->release(raw);
+		m_jpegFrames->setSize(jpeg, size > 0 ? FRAME_HEADER_SIZE + size : 0);
+		m_jpegFrames->publish(jpeg);
+	}
+}
+//
+//=======================================================================================
+//
+// Sends one encoded frame per client request, the newest one. While the client is behind, the
+// encoder replaces the frames it has not asked for yet, a lagging client never gets stale ones.
+void broadcast_server::sendLoop()
+{
+	std::vector<connection_hdl> targets;
+
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_demandMutex);
+			m_demandCond.wait(lock, [this] { return needMoreFrames || m_pipelineQuit; });
+			if (m_pipelineQuit)
+				return;
+			// the request is taken here, one arriving while this frame is sent asks for the next
+			needMoreFrames = false;
+		}
+
+		int jpeg = m_jpegFrames->consume();
+		if (jpeg < 0)
+			return;
+
+		if (m_jpegFrames->size(jpeg) > 0)
+		{
+#ifdef STATS
+			m_netStatsTimer.reset();
+#endif
+			stTimer1 = high_resolution_clock::now();
+			server::message_ptr frame = m_messages.frame(m_jpegFrames->data(jpeg), m_jpegFrames->size(jpeg));
+			{
+				// the websocket thread adds and removes connections meanwhile
+				std::lock_guard<std::mutex> lock(m_demandMutex);
+				targets.assign(m_connections.begin(), m_connections.end());
+			}
+			for (auto it : targets)
+			{
+				try
+				{
+#ifdef STATS
+					m_sendTimer.reset();
+#endif
+					m_server.send(it, frame);
+#ifdef STATS
+					m_sendStats.add (m_sendTimer.getElapsedMilliseconds());
+#endif
+				}
+				catch (const websocketpp::lib::error_code& e)
+				{
+					std::cout << "Sight@Frameserver: SEND failed because: " << e << "(" << e.message()
+							<< ")" << std::endl;
+				}
+			}
+		}
+		m_jpegFrames->release(jpeg);
+	}
+}
+#endif // CREDIT_FLOW
+#endif // PIPELINE
+//
+//=======================================================================================
+//
 void broadcast_server::sendFrame(unsigned char *img)
 {
+#ifdef SKIP_UNCHANGED
+	// the request stays open until a frame differs
+	m_frameHash.compute(img, IMAGE_WIDTH, IMAGE_HEIGHT);
+	if (!m_refresh.exchange(false) && m_frameHash == m_encodedHash)
+	{
+		m_unchanged++;
+		return;
+	}
+	m_encodedHash = m_frameHash;
+#endif
+
 #ifdef CHANGE_RESOLUTION
-	static unsigned int half_w = IMAGE_WIDTH*RESOLUTION_FACTOR;
-	static unsigned int half_h = IMAGE_HEIGHT*RESOLUTION_FACTOR;
-	unsigned char *halfImg = new unsigned char [half_w * half_h * 3 ];
-	scale ( img, halfImg, RESOLUTION_FACTOR );
+	// into the resampler's buffer, once for all clients
+	img = m_resampler.resample(img);
 #endif
 
 #ifdef JPEG_ENCODING
@@ -397,18 +934,19 @@ void broadcast_server::sendFrame(unsigned char *img)
 	sendNvPipeFrame (img);
 #endif
 #ifdef NO_COMPRESSION
+#ifdef CHANGE_RESOLUTION
+	server::message_ptr frame = m_messages.frame(img, (size_t)m_resampler.width()*m_resampler.height()*3);
+#else
+	// when img is unsigned char
+	server::message_ptr frame = m_messages.frame(img, (size_t)IMAGE_WIDTH*IMAGE_HEIGHT*3);
+#endif
 	con_list::iterator it;
 	for (it = m_connections.begin(); it != m_connections.end(); it++)
 	{
 		try
 		{
-#ifdef CHANGE_RESOLUTION
-			m_server.send(*it, halfImg, (size_t)((IMAGE_WIDTH/2)*(IMAGE_HEIGHT/2)*3) , websocketpp::frame::opcode::BINARY);
-#else
-			// when img is unsigned char
-			m_server.send(*it, img, (size_t)IMAGE_WIDTH*IMAGE_HEIGHT*3 , websocketpp::frame::opcode::BINARY);
+			m_server.send(*it, frame);
 			//m_server.send(it, "END  ", websocketpp::frame::opcode::text);
-#endif
 			needMoreFrames = false;
 		}
 		catch (const websocketpp::lib::error_code& e)
@@ -418,10 +956,6 @@ void broadcast_server::sendFrame(unsigned char *img)
 		}
 	}
 #endif
-
-#ifdef CHANGE_RESOLUTION
-	delete [] halfImg;
-#endif
 }
 
 #ifdef NVPIPE_ENCODING
@@ -438,6 +972,7 @@ void broadcast_server::sendNvPipeFrame (unsigned char *rgba)
 	m_encStats.add (m_encTimer.getElapsedMilliseconds());
 #endif
 	//std::cout << "Sight@Frameserver: NvPipe compressed size " << m_nvpipe->getSize() << std::endl;
+	server::message_ptr frame = m_messages.frame(m_nvpipe->getImg(), (size_t) m_nvpipe->getSize());
 	for (auto it : m_connections)
 	{
 		try
@@ -445,9 +980,7 @@ void broadcast_server::sendNvPipeFrame (unsigned char *rgba)
 #ifdef STATS
 			m_sendTimer.reset ();
 #endif
-			m_server.send(it, m_nvpipe->getImg(),
-					(size_t) m_nvpipe->getSize(),
-					websocketpp::frame::opcode::BINARY);
+			m_server.send(it, frame);
 #ifdef STATS
 			m_sendStats.add(m_sendTimer.getElapsedMilliseconds());
 #endif
@@ -483,6 +1016,7 @@ void broadcast_server::sendNvPipeFrame (void *rgbaDevice)
 	m_encStats.add (m_encTimer.getElapsedMilliseconds());
 #endif
 	//std::cout << "Sight@Frameserver: NvPipe compressed size " << m_nvpipe->getSize() << std::endl;
+	server::message_ptr frame = m_messages.frame(m_nvpipe->getImg(), (size_t) m_nvpipe->getSize());
 	for (auto it : m_connections)
 	{
 		try
@@ -490,9 +1024,7 @@ void broadcast_server::sendNvPipeFrame (void *rgbaDevice)
 #ifdef STATS
 			m_sendTimer.reset ();
 #endif
-			m_server.send(it, m_nvpipe->getImg(),
-					(size_t) m_nvpipe->getSize(),
-					websocketpp::frame::opcode::BINARY);
+			m_server.send(it, frame);
 			needMoreFrames = false;
 #ifdef STATS
 			m_sendStats.add(m_sendTimer.getElapsedMilliseconds());
@@ -510,14 +1042,6 @@ void broadcast_server::sendNvPipeFrame (void *rgbaDevice)
 //
 void broadcast_server::sendFrame(void *gpuFrameBufferPtr)
 {
-#ifdef CHANGE_RESOLUTION
-	static unsigned int half_w = IMAGE_WIDTH*RESOLUTION_FACTOR;
-	static unsigned int half_h = IMAGE_HEIGHT*RESOLUTION_FACTOR;
-	unsigned char *halfImg = new unsigned char [half_w * half_h * 3 ];
-	scale ( img, halfImg, RESOLUTION_FACTOR );
-#endif
-
-
 	if (gpuFrameBufferPtr)
 	{
 		sendNvPipeFrame (gpuFrameBufferPtr);
@@ -527,10 +1051,6 @@ void broadcast_server::sendFrame(void *gpuFrameBufferPtr)
 		std::cout << "Optix Frame Buffer not shared with CUDA for encoding\n";
 		return;
 	}
-
-#ifdef CHANGE_RESOLUTION
-	delete [] halfImg;
-#endif
 }
 #endif
 //
@@ -555,6 +1075,19 @@ void broadcast_server::setMessageHandler(cMessageHandler *messageH) {
 //=======================================================================================
 //
 #ifdef JPEG_ENCODING
+jpeg_encoder* broadcast_server::createJpegEncoder()
+{
+#if defined(PARALLEL_JPEG) && defined(CREDIT_FLOW)
+	return new cParallelJpegEncoder(*m_encodePool);
+#elif defined(PARALLEL_JPEG)
+	return new cParallelJpegEncoder(JPEG_THREADS);
+#else
+	return new cTurboJpegEncoder();
+#endif
+}
+//
+//=======================================================================================
+//
 void broadcast_server::adjustJpegQuality() {
 	stDuration = std::chrono::duration_cast < std::chrono::microseconds
 			> (stTimer2 - stTimer1);
@@ -579,80 +1112,6 @@ void broadcast_server::adjustJpegQuality() {
 //
 //=======================================================================================
 //
-#ifdef CHANGE_RESOLUTION
-void broadcast_server::scale ( unsigned char *in, unsigned char *out, float factor )
-{
-	unsigned int half_w = IMAGE_WIDTH*factor;
-	unsigned int half_h = IMAGE_HEIGHT*factor;
-
-/*
-#pragma omp parallel sections num_threads(2) // starts a new team
-	{
-#pragma omp section
-		for (unsigned int j=0; j<half_h ; j++)
-		{
-			for (unsigned int i=0;i< half_w/2; i++)
-			{
-				unsigned int halfIdx	= (half_w * 3) * j + i*3;
-				unsigned int idx		= ( j / factor ) * (IMAGE_WIDTH *3) + (i / factor ) * 3;
-
-				out[halfIdx  ] = in[idx  ];
-				out[halfIdx+1] = in[idx+1];
-				out[halfIdx+2] = in[idx+2];
-			}
-		}
-
-#pragma omp section
-		for (unsigned int j=0; j<half_h ; j++)
-		{
-			for (unsigned int i=half_h/2;i< half_w; i++)
-			{
-				unsigned int halfIdx	= (half_w * 3) * j + i*3;
-				unsigned int idx		= ( j / factor ) * (IMAGE_WIDTH *3) + (i / factor ) * 3;
-
-				out[halfIdx  ] = in[idx  ];
-				out[halfIdx+1] = in[idx+1];
-				out[halfIdx+2] = in[idx+2];
-			}
-		}
-	}
-	*/
-/*
-#pragma omp parallel for num_threads (2)
-	for (unsigned int i=0; i<half_w * half_h; i++)
-	{
-		unsigned int x = i%half_w;
-		unsigned int y = i/half_w;
-
-		unsigned int halfIdx	= (half_w * 3) * y + x*3;
-		unsigned int idx 		= ( y / factor ) * (IMAGE_WIDTH *3) + (x / factor ) * 3;
-
-		out[halfIdx  ] = in[idx  ];
-		out[halfIdx+1] = in[idx+1];
-		out[halfIdx+2] = in[idx+2];
-
-	}
-*/
-
-//#pragma omp parallel for collapse (2)
-	for (unsigned int j=0; j<half_h ; j++)
-	{
-		for (unsigned int i=0;i< half_w; i++)
-		{
-			unsigned int halfIdx	= (half_w * 3) * j + i*3;
-            unsigned int idx		= ( j / factor ) * (IMAGE_WIDTH *3) + (i / factor ) * 3;
-
-            out[halfIdx  ] = in[idx  ];
-			out[halfIdx+1] = in[idx+1];
-			out[halfIdx+2] = in[idx+2];
-		}
-	}
-
-}
-#endif
-//
-//=======================================================================================
-//
 void broadcast_server::save(unsigned char *img)
 {
 	char date[128];
@@ -663,8 +1122,11 @@ void broadcast_server::save(unsigned char *img)
 	strftime (date,sizeof(date),"%Y-%m-%d_%OH_%OM_%OS",timeinfo);
 	std::stringstream filename;
 	filename << "Sight_" << date << ".png";
-	pngEncoder->savePNG(filename.str(), img);
-	std::cout << "Sight@Frameserver: " << filename.str().data() << " saved!\n";
+	// returns once the frame is copied, the writer reports the file
+	if (!m_snapshots->save(filename.str(), img))
+	{
+		std::cout << "Sight@Frameserver: " << filename.str().data() << " dropped, " << SNAPSHOT_QUEUE_FRAMES << " snapshots are being written\n";
+	}
 	m_saveFrame = false;
 }
 //
@@ -679,10 +1141,64 @@ void broadcast_server::printStats()
     {
         m_statsTimer.reset();
 #ifdef REMOTE_GPU_ENCODING
-        std::cout << "Sight@Frameserver network: " << m_netStats.getAverage(updateMillis) << " " << m_sendStats.getAverage(updateMillis) << " " << m_encStats.getAverage(updateMillis) << " ms" << "size: " << m_nvpipe->getSize() << "bytes" <<  std::endl;
+        std::cout << "Sight@Frameserver network: size: " << m_nvpipe->getSize() << "bytes" <<  std::endl;
 #endif
 #ifdef REMOTE
-        std::cout << "Sight@Frameserver network: " << m_netStats.getAverage(updateMillis) << " " << m_sendStats.getAverage(updateMillis) << " " << m_encStats.getAverage(updateMillis) << " ms" << "size: " << jpegEncoder->getJpegSize() << "bytes" <<  std::endl;
+#ifdef CREDIT_FLOW
+        // the last frame of every encode group, 0 for a group that skipped it
+        size_t encodedBytes = 0, numGroups = 0;
+        {
+            std::lock_guard<std::mutex> lock(m_demandMutex);
+            numGroups = m_groups.size();
+            for (auto &group : m_groups)
+                encodedBytes += group->encodedBytes();
+        }
+        std::cout << "Sight@Frameserver network: size: " << encodedBytes << "bytes in " << numGroups << " encodes"
+#else
+        std::cout << "Sight@Frameserver network: size: " << jpegEncoder->getJpegSize() << "bytes"
+#endif
+#ifdef PIPELINE
+                  << " dropped: " << m_rawFrames->dropped() << " frames"
+#endif
+#ifdef SKIP_UNCHANGED
+                  << " unchanged: " << m_unchanged << " frames"
+#endif
+                  << " messages: " << m_messages.allocated() << " allocated"
+                  <<  std::endl;
+#endif
+#if defined(REMOTE) || defined(REMOTE_GPU_ENCODING)
+        // the last second and the last LATENCY_WINDOWS - 1 seconds
+        m_encStats.rotate();
+        m_sendStats.rotate();
+        m_netStats.rotate();
+        std::cout << "Sight@Frameserver encode: " << m_encStats.getSummary(1) << " " << LATENCY_WINDOWS - 1 << " s: " << m_encStats.getSummary(LATENCY_WINDOWS - 1) << std::endl;
+        std::cout << "Sight@Frameserver send: " << m_sendStats.getSummary(1) << " " << LATENCY_WINDOWS - 1 << " s: " << m_sendStats.getSummary(LATENCY_WINDOWS - 1) << std::endl;
+        std::cout << "Sight@Frameserver rtt: " << m_netStats.getSummary(1) << " " << LATENCY_WINDOWS - 1 << " s: " << m_netStats.getSummary(LATENCY_WINDOWS - 1) << std::endl;
+#endif
+        const size_t snapshots = m_snapshots->maxDepth();
+        if (snapshots > 0)
+        {
+            std::cout << "Sight@Frameserver snapshots: queue " << snapshots << " written: " << m_snapshots->written()
+                      << " dropped: " << m_snapshots->dropped() << " failed: " << m_snapshots->failed()
+                      << " latency: " << m_snapshots->latencyMs(updateMillis) << " ms write: " << m_snapshots->writeMs(updateMillis) << " ms" << std::endl;
+        }
+#ifdef CREDIT_FLOW
+        std::lock_guard<std::mutex> lock(m_demandMutex);
+        for (auto &it : m_sessions)
+        {
+            cClientSession &session = it.second;
+            session.netStats.rotate();
+            session.latencyStats.rotate();
+            if (!session.streaming)
+                continue;
+            std::cout << "Sight@Frameserver session: quality " << session.settings.quality << (session.settings.subsampling == TJSAMP_444 ? " 4:4:4" : " 4:2:0")
+                      << " scale " << session.settings.scale << "%"
+                      << " rtt: " << session.netStats.getSummary(1) << " latency: " << session.latencyStats.getSummary(1)
+                      << " window: " << session.flow.window() << " sent: " << session.framesSent << " frames " << session.bytesSent << " bytes";
+            if (session.adaptive)
+                std::cout << " capacity: " << session.rate.capacity() << " MB/s";
+            std::cout << std::endl;
+        }
 #endif
     }
 }
@@ -0,0 +1,15 @@
+/*
+ * Distributed under the OSI-approved Apache License, Version 2.0.  See
+ * accompanying file Copyright.txt for details.
+ */
+
+#ifndef BENCHMARKS_H_
+#define BENCHMARKS_H_
+
+/*
+ * CPU side benchmarks, run with: sight -bench name [args]
+ * argv[0] is the benchmark name. Returns the process exit code.
+ */
+int		runBenchmark	( int argc, char **argv );
+
+#endif /* BENCHMARKS_H_ */
@@ -0,0 +1,57 @@
+/*
+ * Distributed under the OSI-approved Apache License, Version 2.0.  See
+ * accompanying file Copyright.txt for details.
+ */
+
+#ifndef CALIGNEDALLOCATOR_H_
+#define CALIGNEDALLOCATOR_H_
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <new>
+
+/*
+ * std::vector allocator returning Alignment byte aligned storage, e.g. to start node arrays
+ * on a cache line. The default allocator only guarantees 16 bytes before C++17.
+ */
+template <class T, size_t Alignment>
+class cAlignedAllocator
+{
+public:
+	typedef T	value_type;
+
+	template <class U>
+	struct rebind
+	{
+		typedef cAlignedAllocator<U, Alignment> other;
+	};
+
+				cAlignedAllocator	(	)	{ };
+	template <class U>
+				cAlignedAllocator	( const cAlignedAllocator<U, Alignment> & )	{ };
+
+	T*			allocate			( size_t n )
+	{
+		void *p = 0;
+		if (n == 0)
+			return 0;
+		if (posix_memalign(&p, Alignment, n * sizeof(T)) != 0)
+			throw std::bad_alloc();
+		return (T*) p;
+	};
+	void		deallocate			( T *p, size_t )	{ free(p); };
+};
+
+template <class T, class U, size_t Alignment>
+bool operator == (const cAlignedAllocator<T, Alignment> &, const cAlignedAllocator<U, Alignment> &)
+{
+	return true;
+}
+
+template <class T, class U, size_t Alignment>
+bool operator != (const cAlignedAllocator<T, Alignment> &, const cAlignedAllocator<U, Alignment> &)
+{
+	return false;
+}
+
+#endif /* CALIGNEDALLOCATOR_H_ */
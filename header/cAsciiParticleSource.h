@@ -0,0 +1,52 @@
+/*
+ * Distributed under the OSI-approved Apache License, Version 2.0.  See
+ * accompanying file Copyright.txt for details.
+ */
+
+#ifndef CASCIIPARTICLESOURCE_H_
+#define CASCIIPARTICLESOURCE_H_
+
+#include <string>
+#include <vector>
+#include "cParticleSource.h"
+
+// Size of the read buffer. Host memory used by the source does not depend on the file size.
+#define ASCII_SOURCE_BUFFER_SIZE	(16 << 20)
+
+/*
+ * Streams a space separated particle file (same format and decimation as loadAscii)
+ * through a fixed size buffer. open() makes a first pass over the file to count the
+ * particles and compute their bounds.
+ */
+class cAsciiParticleSource : public cParticleSource
+{
+public:
+							cAsciiParticleSource	(	);
+							~cAsciiParticleSource	(	);
+
+	bool					open					( const std::string &filename, unsigned int decimation );
+	void					close					(	);
+
+	uint64_t				numParticles			(	) const	{ return m_numParticles; };
+	const float*			min						(	) const	{ return m_min; };
+	const float*			max						(	) const	{ return m_max; };
+
+	size_t					read					( float *dst, size_t maxParticles );
+	bool					rewind					(	);
+
+private:
+	bool					nextLine				( const char *&line, const char *&lineEnd );
+	bool					fillBuffer				(	);
+	static void				parseRecord				( const char *line, const char *lineEnd, float *dst );
+
+	int						m_fd;
+	unsigned int			m_decimation;
+	std::vector<char>		m_buffer;
+	size_t					m_begin, m_end;
+	bool					m_eof;
+	uint64_t				m_record;
+	uint64_t				m_numParticles;
+	float					m_min[4], m_max[4];
+};
+
+#endif /* CASCIIPARTICLESOURCE_H_ */
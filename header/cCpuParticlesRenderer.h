@@ -0,0 +1,92 @@
+/*
+ * Distributed under the OSI-approved Apache License, Version 2.0.  See
+ * accompanying file Copyright.txt for details.
+ */
+
+#ifndef CCPUPARTICLESRENDERER_H_
+#define CCPUPARTICLESRENDERER_H_
+
+#include <stdint.h>
+#include <vector>
+#include "../frameserver/header/cThreadPool.h"
+#include "cParticlesRenderer.h"
+#include "cSphereBVH.h"
+#include "cWideBVH.h"
+#include "vecmath.h"
+
+// Pixels per side of the tiles handed to the worker threads
+#define CPU_TILE_SIZE		32
+#define CPU_NUM_COLORS		128
+
+struct sCpuLight
+{
+	sVec3	pos;
+	sVec3	color;
+	bool	castsShadow;
+};
+
+/*
+ * Multithreaded CPU reference of cOptixParticlesRenderer. It reproduces pinhole_camera
+ * (jittered, accumulated samples), robust_intersect and closest_hit_radiance_AO_phong with the
+ * same scene constants, so server, encoding and loading can be tested without a GPU.
+ */
+class cCpuParticlesRenderer : public cParticlesRenderer
+{
+public:
+						cCpuParticlesRenderer		(	);
+						~cCpuParticlesRenderer		(	);
+
+	void				init						( int width, int height, cParticleSource *source );
+	void				display						( unsigned char *pixels	);
+	void				getPixels					( unsigned char *img	);
+	void				setMouseHandler				( cMouseHandler *mouseH );
+	void				setKeyboardHandler 			( cKeyboardHandler *keyHandler );
+	unsigned int		accumulatedFrames			(	) { return m_frameAccum; };
+	void				setRenderScale				( unsigned int percent );
+	int					renderWidth					(	) { return m_renderWidth; };
+	int					renderHeight				(	) { return m_renderHeight; };
+	bool				renderRegion				( int posterWidth, int posterHeight, int x, int y, int width, int height,
+													  unsigned int samples, unsigned char *img );
+	void				setCamera					( const float *eye, const float *lookAt, const float *up, float fov );
+	void				getCamera					( float *eye, float *lookAt, float *up, float &fov );
+
+private:
+	void				updateView					(	);
+	void				updateCamera				(	);
+	void				resetAccumulation			(	);
+	void				setRenderSize				( int width, int height );
+	void				renderTile					( unsigned int tile );
+	sVec3				shade						( const sRay &ray, uint32_t sphere, unsigned int seed );
+	sVec3				phongShade					( const sVec3 &hitPoint, const sVec3 &normal,
+													  const sVec3 &direction );
+
+	int					m_width, m_height;
+	int					m_renderWidth, m_renderHeight;	// pixels traced, the bottom-left corner of the buffers
+	unsigned int		m_frameAccum;
+	unsigned int		m_tilesX, m_tilesY;
+	float				m_hfov, m_ratio;
+	sVec3				m_eye, m_lookAt, m_up, m_U, m_V, m_W;
+	sMat3				m_rotate;
+	cMouseHandler*		m_mouseH;
+	cKeyboardHandler*	m_keyboardHandler;
+
+	// scene, same values as the OptiX context variables
+	cSphereBVH			m_bvh;		// shadow and occlusion rays
+	cWideBVH			m_wideBVH;	// primary ray packets
+	sCpuLight			m_lights[3];
+	float				m_colors[3*CPU_NUM_COLORS];
+	float				m_energyMin, m_energyMax;
+	sVec3				m_bgColor;
+	float				m_sceneEpsilon;
+	float				m_occlusionDistance;
+	int					m_sqrtOcclusionSamples;
+	float				m_phongExp;
+	float				m_jitterFactor;
+
+	std::vector<uint32_t>	m_seeds;
+	std::vector<sVec3>		m_accum;
+	std::vector<unsigned char> m_output;	// top-down RGB8
+	cThreadPool			m_pool;
+};
+
+#endif /* CCPUPARTICLESRENDERER_H_ */
@@ -13,22 +13,19 @@
 #include <optixu/optixu_aabb_namespace.h>
 #include "../header/sutil.h"
 #include "../header/Arcball.h"
+#include "../header/cParticlesRenderer.h"
 
 
 //#define POST_PROCESSING
 
-class cPNGEncoder;
+class cSnapshotWriter;
 
 using namespace optix;
 
-#define NUM_PARTICLES_PER_GROUP 		1000*1000
 #define GROUP_SIZE			512
 
-class cMouseHandler;
-class cKeyboardHandler;
 
-
-class cOptixParticlesRenderer
+class cOptixParticlesRenderer : public cParticlesRenderer
 {
 public:
 	enum
@@ -40,14 +37,21 @@ public:
 						cOptixParticlesRenderer		( bool shareBuffer	);
 						~cOptixParticlesRenderer	(	);
 
-	void				init						( int width, int height,
-													  std::vector<float> *pos, float *min, float *max );
+	void				init						( int width, int height, cParticleSource *source );
 	bool				displayProgressive			( unsigned char *pixels	);
 	void				display						( unsigned char *pixels	);
 	void				setMouseHandler				( cMouseHandler *mouseH );
 	void				setKeyboardHandler 			( cKeyboardHandler *keyHandler );
+	unsigned int		accumulatedFrames			(	) { return m_frameAccum; };
+	void				setRenderScale				( unsigned int percent );
+	int					renderWidth					(	) { return m_renderWidth; };
+	int					renderHeight				(	) { return m_renderHeight; };
 	void				getPixels					( unsigned char *img	);
 	void*				getGPUFrameBufferPtr		( 	) { return m_bufferPtr; };
+	bool				renderRegion				( int posterWidth, int posterHeight, int x, int y, int width, int height,
+													  unsigned int samples, unsigned char *img );
+	void				setCamera					( const float *eye, const float *lookAt, const float *up, float fov );
+	void				getCamera					( float *eye, float *lookAt, float *up, float &fov );
 
 private:
 	void				updateView					(	);
@@ -59,11 +63,12 @@ private:
 	void				createInstance				(	);
 	void 				setBufferIds				( const std::vector<Buffer>& buffers,
 	                   	   	   	   	   	   	   	   	  Buffer top_level_buffer );
-	void				createGeometry 				( std::vector<float> *pos, float *min, float *max );
+	void				createGeometry 				( cParticleSource *source );
 	void				setupPostprocessing			( );
 	void				onKeyboardEvent				(	);
 
 	int					m_width, m_height;
+	int					m_renderWidth, m_renderHeight;	// launch size, the bottom-left corner of the buffers
 	int					m_ao_sample_mult;
 	unsigned int		m_frameAccum, m_numGroups, m_numPartPerGroup;
 	float				m_hfov, m_ratio;
@@ -82,7 +87,7 @@ private:
 	Buffer				m_outBuffer, m_streamBuffer, m_posBuffer, m_accumBuffer;
 	Aabb				m_aabb;
 
-	cPNGEncoder			*m_pngEncoder;
+	cSnapshotWriter		*m_snapshots;
 	// controls for auto saving
 	bool				m_autosave;
 	bool				m_denoise;
@@ -0,0 +1,79 @@
+/*
+ * Distributed under the OSI-approved Apache License, Version 2.0.  See
+ * accompanying file Copyright.txt for details.
+ */
+
+#ifndef CPARTICLECACHE_H_
+#define CPARTICLECACHE_H_
+
+#include <string>
+#include <stdint.h>
+#include "cParticleSource.h"
+
+#define PARTICLE_CACHE_MAGIC		"SIGHTPC"
+#define PARTICLE_CACHE_VERSION		1
+#define PARTICLE_CACHE_EXTENSION	".sightcache"
+// Particle array offset. A page boundary so the array can be mapped and handed out as is.
+#define PARTICLE_CACHE_DATA_OFFSET	4096
+// Header flags
+#define PARTICLE_CACHE_MORTON_SORTED	0x1		// particles are stored in Morton order (see mortonSort)
+
+/*
+ * Binary sidecar of an ASCII particle file. All fields are little-endian.
+ *
+ *  offset 0                          : sParticleCacheHeader
+ *  offset PARTICLE_CACHE_DATA_OFFSET : numParticles float4 records {x, y, z, energy}
+ */
+struct sParticleCacheHeader
+{
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	dataOffset;
+	uint64_t	numParticles;
+	uint32_t	decimation;
+	uint32_t	flags;
+	uint64_t	sourceSize;		// size and modification time of the ASCII file, used to detect stale caches
+	int64_t		sourceMtime;
+	float		min[4];
+	float		max[4];
+};
+
+class cParticleCache : public cParticleSource
+{
+public:
+						cParticleCache				(	);
+						~cParticleCache				(	);
+
+	// Maps the cache of the given ASCII file. Fails if the cache is missing, stale or was built
+	// with a different decimation factor.
+	bool				open						( const std::string &source, unsigned int decimation );
+	void				close						(	);
+
+	// Writes the cache of the given ASCII file, streaming the particles from the given source
+	static bool			write						( const std::string &source, unsigned int decimation,
+													  cParticleSource &particles, uint32_t flags = 0 );
+	static std::string	cacheFilename				( const std::string &source );
+
+	const float*		data						(	) const	{ return m_data; };
+	uint64_t			numParticles				(	) const	{ return m_header.numParticles; };
+	const float*		min							(	) const	{ return m_header.min; };
+	const float*		max							(	) const	{ return m_header.max; };
+	uint32_t			flags						(	) const	{ return m_header.flags; };
+
+	// Streaming access. Pages behind the read cursor are released so the resident
+	// size stays bounded while the whole cache is consumed.
+	size_t				read						( float *dst, size_t maxParticles );
+	bool				rewind						(	);
+
+private:
+	static bool			isLittleEndian				(	);
+	static bool			sourceStats					( const std::string &source, uint64_t &size, int64_t &mtime );
+
+	sParticleCacheHeader	m_header;
+	void*					m_map;
+	size_t					m_mapSize;
+	const float*			m_data;
+	uint64_t				m_cursor;
+};
+
+#endif /* CPARTICLECACHE_H_ */
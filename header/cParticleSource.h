@@ -0,0 +1,82 @@
+/*
+ * Distributed under the OSI-approved Apache License, Version 2.0.  See
+ * accompanying file Copyright.txt for details.
+ */
+
+#ifndef CPARTICLESOURCE_H_
+#define CPARTICLESOURCE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Sequential reader of particles. Particles are float4 records {x, y, z, energy}.
+ * The particle count and bounds are known before the first read so consumers can
+ * size their buffers and map energies to colors while streaming.
+ */
+class cParticleSource
+{
+public:
+	virtual					~cParticleSource	(	) { };
+
+	virtual uint64_t		numParticles		(	) const = 0;
+	virtual const float*	min					(	) const = 0;
+	virtual const float*	max					(	) const = 0;
+
+	// Copies up to maxParticles records into dst and returns how many were copied, 0 at the end
+	virtual size_t			read				( float *dst, size_t maxParticles ) = 0;
+	// Restarts reading from the first particle
+	virtual bool			rewind				(	) = 0;
+};
+
+/*
+ * Particles already in host memory, e.g. the output of loadAscii.
+ */
+class cMemoryParticleSource : public cParticleSource
+{
+public:
+							cMemoryParticleSource	(	)
+							{
+								set(0, 0, 0, 0);
+							};
+
+	void					set					( const float *pos, uint64_t numParticles,
+												  const float *min, const float *max )
+	{
+		m_pos			= pos;
+		m_numParticles	= numParticles;
+		m_cursor		= 0;
+		memset(m_min, 0, sizeof(m_min));
+		memset(m_max, 0, sizeof(m_max));
+		if (min)
+			memcpy(m_min, min, sizeof(m_min));
+		if (max)
+			memcpy(m_max, max, sizeof(m_max));
+	};
+
+	uint64_t				numParticles		(	) const	{ return m_numParticles; };
+	const float*			min					(	) const	{ return m_min; };
+	const float*			max					(	) const	{ return m_max; };
+	const float*			data				(	) const	{ return m_pos; };
+
+	size_t					read				( float *dst, size_t maxParticles )
+	{
+		uint64_t n = m_numParticles - m_cursor;
+		if (n > maxParticles)
+			n = maxParticles;
+		memcpy(dst, m_pos + m_cursor * 4, n * 4 * sizeof(float));
+		m_cursor += n;
+		return n;
+	};
+
+	bool					rewind				(	) { m_cursor = 0; return true; };
+
+private:
+	const float*			m_pos;
+	uint64_t				m_numParticles;
+	uint64_t				m_cursor;
+	float					m_min[4], m_max[4];
+};
+
+#endif /* CPARTICLESOURCE_H_ */
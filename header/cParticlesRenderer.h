@@ -0,0 +1,55 @@
+/*
+ * Distributed under the OSI-approved Apache License, Version 2.0.  See
+ * accompanying file Copyright.txt for details.
+ */
+
+#ifndef CPARTICLESRENDERER_H_
+#define CPARTICLESRENDERER_H_
+
+// Comment out to build without OptiX/CUDA; only the CPU renderer is available then
+#define OPTIX_RENDERER
+
+// Particles per OptiX geometry group, also the group size used by the overlap statistics
+#define NUM_PARTICLES_PER_GROUP 		(1000*1000)
+
+class cParticleSource;
+class cMouseHandler;
+class cKeyboardHandler;
+
+/*
+ * Renderer backend interface used by main.cpp and the frame server.
+ * display() renders one frame, getPixels() returns the last frame as top-down RGB8
+ * (BGRA8 when NVPIPE_ENCODING is used) of renderWidth() x renderHeight() pixels.
+ */
+class cParticlesRenderer
+{
+public:
+	virtual				~cParticlesRenderer			(	) { };
+
+	virtual void		init						( int width, int height, cParticleSource *source ) = 0;
+	virtual void		display						( unsigned char *pixels	) = 0;
+	virtual void		getPixels					( unsigned char *img	) = 0;
+	virtual void		setMouseHandler				( cMouseHandler *mouseH ) = 0;
+	virtual void		setKeyboardHandler 			( cKeyboardHandler *keyHandler ) = 0;
+	// Renders the next frames at percent of the init() size per side, fewer rays while the view
+	// moves. A new scale restarts the accumulation.
+	virtual void		setRenderScale				( unsigned int percent ) = 0;
+	virtual int			renderWidth					(	) = 0;
+	virtual int			renderHeight				(	) = 0;
+	// Device pointer of the frame buffer for GPU encoding, 0 when the backend has none
+	virtual void*		getGPUFrameBufferPtr		( 	) { return 0; };
+	// Frames accumulated since the camera last moved, 0 when the backend does not accumulate
+	virtual unsigned int accumulatedFrames			(	) { return 0; };
+	// Camera of the next frames, fov is the horizontal field of view in degrees. A new camera
+	// restarts the accumulation.
+	virtual void		setCamera					( const float *eye, const float *lookAt, const float *up, float fov ) = 0;
+	virtual void		getCamera					( float *eye, float *lookAt, float *up, float &fov ) = 0;
+	// Renders the width x height window at (x, y), counted from the top left, of a posterWidth x
+	// posterHeight image of the current view, with the same horizontal field of view, into img
+	// as top-down RGB8 after samples accumulated frames. The window is at most the init() size.
+	// For offline rendering between frames, the next display() starts a new accumulation.
+	virtual bool		renderRegion				( int posterWidth, int posterHeight, int x, int y, int width, int height,
+													  unsigned int samples, unsigned char *img ) = 0;
+};
+
+#endif /* CPARTICLESRENDERER_H_ */
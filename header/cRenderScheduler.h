@@ -0,0 +1,96 @@
+/*
+ * Distributed under the OSI-approved Apache License, Version 2.0.  See
+ * accompanying file Copyright.txt for details.
+ */
+
+#ifndef CRENDERSCHEDULER_H_
+#define CRENDERSCHEDULER_H_
+
+#include <stdint.h>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include "../frameserver/header/cTimer.h"
+#include "../frameserver/header/cStats.h"
+
+// Accumulated frames after which the image is final, 0 for no limit
+#define RENDER_SAMPLE_BUDGET			1024
+// Converged once the mean change of a channel between two frames is below this, in 8 bit levels
+#define RENDER_CONVERGED_CHANGE			0.05f
+// Frames accumulated before the change is trusted
+#define RENDER_MIN_FRAMES				16
+// Every n-th byte of a frame is compared, a prime so the samples do not line up with the channels
+#define RENDER_CHANGE_STRIDE			7
+// Longest sleep before the conditions are checked again, also the latency of a quit
+#define RENDER_IDLE_POLL_MS				100
+// Resolution per side in percent while the camera moves, when the scheduler is asked to lower it
+#define RENDER_INTERACTIVE_SCALE		50
+// Time the camera has to stand still before the full resolution is rendered again
+#define RENDER_SETTLE_MS				250
+
+/*
+ * Decides when the render loop launches a frame. It sleeps while no client is streaming and once
+ * the accumulation has converged or used up the sample budget. Input, new connections and
+ * stream requests wake it immediately through wake(); a camera change restarts the accumulation,
+ * which the scheduler sees as a drop of the accumulated frames.
+ * With an interactive scale below 100, frames are rendered at that resolution while the camera
+ * moves, so a frame costs about that share of the pixels, and at full resolution again once it
+ * stood still for RENDER_SETTLE_MS.
+ */
+class cRenderScheduler
+{
+public:
+					cRenderScheduler		( unsigned int sampleBudget = RENDER_SAMPLE_BUDGET,
+											  float threshold = RENDER_CONVERGED_CHANGE,
+											  unsigned int interactiveScale = 100 );
+
+	// Any thread
+	void			wake					(	);
+
+	/*
+	 * Render thread: true when a frame should be rendered now. Otherwise it sleeps until woken
+	 * or for RENDER_IDLE_POLL_MS and returns false, so the caller can check whether to quit.
+	 */
+	bool			wait					( bool active, unsigned int accumulated );
+
+	// Render thread, after a frame: its top-down RGB8 pixels, or 0 when it was not read back
+	void			frameDone				( const unsigned char *rgb, size_t bytes );
+	// Render thread, after frameDone(): the frame took input that arrived at arrival, cProtocol::now()
+	void			inputShown				( uint64_t arrival );
+
+	// Render thread: frames rendered, time asleep and frames that would have been rendered in it,
+	// the distribution of the render and input to frame latencies
+	void			printStats				(	);
+
+	bool			converged				(	) const		{ return m_converged; };
+	// Render thread: resolution of the next frame in percent per side, set by wait()
+	unsigned int	renderScale				(	) const		{ return m_scale; };
+
+private:
+
+	unsigned int				m_budget;
+	float						m_threshold;
+	unsigned int				m_interactiveScale;
+	// render thread only, m_mutex guards the wake-ups
+	bool						m_converged;
+	unsigned int				m_accumulated;
+	unsigned int				m_framesSinceReset;
+	bool						m_frameRendered;	// since the last wait()
+	bool						m_moved;			// at m_stillTimer
+	bool						m_rescaled;			// the next restart is the new scale's
+	unsigned int				m_scale;
+	cTimer						m_stillTimer;
+	uint64_t					m_wakeups, m_seenWakeups;
+	std::vector<unsigned char>	m_previous;
+	std::mutex					m_mutex;
+	std::condition_variable		m_cond;
+
+	// counters, reset by printStats()
+	unsigned int				m_rendered;
+	double						m_idleMs, m_renderMs, m_frameMs;
+	cTimer						m_frameTimer, m_statsTimer;
+	LatencyStats				m_renderStats, m_inputStats;
+};
+
+#endif /* CRENDERSCHEDULER_H_ */
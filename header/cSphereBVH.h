@@ -0,0 +1,124 @@
+/*
+ * Distributed under the OSI-approved Apache License, Version 2.0.  See
+ * accompanying file Copyright.txt for details.
+ */
+
+#ifndef CSPHEREBVH_H_
+#define CSPHEREBVH_H_
+
+#include <stdint.h>
+#include <vector>
+#include "vecmath.h"
+#include "cAlignedAllocator.h"
+
+class cThreadPool;
+
+// Maximum number of spheres in a leaf
+#define BVH_LEAF_SIZE		4
+#define BVH_STACK_SIZE		64
+// Node arrays start on a cache line, so a node and its left child share one
+#define BVH_NODE_ALIGNMENT	64
+
+/*
+ * 32 byte node of a depth-first flattened BVH.
+ * Interior node: count == 0, the left child follows the node and offset is the right child.
+ * Leaf: spheres [offset, offset + count).
+ */
+struct sBVHNode
+{
+	float		min[3];
+	uint32_t	offset;
+	float		max[3];
+	uint32_t	count;
+};
+
+typedef std::vector<sBVHNode, cAlignedAllocator<sBVHNode, BVH_NODE_ALIGNMENT> >	bvh_nodes;
+
+struct sRay
+{
+	sVec3	origin;
+	sVec3	direction;
+	float	tmin, tmax;
+};
+
+struct sHit
+{
+	float		t;
+	uint32_t	sphere;
+};
+
+/*
+ * Same test as intersect_sphere<true> in shaders/particles.cu: only the entry point is reported
+ * and far roots are refined once from the first estimate.
+ */
+static inline bool intersectSphere (const float *center, float radius, const sRay &ray, float &t)
+{
+	sVec3 O = ray.origin - makeVec3(center);
+	sVec3 D = ray.direction;
+
+	float b		= dot(O, D);
+	float c		= dot(O, O) - radius*radius;
+	float disc	= b*b - c;
+
+	if (disc > 0.0f)
+	{
+		float sdisc		= sqrtf(disc);
+		float root1		= (-b - sdisc);
+		float root11	= 0.0f;
+
+		if (fabsf(root1) > 10.f * radius)
+		{
+			sVec3 O1	= O + root1 * D;
+			b			= dot(O1, D);
+			c			= dot(O1, O1) - radius*radius;
+			disc		= b*b - c;
+			if (disc > 0.0f)
+			{
+				root11 = (-b - sqrtf(disc));
+			}
+		}
+		t = root1 + root11;
+		return t > ray.tmin && t < ray.tmax;
+	}
+	return false;
+}
+
+/*
+ * Bounding volume hierarchy over spheres of a common radius. The BVH keeps its own copy of the
+ * float4 {x, y, z, energy} particles, reordered so every leaf references a contiguous range.
+ */
+class cSphereBVH
+{
+public:
+							cSphereBVH			(	);
+
+	// Serial median split build
+	void					build				( const float *pos, uint64_t numParticles, float radius );
+	// Parallel linear BVH build (Karras 2012): a binary radix tree over the Morton order of the
+	// sphere centers, fitted bottom-up and flattened into the same depth-first node layout.
+	// Up to 2^31 spheres.
+	void					buildLBVH			( const float *pos, uint64_t numParticles, float radius,
+												  cThreadPool &pool );
+	// Surface area heuristic cost relative to the root, one unit per node visit and per sphere test
+	double					sahCost				(	) const;
+
+	// Closest hit along the ray
+	bool					intersect			( const sRay &ray, sHit &hit ) const;
+	// Any hit along the ray, for shadow and occlusion rays
+	bool					occluded			( const sRay &ray ) const;
+
+	const float*			sphere				( uint32_t i ) const	{ return &m_spheres[(size_t)i * 4]; };
+	uint64_t				numSpheres			(	) const	{ return m_spheres.size() / 4; };
+	float					radius				(	) const	{ return m_radius; };
+	const bvh_nodes&		nodes				(	) const	{ return m_nodes; };
+
+private:
+	uint32_t				buildNode			( std::vector<uint32_t> &ids, uint32_t begin, uint32_t end,
+												  const float *pos );
+
+	bvh_nodes				m_nodes;
+	std::vector<float>		m_spheres;
+	float					m_radius;
+};
+
+#endif /* CSPHEREBVH_H_ */
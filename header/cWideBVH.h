@@ -0,0 +1,105 @@
+/*
+ * Distributed under the OSI-approved Apache License, Version 2.0.  See
+ * accompanying file Copyright.txt for details.
+ */
+
+#ifndef CWIDEBVH_H_
+#define CWIDEBVH_H_
+
+#include <stdint.h>
+#include <vector>
+#include "cSphereBVH.h"
+
+#define BVH4_WIDTH			4
+#define BVH4_EMPTY			0xFFFFFFFFu
+#define PACKET_SIZE			8
+#define PACKET_NO_HIT		0xFFFFFFFFu
+
+/*
+ * 4-wide node, child bounds stored as SoA so one child box is tested against a whole packet.
+ * Leaf child: count > 0 and spheres [child, child + count). Interior child: count == 0.
+ * Unused slots have child == BVH4_EMPTY.
+ */
+struct sBVH4Node
+{
+	float		minX[BVH4_WIDTH], minY[BVH4_WIDTH], minZ[BVH4_WIDTH];
+	float		maxX[BVH4_WIDTH], maxY[BVH4_WIDTH], maxZ[BVH4_WIDTH];
+	uint32_t	child[BVH4_WIDTH];
+	uint32_t	count[BVH4_WIDTH];
+};
+
+/*
+ * Packet of coherent rays in SoA layout. Lanes with tmin > tmax are inactive.
+ * intersect() shortens tmax to the closest hit and writes the sphere index, PACKET_NO_HIT on a miss.
+ */
+struct alignas(32) sRayPacket
+{
+	float		ox[PACKET_SIZE], oy[PACKET_SIZE], oz[PACKET_SIZE];
+	float		dx[PACKET_SIZE], dy[PACKET_SIZE], dz[PACKET_SIZE];
+	float		tmin[PACKET_SIZE], tmax[PACKET_SIZE];
+	uint32_t	sphere[PACKET_SIZE];
+};
+
+// Traversal stack shared by the scalar and AVX2 paths
+#define PACKET_STACK_SIZE	256
+
+struct sStackEntry
+{
+	uint32_t	index;		// wide node, or first sphere of a leaf
+	uint32_t	count;		// spheres of a leaf, 0 for a node
+	float		tnear;		// closest entry distance over the packet, used to cull stale entries
+};
+
+static inline sStackEntry makeStackEntry (uint32_t index, uint32_t count, float tnear)
+{
+	sStackEntry e = { index, count, tnear };
+	return e;
+}
+
+// Pushes the children hit by the packet so the nearest one is popped first
+static inline void pushNearestLast (sStackEntry *stack, int &top, sStackEntry *hits, int numHits)
+{
+	for (int i = 1; i < numHits; i++)
+	{
+		sStackEntry e = hits[i];
+		int j = i - 1;
+		for (; j >= 0 && hits[j].tnear < e.tnear; j--)
+			hits[j + 1] = hits[j];
+		hits[j + 1] = e;
+	}
+	for (int i = 0; i < numHits; i++)
+		stack[top++] = hits[i];
+}
+
+/*
+ * Wide BVH collapsed from a cSphereBVH for packet traversal of primary rays. Sphere centers are
+ * kept as SoA arrays; sphere indices match the source cSphereBVH so shading can use its data.
+ * The AVX2 path is used when the CPU supports it, otherwise a scalar path with the same results.
+ */
+class cWideBVH
+{
+public:
+							cWideBVH			(	);
+
+	void					build				( const cSphereBVH &bvh );
+
+	void					intersect			( sRayPacket &packet ) const;
+	void					intersectScalar		( sRayPacket &packet ) const;
+	void					intersectAVX2		( sRayPacket &packet ) const;
+
+	static bool				supportsAVX2		(	);
+	// Forces the scalar path, e.g. to compare both in benchmarks
+	void					setSIMD				( bool enable )	{ m_simd = enable && supportsAVX2(); };
+	bool					simd				(	) const	{ return m_simd; };
+	const std::vector<sBVH4Node>& nodes			(	) const	{ return m_nodes; };
+
+private:
+	uint32_t				collapse			( const cSphereBVH &bvh, uint32_t index );
+
+	std::vector<sBVH4Node>	m_nodes;
+	std::vector<float>		m_x, m_y, m_z;
+	float					m_radius;
+	bool					m_simd;
+};
+
+#endif /* CWIDEBVH_H_ */
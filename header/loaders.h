@@ -16,6 +16,7 @@ template <typename T> T Min (T x, T y )
 	return x < y ? x : y;
 }
 
+float	parseFloat	(const char *&ptr, const char *end);
 int		loadAscii 	(const char* filename, std::vector<float> *positions, std::vector<float> *nrg, float *min, float *max, unsigned int decimation);
 
 #endif /* LOADERS_H_ */
@@ -0,0 +1,55 @@
+/*
+ * Distributed under the OSI-approved Apache License, Version 2.0.  See
+ * accompanying file Copyright.txt for details.
+ */
+
+#ifndef OFFLINE_H_
+#define OFFLINE_H_
+
+#include <string>
+#include <vector>
+
+class cParticlesRenderer;
+
+// Frames accumulated per poster tile or batch frame when no sample count is given
+#define OFFLINE_SAMPLES			256
+// PNG writer threads of the batch renderer and frames queued to them
+#define BATCH_WRITER_THREADS	2
+#define BATCH_QUEUE_FRAMES		4
+
+// Camera at a frame of a batch camera path, fov is the horizontal field of view in degrees
+struct sCameraKey
+{
+	int				frame;
+	float			eye[3], lookAt[3], up[3];
+	float			fov;
+	unsigned int	samples;
+};
+
+/*
+ * Renders the current view as a width x height PNG of any size. The poster is cut into tiles of
+ * the renderer's frame size, each rendered as its own sub-frustum of the view with samples
+ * accumulated frames. A row of tiles is written to filename as one stripe as soon as it is done,
+ * so memory stays bounded by one tile row whatever the size of the poster.
+ */
+bool	renderPoster	( cParticlesRenderer *renderer, int width, int height, unsigned int samples,
+						  const std::string &filename );
+
+/*
+ * Reads a camera path, one keyframe per line:
+ *		frame eyeX eyeY eyeZ lookAtX lookAtY lookAtZ upX upY upZ fov [samples]
+ * in increasing frame order, # starts a comment. Keys without samples get the given count.
+ */
+bool	loadCameraPath	( const std::string &filename, unsigned int samples, std::vector<sCameraKey> &keys );
+// The camera at frame, interpolated linearly between the keys around it
+sCameraKey	cameraAt	( const std::vector<sCameraKey> &keys, int frame );
+
+/*
+ * Renders every frame of the camera path in pathFile, from the first keyframe to the last,
+ * converged over its samples, to Sight_Batch_NNNNN.png without a frame server. The next frame
+ * renders while BATCH_WRITER_THREADS threads compress the previous ones. Frames per second and
+ * the time of every stage are printed, with the CPU renderer the run is reproducible.
+ */
+bool	renderBatch		( cParticlesRenderer *renderer, const std::string &pathFile, unsigned int samples );
+
+#endif /* OFFLINE_H_ */
@@ -0,0 +1,61 @@
+/*
+ * Distributed under the OSI-approved Apache License, Version 2.0.  See
+ * accompanying file Copyright.txt for details.
+ */
+
+#ifndef PARTICLESORT_H_
+#define PARTICLESORT_H_
+
+#include <stdint.h>
+#include <vector>
+
+class cThreadPool;
+
+// Bits per axis of the Morton codes, 3 * 10 = 30 bit keys
+#define MORTON_BITS_PER_AXIS	10
+// Sort keys are 64 bit: Morton code in the upper 30 bits, particle index in the lower 34 bits
+#define MORTON_INDEX_BITS		34
+
+struct sParticleBounds
+{
+	float	min[3];
+	float	max[3];
+
+	void	reset	(	);
+	void	grow	( const float *p );
+	void	grow	( const sParticleBounds &b );
+	bool	overlaps( const sParticleBounds &b ) const;
+	double	volume	(	) const;
+};
+
+/*
+ * How much the bounding boxes of consecutive particle groups overlap.
+ *  volumeRatio		: sum of the group volumes / volume of the whole dataset. Spatially
+ *					  compact groups tile the domain and give ~1, groups in file order
+ *					  usually span the whole domain and give ~numGroups.
+ *  meanOverlapping	: average number of other groups whose box intersects a group's box.
+ */
+struct sGroupOverlapStats
+{
+	unsigned int	numGroups;
+	double			volumeRatio;
+	double			meanOverlapping;
+};
+
+uint32_t			mortonCode		( const float *p, const float *min, const float *max );
+
+// Sort keys of the float4 particles in Z-order, computed and sorted with a parallel LSD radix sort.
+// Keys are unique since they include the particle index.
+void				mortonKeys		( const float *pos, uint64_t numParticles, const float *min,
+									  const float *max, std::vector<uint64_t> &keys, cThreadPool &pool );
+// Reorders the float4 particles along a Z-order curve of their positions using mortonKeys.
+// Consecutive particles, and therefore the geometry groups, become spatially compact.
+void				mortonSort		( float *pos, uint64_t numParticles, const float *min,
+									  const float *max, cThreadPool &pool );
+
+sGroupOverlapStats	groupOverlap	( const std::vector<sParticleBounds> &groups );
+// Bounds of every groupSize consecutive particles, then their overlap
+sGroupOverlapStats	groupOverlap	( const float *pos, uint64_t numParticles, uint64_t groupSize,
+									  cThreadPool &pool );
+
+#endif /* PARTICLESORT_H_ */
@@ -0,0 +1,46 @@
+/*
+ * Distributed under the OSI-approved Apache License, Version 2.0.  See
+ * accompanying file Copyright.txt for details.
+ */
+
+#ifndef PIXELCONVERT_H_
+#define PIXELCONVERT_H_
+
+#include <stdint.h>
+
+class cThreadPool;
+
+// Source formats of the OptiX output buffers
+enum ePixelFormat
+{
+	PIXEL_BGRA8,		// RT_FORMAT_UNSIGNED_BYTE4
+	PIXEL_FLOAT,		// RT_FORMAT_FLOAT, written to all three channels
+	PIXEL_FLOAT3,		// RT_FORMAT_FLOAT3
+	PIXEL_FLOAT4		// RT_FORMAT_FLOAT4, alpha dropped
+};
+
+// Rows per task when a conversion is split over a thread pool
+#define PIXEL_CONVERT_ROWS_PER_TASK		32
+
+/*
+ * Converts one row to RGB8, the input layout of the JPEG and PNG encoders. Floats are scaled by
+ * 255, truncated and clamped to [0, 255] as in sutil::displayBuffer.
+ */
+void			convertRowScalar		( const void *src, ePixelFormat format, unsigned int width, unsigned char *dst );
+// Same results with SSSE3 shuffles on AVX2 registers, 8 to 32 values per instruction
+void			convertRowAVX2			( const void *src, ePixelFormat format, unsigned int width, unsigned char *dst );
+bool			pixelConvertSupportsAVX2(	);
+
+/*
+ * Converts a bottom-up OptiX buffer into a top-down RGB8 image. Rows are split over the pool when
+ * one is given; simd = false forces the scalar rows, e.g. to compare both in benchmarks.
+ * srcWidth is the width of buffers larger than the image, whose bottom-left corner is converted.
+ */
+void			convertToRGB8			( const void *src, ePixelFormat format, unsigned int width, unsigned int height,
+										  unsigned char *dst, cThreadPool *pool = 0, bool simd = true,
+										  unsigned int srcWidth = 0 );
+
+// Pool shared by the conversions of the OptiX frame buffers
+cThreadPool*	pixelConvertPool		(	);
+
+#endif /* PIXELCONVERT_H_ */
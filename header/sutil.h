@@ -131,7 +131,9 @@ void SUTILAPI displayBufferPPM(
 // Extract the contents of the Buffer image  (C API version).
 void SUTILAPI displayBuffer(
 		unsigned char *pix,					// Array to store contents
-        RTbuffer buffer);                   // Buffer to be displayed
+        RTbuffer buffer,                    // Buffer to be displayed
+        unsigned int width = 0,             // Bottom-left corner of a smaller launch,
+        unsigned int height = 0);           // 0 for the whole buffer
 
 // Extract the contents of a Stream Buffer
 void SUTILAPI displayStreamBuffer(
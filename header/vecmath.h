@@ -0,0 +1,81 @@
+/*
+ * Distributed under the OSI-approved Apache License, Version 2.0.  See
+ * accompanying file Copyright.txt for details.
+ */
+
+#ifndef VECMATH_H_
+#define VECMATH_H_
+
+#include <math.h>
+
+/*
+ * Minimal float3 math for the CPU renderer, mirrors the optixu functions used by the shaders
+ * so the CPU backend builds without the OptiX SDK.
+ */
+struct sVec3
+{
+	float x, y, z;
+};
+
+static inline sVec3 makeVec3 (float x, float y, float z)	{ sVec3 v = { x, y, z }; return v; }
+static inline sVec3 makeVec3 (const float *p)				{ sVec3 v = { p[0], p[1], p[2] }; return v; }
+
+static inline sVec3 operator+ (const sVec3 &a, const sVec3 &b)	{ return makeVec3(a.x + b.x, a.y + b.y, a.z + b.z); }
+static inline sVec3 operator- (const sVec3 &a, const sVec3 &b)	{ return makeVec3(a.x - b.x, a.y - b.y, a.z - b.z); }
+static inline sVec3 operator- (const sVec3 &a)					{ return makeVec3(-a.x, -a.y, -a.z); }
+static inline sVec3 operator* (const sVec3 &a, const sVec3 &b)	{ return makeVec3(a.x * b.x, a.y * b.y, a.z * b.z); }
+static inline sVec3 operator* (const sVec3 &a, float s)			{ return makeVec3(a.x * s, a.y * s, a.z * s); }
+static inline sVec3 operator* (float s, const sVec3 &a)			{ return makeVec3(a.x * s, a.y * s, a.z * s); }
+static inline sVec3 operator/ (const sVec3 &a, float s)			{ return a * (1.0f / s); }
+
+static inline float dot (const sVec3 &a, const sVec3 &b)		{ return a.x * b.x + a.y * b.y + a.z * b.z; }
+static inline float length (const sVec3 &a)						{ return sqrtf(dot(a, a)); }
+static inline sVec3 normalize (const sVec3 &a)					{ return a * (1.0f / length(a)); }
+static inline sVec3 cross (const sVec3 &a, const sVec3 &b)
+{
+	return makeVec3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+}
+static inline sVec3 lerp (const sVec3 &a, const sVec3 &b, float t)	{ return a + (b - a) * t; }
+
+// Row major 3x3 matrix
+struct sMat3
+{
+	float m[9];
+};
+
+static inline sVec3 operator* (const sMat3 &a, const sVec3 &v)
+{
+	return makeVec3(a.m[0] * v.x + a.m[1] * v.y + a.m[2] * v.z,
+					a.m[3] * v.x + a.m[4] * v.y + a.m[5] * v.z,
+					a.m[6] * v.x + a.m[7] * v.y + a.m[8] * v.z);
+}
+
+static inline sMat3 operator* (const sMat3 &a, const sMat3 &b)
+{
+	sMat3 r;
+	for (int i = 0; i < 3; i++)
+		for (int j = 0; j < 3; j++)
+			r.m[i*3+j] = a.m[i*3] * b.m[j] + a.m[i*3+1] * b.m[3+j] + a.m[i*3+2] * b.m[6+j];
+	return r;
+}
+
+static inline sMat3 transpose (const sMat3 &a)
+{
+	sMat3 r = {{ a.m[0], a.m[3], a.m[6], a.m[1], a.m[4], a.m[7], a.m[2], a.m[5], a.m[8] }};
+	return r;
+}
+
+// Matrix whose columns are the given vectors
+static inline sMat3 fromBasis (const sVec3 &u, const sVec3 &v, const sVec3 &w)
+{
+	sMat3 r = {{ u.x, v.x, w.x, u.y, v.y, w.y, u.z, v.z, w.z }};
+	return r;
+}
+
+static inline sMat3 identity3 ( )
+{
+	sMat3 r = {{ 1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f }};
+	return r;
+}
+
+#endif /* VECMATH_H_ */
@@ -92,7 +92,8 @@ RT_PROGRAM void pinhole_camera()
 #ifdef TIME_VIEW
 	clock_t t0 = clock();
 #endif
-	size_t2 screen = output_buffer.size();
+	// launches smaller than the buffers render the whole view at a lower resolution
+	uint2 screen = launch_dim;
 	// Subpixel jitter: send the ray through a different position inside the pixel each time,
 	// to provide antialiasing.
 	unsigned int seed = rot_seed( rnd_seeds[ launch_index ], frame );
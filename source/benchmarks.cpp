@@ -0,0 +1,1351 @@
+/*
+ * Distributed under the OSI-approved Apache License, Version 2.0.  See
+ * accompanying file Copyright.txt for details.
+ */
+
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <functional>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <deque>
+#include <cmath>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../frameserver/header/cTimer.h"
+#include "../frameserver/header/cThreadPool.h"
+#include "../frameserver/header/cTurboJpegEncoder.h"
+#include "../frameserver/header/cParallelJpegEncoder.h"
+#include "../frameserver/header/cEncodeGroup.h"
+#include "../frameserver/header/cResampler.h"
+#include "../frameserver/header/cRateControl.h"
+#include "../header/loaders.h"
+#include "../header/particleSort.h"
+#include "../header/cParticlesRenderer.h"
+#include "../header/cParticleSource.h"
+#include "../header/cCpuParticlesRenderer.h"
+#include "../frameserver/header/cMouseEventHandler.h"
+#define _WEBSOCKETPP_CPP11_STL_
+#include <websocketpp/config/core.hpp>
+#include <websocketpp/processors/hybi13.hpp>
+#include "../frameserver/header/cMessagePool.h"
+#include "../frameserver/header/cPNGEncoder.h"
+#include "../frameserver/header/cParallelPngEncoder.h"
+#include "../frameserver/header/cStats.h"
+#include "../header/cRenderScheduler.h"
+#include "../header/offline.h"
+#include "../header/cSphereBVH.h"
+#include "../header/cWideBVH.h"
+#include "../header/pixelConvert.h"
+#include "../header/benchmarks.h"
+
+struct sBenchmark
+{
+	const char	*name;
+	const char	*usage;
+	int			(*run) ( int argc, char **argv );
+};
+//
+//=======================================================================================
+//
+// Uniformly distributed particles in a 1000^3 box, energies in [-2.5, -2.0]
+static void syntheticParticles (uint64_t numParticles, std::vector<float> &pos, float *min, float *max)
+{
+	std::mt19937							rng(1234);
+	std::uniform_real_distribution<float>	coord(0.0f, 1000.0f);
+	std::uniform_real_distribution<float>	energy(-2.5f, -2.0f);
+
+	pos.resize(numParticles * 4);
+	for (uint64_t i = 0; i < numParticles; i++)
+	{
+		pos[i*4  ] = coord(rng);
+		pos[i*4+1] = coord(rng);
+		pos[i*4+2] = coord(rng);
+		pos[i*4+3] = energy(rng);
+	}
+	for (int c = 0; c < 3; c++)
+	{
+		min[c] = 0.0f;
+		max[c] = 1000.0f;
+	}
+	min[3] = -2.5f;
+	max[3] = -2.0f;
+}
+//
+//=======================================================================================
+//
+// Either a particle file and a decimation factor, or a particle count for a synthetic set
+static bool benchmarkParticles (int argc, char **argv, std::vector<float> &pos, float *min, float *max,
+								uint64_t defaultCount = 16 * NUM_PARTICLES_PER_GROUP)
+{
+	if (argc >= 3)
+	{
+		std::vector<float> nrg;
+		return loadAscii(argv[1], &pos, &nrg, min, max, atoi(argv[2]));
+	}
+	uint64_t numParticles = argc >= 2 ? strtoull(argv[1], 0, 10) : defaultCount;
+	syntheticParticles(numParticles, pos, min, max);
+	return true;
+}
+//
+//=======================================================================================
+//
+static void printOverlap (const char *label, const sGroupOverlapStats &stats)
+{
+	std::cout << label << ": " << stats.numGroups << " groups, volume ratio " << stats.volumeRatio
+			  << ", mean overlapping groups " << stats.meanOverlapping << std::endl;
+}
+//
+//=======================================================================================
+//
+// Group bounding volume overlap before and after mortonSort
+static int benchmarkSort (int argc, char **argv)
+{
+	std::vector<float>	pos;
+	float				min[4], max[4];
+	cThreadPool			pool;
+
+	if (!benchmarkParticles(argc, argv, pos, min, max))
+	{
+		return 1;
+	}
+	uint64_t numParticles = pos.size() / 4;
+	std::cout << numParticles << " particles, " << pool.size() << " threads\n";
+
+	printOverlap("File order  ", groupOverlap(pos.data(), numParticles, NUM_PARTICLES_PER_GROUP, pool));
+
+	cTimer timer;
+	mortonSort(pos.data(), numParticles, min, max, pool);
+	double ms = timer.getElapsedMilliseconds();
+
+	printOverlap("Morton order", groupOverlap(pos.data(), numParticles, NUM_PARTICLES_PER_GROUP, pool));
+	std::cout << "Sort: " << ms << " ms, " << numParticles / (ms * 1e3) << " Mparticles/s\n";
+	return 0;
+}
+//
+//=======================================================================================
+//
+// Build time and SAH cost of the serial median split BVH and the parallel LBVH
+static int benchmarkBVH (int argc, char **argv)
+{
+	std::vector<float>	pos;
+	float				min[4], max[4];
+	cThreadPool			pool;
+	// the serial build takes minutes beyond this
+	const uint64_t		medianLimit = 64 * NUM_PARTICLES_PER_GROUP;
+
+	if (!benchmarkParticles(argc, argv, pos, min, max))
+	{
+		return 1;
+	}
+	uint64_t numParticles = pos.size() / 4;
+	std::cout << numParticles << " particles, " << pool.size() << " threads\n";
+
+	for (int lbvh = 0; lbvh < 2; lbvh++)
+	{
+		if (!lbvh && numParticles > medianLimit)
+		{
+			std::cout << "Median split: skipped above " << medianLimit << " particles\n";
+			continue;
+		}
+
+		cSphereBVH	bvh;
+		cTimer		timer;
+		if (lbvh)
+			bvh.buildLBVH(pos.data(), numParticles, 2.0f, pool);
+		else
+			bvh.build(pos.data(), numParticles, 2.0f);
+		double ms = timer.getElapsedMilliseconds();
+
+		std::cout << (lbvh ? "LBVH        : " : "Median split: ") << ms << " ms, "
+				  << numParticles / (ms * 1e3) << " Mparticles/s, " << bvh.nodes().size()
+				  << " nodes, SAH cost " << bvh.sahCost() << "\n";
+	}
+	return 0;
+}
+//
+//=======================================================================================
+//
+// Primary rays of a 1920x1080 pinhole camera looking at the particles
+struct sCameraRays
+{
+	int		width, height;
+	sVec3	eye, U, V, W;
+
+	sVec3	direction	( int x, int y ) const
+	{
+		float dx = (x + 0.5f) / width  * 2.0f - 1.0f;
+		float dy = (y + 0.5f) / height * 2.0f - 1.0f;
+		return normalize(dx * U + dy * V + W);
+	}
+};
+
+static double traceRows (cThreadPool &pool, const sCameraRays &camera, int frames,
+						 const std::function<void(int)> &traceRow)
+{
+	cTimer timer;
+	for (int f = 0; f < frames; f++)
+	{
+		pool.run(camera.height, [&traceRow](unsigned int y) { traceRow(y); });
+	}
+	return (double) camera.width * camera.height * frames / (timer.getElapsedSeconds() * 1e6);
+}
+//
+//=======================================================================================
+//
+// Mrays/s of the primary rays: single rays on the binary BVH, packets on the wide BVH (scalar and AVX2)
+static int benchmarkRays (int argc, char **argv)
+{
+	std::vector<float>	pos;
+	float				min[4], max[4];
+	cThreadPool			pool;
+	const int			frames = 4;
+
+	if (!benchmarkParticles(argc, argv, pos, min, max, NUM_PARTICLES_PER_GROUP))
+	{
+		return 1;
+	}
+	uint64_t numParticles = pos.size() / 4;
+
+	cSphereBVH	bvh;
+	cWideBVH	wide;
+	cTimer		timer;
+	bvh.buildLBVH(pos.data(), numParticles, 2.0f, pool);
+	wide.build(bvh);
+	std::cout << numParticles << " particles, BVH built in " << timer.getElapsedMilliseconds() << " ms, "
+			  << bvh.nodes().size() << " binary / " << wide.nodes().size() << " wide nodes, "
+			  << pool.size() << " threads\n";
+
+	sCameraRays camera;
+	camera.width	= 1920;
+	camera.height	= 1080;
+	sVec3 center	= makeVec3((min[0] + max[0]) * 0.5f, (min[1] + max[1]) * 0.5f, (min[2] + max[2]) * 0.5f);
+	float maxDim	= std::max(max[1] - min[1], max[2] - min[2]);
+	camera.eye		= center + makeVec3(0.0f, 0.0f, maxDim * 2.0f);
+	camera.W		= center - camera.eye;
+	camera.U		= normalize(cross(camera.W, makeVec3(0.0f, 1.0f, 0.0f))) * (length(camera.W) * tanf(0.5f * 60.0f * 3.14159265f / 180.0f));
+	camera.V		= normalize(cross(camera.U, camera.W)) * (length(camera.U) * camera.height / camera.width);
+
+	std::vector<uint32_t> reference((size_t)camera.width * camera.height), result(reference.size());
+
+	double mrays = traceRows(pool, camera, frames, [&](int y)
+	{
+		for (int x = 0; x < camera.width; x++)
+		{
+			sRay ray;
+			sHit hit;
+			ray.origin		= camera.eye;
+			ray.direction	= camera.direction(x, y);
+			ray.tmin		= 1.0f;
+			ray.tmax		= 1e30f;
+			reference[(size_t)y * camera.width + x] = bvh.intersect(ray, hit) ? hit.sphere : PACKET_NO_HIT;
+		}
+	});
+	uint64_t hits = 0;
+	for (size_t i = 0; i < reference.size(); i++)
+		hits += reference[i] != PACKET_NO_HIT;
+	std::cout << "Single rays    : " << mrays << " Mrays/s, " << 100.0 * hits / reference.size() << " % hits\n";
+
+	for (int simd = 0; simd < 2; simd++)
+	{
+		wide.setSIMD(simd == 1);
+		if (simd == 1 && !wide.simd())
+		{
+			std::cout << "AVX2 packets   : not supported by this CPU\n";
+			break;
+		}
+
+		mrays = traceRows(pool, camera, frames, [&](int y)
+		{
+			sRayPacket packet;
+			for (int x0 = 0; x0 < camera.width; x0 += PACKET_SIZE)
+			{
+				for (int l = 0; l < PACKET_SIZE; l++)
+				{
+					sVec3 d = camera.direction(std::min(x0 + l, camera.width - 1), y);
+					packet.ox[l] = camera.eye.x;	packet.oy[l] = camera.eye.y;	packet.oz[l] = camera.eye.z;
+					packet.dx[l] = d.x;				packet.dy[l] = d.y;				packet.dz[l] = d.z;
+					packet.tmin[l] = 1.0f;
+					packet.tmax[l] = x0 + l < camera.width ? 1e30f : -1.0f;
+				}
+				wide.intersect(packet);
+				for (int l = 0; l < PACKET_SIZE && x0 + l < camera.width; l++)
+					result[(size_t)y * camera.width + x0 + l] = packet.sphere[l];
+			}
+		});
+
+		uint64_t mismatches = 0;
+		for (size_t i = 0; i < reference.size(); i++)
+			mismatches += reference[i] != result[i];
+		std::cout << (simd ? "AVX2 packets   : " : "Scalar packets : ") << mrays << " Mrays/s, "
+				  << mismatches << " pixels differ from single rays\n";
+	}
+	return 0;
+}
+//
+//=======================================================================================
+//
+// Light background with shaded discs, close to the rendered particle frames
+static void syntheticFrame (int width, int height, std::vector<unsigned char> &rgb)
+{
+	std::mt19937							rng(1234);
+	std::uniform_real_distribution<float>	u(0.0f, 1.0f);
+
+	rgb.assign((size_t)width * height * 3, 242);
+	for (int d = 0; d < 4000; d++)
+	{
+		int		cx = (int)(u(rng) * width), cy = (int)(u(rng) * height), r = 2 + (int)(u(rng) * 12);
+		float	color[3] = { 0.9f, 0.3f + 0.5f * u(rng), 0.1f };
+		for (int y = std::max(0, cy - r); y < std::min(height, cy + r); y++)
+		{
+			for (int x = std::max(0, cx - r); x < std::min(width, cx + r); x++)
+			{
+				float dist2 = (float)((x - cx) * (x - cx) + (y - cy) * (y - cy)) / (r * r);
+				if (dist2 >= 1.0f)
+					continue;
+				for (int c = 0; c < 3; c++)
+					rgb[((size_t)y * width + x) * 3 + c] = (unsigned char)(255.0f * color[c] * sqrtf(1.0f - dist2));
+			}
+		}
+	}
+}
+//
+//=======================================================================================
+//
+// Largest difference between the decoded JPEG and a reference image, -1 if it does not decode
+static int decodeDifference (const unsigned char *jpeg, unsigned long size, int width, int height,
+							 const std::vector<unsigned char> &reference)
+{
+	tjhandle					decompressor = tjInitDecompress();
+	std::vector<unsigned char>	rgb((size_t)width * height * 3);
+	int							w, h, samp, colorspace;
+	int							diff = -1;
+
+	if (tjDecompressHeader3(decompressor, jpeg, size, &w, &h, &samp, &colorspace) == 0 && w == width && h == height &&
+		tjDecompress2(decompressor, jpeg, size, rgb.data(), width, 0, height, TJPF_RGB, TJFLAG_FASTDCT) == 0)
+	{
+		diff = 0;
+		for (size_t i = 0; i < rgb.size(); i++)
+			diff = std::max(diff, std::abs((int) rgb[i] - (int) reference[i]));
+	}
+	tjDestroy(decompressor);
+	return diff;
+}
+//
+//=======================================================================================
+//
+// ms/frame of the single tjCompress2 call against the striped encoder at several thread counts
+static int benchmarkJpeg (int argc, char **argv)
+{
+	const int	width	= argc >= 3 ? atoi(argv[1]) : 1920;
+	const int	height	= argc >= 3 ? atoi(argv[2]) : 1088;
+	const int	frames	= 20;
+	const int	maxThreads = std::max(1u, std::thread::hardware_concurrency());
+
+	std::vector<unsigned char> rgb, decoded;
+	syntheticFrame(width, height, rgb);
+
+	cTurboJpegEncoder single;
+	single.setImageParams(width, height);
+	if (!single.initEncoder() || !single.encode(rgb.data()))
+	{
+		return 1;
+	}
+	cTimer timer;
+	for (int f = 0; f < frames; f++)
+		single.encode(rgb.data());
+	double singleMs = timer.getElapsedMilliseconds() / frames;
+	std::cout << width << "x" << height << ", " << frames << " frames\n";
+	std::cout << "tjCompress2         : " << singleMs << " ms/frame, " << single.getJpegSize() << " bytes\n";
+
+	// the stitched image has to decode to the same pixels as the single stream
+	decoded.resize(rgb.size());
+	tjhandle decompressor = tjInitDecompress();
+	tjDecompress2(decompressor, single.getImg(), single.getJpegSize(), decoded.data(), width, 0, height, TJPF_RGB, TJFLAG_FASTDCT);
+	tjDestroy(decompressor);
+
+	for (int threads = 1; ; threads = std::min(threads * 2, maxThreads))
+	{
+		cParallelJpegEncoder striped(threads);
+		striped.setImageParams(width, height);
+		if (!striped.initEncoder() || !striped.encode(rgb.data()))
+		{
+			return 1;
+		}
+		timer.reset();
+		for (int f = 0; f < frames; f++)
+			striped.encode(rgb.data());
+		double ms = timer.getElapsedMilliseconds() / frames;
+
+		int diff = decodeDifference(striped.getImg(), striped.getJpegSize(), width, height, decoded);
+		std::cout << "Striped, " << threads << (threads < 10 ? " threads  : " : " threads : ") << ms << " ms/frame, "
+				  << singleMs / ms << "x, " << striped.numStripes() << " stripes, " << striped.getJpegSize() << " bytes, "
+				  << (diff < 0 ? std::string("does not decode") : "max difference " + std::to_string(diff)) << "\n";
+		if (threads == maxThreads)
+			break;
+	}
+	return 0;
+}
+//
+//=======================================================================================
+//
+// ms/frame of scaling a rendered frame down and encoding it, at the resolutions of
+// DYNAMIC_RESOLUTION and the rate control: the CHANGE_RESOLUTION loop cResampler replaced
+// (new[] per frame, nearest pixel through float divides), cResampler and tjCompress2 of the result
+static int benchmarkResample (int argc, char **argv)
+{
+	const int	width		= argc >= 3 ? atoi(argv[1]) : 1920;
+	const int	height		= argc >= 3 ? atoi(argv[2]) : 1088;
+	const int	frames		= 20;
+	const int	scales[]	= { 100, 75, 50, 35, 25 };
+	// keeps the optimizer from dropping the old loop
+	volatile unsigned char	sink;
+
+	std::vector<unsigned char> rgb;
+	syntheticFrame(width, height, rgb);
+	std::cout << width << "x" << height << ", " << frames << " frames\n";
+	std::cout << "scale   pixels   nearest ms   cResampler ms   encode ms    bytes\n";
+
+	for (size_t i = 0; i < sizeof(scales) / sizeof(scales[0]); i++)
+	{
+		const int	w		= std::max(1, width  * scales[i] / 100);
+		const int	h		= std::max(1, height * scales[i] / 100);
+		const float	factor	= scales[i] / 100.0f;
+
+		cTimer timer;
+		for (int f = 0; f < frames; f++)
+		{
+			unsigned char *scaled = new unsigned char [(size_t)w * h * 3];
+			for (unsigned int j = 0; j < (unsigned int) h; j++)
+			{
+				for (unsigned int x = 0; x < (unsigned int) w; x++)
+				{
+					unsigned int out	= (w * 3) * j + x * 3;
+					unsigned int in		= (unsigned int)(j / factor) * (width * 3) + (unsigned int)(x / factor) * 3;
+					scaled[out  ] = rgb[in  ];
+					scaled[out+1] = rgb[in+1];
+					scaled[out+2] = rgb[in+2];
+				}
+			}
+			sink = scaled[(size_t)w * h * 3 / 2];
+			delete [] scaled;
+		}
+		const double nearestMs = timer.getElapsedMilliseconds() / frames;
+
+		cResampler resampler;
+		resampler.setup(width, height, w, h);
+		unsigned char *scaled = resampler.resample(rgb.data());
+		timer.reset();
+		for (int f = 0; f < frames; f++)
+			scaled = resampler.resample(rgb.data());
+		const double resampleMs = timer.getElapsedMilliseconds() / frames;
+
+		cTurboJpegEncoder encoder;
+		encoder.setImageParams(w, h);
+		if (!encoder.initEncoder() || !encoder.encode(scaled))
+		{
+			return 1;
+		}
+		timer.reset();
+		for (int f = 0; f < frames; f++)
+			encoder.encode(scaled);
+		const double encodeMs = timer.getElapsedMilliseconds() / frames;
+
+		printf("%4d%%   %5.1f%%   %10.2f   %13.2f   %9.2f   %7d\n", scales[i], 100.0 * w * h / ((double) width * height),
+			   nearestMs, resampleMs, encodeMs, encoder.getJpegSize());
+	}
+	(void) sink;
+	return 0;
+}
+//
+//=======================================================================================
+//
+// GB/s (bytes read + written) of the frame buffer to RGB8 conversion of every OptiX format
+static int benchmarkPixels (int argc, char **argv)
+{
+	const unsigned int	width	= argc >= 3 ? atoi(argv[1]) : 1920;
+	const unsigned int	height	= argc >= 3 ? atoi(argv[2]) : 1088;
+	const int			frames	= 20;
+	const char			*names[] = { "BGRA8 ", "FLOAT ", "FLOAT3", "FLOAT4" };
+	const unsigned int	channels[] = { 1, 1, 3, 4 };
+	cThreadPool			pool;
+
+	std::mt19937							rng(1234);
+	std::uniform_real_distribution<float>	u(-0.1f, 1.1f);
+	std::vector<float>						src((size_t)width * height * 4);
+	for (size_t i = 0; i < src.size(); i++)
+		src[i] = u(rng);
+
+	std::vector<unsigned char> reference((size_t)width * height * 3), rgb(reference.size());
+	std::cout << width << "x" << height << ", " << pool.size() << " threads"
+			  << (pixelConvertSupportsAVX2() ? "" : ", no AVX2: the SIMD rows run the scalar path") << "\n";
+
+	for (int f = 0; f < 4; f++)
+	{
+		ePixelFormat	format	= (ePixelFormat) f;
+		double			bytes	= (double) width * height * (format == PIXEL_BGRA8 ? 4 : channels[f] * sizeof(float)) +
+								  reference.size();
+
+		std::cout << names[f] << ":";
+		for (int mode = 0; mode < 3; mode++)
+		{
+			std::vector<unsigned char> &out = mode == 0 ? reference : rgb;
+			cTimer timer;
+			for (int i = 0; i < frames; i++)
+				convertToRGB8(src.data(), format, width, height, out.data(), mode == 2 ? &pool : 0, mode > 0);
+			double gbs = bytes * frames / (timer.getElapsedSeconds() * 1e9);
+
+			const char *labels[] = { " scalar ", ", SIMD ", ", SIMD + threads " };
+			std::cout << labels[mode] << gbs << " GB/s";
+			if (mode > 0 && out != reference)
+				std::cout << " (differs from scalar)";
+		}
+		std::cout << "\n";
+	}
+	return 0;
+}
+//
+//=======================================================================================
+//
+// Simulated link phase of "sight -bench rate": seconds, link MB/s, user interacting
+struct sRatePhase
+{
+	double	seconds, mbps;
+	bool	interacting;
+};
+// Mixed stream: the frames between two whole ones that are patches while the view stands still,
+// their size against a whole frame, and the size of a frame at RENDER_INTERACTIVE_SCALE while
+// it moves, a JPEG of a quarter of the pixels being a bit more than a quarter of the bytes
+#define RATE_BENCH_PATCHES			7
+#define RATE_BENCH_PATCH_SIZE		0.08
+#define RATE_BENCH_SCALED_SIZE		0.3
+//
+//=======================================================================================
+//
+/*
+ * Runs cRateControl against the simulated link, in virtual time: frames rendered at 60 fps, a
+ * window of 4 frames, a FIFO link and a fixed base round trip. Frames are whole frames of the
+ * sizes of every level, or with mixed the stream of a session with patches and a lower
+ * resolution while interacting, acked with their share of a whole frame or, without normalize,
+ * as if they were whole. Returns the level and the best level the link carries every second,
+ * with print a line per second.
+ */
+static void simulateRate (const std::vector<double> &sizes, const sRatePhase *phases, size_t numPhases, double baseRtt,
+						  bool mixed, bool normalize, bool print, std::vector<int> &levels, std::vector<int> &ideals)
+{
+	const double	renderMs	= 1000.0 / 60.0;
+	const unsigned	window		= 4;
+	const double	scaledShare	= RENDER_INTERACTIVE_SCALE * RENDER_INTERACTIVE_SCALE / 10000.0;
+	int				count;
+	const sRateLevel *ladder	= cRateControl::levels(count);
+
+	struct sFlight { double sent, ack, bytes, share; };
+	std::deque<sFlight>						flights;
+	std::mt19937							rng(1234);
+	std::uniform_real_distribution<double>	jitter(0.9, 1.1);
+	cRateControl							rate;
+	double	linkFree = 0.0, nextRender = 0.0, phaseEnd = 0.0, rttSum = 0.0;
+	int		frameLevel = -1, delivered = 0, frames = 0;
+
+	levels.clear();
+	ideals.clear();
+	double t = 0.0;
+	for (size_t p = 0; p < numPhases; p++)
+	{
+		const double	bytesPerMs	= phases[p].mbps * 1000.0;
+		// best level the link carries at the target rate, from the real sizes
+		const double	headroom	= phases[p].interacting ? RATE_INTERACTIVE_HEADROOM : RATE_HEADROOM;
+		int				ideal		= count - 1;
+		for (int l = count - 1; l >= 0; l--)
+		{
+			if (sizes[l] / bytesPerMs <= headroom * 1000.0 / RATE_TARGET_FPS)
+				ideal = l;
+		}
+
+		phaseEnd += phases[p].seconds * 1000.0;
+		for (double second = t + 1000.0; t < phaseEnd; t += 1.0)
+		{
+			while (!flights.empty() && flights.front().ack <= t)
+			{
+				rate.acked((size_t) flights.front().bytes, t - flights.front().sent, t, normalize ? flights.front().share : 1.0);
+				rttSum += t - flights.front().sent;
+				delivered++;
+				flights.pop_front();
+			}
+			if (phases[p].interacting && fmod(t, 50.0) == 0.0)
+			{
+				rate.interaction(t);
+			}
+			rate.update(t, (unsigned int) flights.size());
+
+			if (t >= nextRender)
+			{
+				frameLevel	= rate.level();
+				nextRender	+= renderMs;
+			}
+			// like cFlowControl::canSend: open window and at most 1.5 frames in the socket
+			double backlog = std::max(0.0, linkFree - t) * bytesPerMs;
+			if (frameLevel >= 0 && flights.size() < window && backlog <= 1.5 * sizes[frameLevel])
+			{
+				sFlight frame;
+				frame.bytes	= sizes[frameLevel] * jitter(rng);
+				frame.share	= 1.0;
+				if (mixed && phases[p].interacting)
+				{
+					frame.bytes	*= RATE_BENCH_SCALED_SIZE;
+					frame.share	= scaledShare;
+				}
+				else if (mixed && frames % (RATE_BENCH_PATCHES + 1) != 0)
+				{
+					frame.bytes	*= RATE_BENCH_PATCH_SIZE;
+					frame.share	= 0.0;
+				}
+				frame.sent	= t;
+				linkFree	= std::max(t, linkFree) + frame.bytes / bytesPerMs;
+				frame.ack	= linkFree + baseRtt;
+				flights.push_back(frame);
+				frameLevel	= -1;
+				frames++;
+			}
+
+			if (t + 1.0 >= second)
+			{
+				const sRateLevel &level = ladder[rate.level()];
+				if (print)
+				{
+					printf("%4.0f  %9.2f  %8.2f  %5d  %4d %s  %4d%%  %3d  %7.1f  %5d%s\n", second / 1000.0, phases[p].mbps,
+						   rate.capacity(), rate.level(), level.quality,
+						   level.subsampling == TJSAMP_444 ? "444" : "420", level.scale, delivered,
+						   delivered > 0 ? rttSum / delivered : 0.0, ideal, phases[p].interacting ? "  interacting" : "");
+				}
+				levels.push_back(rate.level());
+				ideals.push_back(ideal);
+				delivered	= 0;
+				rttSum		= 0.0;
+				second		+= 1000.0;
+			}
+		}
+	}
+}
+//
+//=======================================================================================
+//
+/*
+ * cRateControl against a simulated shaped link whose bandwidth changes every few seconds. Frame
+ * sizes are the real JPEG sizes of the synthetic frame at every level. Then the same link with
+ * the stream of a session that sends patches and frames at a lower resolution while the view
+ * moves: their sizes normalized to whole frames, the levels have to stay where whole frames put
+ * them, taken as whole frames they would pick levels the link cannot carry.
+ */
+static int benchmarkRate (int argc, char **argv)
+{
+	const double	baseRtt		= argc >= 2 ? atof(argv[1]) : 40.0;
+	const int		width		= 1920, height = 1088;
+	const sRatePhase phases[] =
+	{
+		{ 6, 8.0, false }, { 6, 2.0, false }, { 6, 2.0, true }, { 6, 0.6, true }, { 6, 0.6, false }, { 6, 4.0, false }, { 6, 16.0, true }
+	};
+	const size_t	numPhases	= sizeof(phases) / sizeof(phases[0]);
+
+	std::vector<unsigned char> rgb;
+	syntheticFrame(width, height, rgb);
+
+	int					count;
+	const sRateLevel	*ladder = cRateControl::levels(count);
+	std::vector<double>	sizes(count);
+	std::cout << "Level sizes, " << width << "x" << height << ":\n";
+	for (int l = 0; l < count; l++)
+	{
+		sEncodeSettings settings = { ladder[l].quality, ladder[l].scale, ladder[l].subsampling };
+		cEncodeGroup<cTurboJpegEncoder> group(settings, width, height, new cTurboJpegEncoder());
+		group.encode(rgb.data(), width, height, 0, 0);
+		int slot = group.frames()->tryConsume();
+		sizes[l] = (double)(group.frames()->size(slot) - FRAME_HEADER_SIZE);
+		std::cout << "  q " << ladder[l].quality << (ladder[l].subsampling == TJSAMP_444 ? " 4:4:4 " : " 4:2:0 ")
+				  << ladder[l].scale << "%: " << sizes[l] << " bytes, cost " << sizes[l] / sizes[0]
+				  << " (ladder " << ladder[l].cost << ")\n";
+	}
+
+	std::vector<int> whole, normalized, raw, ideals;
+	std::cout << "\nBase RTT " << baseRtt << " ms, target " << RATE_TARGET_FPS << " fps, window 4\n"
+			  << "   s  link MB/s  capacity  level  quality  scale  fps   rtt ms  best level\n";
+	simulateRate(sizes, phases, numPhases, baseRtt, false, true, true, whole, ideals);
+	simulateRate(sizes, phases, numPhases, baseRtt, true, true, false, normalized, ideals);
+	simulateRate(sizes, phases, numPhases, baseRtt, true, false, false, raw, ideals);
+
+	std::cout << "\nPatches (" << RATE_BENCH_PATCHES << " of " << RATE_BENCH_PATCHES + 1 << " frames) while still, "
+			  << RENDER_INTERACTIVE_SCALE << "% resolution while interacting, level per second\n"
+			  << "   s  best  whole frames  normalized  as whole frames\n";
+	// a level of the ladder is a few percent of the frame size, one too good is noise
+	int overWhole = 0, overNormalized = 0, overRaw = 0;
+	for (size_t i = 0; i < whole.size(); i++)
+	{
+		printf("%4d  %4d  %12d  %10d  %15d\n", (int) i + 1, ideals[i], whole[i], normalized[i], raw[i]);
+		overWhole		+= whole[i] < ideals[i] - 1 ? 1 : 0;
+		overNormalized	+= normalized[i] < ideals[i] - 1 ? 1 : 0;
+		overRaw			+= raw[i] < ideals[i] - 1 ? 1 : 0;
+	}
+	printf("seconds more than one level better than the link carries: whole frames %d, normalized %d, as whole frames %d\n",
+		   overWhole, overNormalized, overRaw);
+	return 0;
+}
+//
+//=======================================================================================
+//
+// Draws the published frame of a group over the image the client shows: the whole JPEG, or
+// every patch at its position. False if a JPEG does not decode.
+static bool showFrame (tjhandle decompressor, cFrameQueue *frames, std::vector<unsigned char> &shown, int width)
+{
+	int slot = frames->tryConsume();
+	if (slot < 0)
+		return true;
+
+	const unsigned char	*data = frames->data(slot);
+	size_t				size = frames->size(slot);
+	sFrameHeader		header;
+	sPatchHeader		patch;
+	bool				ok = cProtocol::readFrameHeader(data, size, header);
+	std::vector<unsigned char> rgb;
+
+	// a whole frame is one patch
+	size_t p = FRAME_HEADER_SIZE;
+	if (ok && (header.flags & FRAME_FLAG_PATCHES))
+		p += PATCH_BASE_SIZE;
+	patch.x = patch.y = 0;
+	patch.width		= header.width;
+	patch.height	= header.height;
+	patch.size		= (uint32_t)(size - p);
+	while (ok && p < size)
+	{
+		if (header.flags & FRAME_FLAG_PATCHES)
+		{
+			ok = cProtocol::readPatchHeader(data + p, size - p, patch);
+			p += PATCH_HEADER_SIZE;
+		}
+		rgb.resize((size_t) patch.width * patch.height * 3);
+		ok = ok && tjDecompress2(decompressor, data + p, patch.size, rgb.data(), patch.width, 0, patch.height, TJPF_RGB, TJFLAG_FASTDCT) == 0;
+		for (int y = 0; ok && y < patch.height; y++)
+		{
+			memcpy(&shown[(((size_t) patch.y + y) * width + patch.x) * 3], &rgb[(size_t) y * patch.width * 3], (size_t) patch.width * 3);
+		}
+		p += patch.size;
+	}
+	frames->release(slot);
+	return ok;
+}
+//
+//=======================================================================================
+//
+// Bytes/frame and encode ms of whole JPEG frames against DIRTY_TILES patches, on the frames the
+// CPU renderer draws through a scripted session of drags and pauses that let the image converge.
+// The clients show every frame; their images are rebuilt from what was sent and compared with
+// the rendered frames, the patches have to be as close as the whole frames.
+static int benchmarkTiles (int argc, char **argv)
+{
+	std::vector<float>	pos;
+	float				min[4], max[4];
+	const int			width = 960, height = 544;
+	// frames, mouse buttons held and mouse move per frame
+	const struct { const char *name; int frames; int buttons; int dx, dy; } phases[] =
+	{
+		{ "rotate  ", 8, 1, 12, 4 }, { "converge", 24, 0, 0, 0 }, { "zoom    ", 6, 4, 0, 6 }, { "converge", 24, 0, 0, 0 }
+	};
+
+	if (!benchmarkParticles(argc, argv, pos, min, max, NUM_PARTICLES_PER_GROUP))
+	{
+		return 1;
+	}
+
+	cMemoryParticleSource	source;
+	cMouseHandler			mouse;
+	cCpuParticlesRenderer	renderer;
+	source.set(pos.data(), pos.size() / 4, min, max);
+	renderer.init(width, height, &source);
+	renderer.setMouseHandler(&mouse);
+
+	sEncodeSettings							settings = { TJPEG_QUALITY, 100, TJSAMP_444 };
+	cEncodeGroup<cTurboJpegEncoder>			whole(settings, width, height, new cTurboJpegEncoder());
+	cEncodeGroup<cTurboJpegEncoder>			patches(settings, width, height, new cTurboJpegEncoder());
+	std::vector<unsigned char>				rgb((size_t) width * height * 3), wholeShown(rgb.size()), shown(rgb.size());
+	tjhandle								decompressor = tjInitDecompress();
+	patches.enablePatches(true);
+
+	std::cout << pos.size() / 4 << " particles, " << width << "x" << height << ", quality " << TJPEG_QUALITY << "\n";
+	std::cout << "phase     frames   whole bytes   whole ms   max diff   patch bytes   patch ms   max diff   patched   skipped\n";
+
+	uint32_t	frameId = 0;
+	int			x = width / 2, y = height / 2;
+	for (size_t p = 0; p < sizeof(phases) / sizeof(phases[0]); p++)
+	{
+		double	wholeBytes = 0.0, wholeMs = 0.0, patchBytes = 0.0, patchMs = 0.0;
+		int		patched = 0, skipped = 0, wholeDiff = 0, diff = 0;
+		for (int f = 0; f < phases[p].frames; f++, frameId++)
+		{
+			sControlMessage msg;
+			memset(&msg, 0, sizeof(msg));
+			msg.type	= CONTROL_MOUSE;
+			msg.buttons	= (uint8_t) phases[p].buttons;
+			x			+= phases[p].dx;
+			y			+= phases[p].dy;
+			msg.x		= (uint16_t) x;
+			msg.y		= (uint16_t) y;
+			mouse.parse(msg);
+			renderer.display(0);
+			renderer.getPixels(rgb.data());
+
+			whole.encode(rgb.data(), width, height, frameId, 0);
+			wholeBytes	+= whole.encodedBytes();
+			wholeMs		+= whole.encodeMs();
+
+			patches.encode(rgb.data(), width, height, frameId, 0, 0, frameId > 0 ? (int64_t) frameId - 1 : -1);
+			patchBytes	+= patches.encodedBytes();
+			patchMs		+= patches.encodeMs();
+			patched		+= patches.patched();
+			skipped		+= patches.encodedBytes() == 0;
+
+			if (!showFrame(decompressor, whole.frames(), wholeShown, width) ||
+				!showFrame(decompressor, patches.frames(), shown, width))
+			{
+				std::cout << "Frame " << frameId << " does not decode\n";
+				tjDestroy(decompressor);
+				return 1;
+			}
+			for (size_t i = 0; i < rgb.size(); i++)
+			{
+				wholeDiff	= std::max(wholeDiff, std::abs((int) rgb[i] - (int) wholeShown[i]));
+				diff		= std::max(diff, std::abs((int) rgb[i] - (int) shown[i]));
+			}
+		}
+		const int frames = phases[p].frames;
+		printf("%s   %6d   %11.0f   %8.2f   %8d   %11.0f   %8.2f   %8d   %6.0f%%   %6.0f%%\n", phases[p].name, frames,
+			   wholeBytes / frames, wholeMs / frames, wholeDiff, patchBytes / frames, patchMs / frames, diff,
+			   100.0 * patched / frames, 100.0 * skipped / frames);
+	}
+	tjDestroy(decompressor);
+	return 0;
+}
+//
+//=======================================================================================
+//
+// ms, messages and bytes copied per frame sent to every client: send(hdl, data, size) for each
+// connection, a new message with a copy of the frame that the processor copies again into the
+// framed message, against one cMessagePool message shared by all connections. Connections keep
+// a few frames queued, like clients behind a slow link.
+static int benchmarkFanout (int argc, char **argv)
+{
+	typedef websocketpp::config::core	config;
+	typedef config::message_type		message;
+	const size_t	size		= (argc >= 2 ? (size_t) atoi(argv[1]) : 256) * 1024;
+	const int		frames		= 200;
+	const size_t	queued		= 3;
+	const int		clients[]	= { 1, 2, 4, 8, 16, 32 };
+
+	std::vector<unsigned char> jpeg(size);
+	for (size_t i = 0; i < size; i++)
+		jpeg[i] = (unsigned char)((i * 2654435761u) >> 13);
+
+	config::con_msg_manager_type::ptr		manager = websocketpp::lib::make_shared<config::con_msg_manager_type>();
+	config::rng_type						rng;
+	websocketpp::processor::hybi13<config>	processor(false, true, manager, rng);
+	cMessagePool<message>					pool;
+
+	// both have to put the same bytes on the wire
+	message::ptr in = manager->get_message(websocketpp::frame::opcode::BINARY, size), out = manager->get_message();
+	in->append_payload(jpeg.data(), size);
+	processor.prepare_data_frame(in, out);
+	message::ptr shared = pool.frame(jpeg.data(), size);
+	if (out->get_header() != shared->get_header() || out->get_payload() != shared->get_payload())
+	{
+		std::cout << "Pooled message differs from the one websocketpp prepares\n";
+		return 1;
+	}
+
+	std::cout << size / 1024 << " KB frames, " << frames << " frames, " << queued << " frames queued per connection\n";
+	std::cout << "clients   per connection: ms   messages   MB copied      shared: ms   messages   MB copied\n";
+	for (size_t c = 0; c < sizeof(clients) / sizeof(clients[0]); c++)
+	{
+		const size_t				sends = (size_t) clients[c];
+		std::deque<message::ptr>	flight;
+
+		cTimer timer;
+		for (int f = 0; f < frames; f++)
+		{
+			for (size_t i = 0; i < sends; i++)
+			{
+				in	= manager->get_message(websocketpp::frame::opcode::BINARY, size);
+				out	= manager->get_message();
+				in->append_payload(jpeg.data(), size);
+				processor.prepare_data_frame(in, out);
+				flight.push_back(out);
+			}
+			while (flight.size() > sends * queued)
+				flight.pop_front();
+		}
+		const double copyMs = timer.getElapsedMilliseconds() / frames;
+		flight.clear();
+		in.reset();
+		out.reset();
+
+		const uint64_t allocated = pool.allocated();
+		timer.reset();
+		for (int f = 0; f < frames; f++)
+		{
+			shared = pool.frame(jpeg.data(), size);
+			for (size_t i = 0; i < sends; i++)
+				flight.push_back(shared);
+			while (flight.size() > sends * queued)
+				flight.pop_front();
+		}
+		const double sharedMs = timer.getElapsedMilliseconds() / frames;
+		flight.clear();
+
+		printf("%7d   %16.3f   %8d   %9.2f   %12.3f   %8.3f   %9.2f\n", clients[c], copyMs, (int)(2 * sends),
+			   2.0 * sends * size / 1e6, sharedMs, (double)(pool.allocated() - allocated) / frames, size / 1e6);
+	}
+	return 0;
+}
+//
+//=======================================================================================
+//
+// Whether a PNG decodes to the bottom-up RGB8 image it was encoded from
+static bool pngMatches (const unsigned char *png, size_t size, int width, int height, const std::vector<unsigned char> &reference)
+{
+	png_image image;
+	memset(&image, 0, sizeof(image));
+	image.version = PNG_IMAGE_VERSION;
+	if (!png_image_begin_read_from_memory(&image, png, size))
+		return false;
+	if ((int) image.width != width || (int) image.height != height)
+	{
+		png_image_free(&image);
+		return false;
+	}
+	image.format = PNG_FORMAT_RGB;
+	std::vector<unsigned char> rgb(PNG_IMAGE_SIZE(image));
+	// a negative stride stores the rows bottom-up
+	if (!png_image_finish_read(&image, 0, rgb.data(), -(png_int_32)(width * 3), 0))
+		return false;
+	return rgb == reference;
+}
+//
+//=======================================================================================
+//
+static long fileSize (const char *filename)
+{
+	FILE *fp = fopen(filename, "rb");
+	if (!fp)
+		return -1;
+	fseek(fp, 0, SEEK_END);
+	long size = ftell(fp);
+	fclose(fp);
+	return size;
+}
+//
+//=======================================================================================
+//
+// MB/s of raw RGB and compression ratio of snapshots written by libpng (cPNGEncoder, level 3, no
+// filter) and by cParallelPngEncoder, at 1080p and 8K, on the synthetic frame and on the same
+// frame with the noise of an image still converging
+static int benchmarkPng (int argc, char **argv)
+{
+	const int		sizes[][2]	= { { 1920, 1088 }, { 7680, 4320 } };
+	const int		numSizes	= argc >= 3 ? 1 : 2;
+	const char		*filename	= "Sight_bench.png";
+	std::mt19937	rng(1234);
+
+	std::cout << "threads: " << std::max(1u, std::thread::hardware_concurrency()) << "\n";
+	for (int s = 0; s < numSizes; s++)
+	{
+		const int		width	= argc >= 3 ? atoi(argv[1]) : sizes[s][0];
+		const int		height	= argc >= 3 ? atoi(argv[2]) : sizes[s][1];
+		const double	rawMB	= (double) width * height * 3 / 1e6;
+		const int		frames	= rawMB > 20.0 ? 2 : 5;
+
+		std::vector<unsigned char> images[2];
+		syntheticFrame(width, height, images[0]);
+		images[1] = images[0];
+		std::uniform_int_distribution<int> noise(-3, 3);
+		for (size_t i = 0; i < images[1].size(); i++)
+			images[1][i] = (unsigned char) std::min(std::max(images[1][i] + noise(rng), 0), 255);
+
+		for (int i = 0; i < 2; i++)
+		{
+			std::cout << width << "x" << height << (i == 0 ? ", discs" : ", discs + noise") << ", " << frames << " frames\n";
+
+			cPNGEncoder single;
+			single.setImageParams(width, height);
+			single.initEncoder();
+			cTimer timer;
+			for (int f = 0; f < frames; f++)
+				single.savePNG(filename, images[i].data());
+			double seconds = timer.getElapsedSeconds() / frames;
+			printf("  libpng, level 3, no filter    : %8.1f MB/s   ratio %6.2f\n", rawMB / seconds, rawMB * 1e6 / fileSize(filename));
+
+			const int levels[] = { 3, PPNG_COMPRESSION_LEVEL };
+			for (int l = 0; l < 2; l++)
+			{
+				cParallelPngEncoder parallel;
+				parallel.setImageParams(width, height);
+				parallel.setCompressionLevel(levels[l]);
+				if (!parallel.initEncoder() || !parallel.encode(images[i].data()))
+				{
+					return 1;
+				}
+				const bool matches = pngMatches(parallel.getImg(), parallel.getSize(), width, height, images[i]);
+				timer.reset();
+				for (int f = 0; f < frames; f++)
+					parallel.savePNG(filename, images[i].data());
+				seconds = timer.getElapsedSeconds() / frames;
+				printf("  parallel, level %d, adaptive   : %8.1f MB/s   ratio %6.2f   %d blocks%s\n", levels[l], rawMB / seconds,
+					   rawMB * 1e6 / parallel.getSize(), parallel.numBlocks(), matches ? "" : "   DOES NOT DECODE TO THE IMAGE");
+				if (!matches)
+				{
+					remove(filename);
+					return 1;
+				}
+			}
+		}
+	}
+	remove(filename);
+	return 0;
+}
+//
+//=======================================================================================
+//
+// ns per sample recorded by LatencyStats from 1 to n threads at once, against an AverageStats add
+// that would lose samples to the races, and its percentiles against the exact ones of
+// log-normal latencies around 5 ms
+static int benchmarkLatency (int argc, char **argv)
+{
+	const unsigned int	maxThreads	= argc >= 2 ? std::max(atoi(argv[1]), 1) : std::max(2u, std::thread::hardware_concurrency());
+	const size_t		samples		= 1 << 22;
+	std::mt19937		rng(1234);
+	std::lognormal_distribution<double> distribution(std::log(5000.0), 0.5);
+
+	std::vector<uint64_t> values(samples);
+	for (size_t i = 0; i < samples; i++)
+		values[i] = (uint64_t) distribution(rng);
+
+	AverageStats average;
+	cTimer timer;
+	for (size_t i = 0; i < samples; i++)
+		average.add(values[i] * 0.001f);
+	printf("AverageStats, 1 thread: %6.2f ns/sample (%.3f ms)\n", timer.getElapsedSeconds() * 1e9 / samples, average.getAverage(0.0f));
+
+	printf("threads   ns/sample   ns/sample/thread\n");
+	for (unsigned int threads = 1; threads <= maxThreads; threads *= 2)
+	{
+		LatencyStats				stats;
+		std::vector<std::thread>	workers;
+		const size_t				share = samples / threads;
+		timer.reset();
+		for (unsigned int t = 0; t < threads; t++)
+		{
+			workers.push_back(std::thread([&stats, &values, share, t]
+			{
+				for (size_t i = t * share; i < (t + 1) * share; i++)
+					stats.record(values[i]);
+			}));
+		}
+		for (auto &worker : workers)
+			worker.join();
+		const double ns = timer.getElapsedSeconds() * 1e9 / (share * threads);
+		stats.rotate();
+		if (stats.getSummary(1).count != share * threads)
+		{
+			printf("%u threads: %llu samples recorded of %llu\n", threads, (unsigned long long) stats.getSummary(1).count,
+				   (unsigned long long) (share * threads));
+			return 1;
+		}
+		printf("%7u   %9.2f   %16.2f\n", threads, ns, ns * threads);
+	}
+
+	// the samples spread over windows, summarized over all of them
+	LatencyStats stats;
+	const unsigned int windows = LATENCY_WINDOWS - 1;
+	for (unsigned int w = 0; w < windows; w++)
+	{
+		for (size_t i = w * samples / windows; i < (w + 1) * samples / windows; i++)
+			stats.record(values[i]);
+		stats.rotate();
+	}
+	const LatencyStats::Summary summary = stats.getSummary(windows);
+	std::sort(values.begin(), values.end());
+	const double	percentiles[]	= { 0.50, 0.90, 0.99 };
+	const float		reported[]		= { summary.p50, summary.p90, summary.p99 };
+	printf("percentile   exact ms   reported ms   error\n");
+	for (int i = 0; i < 3; i++)
+	{
+		const double exact = values[(size_t) std::ceil(percentiles[i] * samples) - 1] * 0.001;
+		printf("       p%2d   %8.3f   %11.3f   %4.1f%%\n", (int)(percentiles[i] * 100), exact, reported[i], 100.0 * (reported[i] - exact) / exact);
+	}
+	printf("       max   %8.3f   %11.3f\n", values.back() * 0.001, summary.max);
+	return 0;
+}
+//
+//=======================================================================================
+//
+// Calls of cRenderScheduler::wait() while nobody streams, after a wake-up and with wake-ups
+// coming from another thread: each should sleep until the next wake-up or for
+// RENDER_IDLE_POLL_MS, not return at once. A wake-up left from the idle time still gets its
+// frame once a client streams.
+static int benchmarkIdle (int argc, char **argv)
+{
+	const double	ms			= argc >= 2 ? atof(argv[1]) : 1000.0;
+	const double	wakeMs		= 50.0;
+	bool			failed		= false;
+
+	for (int waking = 0; waking < 2; waking++)
+	{
+		cRenderScheduler	scheduler(0);
+		std::atomic<bool>	quit(false);
+		std::thread			waker;
+
+		// a connection opened while nobody streams
+		scheduler.wake();
+		if (waking)
+		{
+			waker = std::thread([&scheduler, &quit, wakeMs]
+			{
+				while (!quit)
+				{
+					std::this_thread::sleep_for(std::chrono::milliseconds((int) wakeMs));
+					scheduler.wake();
+				}
+			});
+		}
+		unsigned int	calls	= 0;
+		unsigned int	frames	= 0;
+		cTimer			timer;
+		const clock_t	cpu		= clock();
+		while (timer.getElapsedMilliseconds() < ms)
+		{
+			frames += scheduler.wait(false, 0) ? 1 : 0;
+			calls++;
+		}
+		const double cpuMs		= 1000.0 * (clock() - cpu) / CLOCKS_PER_SEC;
+		const double elapsed	= timer.getElapsedMilliseconds();
+		quit = true;
+		if (waker.joinable())
+			waker.join();
+
+		// sleeps of RENDER_IDLE_POLL_MS, or ended by a wake-up every wakeMs, and some slack
+		const double	sleep		= waking ? wakeMs : RENDER_IDLE_POLL_MS;
+		const unsigned int expected	= (unsigned int)(elapsed / sleep) + 1;
+		const bool		pending		= scheduler.wait(true, 0);
+		printf("%-26s %8.0f ms   %6u calls (%u expected)   %8.1f ms CPU   frames while idle %u   frame once streaming %s\n",
+			   waking ? "idle, woken every 50 ms:" : "idle:", elapsed, calls, expected, cpuMs, frames, pending ? "yes" : "NO");
+		if (calls > 2 * expected || frames > 0 || !pending)
+			failed = true;
+	}
+	if (failed)
+	{
+		printf("the idle scheduler does not sleep\n");
+		return 1;
+	}
+	return 0;
+}
+//
+//=======================================================================================
+//
+// Top-down RGB8 pixels of a PNG file
+static bool pngRead (const char *filename, int &width, int &height, std::vector<unsigned char> &rgb)
+{
+	png_image image;
+	memset(&image, 0, sizeof(image));
+	image.version = PNG_IMAGE_VERSION;
+	if (!png_image_begin_read_from_file(&image, filename))
+		return false;
+	image.format	= PNG_FORMAT_RGB;
+	width			= (int) image.width;
+	height			= (int) image.height;
+	rgb.resize(PNG_IMAGE_SIZE(image));
+	return png_image_finish_read(&image, 0, rgb.data(), 0, 0) != 0;
+}
+//
+//=======================================================================================
+//
+// Frame 0 of a batch of the initial view against a poster of that view in one tile, both
+// rendered by the CPU backend: the files have to be the same image, the same way up
+static int benchmarkOffline (int argc, char **argv)
+{
+	std::vector<float>	pos;
+	float				min[4], max[4];
+	const int			width = 480, height = 272;
+	const unsigned int	samples = 4;
+	const char			*pathFile = "Sight_bench_path.txt", *posterFile = "Sight_bench_poster.png";
+	const char			*batchFile = "Sight_Batch_00000.png";
+
+	if (!benchmarkParticles(argc, argv, pos, min, max, NUM_PARTICLES_PER_GROUP))
+	{
+		return 1;
+	}
+	cMemoryParticleSource	source;
+	cCpuParticlesRenderer	renderer;
+	source.set(pos.data(), pos.size() / 4, min, max);
+	renderer.init(width, height, &source);
+
+	float eye[3], lookAt[3], up[3], fov;
+	renderer.getCamera(eye, lookAt, up, fov);
+	FILE *fp = fopen(pathFile, "w");
+	if (!fp)
+		return 1;
+	fprintf(fp, "0 %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %u\n", eye[0], eye[1], eye[2],
+			lookAt[0], lookAt[1], lookAt[2], up[0], up[1], up[2], fov, samples);
+	fclose(fp);
+
+	cTimer timer;
+	const bool rendered = renderPoster(&renderer, width, height, samples, posterFile) &&
+						  renderBatch(&renderer, pathFile, samples);
+	const double ms = timer.getElapsedMilliseconds();
+
+	std::vector<unsigned char>	poster, batch;
+	int							posterW = 0, posterH = 0, batchW = 0, batchH = 0;
+	const bool					read = rendered && pngRead(posterFile, posterW, posterH, poster) &&
+									   pngRead(batchFile, batchW, batchH, batch);
+	remove(pathFile);
+	remove(posterFile);
+	remove(batchFile);
+	if (!read || posterW != batchW || posterH != batchH)
+	{
+		printf("the poster and the batch frame could not be rendered or read\n");
+		return 1;
+	}
+
+	// differences to the poster and to the poster upside down, which an asymmetric view tells apart
+	const size_t stride = (size_t) width * 3;
+	uint64_t same = 0, flipped = 0;
+	for (int y = 0; y < height; y++)
+	{
+		for (size_t x = 0; x < stride; x++)
+		{
+			const int v = batch[y * stride + x];
+			same	+= std::abs(v - poster[y * stride + x]);
+			flipped	+= std::abs(v - poster[(height - 1 - y) * stride + x]);
+		}
+	}
+	printf("%dx%d, %u samples, %.0f ms: mean difference to the poster %.3f, to the poster upside down %.3f\n",
+		   width, height, samples, ms, (double) same / batch.size(), (double) flipped / batch.size());
+	if (same != 0 || flipped == 0)
+	{
+		printf("the batch frame is not the poster image%s\n", same > flipped ? ", it is upside down" : "");
+		return 1;
+	}
+	return 0;
+}
+//
+//=======================================================================================
+//
+// parseFloat against strtof on decimals of 6 to 9 digits and on decimals next to the point
+// halfway between two floats, where rounding to double and then to float can round twice. Fails
+// on any difference; the second count is what a double converted to float would have got wrong.
+static int benchmarkParse (int argc, char **argv)
+{
+	const int			count	= argc >= 2 ? atoi(argv[1]) : 1000000;
+	std::mt19937		rng(7);
+	std::string			text;
+	char				buf[64];
+
+	for (int i = 0; i < count; i++)
+	{
+		float f;
+		do
+		{
+			uint32_t bits = rng();
+			memcpy(&f, &bits, sizeof(f));
+		}
+		while (!std::isfinite(f) || std::fabs(f) < 1e-20f || std::fabs(f) > 1e30f);
+
+		if (i & 1)
+		{
+			// the midpoint to the next float, exact in a double, printed to 15 or 16 digits
+			const double mid = ((double) f + (double) nextafterf(f, INFINITY)) * 0.5;
+			snprintf(buf, sizeof(buf), "%.*g ", 15 + (i >> 1) % 2, mid);
+		}
+		else
+		{
+			snprintf(buf, sizeof(buf), "%.*g ", 6 + (i >> 1) % 4, f);
+		}
+		text += buf;
+	}
+
+	const char			*end = text.data() + text.size();
+	std::vector<float>	fast(count), slow(count);
+	int					mismatches = 0, twice = 0;
+
+	cTimer timer;
+	const char *ptr = text.data();
+	for (int i = 0; i < count; i++)
+		fast[i] = parseFloat(ptr, end);
+	const double fastMs = timer.getElapsedMilliseconds();
+
+	timer.reset();
+	char *next = (char *) text.data();
+	for (int i = 0; i < count; i++)
+		slow[i] = strtof(next, &next);
+	const double slowMs = timer.getElapsedMilliseconds();
+
+	next = (char *) text.data();
+	for (int i = 0; i < count; i++)
+	{
+		const char *token = next;
+		strtod(next, &next);
+		if ((float) strtod(token, 0) != slow[i])
+			twice++;
+		if (memcmp(&fast[i], &slow[i], sizeof(float)) != 0)
+		{
+			if (mismatches++ < 10)
+				printf("%.*s: parseFloat %.9g, strtof %.9g\n", (int)(next - token), token, fast[i], slow[i]);
+		}
+	}
+	printf("%d numbers, %d rounded wrongly by double then float: parseFloat %.1f ns, strtof %.1f ns per number, "
+		   "%d differences\n", count, twice, fastMs * 1e6 / count, slowMs * 1e6 / count, mismatches);
+	return mismatches == 0 ? 0 : 1;
+}
+//
+//=======================================================================================
+//
+static const sBenchmark benchmarks[] =
+{
+	{ "sort",	"[file decimation | numParticles]",	benchmarkSort },
+	{ "bvh",	"[file decimation | numParticles]",	benchmarkBVH },
+	{ "rays",	"[file decimation | numParticles]",	benchmarkRays },
+	{ "jpeg",	"[width height]",					benchmarkJpeg },
+	{ "pixels",	"[width height]",					benchmarkPixels },
+	{ "resample",	"[width height]",				benchmarkResample },
+	{ "rate",	"[base RTT ms]",					benchmarkRate },
+	{ "tiles",	"[file decimation | numParticles]",	benchmarkTiles },
+	{ "fanout",	"[frame KB]",						benchmarkFanout },
+	{ "png",	"[width height]",					benchmarkPng },
+	{ "latency",	"[threads]",					benchmarkLatency },
+	{ "idle",	"[ms]",								benchmarkIdle },
+	{ "offline",	"[file decimation | numParticles]",	benchmarkOffline },
+	{ "parse",	"[count]",							benchmarkParse },
+};
+
+int runBenchmark (int argc, char **argv)
+{
+	const size_t numBenchmarks = sizeof(benchmarks) / sizeof(benchmarks[0]);
+
+	for (size_t i = 0; argc > 0 && i < numBenchmarks; i++)
+	{
+		if (strcmp(argv[0], benchmarks[i].name) == 0)
+		{
+			return benchmarks[i].run(argc, argv);
+		}
+	}
+
+	std::cout << "\n Benchmarks: \n";
+	for (size_t i = 0; i < numBenchmarks; i++)
+	{
+		std::cout << "\t\t sight -bench " << benchmarks[i].name << " " << benchmarks[i].usage << "\n";
+	}
+	std::cout << std::endl;
+	return 1;
+}
@@ -0,0 +1,198 @@
+/*
+ * Distributed under the OSI-approved Apache License, Version 2.0.  See
+ * accompanying file Copyright.txt for details.
+ */
+
+#include <iostream>
+#include <vector>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "../header/loaders.h"
+#include "../header/cAsciiParticleSource.h"
+
+cAsciiParticleSource::cAsciiParticleSource ( )
+{
+	m_fd			= -1;
+	m_decimation	= 1;
+	m_begin			= 0;
+	m_end			= 0;
+	m_eof			= true;
+	m_record		= 0;
+	m_numParticles	= 0;
+	memset(m_min, 0, sizeof(m_min));
+	memset(m_max, 0, sizeof(m_max));
+}
+
+cAsciiParticleSource::~cAsciiParticleSource ( )
+{
+	close ();
+}
+//
+//=======================================================================================
+//
+bool cAsciiParticleSource::open (const std::string &filename, unsigned int decimation)
+{
+	close ();
+
+	m_fd = ::open(filename.c_str(), O_RDONLY);
+	if (m_fd < 0)
+	{
+		return false;
+	}
+	posix_fadvise(m_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	m_decimation = decimation > 0 ? decimation : 1;
+	m_buffer.resize(ASCII_SOURCE_BUFFER_SIZE);
+
+	std::cout << "Scanning " << filename << std::endl;
+
+	// first pass: particle count and bounds
+	const char	*line, *lineEnd;
+	float		record[4];
+	rewind ();
+	while (nextLine(line, lineEnd))
+	{
+		if (m_record++ % m_decimation != 0)
+			continue;
+
+		parseRecord(line, lineEnd, record);
+		for (int c = 0; c < 4; c++)
+		{
+			m_min[c] = m_numParticles == 0 ? record[c] : Min<float> (record[c], m_min[c]);
+			m_max[c] = m_numParticles == 0 ? record[c] : Max<float> (record[c], m_max[c]);
+		}
+		m_numParticles++;
+	}
+
+	std::cout << "Num atoms: " 			<< " " << m_numParticles << std::endl;
+	std::cout << "Min = {" << m_min[0] 	<< ", " << m_min[1] << ", " << m_min[2] << " } \n";
+	std::cout << "Max = {" << m_max[0] 	<< ", " << m_max[1] << ", " << m_max[2] << " } \n";
+	std::cout << "Energy min: " << m_min[3] << " Energy max: " << m_max[3] << std::endl;
+
+	return rewind ();
+}
+//
+//=======================================================================================
+//
+void cAsciiParticleSource::close ( )
+{
+	if (m_fd >= 0)
+	{
+		::close(m_fd);
+	}
+	m_fd			= -1;
+	m_numParticles	= 0;
+	m_eof			= true;
+	std::vector<char>().swap(m_buffer);
+}
+//
+//=======================================================================================
+//
+bool cAsciiParticleSource::rewind ( )
+{
+	if (m_fd < 0 || lseek(m_fd, 0, SEEK_SET) != 0)
+	{
+		return false;
+	}
+	m_begin		= 0;
+	m_end		= 0;
+	m_eof		= false;
+	m_record	= 0;
+	return true;
+}
+//
+//=======================================================================================
+//
+size_t cAsciiParticleSource::read (float *dst, size_t maxParticles)
+{
+	const char	*line, *lineEnd;
+	size_t		n = 0;
+
+	while (n < maxParticles && nextLine(line, lineEnd))
+	{
+		if (m_record++ % m_decimation != 0)
+			continue;
+
+		parseRecord(line, lineEnd, dst);
+		dst += 4;
+		n++;
+	}
+	return n;
+}
+//
+//=======================================================================================
+//
+// Moves the unread tail to the front of the buffer and appends more data from the file
+bool cAsciiParticleSource::fillBuffer ( )
+{
+	if (m_eof)
+	{
+		return false;
+	}
+
+	size_t tail = m_end - m_begin;
+	memmove(m_buffer.data(), m_buffer.data() + m_begin, tail);
+	m_begin	= 0;
+	m_end	= tail;
+
+	// a single line larger than the buffer
+	if (m_end == m_buffer.size())
+	{
+		m_buffer.resize(m_buffer.size() * 2);
+	}
+
+	ssize_t bytes = ::read(m_fd, m_buffer.data() + m_end, m_buffer.size() - m_end);
+	if (bytes <= 0)
+	{
+		m_eof = true;
+		return false;
+	}
+	m_end += bytes;
+	return true;
+}
+//
+//=======================================================================================
+//
+// Returns the next line holding a record, blank lines are skipped
+bool cAsciiParticleSource::nextLine (const char *&line, const char *&lineEnd)
+{
+	for (;;)
+	{
+		const char *begin	= m_buffer.data() + m_begin;
+		const char *end		= m_buffer.data() + m_end;
+		const char *eol		= (const char *) memchr(begin, '\n', end - begin);
+
+		if (!eol && !m_eof)
+		{
+			fillBuffer ();
+			continue;
+		}
+		if (!eol && begin == end)
+		{
+			return false;
+		}
+
+		lineEnd	= eol ? eol : end;
+		m_begin	= (lineEnd - m_buffer.data()) + (eol ? 1 : 0);
+
+		line = begin;
+		while (line < lineEnd && (*line == ' ' || *line == '\t' || *line == '\r'))
+			line++;
+		if (line < lineEnd)
+		{
+			return true;
+		}
+	}
+}
+//
+//=======================================================================================
+//
+void cAsciiParticleSource::parseRecord (const char *line, const char *lineEnd, float *dst)
+{
+	// record fields are stored in reverse order: z y x energy
+	dst[2] = parseFloat(line, lineEnd);
+	dst[1] = parseFloat(line, lineEnd);
+	dst[0] = parseFloat(line, lineEnd);
+	dst[3] = parseFloat(line, lineEnd);
+}
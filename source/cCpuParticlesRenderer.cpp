@@ -0,0 +1,540 @@
+/*
+ * Distributed under the OSI-approved Apache License, Version 2.0.  See
+ * accompanying file Copyright.txt for details.
+ */
+
+#include <iostream>
+#include <random>
+#include <chrono>
+#include <string.h>
+#include <algorithm>
+#include "../frameserver/header/cMouseEventHandler.h"
+#include "../frameserver/header/cKeyboardHandler.h"
+#include "../frameserver/header/cTimer.h"
+#include "../header/cCpuParticlesRenderer.h"
+#include "../header/cParticleSource.h"
+#include "../header/cColorTable.h"
+
+#define CPU_PI		3.14159265358979323846f
+
+// Random numbers of shaders/random.h
+static inline unsigned int lcg (unsigned int &prev)
+{
+	const unsigned int LCG_A = 1664525u;
+	const unsigned int LCG_C = 1013904223u;
+	prev = (LCG_A * prev + LCG_C);
+	return prev & 0x00FFFFFF;
+}
+
+static inline float rnd (unsigned int &prev)
+{
+	return ((float) lcg(prev) / (float) 0x01000000);
+}
+//
+//=======================================================================================
+//
+// optix::cosine_sample_hemisphere followed by optix::Onb::inverse_transform around n
+static inline sVec3 cosineSampleHemisphere (float u1, float u2, const sVec3 &n)
+{
+	const float r	= sqrtf(u1);
+	const float phi	= 2.0f * CPU_PI * u2;
+	const float x	= r * cosf(phi);
+	const float y	= r * sinf(phi);
+	const float z	= sqrtf(std::max(0.0f, 1.0f - x*x - y*y));
+
+	sVec3 binormal	= fabsf(n.x) > fabsf(n.z) ? makeVec3(-n.y, n.x, 0.0f) : makeVec3(0.0f, -n.z, n.y);
+	binormal		= normalize(binormal);
+	sVec3 tangent	= cross(binormal, n);
+
+	return x * tangent + y * binormal + z * n;
+}
+//
+//=======================================================================================
+//
+// sutil::calculateCameraVariables with a horizontal field of view
+static void calculateCameraVariables (const sVec3 &eye, const sVec3 &lookAt, const sVec3 &up, float fov,
+									  float ratio, sVec3 &U, sVec3 &V, sVec3 &W)
+{
+	W = lookAt - eye;
+	float wlen	= length(W);
+	U			= normalize(cross(W, up));
+	V			= normalize(cross(U, W));
+	float ulen	= wlen * tanf(0.5f * fov * CPU_PI / 180.0f);
+	U			= U * ulen;
+	V			= V * (ulen / ratio);
+}
+//
+//=======================================================================================
+//
+// Arcball::rotate
+static sMat3 arcballRotate (float fromX, float fromY, float toX, float toY)
+{
+	const float center = 0.5f, radius = 0.45f;
+	sVec3 p[2];
+	float v[2][2] = { { fromX, fromY }, { toX, toY } };
+
+	for (int i = 0; i < 2; i++)
+	{
+		float x		= (v[i][0] - center) / radius;
+		float y		= (1.0f - v[i][1] - center) / radius;
+		float z		= 0.0f;
+		float len2	= x*x + y*y;
+		if (len2 > 1.0f)
+		{
+			float len = sqrtf(len2);
+			x /= len;
+			y /= len;
+		}
+		else
+		{
+			z = sqrtf(1.0f - len2);
+		}
+		p[i] = makeVec3(x, y, z);
+	}
+
+	sVec3	c	= cross(p[0], p[1]);
+	float	qw	= dot(p[0], p[1]), qx = c.x, qy = c.y, qz = c.z;
+	float	n	= sqrtf(qw*qw + qx*qx + qy*qy + qz*qz);
+	qw /= n; qx /= n; qy /= n; qz /= n;
+
+	sMat3 m = {{
+		1.0f - 2.0f*qy*qy - 2.0f*qz*qz,	2.0f*qx*qy - 2.0f*qz*qw,		2.0f*qx*qz + 2.0f*qy*qw,
+		2.0f*qx*qy + 2.0f*qz*qw,		1.0f - 2.0f*qx*qx - 2.0f*qz*qz,	2.0f*qy*qz - 2.0f*qx*qw,
+		2.0f*qx*qz - 2.0f*qy*qw,		2.0f*qy*qz + 2.0f*qx*qw,		1.0f - 2.0f*qx*qx - 2.0f*qy*qy }};
+	return m;
+}
+//
+//=======================================================================================
+//
+cCpuParticlesRenderer::cCpuParticlesRenderer ( )
+{
+	m_width			= 1280;
+	m_height		= 720;
+	m_renderWidth	= m_width;
+	m_renderHeight	= m_height;
+	m_frameAccum	= 0;
+	m_tilesX		= 0;
+	m_tilesY		= 0;
+	m_hfov			= 60.0f;
+	m_ratio			= 1.0f;
+	m_eye			= makeVec3(0.0f, 0.0f, 100.0f);
+	m_lookAt		= makeVec3(0.0f, 0.0f, 0.0f);
+	m_up			= makeVec3(0.0f, 1.0f, 0.0f);
+	m_rotate		= identity3();
+	m_mouseH		= 0;
+	m_keyboardHandler = 0;
+
+	m_energyMin				= 0.0f;
+	m_energyMax				= 1.0f;
+	m_bgColor				= makeVec3(0.95f, 0.95f, 0.95f);
+	m_sceneEpsilon			= 1.0f;
+	m_occlusionDistance		= 20.0f;
+	m_sqrtOcclusionSamples	= 1;
+	m_phongExp				= 200.0f;
+	m_jitterFactor			= 1.0f;
+}
+
+cCpuParticlesRenderer::~cCpuParticlesRenderer ( )
+{
+}
+//
+//=======================================================================================
+//
+void cCpuParticlesRenderer::init (int width, int height, cParticleSource *source)
+{
+	const float *min = source->min();
+	const float *max = source->max();
+
+	m_width		= width;
+	m_height	= height;
+	m_hfov		= 60.0f;
+	m_ratio		= static_cast<float>(m_width) / static_cast<float>(m_height);
+	m_renderWidth	= 0;
+	setRenderScale (100);
+
+	// same camera setup as the OptiX renderer
+	sVec3 center	= makeVec3((min[0] + max[0]) * 0.5f, (min[1] + max[1]) * 0.5f, (min[2] + max[2]) * 0.5f);
+	float max_dim	= std::max(max[1] - min[1], max[2] - min[2]);
+	m_eye			= center + makeVec3(0.0f, 0.0f, max_dim * 5.0f);
+	m_lookAt		= center;
+	calculateCameraVariables(m_eye, m_lookAt, m_up, m_hfov, m_ratio, m_U, m_V, m_W);
+
+	// lights of createMaterial
+	m_lights[0].pos			= makeVec3(min);
+	m_lights[0].castsShadow	= false;
+	m_lights[1].pos			= makeVec3(max);
+	m_lights[1].castsShadow	= true;
+	m_lights[2].pos			= makeVec3(0.0f, 0.0f, 0.0f);
+	m_lights[2].castsShadow	= false;
+	for (int i = 0; i < 3; i++)
+	{
+		m_lights[i].color	= makeVec3(1.0f, 1.0f, 1.0f);
+	}
+
+	double		color[3*CPU_NUM_COLORS];
+	cColorTable	colorTab ("orange");
+	colorTab.Sample (CPU_NUM_COLORS, color);
+	for (int i = 0; i < 3*CPU_NUM_COLORS; i++)
+	{
+		m_colors[i] = (float) color[i];
+	}
+	m_energyMin = min[3];
+	m_energyMax = max[3];
+
+	std::vector<float> pos(source->numParticles() * 4);
+	size_t loaded = 0, n;
+	source->rewind();
+	while (loaded < source->numParticles() &&
+		   (n = source->read(&pos[loaded * 4], source->numParticles() - loaded)) > 0)
+	{
+		loaded += n;
+	}
+	pos.resize(loaded * 4);
+
+	cTimer timer;
+	m_bvh.buildLBVH(pos.data(), loaded, 2.0f, m_pool);
+	m_wideBVH.build(m_bvh);
+	std::cout << "CPU renderer: " << loaded << " particles, BVH with " << m_bvh.nodes().size()
+			  << " nodes built in " << timer.getElapsedMilliseconds() << " ms, "
+			  << m_pool.size() << " threads, " << (m_wideBVH.simd() ? "AVX2" : "scalar") << " packets" << std::endl;
+
+	std::mt19937 rng(7654321u);
+	m_seeds.resize((size_t)m_width * m_height);
+	for (size_t i = 0; i < m_seeds.size(); i++)
+	{
+		m_seeds[i] = rng();
+	}
+	m_accum.assign((size_t)m_width * m_height, makeVec3(0.0f, 0.0f, 0.0f));
+	m_output.assign((size_t)m_width * m_height * 3, 0);
+	resetAccumulation ();
+}
+//
+//=======================================================================================
+//
+void cCpuParticlesRenderer::setMouseHandler (cMouseHandler *mouseH)
+{
+	m_mouseH = mouseH;
+}
+//
+//=======================================================================================
+//
+void cCpuParticlesRenderer::setKeyboardHandler (cKeyboardHandler *keyHandler)
+{
+	m_keyboardHandler = keyHandler;
+}
+//
+//=======================================================================================
+//
+void cCpuParticlesRenderer::updateCamera ( )
+{
+	calculateCameraVariables(m_eye, m_lookAt, m_up, m_hfov, m_ratio, m_U, m_V, m_W);
+
+	// rotation about lookAt in the camera frame, applied twice as in cOptixParticlesRenderer
+	const sMat3 frame	= fromBasis(normalize(m_U), normalize(m_V), normalize(-m_W));
+	const sMat3 trans	= frame * m_rotate * m_rotate * transpose(frame);
+
+	m_eye	= m_lookAt + trans * (m_eye - m_lookAt);
+	m_up	= trans * m_up;
+
+	calculateCameraVariables(m_eye, m_lookAt, m_up, m_hfov, m_ratio, m_U, m_V, m_W);
+
+	m_rotate = identity3();
+}
+//
+//=======================================================================================
+//
+void cCpuParticlesRenderer::updateView ( )
+{
+	static int lastX=0, lastY=0;
+	switch (m_mouseH->getButton())
+	{
+	case cMouseHandler::LEFT_BUTTON:
+		if (m_mouseH->getState()==cMouseHandler::DOWN)
+		{
+			m_rotate = arcballRotate((float) m_mouseH->getX() / m_width, (float) m_mouseH->getY() / m_height,
+									 (float) lastX / m_width, (float) lastY / m_height);
+			updateCamera ();
+			resetAccumulation();
+		}
+		break;
+	case cMouseHandler::RIGHT_BUTTON:
+		if (m_mouseH->getState()==cMouseHandler::DOWN)
+		{
+			const float dx = static_cast<float>( m_mouseH->getX() - lastX ) /
+							 static_cast<float>( m_width );
+			const float dy = static_cast<float>( m_mouseH->getY() - lastY ) /
+							 static_cast<float>( m_height );
+			const float dmax = fabsf( dx ) > fabsf( dy ) ? dx : dy;
+			const float scale = std::min( dmax, 10.0f );
+			m_eye = m_eye + (m_lookAt - m_eye)*scale;
+
+			updateCamera ();
+			resetAccumulation();
+		}
+		break;
+	case cMouseHandler::MIDDLE_BUTTON:
+		break;
+	}
+
+	lastX = m_mouseH->getX();
+	lastY = m_mouseH->getY();
+}
+//
+//=======================================================================================
+//
+void cCpuParticlesRenderer::resetAccumulation ( )
+{
+	m_frameAccum = 0;
+}
+//
+//=======================================================================================
+//
+void cCpuParticlesRenderer::setRenderScale (unsigned int percent)
+{
+	percent			= std::min(std::max(percent, 1u), 100u);
+	int width		= std::max(1, m_width  * (int) percent / 100);
+	int height		= std::max(1, m_height * (int) percent / 100);
+	if (width == m_renderWidth && height == m_renderHeight)
+		return;
+
+	setRenderSize (width, height);
+	resetAccumulation ();
+}
+//
+//=======================================================================================
+//
+void cCpuParticlesRenderer::setCamera (const float *eye, const float *lookAt, const float *up, float fov)
+{
+	m_eye		= makeVec3(eye);
+	m_lookAt	= makeVec3(lookAt);
+	m_up		= makeVec3(up);
+	m_hfov		= fov;
+	calculateCameraVariables(m_eye, m_lookAt, m_up, m_hfov, m_ratio, m_U, m_V, m_W);
+	resetAccumulation ();
+}
+//
+//=======================================================================================
+//
+void cCpuParticlesRenderer::getCamera (float *eye, float *lookAt, float *up, float &fov)
+{
+	eye[0]		= m_eye.x;		eye[1]		= m_eye.y;		eye[2]		= m_eye.z;
+	lookAt[0]	= m_lookAt.x;	lookAt[1]	= m_lookAt.y;	lookAt[2]	= m_lookAt.z;
+	up[0]		= m_up.x;		up[1]		= m_up.y;		up[2]		= m_up.z;
+	fov			= m_hfov;
+}
+//
+//=======================================================================================
+//
+// the buffers keep their size, a smaller image is packed at their start
+void cCpuParticlesRenderer::setRenderSize (int width, int height)
+{
+	m_renderWidth	= width;
+	m_renderHeight	= height;
+	m_tilesX		= (m_renderWidth  + CPU_TILE_SIZE - 1) / CPU_TILE_SIZE;
+	m_tilesY		= (m_renderHeight + CPU_TILE_SIZE - 1) / CPU_TILE_SIZE;
+}
+//
+//=======================================================================================
+//
+// The rays of a frame the size of the window span its part of the poster's view: U and V shrink
+// to the window, W points at its center
+bool cCpuParticlesRenderer::renderRegion (int posterWidth, int posterHeight, int x, int y, int width, int height,
+										  unsigned int samples, unsigned char *img)
+{
+	if (width <= 0 || height <= 0 || width > m_width || height > m_height)
+		return false;
+
+	const sVec3	U = m_U, V = m_V, W = m_W;
+	const int	renderWidth = m_renderWidth, renderHeight = m_renderHeight;
+	// launch y grows upwards
+	const sVec3	posterV	= V * (m_ratio * posterHeight / posterWidth);
+	const float	bottom	= (float)(posterHeight - y - height);
+
+	m_U = U * ((float) width / posterWidth);
+	m_V = posterV * ((float) height / posterHeight);
+	m_W = W + U * ((2.0f * x + width) / posterWidth - 1.0f) + posterV * ((2.0f * bottom + height) / posterHeight - 1.0f);
+	setRenderSize (width, height);
+	resetAccumulation ();
+
+	for (unsigned int s = 0; s < std::max(samples, 1u); s++)
+	{
+		m_pool.run(m_tilesX * m_tilesY, [this](unsigned int tile)
+		{
+			renderTile(tile);
+		});
+		m_frameAccum++;
+	}
+	getPixels (img);
+
+	m_U = U;
+	m_V = V;
+	m_W = W;
+	setRenderSize (renderWidth, renderHeight);
+	resetAccumulation ();
+	return true;
+}
+//
+//=======================================================================================
+//
+void cCpuParticlesRenderer::display (unsigned char *pixels)
+{
+	// input queued by the network thread since the last frame, drags coalesced per button state
+	while (m_mouseH && m_mouseH->poll())
+	{
+		updateView ();
+	}
+	while (m_keyboardHandler && m_keyboardHandler->poll())
+	{
+	}
+
+	m_pool.run(m_tilesX * m_tilesY, [this](unsigned int tile)
+	{
+		renderTile(tile);
+	});
+	m_frameAccum++;
+}
+//
+//=======================================================================================
+//
+// pinhole_camera for every pixel of the tile. Primary rays are traced in packets of
+// PACKET_SIZE pixels of a row, shading rays one at a time.
+void cCpuParticlesRenderer::renderTile (unsigned int tile)
+{
+	const int	x0		= (tile % m_tilesX) * CPU_TILE_SIZE;
+	const int	y0		= (tile / m_tilesX) * CPU_TILE_SIZE;
+	const int	x1		= std::min(x0 + CPU_TILE_SIZE, m_renderWidth);
+	const int	y1		= std::min(y0 + CPU_TILE_SIZE, m_renderHeight);
+	const float	blend	= 1.0f / static_cast<float>(m_frameAccum + 1);
+	sRayPacket	packet;
+
+	for (int y = y0; y < y1; y++)
+	{
+		for (int px = x0; px < x1; px += PACKET_SIZE)
+		{
+			for (int l = 0; l < PACKET_SIZE; l++)
+			{
+				int				x		= std::min(px + l, x1 - 1);
+				unsigned int	seed	= m_seeds[(size_t)y * m_renderWidth + x] ^ m_frameAccum;
+
+				float jx	= (rnd(seed) - 0.5f) * m_jitterFactor;
+				float jy	= (rnd(seed) - 0.5f) * m_jitterFactor;
+				float dx	= (x + jx) / m_renderWidth  * 2.0f - 1.0f;
+				float dy	= (y + jy) / m_renderHeight * 2.0f - 1.0f;
+				sVec3 d		= normalize(dx * m_U + dy * m_V + m_W);
+
+				packet.ox[l] = m_eye.x;	packet.oy[l] = m_eye.y;	packet.oz[l] = m_eye.z;
+				packet.dx[l] = d.x;		packet.dy[l] = d.y;		packet.dz[l] = d.z;
+				packet.tmin[l] = m_sceneEpsilon;
+				// lanes past the tile edge are disabled
+				packet.tmax[l] = px + l < x1 ? 1e30f : -1.0f;
+			}
+			m_wideBVH.intersect(packet);
+
+			for (int l = 0; l < PACKET_SIZE && px + l < x1; l++)
+			{
+				const int	x	= px + l;
+				size_t		idx	= (size_t)y * m_renderWidth + x;
+
+				sRay ray;
+				ray.origin		= m_eye;
+				ray.direction	= makeVec3(packet.dx[l], packet.dy[l], packet.dz[l]);
+				ray.tmin		= m_sceneEpsilon;
+				ray.tmax		= packet.tmax[l];
+
+				sVec3 result	= packet.sphere[l] == PACKET_NO_HIT ? m_bgColor :
+								  shade(ray, packet.sphere[l], m_seeds[idx] ^ m_frameAccum);
+				sVec3 acc		= m_frameAccum > 1 ? lerp(m_accum[idx], result, blend) : result;
+				m_accum[idx]	= acc;
+
+				// launch index y grows upwards, the output is top-down
+				unsigned char *out = &m_output[((size_t)(m_renderHeight - 1 - y) * m_renderWidth + x) * 3];
+				out[0] = static_cast<unsigned char>(std::min(std::max(acc.x, 0.0f), 1.0f) * 255.99f);
+				out[1] = static_cast<unsigned char>(std::min(std::max(acc.y, 0.0f), 1.0f) * 255.99f);
+				out[2] = static_cast<unsigned char>(std::min(std::max(acc.z, 0.0f), 1.0f) * 255.99f);
+			}
+		}
+	}
+}
+//
+//=======================================================================================
+//
+// closest_hit_radiance_AO_phong at ray.tmax on the given sphere
+sVec3 cCpuParticlesRenderer::shade (const sRay &ray, uint32_t sphereIdx, unsigned int seed)
+{
+	const float	*sphere		= m_bvh.sphere(sphereIdx);
+	sVec3		hitPoint	= ray.origin + ray.tmax * ray.direction;
+	sVec3		normal		= (hitPoint - makeVec3(sphere)) / m_bvh.radius();
+	sVec3		ffnormal	= dot(-ray.direction, normal) >= 0.0f ? normal : -normal;
+
+	// ambient occlusion
+	float		occlusion		= 0.0f;
+	const float	invSqrtSamples	= 1.0f / float(m_sqrtOcclusionSamples);
+	for (int i = 0; i < m_sqrtOcclusionSamples; i++)
+	{
+		for (int j = 0; j < m_sqrtOcclusionSamples; j++)
+		{
+			float u1 = (float(i) + rnd(seed)) * invSqrtSamples;
+			float u2 = (float(j) + rnd(seed)) * invSqrtSamples;
+
+			sRay occlusionRay;
+			occlusionRay.origin		= hitPoint;
+			occlusionRay.direction	= cosineSampleHemisphere(u1, u2, ffnormal);
+			occlusionRay.tmin		= m_sceneEpsilon;
+			occlusionRay.tmax		= m_occlusionDistance;
+			occlusion += m_bvh.occluded(occlusionRay) ? 0.0f : 1.0f;
+		}
+	}
+	occlusion /= (float)(m_sqrtOcclusionSamples * m_sqrtOcclusionSamples);
+
+	int		colorIdx	= (int) (MapValueToNorm(sphere[3], m_energyMin, m_energyMax, false) * (CPU_NUM_COLORS-1));
+	sVec3	color		= makeVec3(&m_colors[colorIdx*3]);
+
+	return occlusion * phongShade(hitPoint, ffnormal, ray.direction) * color;
+}
+//
+//=======================================================================================
+//
+// phongShade with Ka = Kd = Ks = 1, Kr = 0 and a white ambient light
+sVec3 cCpuParticlesRenderer::phongShade (const sVec3 &hitPoint, const sVec3 &normal, const sVec3 &direction)
+{
+	sVec3 result = makeVec3(1.0f, 1.0f, 1.0f);
+
+	for (int i = 0; i < 3; i++)
+	{
+		const sCpuLight	&light	= m_lights[i];
+		float			Ldist	= length(light.pos - hitPoint);
+		sVec3			L		= normalize(light.pos - hitPoint);
+		float			nDl		= dot(normal, L);
+
+		if (nDl <= 0.0f)
+			continue;
+
+		if (light.castsShadow)
+		{
+			sRay shadowRay;
+			shadowRay.origin	= hitPoint;
+			shadowRay.direction	= L;
+			shadowRay.tmin		= m_sceneEpsilon;
+			shadowRay.tmax		= Ldist;
+			if (m_bvh.occluded(shadowRay))
+				continue;
+		}
+
+		result = result + nDl * light.color;
+
+		sVec3 H		= normalize(L - direction);
+		float nDh	= dot(normal, H);
+		if (nDh > 0.0f)
+		{
+			result = result + powf(nDh, m_phongExp) * light.color;
+		}
+	}
+	return result;
+}
+//
+//=======================================================================================
+//
+void cCpuParticlesRenderer::getPixels (unsigned char *pixels)
+{
+	memcpy(pixels, m_output.data(), (size_t)m_renderWidth * m_renderHeight * 3);
+}
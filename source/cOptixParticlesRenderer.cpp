@@ -3,11 +3,18 @@
  * accompanying file Copyright.txt for details.
  */
 
+#include "../header/cParticlesRenderer.h"
+
+#ifdef OPTIX_RENDERER
+
 #include <string.h>
+#include <algorithm>
 #include "../frameserver/header/cMouseEventHandler.h"
 #include "../frameserver/header/cKeyboardHandler.h"
-#include "../frameserver/header/cPNGEncoder.h"
+#include "../frameserver/header/cSnapshotWriter.h"
 #include "../header/cOptixParticlesRenderer.h"
+#include "../header/cParticleSource.h"
+#include "../header/particleSort.h"
 #include "../header/Arcball.h"
 #include "../header/DeviceMemoryLogger.h"
 #include "../header/cColorTable.h"
@@ -28,6 +35,8 @@ cOptixParticlesRenderer::cOptixParticlesRenderer(bool shareBuffer=false)
 {
 	m_width 	= 1280;
 	m_height 	= 720;
+	m_renderWidth	= m_width;
+	m_renderHeight	= m_height;
 	m_frameAccum = 0;
 	m_context	= 0;
 	m_mouseH	= 0;
@@ -40,7 +49,7 @@ cOptixParticlesRenderer::cOptixParticlesRenderer(bool shareBuffer=false)
     m_rotate  	= Matrix4x4::identity();
     m_shareBuffer	= shareBuffer;
 
-    m_pngEncoder 		= 0;
+    m_snapshots 		= 0;
 	m_autosave			= false;
 	m_renderPassCounter	= 0;
 	m_numRenderSteps	= 10;
@@ -57,16 +66,21 @@ cOptixParticlesRenderer::~cOptixParticlesRenderer ( )
 #endif
 	m_context->destroy();
 	delete [] m_sphere;
-	delete m_pngEncoder;
+	delete m_snapshots;
 
 }
 //
 //=======================================================================================
 //
-void cOptixParticlesRenderer::init ( int width, int height, std::vector<float> *pos, float *min, float *max)
+void cOptixParticlesRenderer::init ( int width, int height, cParticleSource *source )
 {
+	const float *min = source->min();
+	const float *max = source->max();
+
 	m_width 	= width;
 	m_height 	= height;
+	m_renderWidth	= width;
+	m_renderHeight	= height;
 	m_hfov    	= 60.0f;
 
 	// Setting camera view according to min / max position values:
@@ -91,7 +105,7 @@ void cOptixParticlesRenderer::init ( int width, int height, std::vector<float> *
 #endif
 		DeviceMemoryLogger::logDeviceDescription(m_context, std::cout);
 		// Setup state
-		createGeometry ( pos, min, max);
+		createGeometry ( source );
 		createMaterial( );
 		createInstance( );
 
@@ -132,13 +146,9 @@ void cOptixParticlesRenderer::init ( int width, int height, std::vector<float> *
 	setupPostprocessing ();
 #endif
 
-	m_pngEncoder = new cPNGEncoder ();
-	m_pngEncoder->setImageParams(m_width, m_height);
-	if (!(m_pngEncoder->initEncoder()))
-	{
-		std::cout << "Warning: Renderer's PNG Encoder failed at initialization \n";
-	}
-	std::cout << "\nRenderer's PNG Encoder initialized\n";
+	// autosaves are written in the background, the next launch does not wait for them
+	m_snapshots = new cSnapshotWriter (m_width, m_height);
+	std::cout << "\nRenderer's PNG snapshot writer initialized\n";
 
 
 
@@ -255,10 +265,14 @@ bool cOptixParticlesRenderer::displayProgressive (unsigned char *pixels)
 		sutil::displayStreamBuffer(pixels, m_streamBuffer->get(), m_width, m_height);
 	}
 
-	if (m_mouseH->refreshed())
+	bool moved = false;
+	while (m_mouseH->poll())
 	{
 		updateView ();
-		m_mouseH->refresh(false);
+		moved = true;
+	}
+	if (moved)
+	{
 		m_context->launchProgressive( 0, m_width, m_height, 100 );
 	}
 	//	std::cout << "Launch\n";
@@ -275,16 +289,14 @@ void cOptixParticlesRenderer::display (unsigned char *pixels)
 {
 	double fpsexpave = 0.0;
 	static unsigned frame_count = 0;
-	if (m_mouseH->refreshed())
+	// input queued by the network thread since the last frame, drags coalesced per button state
+	while (m_mouseH->poll())
 	{
 		updateView ();
-		m_mouseH->refresh(false);
-
 	}
-	if ( m_keyboardHandler->refreshed())
+	while (m_keyboardHandler->poll())
 	{
 		onKeyboardEvent ( );
-		m_keyboardHandler->refresh( false );
 	}
 	//else
 	//{
@@ -300,9 +312,9 @@ void cOptixParticlesRenderer::display (unsigned char *pixels)
 	if (!m_denoiserEnabled)
 #endif
 	{
-		m_context->launch( ENTRY_POINT_MAIN_SHADING, m_width, m_height);
+		m_context->launch( ENTRY_POINT_MAIN_SHADING, m_renderWidth, m_renderHeight);
 #ifdef POST_PROCESSING
-		m_context->launch( ENTRY_POINT_FLOAT4_TO_COLOR, m_width, m_height );
+		m_context->launch( ENTRY_POINT_FLOAT4_TO_COLOR, m_renderWidth, m_renderHeight );
 #endif
 	}
 #ifdef POST_PROCESSING
@@ -338,8 +350,10 @@ void cOptixParticlesRenderer::display (unsigned char *pixels)
 		strftime (date,sizeof(date),"%Y-%m-%d_%OH_%OM_%OS",timeinfo);
 		std::stringstream filename;
 		filename << "Sight_AutoSave_" << date << ".png";
-		m_pngEncoder->savePNG(filename.str(), pixels);
-		std::cout << filename.str().data() << " saved!\n";
+		if (!m_snapshots->save(filename.str(), pixels))
+		{
+			std::cout << filename.str().data() << " dropped, the previous autosaves are still being written\n";
+		}
 		m_renderPassCounter = 0;
 		m_autosave = false;
 		m_denoise = true;
@@ -586,37 +600,57 @@ void cOptixParticlesRenderer::createMaterial(	)
 //
 //=======================================================================================
 //
-void cOptixParticlesRenderer::createGeometry (std::vector<float> *pos, float *min, float *max)
+void cOptixParticlesRenderer::createGeometry (cParticleSource *source)
 {
-	unsigned int 	i = 0, j, k, numParticles;
-	unsigned int	posIdx = 0;
+	unsigned int 	i = 0, k;
 	unsigned int 	ncolors = 128;
 	double 			color[3*ncolors];
 	cColorTable 	colorTab ("orange");
+	const uint64_t	numParticles	= source->numParticles();
+	const float		*min			= source->min();
+	const float		*max			= source->max();
 
 	colorTab.Sample (ncolors, color);
 
-	numParticles 	= pos->size()/4;
-	m_numGroups		= numParticles / (NUM_PARTICLES_PER_GROUP);
-	m_sphere = new Geometry[m_numGroups+1];
-	//m_numGroups = 1;
+	// groups are filled one at a time straight from the source, the host never holds more
+	// than the group being uploaded
+	m_numGroups		= (numParticles + NUM_PARTICLES_PER_GROUP - 1) / NUM_PARTICLES_PER_GROUP;
+	m_sphere = new Geometry[m_numGroups];
 	std::cout << "Particles: " << numParticles << " Groups: " << m_numGroups << std::endl;
 
+	std::vector<sParticleBounds> groupBounds(m_numGroups);
+
+	source->rewind();
 	for (k=0; k<m_numGroups; k++ )
 	{
-		Buffer colorBuffer 	= m_context->createBuffer( RT_BUFFER_INPUT, RT_FORMAT_FLOAT4, NUM_PARTICLES_PER_GROUP );
-		Buffer posBuffer	= m_context->createBuffer( RT_BUFFER_INPUT, RT_FORMAT_FLOAT4, NUM_PARTICLES_PER_GROUP );
+		unsigned int groupSize = (unsigned int) std::min<uint64_t>(NUM_PARTICLES_PER_GROUP, numParticles - (uint64_t)k*NUM_PARTICLES_PER_GROUP);
+
+		Buffer colorBuffer 	= m_context->createBuffer( RT_BUFFER_INPUT, RT_FORMAT_FLOAT4, groupSize );
+		Buffer posBuffer	= m_context->createBuffer( RT_BUFFER_INPUT, RT_FORMAT_FLOAT4, groupSize );
 		float4*	positions 	= reinterpret_cast<float4*>(posBuffer->map());
 		float4*	colors		= reinterpret_cast<float4*>(colorBuffer->map());
 
-		for( i = 0; i < NUM_PARTICLES_PER_GROUP; i++ )
+		// the source writes {x, y, z, energy} records directly into the mapped buffer
+		unsigned int loaded = 0;
+		while (loaded < groupSize)
 		{
-			positions->x	= pos->operator [](posIdx  );
-			positions->y 	= pos->operator [](posIdx+1);
-			positions->z 	= pos->operator [](posIdx+2);
-			positions->w 	= 1.0f;
+			size_t n = source->read(reinterpret_cast<float*>(positions + loaded), groupSize - loaded);
+			if (n == 0)
+				break;
+			loaded += n;
+		}
+		if (loaded < groupSize)
+		{
+			std::cout << "Warning: particle source ended early, " << groupSize - loaded << " particles missing\n";
+			memset(positions + loaded, 0, (groupSize - loaded) * sizeof(float4));
+		}
+
+		groupBounds[k].reset();
+		for( i = 0; i < groupSize; i++ )
+		{
+			groupBounds[k].grow(&positions->x);
 
-			float	energy 	= pos->operator [](posIdx+3);
+			float	energy 	= positions->w;
 			int   colorIdx	= (int) (MapValueToNorm(energy, min[3], max[3], false)  * (ncolors-1));
 			//int   colorIdx	= (int) (MapValueToNorm(energy, 0, 1, false)  * (ncolors-1));
 			colors->x		= (float)color[colorIdx*3    ];
@@ -624,17 +658,16 @@ void cOptixParticlesRenderer::createGeometry (std::vector<float> *pos, float *mi
 			colors->z		= (float)color[colorIdx*3 + 2];
 			colors->w		= 1.0;
 
+			positions->w 	= 1.0f;
+
 			positions++;
 			colors++;
-
-			posIdx+=4;
-
 		}
 		posBuffer->unmap();
 		colorBuffer->unmap ();
 
 		m_sphere[k] = m_context->createGeometry();
-		m_sphere[k]->setPrimitiveCount(NUM_PARTICLES_PER_GROUP);
+		m_sphere[k]->setPrimitiveCount(groupSize);
 		m_sphere[k]->setBoundingBoxProgram( m_context->createProgramFromPTXFile( "shaders/particles.ptx", "bounds" ) );
 		m_sphere[k]->setIntersectionProgram( m_context->createProgramFromPTXFile( "shaders/particles.ptx", "robust_intersect" ) );
 		//particles->setIntersectionProgram( m_context->createProgramFromPTXFile( "shaders/particles.ptx", "sphere_array_intersect" ) );
@@ -643,43 +676,10 @@ void cOptixParticlesRenderer::createGeometry (std::vector<float> *pos, float *mi
 		m_sphere[k]["radius"]->setFloat(2.0f);
 	}
 
-	// loading the remaining particles
-	unsigned int remainingParticles = numParticles - posIdx/4;
-	Buffer colorBuffer 	= m_context->createBuffer( RT_BUFFER_INPUT, RT_FORMAT_FLOAT4, remainingParticles );
-	Buffer posBuffer	= m_context->createBuffer( RT_BUFFER_INPUT, RT_FORMAT_FLOAT4, remainingParticles );
-	float4*	positions 	= reinterpret_cast<float4*>(posBuffer->map());
-	float4*	colors		= reinterpret_cast<float4*>(colorBuffer->map());
-	for (i=0; i< remainingParticles;i++ )
-	{
-		positions->x	= pos->operator [](posIdx  );
-		positions->y 	= pos->operator [](posIdx+1);
-		positions->z 	= pos->operator [](posIdx+2);
-		positions->w 	= 15.0f;
-
-		float	energy 	= pos->operator [](posIdx+3);
-		//int   colorIdx	= (int) (MapValueToNorm(energy, min[3], max[3], false)  * ncolors);
-		int   colorIdx	= (int) (MapValueToNorm(energy, -2.5, -2.0, false)  * (ncolors-1));
-		colors->x		= (float)color[colorIdx*3    ];
-		colors->y		= (float)color[colorIdx*3 + 1];
-		colors->z		= (float)color[colorIdx*3 + 2];
-		colors->w		= 1.0;
-
-		positions++;
-		colors++;
-
-		posIdx+=4;
-	}
-	posBuffer->unmap();
-	colorBuffer->unmap ();
-	m_numGroups++; // adding a group for the remaining particles
-
-	m_sphere[k] = m_context->createGeometry();
-	m_sphere[k]->setPrimitiveCount(remainingParticles);
-	m_sphere[k]->setBoundingBoxProgram( m_context->createProgramFromPTXFile( "shaders/particles.ptx", "bounds" ) );
-	m_sphere[k]->setIntersectionProgram( m_context->createProgramFromPTXFile( "shaders/particles.ptx", "robust_intersect" ) );
-	//particles->setIntersectionProgram( m_context->createProgramFromPTXFile( "shaders/particles.ptx", "sphere_array_intersect" ) );
-	m_sphere[k]["particle_buffer"]->setBuffer ( posBuffer );
-	m_sphere[k]["color_buffer"]->setBuffer (colorBuffer);
+	// groups that overlap less can be culled by the top level acceleration structure
+	sGroupOverlapStats overlap = groupOverlap(groupBounds);
+	std::cout << "Group AABB overlap: volume ratio " << overlap.volumeRatio
+			  << ", mean overlapping groups " << overlap.meanOverlapping << std::endl;
 
 
 	// One side of the box
@@ -761,6 +761,93 @@ void cOptixParticlesRenderer::resetAccumulation ()
 //
 //=======================================================================================
 //
+// pinhole_camera spreads the rays of a smaller launch over the whole view, into the bottom-left
+// corner of the buffers, so they are not reallocated
+void cOptixParticlesRenderer::setRenderScale (unsigned int percent)
+{
+#ifdef POST_PROCESSING
+	// the denoiser command list is built for the whole buffers
+	if (m_denoiserEnabled)
+		percent = 100;
+#endif
+	percent		= std::min(std::max(percent, 1u), 100u);
+	int width	= std::max(1, m_width  * (int) percent / 100);
+	int height	= std::max(1, m_height * (int) percent / 100);
+	if (width == m_renderWidth && height == m_renderHeight)
+		return;
+
+	m_renderWidth	= width;
+	m_renderHeight	= height;
+	resetAccumulation ();
+}
+//
+//=======================================================================================
+//
+void cOptixParticlesRenderer::setCamera (const float *eye, const float *lookAt, const float *up, float fov)
+{
+	m_eye		= make_float3(eye[0], eye[1], eye[2]);
+	m_lookAt	= make_float3(lookAt[0], lookAt[1], lookAt[2]);
+	m_up		= make_float3(up[0], up[1], up[2]);
+	m_hfov		= fov;
+	sutil::calculateCameraVariables(
+			  m_eye, m_lookAt, m_up, m_hfov, m_ratio,
+			  m_U, m_V, m_W );
+
+	m_context["eye"]->setFloat( m_eye );
+	m_context["U"  ]->setFloat( m_U );
+	m_context["V"  ]->setFloat( m_V );
+	m_context["W"  ]->setFloat( m_W );
+	resetAccumulation ();
+}
+//
+//=======================================================================================
+//
+void cOptixParticlesRenderer::getCamera (float *eye, float *lookAt, float *up, float &fov)
+{
+	eye[0]		= m_eye.x;		eye[1]		= m_eye.y;		eye[2]		= m_eye.z;
+	lookAt[0]	= m_lookAt.x;	lookAt[1]	= m_lookAt.y;	lookAt[2]	= m_lookAt.z;
+	up[0]		= m_up.x;		up[1]		= m_up.y;		up[2]		= m_up.z;
+	fov			= m_hfov;
+}
+//
+//=======================================================================================
+//
+// A launch the size of the window whose rays span its part of the poster's view: U and V shrink
+// to the window, W points at its center. The camera variables are restored afterwards.
+bool cOptixParticlesRenderer::renderRegion (int posterWidth, int posterHeight, int x, int y, int width, int height,
+											unsigned int samples, unsigned char *img)
+{
+	if (width <= 0 || height <= 0 || width > m_width || height > m_height)
+		return false;
+
+	// launch y grows upwards
+	const float3	posterV	= m_V * (m_ratio * posterHeight / posterWidth);
+	const float		bottom	= (float)(posterHeight - y - height);
+	m_context["U"]->setFloat( m_U * ((float) width / posterWidth) );
+	m_context["V"]->setFloat( posterV * ((float) height / posterHeight) );
+	m_context["W"]->setFloat( m_W + m_U * ((2.0f * x + width) / posterWidth - 1.0f) +
+							  posterV * ((2.0f * bottom + height) / posterHeight - 1.0f) );
+	resetAccumulation ();
+
+	for (unsigned int s = 0; s < std::max(samples, 1u); s++)
+	{
+		m_context->launch( ENTRY_POINT_MAIN_SHADING, width, height );
+#ifdef POST_PROCESSING
+		m_context->launch( ENTRY_POINT_FLOAT4_TO_COLOR, width, height );
+#endif
+		m_context["frame"]->setUint( m_frameAccum++ );
+	}
+	sutil::displayBuffer(img, m_context["output_buffer"]->getBuffer()->get(), width, height);
+
+	m_context["U"]->setFloat( m_U );
+	m_context["V"]->setFloat( m_V );
+	m_context["W"]->setFloat( m_W );
+	resetAccumulation ();
+	return true;
+}
+//
+//=======================================================================================
+//
 void cOptixParticlesRenderer::setBufferIds( const std::vector<Buffer>& buffers, Buffer top_level_buffer )
 {
 	top_level_buffer->setSize( buffers.size() );
@@ -834,6 +921,8 @@ void cOptixParticlesRenderer::onKeyboardEvent ()
 void cOptixParticlesRenderer::getPixels (unsigned char *pixels)
 {
 
-	sutil::displayBuffer(pixels, m_context["output_buffer"]->getBuffer()->get());
+	sutil::displayBuffer(pixels, m_context["output_buffer"]->getBuffer()->get(), m_renderWidth, m_renderHeight);
 	//std::cout << "getPixels\n";
 }
+
+#endif // OPTIX_RENDERER
@@ -0,0 +1,227 @@
+/*
+ * Distributed under the OSI-approved Apache License, Version 2.0.  See
+ * accompanying file Copyright.txt for details.
+ */
+
+#include <iostream>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../header/cParticleCache.h"
+
+cParticleCache::cParticleCache ( )
+{
+	memset(&m_header, 0, sizeof(m_header));
+	m_map		= 0;
+	m_mapSize	= 0;
+	m_data		= 0;
+	m_cursor	= 0;
+}
+
+cParticleCache::~cParticleCache ( )
+{
+	close ();
+}
+//
+//=======================================================================================
+//
+std::string cParticleCache::cacheFilename (const std::string &source)
+{
+	return source + PARTICLE_CACHE_EXTENSION;
+}
+//
+//=======================================================================================
+//
+bool cParticleCache::isLittleEndian ( )
+{
+	const uint32_t one = 1;
+	return *reinterpret_cast<const unsigned char*>(&one) == 1;
+}
+//
+//=======================================================================================
+//
+bool cParticleCache::sourceStats (const std::string &source, uint64_t &size, int64_t &mtime)
+{
+	struct stat st;
+	if (stat(source.c_str(), &st) != 0)
+	{
+		return false;
+	}
+	size	= st.st_size;
+	mtime	= st.st_mtime;
+	return true;
+}
+//
+//=======================================================================================
+//
+bool cParticleCache::open (const std::string &source, unsigned int decimation)
+{
+	uint64_t	sourceSize;
+	int64_t		sourceMtime;
+
+	close ();
+
+	// the cache is stored little-endian and mapped as is
+	if (!isLittleEndian() || !sourceStats(source, sourceSize, sourceMtime))
+	{
+		return false;
+	}
+
+	std::string filename = cacheFilename(source);
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < PARTICLE_CACHE_DATA_OFFSET ||
+		pread(fd, &m_header, sizeof(m_header), 0) != (ssize_t)sizeof(m_header))
+	{
+		::close(fd);
+		return false;
+	}
+
+	bool valid = memcmp(m_header.magic, PARTICLE_CACHE_MAGIC, sizeof(PARTICLE_CACHE_MAGIC)) == 0 &&
+				 m_header.version		== PARTICLE_CACHE_VERSION &&
+				 m_header.dataOffset	== PARTICLE_CACHE_DATA_OFFSET &&
+				 m_header.decimation	== decimation &&
+				 m_header.sourceSize	== sourceSize &&
+				 m_header.sourceMtime	== sourceMtime &&
+				 (uint64_t)st.st_size	== m_header.dataOffset + m_header.numParticles * 4 * sizeof(float);
+	if (!valid)
+	{
+		std::cout << filename << " is stale or was created with other settings. It will be rebuilt.\n";
+		memset(&m_header, 0, sizeof(m_header));
+		::close(fd);
+		return false;
+	}
+
+	m_mapSize	= st.st_size;
+	m_map		= mmap(0, m_mapSize, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (m_map == MAP_FAILED)
+	{
+		m_map = 0;
+		m_mapSize = 0;
+		memset(&m_header, 0, sizeof(m_header));
+		return false;
+	}
+	madvise(m_map, m_mapSize, MADV_SEQUENTIAL);
+	m_data		= reinterpret_cast<const float*>(static_cast<const char*>(m_map) + m_header.dataOffset);
+	m_cursor	= 0;
+
+	std::cout << "Particle cache " << filename << " mapped: " << m_header.numParticles << " particles\n";
+	return true;
+}
+//
+//=======================================================================================
+//
+void cParticleCache::close ( )
+{
+	if (m_map)
+	{
+		munmap(m_map, m_mapSize);
+	}
+	m_map		= 0;
+	m_mapSize	= 0;
+	m_data		= 0;
+	m_cursor	= 0;
+}
+//
+//=======================================================================================
+//
+size_t cParticleCache::read (float *dst, size_t maxParticles)
+{
+	if (!m_data)
+	{
+		return 0;
+	}
+
+	uint64_t n = m_header.numParticles - m_cursor;
+	if (n > maxParticles)
+		n = maxParticles;
+	memcpy(dst, m_data + m_cursor * 4, n * 4 * sizeof(float));
+	m_cursor += n;
+
+	// drop the pages already consumed from the resident set
+	const size_t	pageSize	= sysconf(_SC_PAGESIZE);
+	const size_t	consumed	= (m_header.dataOffset + m_cursor * 4 * sizeof(float)) / pageSize * pageSize;
+	madvise(m_map, consumed, MADV_DONTNEED);
+
+	return n;
+}
+//
+//=======================================================================================
+//
+bool cParticleCache::rewind ( )
+{
+	m_cursor = 0;
+	return m_data != 0;
+}
+//
+//=======================================================================================
+//
+bool cParticleCache::write (const std::string &source, unsigned int decimation, cParticleSource &particles, uint32_t flags)
+{
+	sParticleCacheHeader header;
+
+	if (!isLittleEndian() || !particles.rewind())
+	{
+		return false;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, PARTICLE_CACHE_MAGIC, sizeof(PARTICLE_CACHE_MAGIC));
+	header.version		= PARTICLE_CACHE_VERSION;
+	header.dataOffset	= PARTICLE_CACHE_DATA_OFFSET;
+	header.numParticles	= particles.numParticles();
+	header.decimation	= decimation;
+	header.flags		= flags;
+	memcpy(header.min, particles.min(), sizeof(header.min));
+	memcpy(header.max, particles.max(), sizeof(header.max));
+	if (!sourceStats(source, header.sourceSize, header.sourceMtime))
+	{
+		return false;
+	}
+
+	// write a temporary file and rename it so a crashed run never leaves a truncated cache
+	std::string filename	= cacheFilename(source);
+	std::string tmpFilename	= filename + ".tmp";
+	FILE *fp = fopen(tmpFilename.c_str(), "wb");
+	if (!fp)
+	{
+		return false;
+	}
+
+	char padding[PARTICLE_CACHE_DATA_OFFSET];
+	memset(padding, 0, sizeof(padding));
+	memcpy(padding, &header, sizeof(header));
+
+	bool ok = fwrite(padding, 1, sizeof(padding), fp) == sizeof(padding);
+
+	// copy the particles in bounded chunks
+	const size_t		chunkSize	= 1 << 20;
+	std::vector<float>	chunk(chunkSize * 4);
+	uint64_t			written		= 0;
+	size_t				n;
+	while (ok && (n = particles.read(chunk.data(), chunkSize)) > 0)
+	{
+		ok = fwrite(chunk.data(), 4 * sizeof(float), n, fp) == n;
+		written += n;
+	}
+	ok = (fclose(fp) == 0) && ok && written == header.numParticles;
+
+	if (!ok || rename(tmpFilename.c_str(), filename.c_str()) != 0)
+	{
+		unlink(tmpFilename.c_str());
+		return false;
+	}
+
+	std::cout << "Particle cache " << filename << " written\n";
+	return true;
+}
@@ -0,0 +1,175 @@
+/*
+ * Distributed under the OSI-approved Apache License, Version 2.0.  See
+ * accompanying file Copyright.txt for details.
+ */
+
+#include <iostream>
+#include <cstdlib>
+#include <algorithm>
+#include "../header/cRenderScheduler.h"
+#include "../frameserver/header/cProtocol.h"
+
+cRenderScheduler::cRenderScheduler (unsigned int sampleBudget, float threshold, unsigned int interactiveScale)
+{
+	m_budget			= sampleBudget;
+	m_threshold			= threshold;
+	m_interactiveScale	= std::min(std::max(interactiveScale, 1u), 100u);
+	m_converged			= false;
+	m_accumulated		= 0;
+	m_framesSinceReset	= 0;
+	m_frameRendered		= false;
+	m_moved				= false;
+	m_rescaled			= false;
+	m_scale				= 100;
+	m_wakeups			= 0;
+	m_seenWakeups		= 0;
+	m_rendered			= 0;
+	m_idleMs			= 0.0;
+	m_renderMs			= 0.0;
+	m_frameMs			= 0.0;
+}
+//
+//=======================================================================================
+//
+void cRenderScheduler::wake ( )
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_wakeups++;
+	}
+	m_cond.notify_one();
+}
+//
+//=======================================================================================
+//
+bool cRenderScheduler::wait (bool active, unsigned int accumulated)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	// a frame that did not add to the accumulation restarted it, while the camera keeps moving
+	// every frame is the first one
+	if (accumulated < m_accumulated || (m_frameRendered && accumulated > 0 && accumulated == m_accumulated))
+	{
+		// the camera moved and the accumulation started over, or the scale changed
+		m_converged			= false;
+		m_framesSinceReset	= 0;
+		if (!m_rescaled)
+		{
+			m_moved = true;
+			m_stillTimer.reset();
+		}
+	}
+	if (m_frameRendered)
+	{
+		m_rescaled = false;
+	}
+	m_frameRendered	= false;
+	m_accumulated	= accumulated;
+	if (m_budget > 0 && accumulated >= m_budget)
+	{
+		m_converged = true;
+	}
+
+	// fewer pixels while the camera moves, all of them once it stands still
+	const double	still	= m_stillTimer.getElapsedMilliseconds();
+	unsigned int	scale	= m_moved && still < RENDER_SETTLE_MS ? m_interactiveScale : 100;
+	if (scale != m_scale)
+	{
+		m_scale				= scale;
+		m_rescaled			= true;
+		m_converged			= false;
+		m_framesSinceReset	= 0;
+	}
+
+	// a wake-up gets one frame even when converged, it may carry input that moves the camera
+	if (active && (!m_converged || m_wakeups != m_seenWakeups))
+	{
+		m_seenWakeups = m_wakeups;
+		m_frameTimer.reset();
+		return true;
+	}
+
+	// a lowered resolution is raised on time, even when its image converged
+	double pollMs = RENDER_IDLE_POLL_MS;
+	if (m_scale != 100)
+	{
+		pollMs = std::min(pollMs, std::max(RENDER_SETTLE_MS - still, 1.0));
+	}
+	// only a new wake-up ends the sleep: one that came while nobody streamed is left pending for
+	// the first active call, it may be the stream request racing with the caller's check
+	const uint64_t	wakeups	= m_wakeups;
+	cTimer			idle;
+	m_cond.wait_for(lock, std::chrono::milliseconds((int64_t) pollMs),
+					[this, wakeups] { return m_wakeups != wakeups; });
+	m_idleMs += idle.getElapsedMilliseconds();
+	return false;
+}
+//
+//=======================================================================================
+//
+void cRenderScheduler::frameDone (const unsigned char *rgb, size_t bytes)
+{
+	const double ms = m_frameTimer.getElapsedMilliseconds();
+	m_frameMs	= m_frameMs > 0.0 ? 0.9 * m_frameMs + 0.1 * ms : ms;
+	m_renderMs	+= ms;
+	m_renderStats.add((float) ms);
+	m_rendered++;
+	m_framesSinceReset++;
+	m_frameRendered = true;
+
+	if (!rgb)
+		return;
+
+	// mean absolute change of the sampled channels since the previous frame
+	const size_t	samples	= bytes / RENDER_CHANGE_STRIDE;
+	uint64_t		change	= 0;
+	bool			compare	= m_previous.size() == samples;
+
+	m_previous.resize(samples);
+	for (size_t i = 0; i < samples; i++)
+	{
+		unsigned char v = rgb[i * RENDER_CHANGE_STRIDE];
+		change += std::abs((int) v - (int) m_previous[i]);
+		m_previous[i] = v;
+	}
+
+	if (compare && samples > 0 && m_framesSinceReset >= RENDER_MIN_FRAMES &&
+		(float) change / samples < m_threshold)
+	{
+		m_converged = true;
+	}
+}
+//
+//=======================================================================================
+//
+void cRenderScheduler::inputShown (uint64_t arrival)
+{
+	const uint64_t now = cProtocol::now();
+	m_inputStats.record(now > arrival ? now - arrival : 0);
+}
+//
+//=======================================================================================
+//
+void cRenderScheduler::printStats ( )
+{
+	const float updateMillis = 1000.0f;
+	if (m_statsTimer.getElapsedMilliseconds() < updateMillis)
+		return;
+
+	m_statsTimer.reset();
+	if (m_idleMs > 0.0)
+	{
+		std::cout << "Sight@Render: " << m_rendered << " frames " << m_renderMs << " ms, idle " << m_idleMs
+				  << " ms, saved ~" << (m_frameMs > 0.0 ? (unsigned int)(m_idleMs / m_frameMs) : 0) << " frames"
+				  << (m_converged ? " (converged)" : "") << (m_scale != 100 ? " (lowered resolution)" : "") << std::endl;
+	}
+	m_renderStats.rotate();
+	m_inputStats.rotate();
+	if (m_rendered > 0)
+	{
+		std::cout << "Sight@Render render: " << m_renderStats.getSummary(1) << " input to frame: " << m_inputStats.getSummary(1) << std::endl;
+	}
+	m_rendered	= 0;
+	m_idleMs	= 0.0;
+	m_renderMs	= 0.0;
+}
@@ -0,0 +1,519 @@
+/*
+ * Distributed under the OSI-approved Apache License, Version 2.0.  See
+ * accompanying file Copyright.txt for details.
+ */
+
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include "../frameserver/header/cThreadPool.h"
+#include "../header/particleSort.h"
+#include "../header/cSphereBVH.h"
+
+// References to children of the LBVH radix tree with this bit set are single spheres
+#define LBVH_LEAF			0x80000000u
+
+/*
+ * Internal node of the LBVH binary radix tree. Internal node i covers the sorted spheres
+ * [first, last]; size is the number of nodes of its subtree once flattened.
+ */
+struct sRadixNode
+{
+	float		min[3], max[3];
+	uint32_t	left, right;
+	uint32_t	first, last;
+	uint32_t	size;
+};
+
+struct sFlattenTask
+{
+	uint32_t	ref;	// radix node, or sphere | LBVH_LEAF
+	uint32_t	out;	// index of its flattened node
+};
+
+cSphereBVH::cSphereBVH ( )
+{
+	m_radius = 1.0f;
+}
+//
+//=======================================================================================
+//
+void cSphereBVH::build (const float *pos, uint64_t numParticles, float radius)
+{
+	std::vector<uint32_t> ids(numParticles);
+	for (uint32_t i = 0; i < numParticles; i++)
+	{
+		ids[i] = i;
+	}
+
+	m_radius = radius;
+	m_nodes.clear();
+	m_nodes.reserve(numParticles / BVH_LEAF_SIZE * 2 + 1);
+	m_spheres.resize(numParticles * 4);
+	if (numParticles > 0)
+	{
+		buildNode(ids, 0, (uint32_t) numParticles, pos);
+	}
+
+	// leaves reference the spheres in build order
+	for (uint64_t i = 0; i < numParticles; i++)
+	{
+		memcpy(&m_spheres[i * 4], pos + (uint64_t)ids[i] * 4, 4 * sizeof(float));
+	}
+}
+//
+//=======================================================================================
+//
+// Median split along the largest axis of the sphere centers
+uint32_t cSphereBVH::buildNode (std::vector<uint32_t> &ids, uint32_t begin, uint32_t end, const float *pos)
+{
+	uint32_t	index = (uint32_t) m_nodes.size();
+	sBVHNode	node;
+	float		cmin[3] = {  1e38f,  1e38f,  1e38f };
+	float		cmax[3] = { -1e38f, -1e38f, -1e38f };
+
+	for (uint32_t i = begin; i < end; i++)
+	{
+		const float *p = pos + (uint64_t)ids[i] * 4;
+		for (int c = 0; c < 3; c++)
+		{
+			cmin[c] = std::min(cmin[c], p[c]);
+			cmax[c] = std::max(cmax[c], p[c]);
+		}
+	}
+	for (int c = 0; c < 3; c++)
+	{
+		node.min[c] = cmin[c] - m_radius;
+		node.max[c] = cmax[c] + m_radius;
+	}
+	m_nodes.push_back(node);
+
+	if (end - begin <= BVH_LEAF_SIZE)
+	{
+		m_nodes[index].offset	= begin;
+		m_nodes[index].count	= end - begin;
+		return index;
+	}
+
+	int axis = 0;
+	for (int c = 1; c < 3; c++)
+	{
+		if (cmax[c] - cmin[c] > cmax[axis] - cmin[axis])
+			axis = c;
+	}
+
+	uint32_t mid = begin + (end - begin) / 2;
+	std::nth_element(ids.begin() + begin, ids.begin() + mid, ids.begin() + end,
+		[pos, axis](uint32_t a, uint32_t b)
+		{
+			return pos[(uint64_t)a * 4 + axis] < pos[(uint64_t)b * 4 + axis];
+		});
+
+	buildNode(ids, begin, mid, pos);
+	uint32_t right = buildNode(ids, mid, end, pos);
+
+	m_nodes[index].offset	= right;
+	m_nodes[index].count	= 0;
+	return index;
+}
+//
+//=======================================================================================
+//
+// Length of the common prefix of two sort keys, -1 outside the key range (Karras 2012, delta)
+static inline int commonPrefix (const std::vector<uint64_t> &keys, int64_t i, int64_t j)
+{
+	if (j < 0 || j >= (int64_t) keys.size())
+		return -1;
+	return __builtin_clzll(keys[i] ^ keys[j]);
+}
+//
+//=======================================================================================
+//
+// Range and split of internal node i, independently of every other node
+static void buildRadixNode (const std::vector<uint64_t> &keys, std::vector<sRadixNode> &radix,
+							std::vector<uint32_t> &parents, int64_t i)
+{
+	const int64_t	numInternal	= (int64_t) radix.size();
+	const int		d			= commonPrefix(keys, i, i + 1) > commonPrefix(keys, i, i - 1) ? 1 : -1;
+	const int		minPrefix	= commonPrefix(keys, i, i - d);
+
+	// upper bound of the range length, then binary search for the other end
+	int64_t maxLength = 2;
+	while (commonPrefix(keys, i, i + maxLength * d) > minPrefix)
+		maxLength *= 2;
+
+	int64_t length = 0;
+	for (int64_t t = maxLength / 2; t >= 1; t /= 2)
+	{
+		if (commonPrefix(keys, i, i + (length + t) * d) > minPrefix)
+			length += t;
+	}
+	const int64_t	j			= i + length * d;
+	const int		nodePrefix	= commonPrefix(keys, i, j);
+
+	// split where the keys stop sharing the node prefix
+	int64_t split = 0;
+	int64_t t = length;
+	do
+	{
+		t = (t + 1) / 2;
+		if (commonPrefix(keys, i, i + (split + t) * d) > nodePrefix)
+			split += t;
+	} while (t > 1);
+	const int64_t gamma = i + split * d + std::min(d, 0);
+
+	sRadixNode &node = radix[i];
+	node.first	= (uint32_t) std::min(i, j);
+	node.last	= (uint32_t) std::max(i, j);
+	node.left	= node.first == gamma		? (uint32_t) gamma | LBVH_LEAF		: (uint32_t) gamma;
+	node.right	= node.last == gamma + 1	? (uint32_t)(gamma + 1) | LBVH_LEAF	: (uint32_t)(gamma + 1);
+
+	parents[node.left  & LBVH_LEAF ? numInternal + gamma	 : gamma]		= (uint32_t) i;
+	parents[node.right & LBVH_LEAF ? numInternal + gamma + 1 : gamma + 1]	= (uint32_t) i;
+}
+//
+//=======================================================================================
+//
+static inline void radixBounds (const std::vector<sRadixNode> &radix, const float *spheres, float radius,
+								uint32_t ref, float *min, float *max)
+{
+	if (ref & LBVH_LEAF)
+	{
+		const float *p = spheres + (uint64_t)(ref & ~LBVH_LEAF) * 4;
+		for (int c = 0; c < 3; c++)
+		{
+			min[c] = p[c] - radius;
+			max[c] = p[c] + radius;
+		}
+		return;
+	}
+	memcpy(min, radix[ref].min, 3 * sizeof(float));
+	memcpy(max, radix[ref].max, 3 * sizeof(float));
+}
+//
+//=======================================================================================
+//
+static inline uint32_t radixSize (const std::vector<sRadixNode> &radix, uint32_t ref)
+{
+	return ref & LBVH_LEAF ? 1 : radix[ref].size;
+}
+//
+//=======================================================================================
+//
+// Writes the flattened node of task.ref and queues its children. Ranges of up to BVH_LEAF_SIZE
+// spheres become leaves.
+static void flattenNode (const std::vector<sRadixNode> &radix, const float *spheres, float radius,
+						 sBVHNode *nodes, const sFlattenTask &task, std::vector<sFlattenTask> &next)
+{
+	sBVHNode &node = nodes[task.out];
+
+	radixBounds(radix, spheres, radius, task.ref, node.min, node.max);
+	if (task.ref & LBVH_LEAF)
+	{
+		node.offset	= task.ref & ~LBVH_LEAF;
+		node.count	= 1;
+		return;
+	}
+
+	const sRadixNode &r = radix[task.ref];
+	if (r.last - r.first + 1 <= BVH_LEAF_SIZE)
+	{
+		node.offset	= r.first;
+		node.count	= r.last - r.first + 1;
+		return;
+	}
+
+	sFlattenTask left	= { r.left,  task.out + 1 };
+	sFlattenTask right	= { r.right, task.out + 1 + radixSize(radix, r.left) };
+	node.offset	= right.out;
+	node.count	= 0;
+	next.push_back(right);
+	next.push_back(left);
+}
+//
+//=======================================================================================
+//
+void cSphereBVH::buildLBVH (const float *pos, uint64_t numParticles, float radius, cThreadPool &pool)
+{
+	if (numParticles <= BVH_LEAF_SIZE || numParticles >= LBVH_LEAF)
+	{
+		build(pos, numParticles, radius);
+		return;
+	}
+
+	const unsigned int	numChunks	= (unsigned int) std::min<uint64_t>(pool.size() * 4, numParticles);
+	const uint64_t		chunkSize	= (numParticles + numChunks - 1) / numChunks;
+	const uint64_t		numInternal	= numParticles - 1;
+	const uint64_t		indexMask	= (1ull << MORTON_INDEX_BITS) - 1;
+
+	m_radius = radius;
+
+	// bounds of the centers, then the spheres in Morton order
+	std::vector<sParticleBounds> chunkBounds(numChunks);
+	pool.run(numChunks, [&](unsigned int c)
+	{
+		uint64_t end = std::min(numParticles, (c + 1) * chunkSize);
+		chunkBounds[c].reset();
+		for (uint64_t i = c * chunkSize; i < end; i++)
+		{
+			chunkBounds[c].grow(pos + i * 4);
+		}
+	});
+	sParticleBounds scene;
+	scene.reset();
+	for (unsigned int c = 0; c < numChunks; c++)
+	{
+		scene.grow(chunkBounds[c]);
+	}
+
+	std::vector<uint64_t> keys;
+	mortonKeys(pos, numParticles, scene.min, scene.max, keys, pool);
+
+	m_spheres.resize(numParticles * 4);
+	pool.run(numChunks, [&](unsigned int c)
+	{
+		uint64_t end = std::min(numParticles, (c + 1) * chunkSize);
+		for (uint64_t i = c * chunkSize; i < end; i++)
+		{
+			memcpy(&m_spheres[i * 4], pos + (keys[i] & indexMask) * 4, 4 * sizeof(float));
+		}
+	});
+
+	// radix tree, every internal node on its own; parents holds internal nodes, then spheres
+	std::vector<sRadixNode>	radix(numInternal);
+	std::vector<uint32_t>	parents(numInternal + numParticles);
+	pool.run(numChunks, [&](unsigned int c)
+	{
+		uint64_t end = std::min(numInternal, (c + 1) * chunkSize);
+		for (uint64_t i = c * chunkSize; i < end; i++)
+		{
+			buildRadixNode(keys, radix, parents, (int64_t) i);
+		}
+	});
+	std::vector<uint64_t>().swap(keys);
+
+	// bottom-up fit: the second child to reach a node computes its bounds and size
+	std::vector<std::atomic<uint32_t> > visits(numInternal);
+	pool.run(numChunks, [&](unsigned int c)
+	{
+		uint64_t end = std::min(numInternal, (c + 1) * chunkSize);
+		for (uint64_t i = c * chunkSize; i < end; i++)
+		{
+			visits[i].store(0, std::memory_order_relaxed);
+		}
+	});
+
+	const float *spheres = m_spheres.data();
+	pool.run(numChunks, [&](unsigned int c)
+	{
+		uint64_t end = std::min(numParticles, (c + 1) * chunkSize);
+		for (uint64_t i = c * chunkSize; i < end; i++)
+		{
+			uint32_t p = parents[numInternal + i];
+			while (visits[p].fetch_add(1, std::memory_order_acq_rel) == 1)
+			{
+				sRadixNode	&node = radix[p];
+				float		lmin[3], lmax[3], rmin[3], rmax[3];
+
+				radixBounds(radix, spheres, radius, node.left,  lmin, lmax);
+				radixBounds(radix, spheres, radius, node.right, rmin, rmax);
+				for (int k = 0; k < 3; k++)
+				{
+					node.min[k] = std::min(lmin[k], rmin[k]);
+					node.max[k] = std::max(lmax[k], rmax[k]);
+				}
+				node.size = node.last - node.first + 1 <= BVH_LEAF_SIZE ? 1 :
+							1 + radixSize(radix, node.left) + radixSize(radix, node.right);
+				if (p == 0)
+					break;
+				p = parents[p];
+			}
+		}
+	});
+
+	// flatten depth-first: the top of the tree serially, then one task per remaining subtree
+	m_nodes.resize(radix[0].size);
+
+	const uint32_t				grain = std::max<uint32_t>(radix[0].size / (pool.size() * 16), 1024);
+	std::vector<sFlattenTask>	pending, subtrees;
+	sFlattenTask				root = { 0, 0 };
+
+	pending.push_back(root);
+	while (!pending.empty())
+	{
+		sFlattenTask task = pending.back();
+		pending.pop_back();
+		if (radixSize(radix, task.ref) <= grain)
+		{
+			subtrees.push_back(task);
+			continue;
+		}
+		flattenNode(radix, spheres, radius, &m_nodes[0], task, pending);
+	}
+
+	pool.run((unsigned int) subtrees.size(), [&](unsigned int s)
+	{
+		std::vector<sFlattenTask> stack(1, subtrees[s]);
+		while (!stack.empty())
+		{
+			sFlattenTask task = stack.back();
+			stack.pop_back();
+			flattenNode(radix, spheres, radius, &m_nodes[0], task, stack);
+		}
+	});
+}
+//
+//=======================================================================================
+//
+static inline double surfaceArea (const sBVHNode &node)
+{
+	double dx = node.max[0] - node.min[0];
+	double dy = node.max[1] - node.min[1];
+	double dz = node.max[2] - node.min[2];
+	return 2.0 * (dx*dy + dy*dz + dz*dx);
+}
+//
+//=======================================================================================
+//
+double cSphereBVH::sahCost ( ) const
+{
+	if (m_nodes.empty())
+	{
+		return 0.0;
+	}
+
+	double cost = 0.0;
+	for (size_t i = 0; i < m_nodes.size(); i++)
+	{
+		cost += surfaceArea(m_nodes[i]) * (1 + m_nodes[i].count);
+	}
+	return cost / surfaceArea(m_nodes[0]);
+}
+//
+//=======================================================================================
+//
+// Slab test, returns the entry distance or a negative value on a miss
+static inline float intersectBox (const sBVHNode &node, const sRay &ray, const sVec3 &invDir, float tmax)
+{
+	float t0 = (node.min[0] - ray.origin.x) * invDir.x;
+	float t1 = (node.max[0] - ray.origin.x) * invDir.x;
+	float tnear	= std::min(t0, t1);
+	float tfar	= std::max(t0, t1);
+
+	t0 = (node.min[1] - ray.origin.y) * invDir.y;
+	t1 = (node.max[1] - ray.origin.y) * invDir.y;
+	tnear	= std::max(tnear, std::min(t0, t1));
+	tfar	= std::min(tfar,  std::max(t0, t1));
+
+	t0 = (node.min[2] - ray.origin.z) * invDir.z;
+	t1 = (node.max[2] - ray.origin.z) * invDir.z;
+	tnear	= std::max(tnear, std::min(t0, t1));
+	tfar	= std::min(tfar,  std::max(t0, t1));
+
+	tnear	= std::max(tnear, ray.tmin);
+	tfar	= std::min(tfar, tmax);
+	return tnear <= tfar ? tnear : -1.0f;
+}
+//
+//=======================================================================================
+//
+bool cSphereBVH::intersect (const sRay &ray, sHit &hit) const
+{
+	if (m_nodes.empty())
+	{
+		return false;
+	}
+
+	const sVec3	invDir = makeVec3(1.0f / ray.direction.x, 1.0f / ray.direction.y, 1.0f / ray.direction.z);
+	sRay		r = ray;
+	uint32_t	stack[BVH_STACK_SIZE];
+	int			top = 0;
+	bool		found = false;
+
+	stack[top++] = 0;
+	while (top > 0)
+	{
+		const sBVHNode &node = m_nodes[stack[--top]];
+
+		if (intersectBox(node, r, invDir, r.tmax) < 0.0f)
+			continue;
+
+		if (node.count > 0)
+		{
+			for (uint32_t i = node.offset; i < node.offset + node.count; i++)
+			{
+				float t;
+				if (intersectSphere(sphere(i), m_radius, r, t))
+				{
+					r.tmax		= t;
+					hit.t		= t;
+					hit.sphere	= i;
+					found		= true;
+				}
+			}
+		}
+		else
+		{
+			// visit the nearest child first
+			uint32_t	left	= (uint32_t)(&node - &m_nodes[0]) + 1;
+			uint32_t	right	= node.offset;
+			float		tl		= intersectBox(m_nodes[left],  r, invDir, r.tmax);
+			float		tr		= intersectBox(m_nodes[right], r, invDir, r.tmax);
+
+			if (tl >= 0.0f && tr >= 0.0f)
+			{
+				stack[top++] = tl < tr ? right : left;
+				stack[top++] = tl < tr ? left : right;
+			}
+			else if (tl >= 0.0f)
+			{
+				stack[top++] = left;
+			}
+			else if (tr >= 0.0f)
+			{
+				stack[top++] = right;
+			}
+		}
+	}
+	return found;
+}
+//
+//=======================================================================================
+//
+bool cSphereBVH::occluded (const sRay &ray) const
+{
+	if (m_nodes.empty())
+	{
+		return false;
+	}
+
+	const sVec3	invDir = makeVec3(1.0f / ray.direction.x, 1.0f / ray.direction.y, 1.0f / ray.direction.z);
+	uint32_t	stack[BVH_STACK_SIZE];
+	int			top = 0;
+
+	stack[top++] = 0;
+	while (top > 0)
+	{
+		uint32_t		index	= stack[--top];
+		const sBVHNode	&node	= m_nodes[index];
+
+		if (intersectBox(node, ray, invDir, ray.tmax) < 0.0f)
+			continue;
+
+		if (node.count > 0)
+		{
+			for (uint32_t i = node.offset; i < node.offset + node.count; i++)
+			{
+				float t;
+				if (intersectSphere(sphere(i), m_radius, ray, t))
+					return true;
+			}
+		}
+		else
+		{
+			stack[top++] = node.offset;
+			stack[top++] = index + 1;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,228 @@
+/*
+ * Distributed under the OSI-approved Apache License, Version 2.0.  See
+ * accompanying file Copyright.txt for details.
+ */
+
+#include <algorithm>
+#include "../header/cWideBVH.h"
+
+cWideBVH::cWideBVH ( )
+{
+	m_radius	= 1.0f;
+	m_simd		= supportsAVX2();
+}
+//
+//=======================================================================================
+//
+bool cWideBVH::supportsAVX2 ( )
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_cpu_supports("avx2");
+#else
+	return false;
+#endif
+}
+//
+//=======================================================================================
+//
+void cWideBVH::build (const cSphereBVH &bvh)
+{
+	const uint64_t numSpheres = bvh.numSpheres();
+
+	m_radius = bvh.radius();
+	m_x.resize(numSpheres);
+	m_y.resize(numSpheres);
+	m_z.resize(numSpheres);
+	for (uint64_t i = 0; i < numSpheres; i++)
+	{
+		const float *s = bvh.sphere((uint32_t) i);
+		m_x[i] = s[0];
+		m_y[i] = s[1];
+		m_z[i] = s[2];
+	}
+
+	m_nodes.clear();
+	if (!bvh.nodes().empty())
+	{
+		m_nodes.reserve(bvh.nodes().size() / 3 + 1);
+		collapse(bvh, 0);
+	}
+}
+//
+//=======================================================================================
+//
+static inline float surfaceArea (const sBVHNode &node)
+{
+	float dx = node.max[0] - node.min[0];
+	float dy = node.max[1] - node.min[1];
+	float dz = node.max[2] - node.min[2];
+	return dx*dy + dy*dz + dz*dx;
+}
+//
+//=======================================================================================
+//
+// Pulls up to four descendants of a binary node into one wide node, opening the largest child first
+uint32_t cWideBVH::collapse (const cSphereBVH &bvh, uint32_t index)
+{
+	const bvh_nodes &binary = bvh.nodes();
+	uint32_t	children[BVH4_WIDTH];
+	unsigned	numChildren = 0;
+
+	if (binary[index].count > 0)
+	{
+		children[numChildren++] = index;
+	}
+	else
+	{
+		children[numChildren++] = index + 1;
+		children[numChildren++] = binary[index].offset;
+	}
+	while (numChildren < BVH4_WIDTH)
+	{
+		int		best	= -1;
+		float	area	= -1.0f;
+		for (unsigned i = 0; i < numChildren; i++)
+		{
+			if (binary[children[i]].count == 0 && surfaceArea(binary[children[i]]) > area)
+			{
+				best = i;
+				area = surfaceArea(binary[children[i]]);
+			}
+		}
+		if (best < 0)
+			break;
+
+		uint32_t open			= children[best];
+		children[best]			= open + 1;
+		children[numChildren++]	= binary[open].offset;
+	}
+
+	uint32_t wide = (uint32_t) m_nodes.size();
+	m_nodes.push_back(sBVH4Node());
+
+	for (unsigned i = 0; i < BVH4_WIDTH; i++)
+	{
+		sBVH4Node &node = m_nodes[wide];
+		if (i >= numChildren)
+		{
+			node.minX[i] = node.minY[i] = node.minZ[i] =  1e38f;
+			node.maxX[i] = node.maxY[i] = node.maxZ[i] = -1e38f;
+			node.child[i] = BVH4_EMPTY;
+			node.count[i] = 0;
+			continue;
+		}
+
+		const sBVHNode &child = binary[children[i]];
+		node.minX[i] = child.min[0];	node.maxX[i] = child.max[0];
+		node.minY[i] = child.min[1];	node.maxY[i] = child.max[1];
+		node.minZ[i] = child.min[2];	node.maxZ[i] = child.max[2];
+		node.count[i] = child.count;
+		node.child[i] = child.offset;
+		if (child.count == 0)
+		{
+			// m_nodes may reallocate, set the slot through the index afterwards
+			uint32_t sub = collapse(bvh, children[i]);
+			m_nodes[wide].child[i] = sub;
+		}
+	}
+	return wide;
+}
+//
+//=======================================================================================
+//
+void cWideBVH::intersect (sRayPacket &packet) const
+{
+#if defined(__x86_64__) || defined(__i386__)
+	if (m_simd)
+	{
+		intersectAVX2(packet);
+		return;
+	}
+#endif
+	intersectScalar(packet);
+}
+//
+//=======================================================================================
+//
+// Reference path: the same traversal as intersectAVX2 with one lane at a time
+void cWideBVH::intersectScalar (sRayPacket &packet) const
+{
+	float			invX[PACKET_SIZE], invY[PACKET_SIZE], invZ[PACKET_SIZE];
+	sStackEntry		stack[PACKET_STACK_SIZE];
+	int				top = 0;
+
+	for (int l = 0; l < PACKET_SIZE; l++)
+	{
+		invX[l] = 1.0f / packet.dx[l];
+		invY[l] = 1.0f / packet.dy[l];
+		invZ[l] = 1.0f / packet.dz[l];
+		packet.sphere[l] = PACKET_NO_HIT;
+	}
+	if (m_nodes.empty())
+	{
+		return;
+	}
+
+	stack[top++] = makeStackEntry(0, 0, -1e38f);
+	while (top > 0)
+	{
+		const sStackEntry entry = stack[--top];
+
+		float farthest = packet.tmax[0];
+		for (int l = 1; l < PACKET_SIZE; l++)
+			farthest = std::max(farthest, packet.tmax[l]);
+		if (entry.tnear > farthest)
+			continue;
+
+		if (entry.count > 0)
+		{
+			for (uint32_t s = entry.index; s < entry.index + entry.count; s++)
+			{
+				const float center[3] = { m_x[s], m_y[s], m_z[s] };
+				for (int l = 0; l < PACKET_SIZE; l++)
+				{
+					sRay	ray;
+					float	t;
+					ray.origin		= makeVec3(packet.ox[l], packet.oy[l], packet.oz[l]);
+					ray.direction	= makeVec3(packet.dx[l], packet.dy[l], packet.dz[l]);
+					ray.tmin		= packet.tmin[l];
+					ray.tmax		= packet.tmax[l];
+					if (intersectSphere(center, m_radius, ray, t))
+					{
+						packet.tmax[l]		= t;
+						packet.sphere[l]	= s;
+					}
+				}
+			}
+			continue;
+		}
+
+		const sBVH4Node	&node = m_nodes[entry.index];
+		sStackEntry		hits[BVH4_WIDTH];
+		int				numHits = 0;
+
+		for (int c = 0; c < BVH4_WIDTH; c++)
+		{
+			if (node.child[c] == BVH4_EMPTY)
+				continue;
+
+			float nearest = 1e38f;
+			for (int l = 0; l < PACKET_SIZE; l++)
+			{
+				float x0 = (node.minX[c] - packet.ox[l]) * invX[l], x1 = (node.maxX[c] - packet.ox[l]) * invX[l];
+				float y0 = (node.minY[c] - packet.oy[l]) * invY[l], y1 = (node.maxY[c] - packet.oy[l]) * invY[l];
+				float z0 = (node.minZ[c] - packet.oz[l]) * invZ[l], z1 = (node.maxZ[c] - packet.oz[l]) * invZ[l];
+
+				float tnear	= std::max(std::max(std::min(x0, x1), std::min(y0, y1)), std::max(std::min(z0, z1), packet.tmin[l]));
+				float tfar	= std::min(std::min(std::max(x0, x1), std::max(y0, y1)), std::min(std::max(z0, z1), packet.tmax[l]));
+				if (tnear <= tfar)
+					nearest = std::min(nearest, tnear);
+			}
+			if (nearest < 1e38f)
+			{
+				hits[numHits++] = makeStackEntry(node.child[c], node.count[c], nearest);
+			}
+		}
+		pushNearestLast(stack, top, hits, numHits);
+	}
+}
@@ -0,0 +1,153 @@
+/*
+ * Distributed under the OSI-approved Apache License, Version 2.0.  See
+ * accompanying file Copyright.txt for details.
+ */
+
+// Standard headers are included before the target pragma so no library code is compiled for AVX2.
+// FMA is left out on purpose: contracting b*b - c changes which grazing rays hit the spheres.
+#include <algorithm>
+#include "../header/cWideBVH.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#include <immintrin.h>
+
+static inline float horizontalMax (__m256 v)
+{
+	__m128 m = _mm_max_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+	m = _mm_max_ps(m, _mm_movehl_ps(m, m));
+	m = _mm_max_ss(m, _mm_shuffle_ps(m, m, 1));
+	return _mm_cvtss_f32(m);
+}
+
+static inline float horizontalMin (__m256 v)
+{
+	__m128 m = _mm_min_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+	m = _mm_min_ps(m, _mm_movehl_ps(m, m));
+	m = _mm_min_ss(m, _mm_shuffle_ps(m, m, 1));
+	return _mm_cvtss_f32(m);
+}
+//
+//=======================================================================================
+//
+// 8 rays per instruction: one child box or one sphere is tested against the whole packet
+void cWideBVH::intersectAVX2 (sRayPacket &packet) const
+{
+	const __m256	ox		= _mm256_load_ps(packet.ox);
+	const __m256	oy		= _mm256_load_ps(packet.oy);
+	const __m256	oz		= _mm256_load_ps(packet.oz);
+	const __m256	dx		= _mm256_load_ps(packet.dx);
+	const __m256	dy		= _mm256_load_ps(packet.dy);
+	const __m256	dz		= _mm256_load_ps(packet.dz);
+	const __m256	one		= _mm256_set1_ps(1.0f);
+	const __m256	invX	= _mm256_div_ps(one, dx);
+	const __m256	invY	= _mm256_div_ps(one, dy);
+	const __m256	invZ	= _mm256_div_ps(one, dz);
+	const __m256	tmin	= _mm256_load_ps(packet.tmin);
+	const __m256	inf		= _mm256_set1_ps(1e38f);
+	const __m256	radius2	= _mm256_set1_ps(m_radius * m_radius);
+	const __m256	refine	= _mm256_set1_ps(10.f * m_radius);
+	const __m256	absMask	= _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+	__m256			tmax	= _mm256_load_ps(packet.tmax);
+	__m256i			sphere	= _mm256_set1_epi32((int) PACKET_NO_HIT);
+	sStackEntry		stack[PACKET_STACK_SIZE];
+	int				top = 0;
+
+	if (!m_nodes.empty())
+	{
+		stack[top++] = makeStackEntry(0, 0, -1e38f);
+	}
+
+	while (top > 0)
+	{
+		const sStackEntry entry = stack[--top];
+
+		if (entry.tnear > horizontalMax(tmax))
+			continue;
+
+		if (entry.count > 0)
+		{
+			for (uint32_t s = entry.index; s < entry.index + entry.count; s++)
+			{
+				// intersectSphere for 8 rays
+				__m256 Ox	= _mm256_sub_ps(ox, _mm256_set1_ps(m_x[s]));
+				__m256 Oy	= _mm256_sub_ps(oy, _mm256_set1_ps(m_y[s]));
+				__m256 Oz	= _mm256_sub_ps(oz, _mm256_set1_ps(m_z[s]));
+				__m256 b	= _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(Ox, dx), _mm256_mul_ps(Oy, dy)), _mm256_mul_ps(Oz, dz));
+				__m256 c	= _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(Ox, Ox), _mm256_mul_ps(Oy, Oy)), _mm256_mul_ps(Oz, Oz)), radius2);
+				__m256 disc	= _mm256_sub_ps(_mm256_mul_ps(b, b), c);
+				__m256 hit	= _mm256_cmp_ps(disc, _mm256_setzero_ps(), _CMP_GT_OQ);
+				if (_mm256_movemask_ps(hit) == 0)
+					continue;
+
+				__m256 root1	= _mm256_sub_ps(_mm256_sub_ps(_mm256_setzero_ps(), b), _mm256_sqrt_ps(_mm256_max_ps(disc, _mm256_setzero_ps())));
+				__m256 far		= _mm256_cmp_ps(_mm256_and_ps(root1, absMask), refine, _CMP_GT_OQ);
+				__m256 root11	= _mm256_setzero_ps();
+				if (_mm256_movemask_ps(_mm256_and_ps(far, hit)))
+				{
+					__m256 O1x	= _mm256_add_ps(Ox, _mm256_mul_ps(root1, dx));
+					__m256 O1y	= _mm256_add_ps(Oy, _mm256_mul_ps(root1, dy));
+					__m256 O1z	= _mm256_add_ps(Oz, _mm256_mul_ps(root1, dz));
+					__m256 b1	= _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(O1x, dx), _mm256_mul_ps(O1y, dy)), _mm256_mul_ps(O1z, dz));
+					__m256 c1	= _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(O1x, O1x), _mm256_mul_ps(O1y, O1y)), _mm256_mul_ps(O1z, O1z)), radius2);
+					__m256 disc1	= _mm256_sub_ps(_mm256_mul_ps(b1, b1), c1);
+					__m256 valid	= _mm256_and_ps(far, _mm256_cmp_ps(disc1, _mm256_setzero_ps(), _CMP_GT_OQ));
+					__m256 r		= _mm256_sub_ps(_mm256_sub_ps(_mm256_setzero_ps(), b1), _mm256_sqrt_ps(_mm256_max_ps(disc1, _mm256_setzero_ps())));
+					root11 = _mm256_and_ps(valid, r);
+				}
+
+				__m256 t = _mm256_add_ps(root1, root11);
+				hit = _mm256_and_ps(hit, _mm256_and_ps(_mm256_cmp_ps(t, tmin, _CMP_GT_OQ), _mm256_cmp_ps(t, tmax, _CMP_LT_OQ)));
+				tmax	= _mm256_blendv_ps(tmax, t, hit);
+				sphere	= _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(sphere),
+														_mm256_castsi256_ps(_mm256_set1_epi32((int) s)), hit));
+			}
+			continue;
+		}
+
+		const sBVH4Node	&node = m_nodes[entry.index];
+		sStackEntry		hits[BVH4_WIDTH];
+		int				numHits = 0;
+
+		for (int c = 0; c < BVH4_WIDTH; c++)
+		{
+			if (node.child[c] == BVH4_EMPTY)
+				continue;
+
+			__m256 x0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.minX[c]), ox), invX);
+			__m256 x1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.maxX[c]), ox), invX);
+			__m256 y0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.minY[c]), oy), invY);
+			__m256 y1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.maxY[c]), oy), invY);
+			__m256 z0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.minZ[c]), oz), invZ);
+			__m256 z1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.maxZ[c]), oz), invZ);
+
+			__m256 tnear	= _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(x0, x1), _mm256_min_ps(y0, y1)),
+											_mm256_max_ps(_mm256_min_ps(z0, z1), tmin));
+			__m256 tfar		= _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(x0, x1), _mm256_max_ps(y0, y1)),
+											_mm256_min_ps(_mm256_max_ps(z0, z1), tmax));
+			__m256 mask		= _mm256_cmp_ps(tnear, tfar, _CMP_LE_OQ);
+			if (_mm256_movemask_ps(mask))
+			{
+				float nearest = horizontalMin(_mm256_blendv_ps(inf, tnear, mask));
+				hits[numHits++] = makeStackEntry(node.child[c], node.count[c], nearest);
+			}
+		}
+		pushNearestLast(stack, top, hits, numHits);
+	}
+
+	_mm256_store_ps(packet.tmax, tmax);
+	_mm256_store_si256((__m256i*) packet.sphere, sphere);
+}
+
+#pragma GCC pop_options
+
+#else
+
+void cWideBVH::intersectAVX2 (sRayPacket &packet) const
+{
+	intersectScalar(packet);
+}
+
+#endif
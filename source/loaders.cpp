@@ -8,148 +8,344 @@
 #include <string>
 #include <iomanip>
 #include <vector>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../frameserver/header/cThreadPool.h"
 #include "../header/loaders.h"
 
+// Exact powers of ten representable as doubles
+static const double s_pow10[] =
+{
+	1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static inline bool isSpace (char c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static inline bool isDigit (char c)
+{
+	return (unsigned char)(c - '0') < 10;
+}
+
+// Fast decimal parser. Mantissas that do not fit a double exactly or exponents outside the
+// range of exact powers of ten fall back to strtof so the result matches the serial loader.
+// The double is then the one nearest to the decimal, and rounding it to float gives the float
+// nearest to the decimal unless it fell exactly halfway between two floats: those go to strtof
+// as well, since the decimal may lie on either side of it.
+float parseFloat (const char *&ptr, const char *end)
+{
+	while (ptr < end && isSpace(*ptr))
+		ptr++;
+
+	const char 			*start		= ptr;
+	bool				negative	= false;
+	unsigned long long	mantissa	= 0;
+	int					digits		= 0;
+	int					exponent	= 0;
+
+	if (ptr < end && (*ptr == '-' || *ptr == '+'))
+	{
+		negative = (*ptr == '-');
+		ptr++;
+	}
+	while (ptr < end && *ptr == '0')
+		ptr++;
+	while (ptr < end && isDigit(*ptr))
+	{
+		if (digits < 19)
+			mantissa = mantissa*10 + (*ptr - '0');
+		else
+			exponent++;
+		digits++;
+		ptr++;
+	}
+	if (ptr < end && *ptr == '.')
+	{
+		ptr++;
+		if (digits == 0)
+		{
+			while (ptr < end && *ptr == '0')
+			{
+				exponent--;
+				ptr++;
+			}
+		}
+		while (ptr < end && isDigit(*ptr))
+		{
+			if (digits < 19)
+			{
+				mantissa = mantissa*10 + (*ptr - '0');
+				exponent--;
+			}
+			digits++;
+			ptr++;
+		}
+	}
+	if (ptr < end && (*ptr == 'e' || *ptr == 'E'))
+	{
+		const char	*expStart	= ptr++;
+		bool		expNegative	= false;
+		int			expValue	= 0;
+
+		if (ptr < end && (*ptr == '-' || *ptr == '+'))
+		{
+			expNegative = (*ptr == '-');
+			ptr++;
+		}
+		if (ptr < end && isDigit(*ptr))
+		{
+			while (ptr < end && isDigit(*ptr))
+			{
+				if (expValue < 10000)
+					expValue = expValue*10 + (*ptr - '0');
+				ptr++;
+			}
+			exponent += expNegative ? -expValue : expValue;
+		}
+		else
+		{
+			ptr = expStart;
+		}
+	}
+
+	bool	exact = !(digits > 19 || mantissa > (1ULL << 53) || exponent < -22 || exponent > 22 || (ptr < end && isalpha(*ptr)));
+	double	value = 0.0;
+	if (exact)
+	{
+		value = (double) mantissa;
+		value = exponent < 0 ? value / s_pow10[-exponent] : value * s_pow10[exponent];
+
+		// 10^-22 <= value < 2^53 * 10^22 is a normal float, whose 24 bit significand leaves the low
+		// 29 of the double's 53: a halfway double has exactly the top one of those set
+		uint64_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		exact = (bits & 0x1FFFFFFFULL) != 0x10000000ULL;
+	}
+	if (!exact)
+	{
+		// slow path: copy the token so strtof cannot read past the mapped region
+		char	token[64];
+		size_t	len = 0;
+		ptr = start;
+		while (ptr < end && !isSpace(*ptr) && len < sizeof(token) - 1)
+			token[len++] = *ptr++;
+		token[len] = '\0';
+		return strtof(token, 0);
+	}
+
+	return (float) (negative ? -value : value);
+}
+
+// Returns true when [ptr, end) still holds a record, leaving ptr at its first character
+static inline bool nextRecord (const char *&ptr, const char *end)
+{
+	while (ptr < end && isSpace(*ptr))
+		ptr++;
+	return ptr < end;
+}
+
+static inline void skipLine (const char *&ptr, const char *end)
+{
+	const char *eol = (const char *) memchr(ptr, '\n', end - ptr);
+	ptr = eol ? eol + 1 : end;
+}
+
+// Per chunk state. Chunks are aligned to line boundaries so each one holds whole records.
+struct sAsciiChunk
+{
+	const char	*begin, *end;
+	size_t		numRecords;		// records in this chunk
+	size_t		firstRecord;	// global index of the first record
+	size_t		firstOutput;	// index of the first record kept after decimation
+	size_t		numOutput;		// records kept after decimation
+	float		min[4], max[4];
+};
 
 // load dataset with a decimation factor.  Useful when data does not fit in GPU Memory
 
 int loadAscii (const char* filename, std::vector<float> *positions, std::vector<float> *nrg, float *min, float *max, unsigned int decimation)
 {
-	int numParticles = 0;
 	static int numComponents = 4;
 	std::cout << "loading " << filename << std::endl;
-	// first parse the file
-	std::string 	point;
-	std::ifstream 	file (filename, std::ios::binary);
-	char 			*memblock;
 
-	double x, y, z, energy, id;
+	if (decimation == 0)
+	{
+		decimation = 1;
+	}
 
-	if (!file.is_open())
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0)
 	{
 		return false;
 	}
 
-	// get size of file
-	file.seekg(0, file.end);
-	std::size_t size=file.tellg();
-	file.seekg(0);
-
-	std::cout << "file size " << size << " bytes\nReading started\n";
-
-	memblock	= new char [size];
-	file.seekg	(0, std::ios::beg);
-	file.read 	(memblock, size);
-	file.close ( );
-
-	std::cout << "Reading Done... Parsing starts... \n";
+	struct stat st;
+	if (fstat(fd, &st) != 0)
+	{
+		close(fd);
+		return false;
+	}
+	std::size_t size = st.st_size;
 
-	char* ptr = memblock;
-	char* end = 0;
-	unsigned int  recordsRead = 0;
-	 //float x = strtod(memblock, &end);
+	std::cout << "file size " << size << " bytes\nMapping started\n";
 
-	while (ptr != end)
+	positions->clear();
+	if (size == 0)
 	{
+		close(fd);
+		std::cout << "Num atoms: " << " " << 0 << std::endl;
+		return true;
+	}
 
-		if (numParticles%decimation == 0)
-		{
-			if (end)
-			{
-				ptr = end;
-			}
+	void *map = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+	{
+		std::cout << "mmap failed for " << filename << std::endl;
+		return false;
+	}
+	madvise(map, size, MADV_SEQUENTIAL);
 
-			z = strtof(ptr, &end);
-			ptr = end;
+	const char		*data		= (const char *) map;
+	const char		*dataEnd	= data + size;
+	cThreadPool		pool;
+	unsigned int	numChunks	= pool.size() * 4;
+	std::vector<sAsciiChunk> chunks(numChunks);
 
-			y = strtof(ptr, &end);
-			ptr = end;
+	std::cout << "Parsing starts with " << pool.size() << " threads... \n";
 
-			x = strtof(ptr, &end);
-			ptr = end;
+	// split the file in chunks starting right after a new line
+	std::vector<const char *> bounds(numChunks + 1);
+	bounds[0]			= data;
+	bounds[numChunks]	= dataEnd;
+	for (unsigned int i = 1; i < numChunks; i++)
+	{
+		const char *ptr = data + (size / numChunks) * i;
+		if (ptr < bounds[i-1])
+			ptr = bounds[i-1];
+		if (ptr > data && ptr[-1] != '\n')
+			skipLine(ptr, dataEnd);
+		bounds[i] = ptr;
+	}
+	for (unsigned int i = 0; i < numChunks; i++)
+	{
+		chunks[i].begin = bounds[i];
+		chunks[i].end	= bounds[i+1];
+	}
 
-			energy = strtof(ptr, &end);
+	// first pass: count the records of every chunk
+	pool.run(numChunks, [&chunks](unsigned int i)
+	{
+		const char	*ptr	= chunks[i].begin;
+		size_t		count	= 0;
+		while (nextRecord(ptr, chunks[i].end))
+		{
+			count++;
+			skipLine(ptr, chunks[i].end);
+		}
+		chunks[i].numRecords = count;
+	});
 
-			if (numParticles == 0)
-			{
-				min[0] = x;
-				min[1] = y;
-				min[2] = z;
-				min[3] = energy;
-
-				max[0] = x;
-				max[1] = y;
-				max[2] = z;
-				max[3] = energy;
-			}
-			else
-			{
-				min[0] = Min<float> (x, min[0]);
-				min[1] = Min<float> (y, min[1]);
-				min[2] = Min<float>  (z, min[2]);
+	// global record indices and output offsets so decimation matches the serial path
+	size_t numRecords = 0, numOutput = 0;
+	for (unsigned int i = 0; i < numChunks; i++)
+	{
+		size_t first		= numRecords;
+		size_t last			= numRecords + chunks[i].numRecords;
+		size_t keptBefore	= (first + decimation - 1) / decimation;
+		size_t keptAfter	= (last + decimation - 1) / decimation;
 
-				max[0] = Max<float> (x, max[0]);
-				max[1] = Max<float> (y, max[1]);
-				max[2] = Max<float> (z, max[2]);
+		chunks[i].firstRecord	= first;
+		chunks[i].firstOutput	= numOutput;
+		chunks[i].numOutput		= keptAfter - keptBefore;
 
-				min[3] = Min<float> (energy,min[3]);
-				max[3] = Max<float> (energy,max[3]);
-			}
+		numRecords	+= chunks[i].numRecords;
+		numOutput	+= chunks[i].numOutput;
+	}
 
+	positions->resize(numOutput * numComponents);
+	float *out = positions->data();
 
-			positions->push_back 	(x);
-			positions->push_back 	(y);
-			positions->push_back 	(z);
-			positions->push_back 	(energy);
+	// second pass: every chunk writes its records into its own slice of the output
+	pool.run(numChunks, [&chunks, out, decimation](unsigned int i)
+	{
+		sAsciiChunk	&chunk	= chunks[i];
+		const char	*ptr	= chunk.begin;
+		size_t		record	= chunk.firstRecord;
+		float		*dst	= out + chunk.firstOutput * numComponents;
+		bool		first	= true;
 
-			if (positions->size()%(1000000*numComponents) == 0 && numParticles > 1) // print every million atoms read
+		while (nextRecord(ptr, chunk.end))
+		{
+			if (record % decimation == 0)
 			{
-				recordsRead = (positions->size()/numComponents) / 1000000;
-
-				std::cout << "Records read: " << recordsRead << "M of " << numParticles / 1000000 << "M" << std::endl; // divide by 3 because holds 3 variables.
-
+				// record fields are stored in reverse order: z y x energy
+				float z			= parseFloat(ptr, chunk.end);
+				float y			= parseFloat(ptr, chunk.end);
+				float x			= parseFloat(ptr, chunk.end);
+				float energy	= parseFloat(ptr, chunk.end);
+
+				dst[0] = x;
+				dst[1] = y;
+				dst[2] = z;
+				dst[3] = energy;
+
+				if (first)
+				{
+					for (int c = 0; c < 4; c++)
+					{
+						chunk.min[c] = chunk.max[c] = dst[c];
+					}
+					first = false;
+				}
+				else
+				{
+					for (int c = 0; c < 4; c++)
+					{
+						chunk.min[c] = Min<float> (dst[c], chunk.min[c]);
+						chunk.max[c] = Max<float> (dst[c], chunk.max[c]);
+					}
+				}
+				dst += numComponents;
 			}
+			skipLine(ptr, chunk.end);
+			record++;
 		}
-		else // just go through the buffer
-		{
-			if (end)
-				ptr = end;
-
-			//x
-			x = strtof(ptr, &end);
-			ptr = end;
-
-			//y
-			y = strtof(ptr, &end);
-			ptr = end;
+	});
 
-			//z
-			z = strtof(ptr, &end);
-			ptr = end;
-
-			//energy
-			energy = strtof(ptr, &end);
-			//ptr = end;
-			//id
-			//id = strtof(ptr, &end);
+	munmap(map, size);
 
+	// merge the per chunk bounds
+	bool first = true;
+	for (unsigned int i = 0; i < numChunks; i++)
+	{
+		if (chunks[i].numOutput == 0)
+			continue;
+		for (int c = 0; c < 4; c++)
+		{
+			min[c] = first ? chunks[i].min[c] : Min<float> (chunks[i].min[c], min[c]);
+			max[c] = first ? chunks[i].max[c] : Max<float> (chunks[i].max[c], max[c]);
 		}
-		numParticles++;
+		first = false;
 	}
-	delete [] memblock;
 
+	std::cout << "Records read: " << numRecords << std::endl;
 	std::cout << "Num atoms: " 			<< " " << positions->size()/numComponents << std::endl;
-	//std::cout << "Num elements: " 			<< " " << vPosNRG.size()	<< std::endl;
 
 	std::cout << "Min = {" << min[0] 	<< ", " << min[1] << ", " << min[2] << " } \n";
 	std::cout << "Max = {" << max[0] 	<< ", " << max[1] << ", " << max[2] << " } \n";
 	std::cout << "Energy min: " << min[3] << " Energy max: " << max[3] << std::endl;
 
-	file.close();
-
 	return true;
 
 }
-
@@ -14,15 +14,29 @@
 #include <cmath>
 #include <string>
 #include <vector>
+#include <algorithm>
+#include <cstdint>
 #include "../header/loaders.h"
+#include "../header/cParticleCache.h"
+#include "../header/cAsciiParticleSource.h"
+#include "../header/particleSort.h"
+#include "../header/benchmarks.h"
+#include "../header/cRenderScheduler.h"
+#include "../header/offline.h"
 // websockets headers
 #include "../frameserver/header/cBroadcastServer.h"
 #include "../frameserver/header/cMouseEventHandler.h"
 #include "../frameserver/header/cKeyboardHandler.h"
 #include "../frameserver/header/cMessageHandler.h"
+#include "../frameserver/header/cThreadPool.h"
+#include "../frameserver/header/cTimer.h"
 
 // Renderer
+#include "../header/cParticlesRenderer.h"
+#include "../header/cCpuParticlesRenderer.h"
+#ifdef OPTIX_RENDERER
 #include "../header/cOptixParticlesRenderer.h"
+#endif
 
 int						front			= 0;	// buffer
 int						back			= 1;
@@ -34,7 +48,8 @@ broadcast_server		*wsserver 		= 0;
 cMouseHandler 			*mouseHandler 	= 0;
 cKeyboardHandler 		*keyboardHandler= 0;
 cMessageHandler 		*msgHandler 	= 0;
-cOptixParticlesRenderer *renderer	= 0;
+cParticlesRenderer		*renderer		= 0;
+cRenderScheduler		*scheduler		= 0;
 #ifdef NVPIPE_ENCODING
 unsigned char			pixels[IMAGE_WIDTH*IMAGE_HEIGHT*4];
 #else
@@ -46,10 +61,31 @@ void display ()
 	static bool flag = 1;
 	renderer->display(pixels);
 
+#ifdef PIPELINE
+	// encoding and sending run on the frame server threads, hand over the frame and keep rendering
+	if (wsserver->streaming())
+#else
 	if (wsserver->sendMoreFrames())
+#endif
 	{
 		try
 		{
+#ifdef PIPELINE
+			cFrameQueue *frames = wsserver->frameQueue();
+			int slot = frames->acquire();
+			if (slot >= 0)
+			{
+				const int width = renderer->renderWidth(), height = renderer->renderHeight();
+				renderer->getPixels(frames->data(slot));
+				frames->setImageSize(slot, width, height);
+				scheduler->frameDone(frames->data(slot), (size_t)width * height * 3);
+				frames->publish(slot);
+			}
+			else
+			{
+				scheduler->frameDone(0, 0);
+			}
+#else
 #ifdef REMOTE_GPU_ENCODING
 			// Use the next line only when using GPU encoding
 			wsserver->sendFrame(renderer->getGPUFrameBufferPtr());
@@ -57,15 +93,38 @@ void display ()
 #if defined(REMOTE) || defined(NO_COMPRESSION)
 			renderer->getPixels(pixels);
 			wsserver->sendFrame(pixels);
+			scheduler->frameDone(pixels, (size_t)IMAGE_WIDTH * IMAGE_HEIGHT * 3);
+#else
+			scheduler->frameDone(0, 0);
+#endif
 #endif
 		}
+#ifdef OPTIX_RENDERER
 		catch ( Exception& e )
 		{
 			std::cout << e.getErrorString().c_str() << std::endl;
 			exit(1);
 		}
+#else
+		catch ( std::exception& e )
+		{
+			std::cout << e.what() << std::endl;
+			exit(1);
+		}
+#endif
+	}
+	else
+	{
+		scheduler->frameDone(0, 0);
+	}
+	// input the renderer took for this frame, timed from the event waiting longest
+	const uint64_t mouseTime = mouseHandler->takeFirstTime(), keyTime = keyboardHandler->takeFirstTime();
+	if (mouseTime > 0 || keyTime > 0)
+	{
+		scheduler->inputShown(mouseTime > 0 && keyTime > 0 ? std::min(mouseTime, keyTime) : std::max(mouseTime, keyTime));
 	}
-	if (wsserver->saveFrame())
+	// snapshots wait for a frame at full resolution
+	if (wsserver->saveFrame() && renderer->renderWidth() == IMAGE_WIDTH)
 	{
 		renderer->getPixels(pixels);
 		wsserver->save(pixels);
@@ -85,10 +144,15 @@ void display ()
 //
 void renderingLoop ()
 {
-	char c;
 	while (running)
 	{
-		display (	);
+		// sleeps while nobody is streaming or the image has converged, input wakes it up
+		if (scheduler->wait(wsserver->streaming(), renderer->accumulatedFrames()))
+		{
+			renderer->setRenderScale (scheduler->renderScale());
+			display (	);
+		}
+		scheduler->printStats ( );
 	}
 }
 //
@@ -107,6 +171,13 @@ void webSocketServer() {
 void init (int argc, char** argv)
 {
 	int			decimation = 1;
+	bool		stream = false;
+	bool		sort = false;
+	bool		cpu = false;
+	unsigned int samples = RENDER_SAMPLE_BUDGET;
+	bool		samplesGiven = false;
+	int			posterWidth = 0, posterHeight = 0;
+	std::string	cameraPath;
 	std::string filename;
 	std::vector<float> vPos;
 	std::vector<float> vNrg;
@@ -115,31 +186,167 @@ void init (int argc, char** argv)
 	float min[4] = {0.0,0.0,0.0, 0.0};
 	float max[4] = {-100000.0,-100000.0,-100000.0, -100000.0};
 
-	if ( argc == 3 )
+	if ( argc >= 3 )
 	{
 		filename = std::string (argv[1]);
 		decimation = std::stoi (argv[2]);
 	}
-	else
+	for (int i = 3; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-stream") == 0)
+		{
+			stream = true;
+		}
+		else if (strcmp(argv[i], "-sort") == 0)
+		{
+			sort = true;
+		}
+		else if (strcmp(argv[i], "-cpu") == 0)
+		{
+			cpu = true;
+		}
+		else if (strcmp(argv[i], "-samples") == 0 && i + 1 < argc)
+		{
+			samples = (unsigned int) std::stoi (argv[++i]);
+			samplesGiven = true;
+		}
+		else if (strcmp(argv[i], "-batch") == 0 && i + 1 < argc)
+		{
+			cameraPath = std::string (argv[++i]);
+		}
+		else if (strcmp(argv[i], "-poster") == 0 && i + 2 < argc)
+		{
+			posterWidth		= std::stoi (argv[++i]);
+			posterHeight	= std::stoi (argv[++i]);
+			if (posterWidth <= 0 || posterHeight <= 0)
+			{
+				argc = 0;
+			}
+		}
+		else
+		{
+			argc = 0;
+		}
+	}
+	if ( argc < 3 )
 	{
 		std::cout << "\n Usage: \n";
-		std::cout << "\t\t sight [file] decimationFactor \n\n";
+		std::cout << "\t\t sight [file] decimationFactor [-stream] [-sort] [-cpu] [-samples n] [-poster width height] [-batch path] \n";
+		std::cout << "\t\t sight -bench name [args] \n\n";
+		std::cout << "\t -stream \t parse the file in bounded memory instead of loading it whole\n";
+		std::cout << "\t -sort \t\t reorder the particles along a Morton curve so geometry groups are compact\n";
+		std::cout << "\t -cpu \t\t render with the CPU ray tracer instead of OptiX\n";
+		std::cout << "\t -samples \t frames accumulated before rendering stops until the view changes, 0 for no limit\n";
+		std::cout << "\t -poster \t render the initial view as a PNG of any size in tiles, then exit\n";
+		std::cout << "\t -batch \t render the frames of a camera path file to PNG files, then exit\n\n";
 		exit (1);
 	}
 
-// loader for files containing fields x,y,z,Pe
-	if (!loadAscii(filename.data(), &vPos, &vNrg, min, max, decimation))
+	// a binary cache from a previous run is mapped as is, otherwise parse the ASCII file
+	cParticleCache			cache;
+	cAsciiParticleSource	ascii;
+	cMemoryParticleSource	memory;
+	cParticleSource			*source = &cache;
+	uint32_t				cacheFlags = 0;
+
+	if (sort && stream)
+	{
+		std::cout << "-sort needs the whole dataset in memory, -stream is ignored" << std::endl;
+		stream = false;
+	}
+
+	bool cached = cache.open(filename, decimation);
+	if (cached && sort && !(cache.flags() & PARTICLE_CACHE_MORTON_SORTED))
+	{
+		// the cache is in file order, sort a copy and rewrite it
+		vPos.assign(cache.data(), cache.data() + cache.numParticles() * 4);
+		memcpy(min, cache.min(), sizeof(min));
+		memcpy(max, cache.max(), sizeof(max));
+		cache.close();
+		cached = false;
+	}
+
+	if (!cached)
+	{
+		if (stream)
+		{
+			if (!ascii.open(filename, decimation))
+			{
+				std::cout << filename << " file not found. " << std::endl;
+				exit (0);
+			}
+			source = &ascii;
+		}
+		else
+		{
+			// loader for files containing fields x,y,z,Pe
+			if (vPos.empty() && !loadAscii(filename.data(), &vPos, &vNrg, min, max, decimation))
+			{
+				std::cout << filename << " file not found. " << std::endl;
+				exit (0);
+			}
+			if (sort)
+			{
+				cThreadPool pool;
+				cTimer		timer;
+				mortonSort(vPos.data(), vPos.size() / 4, min, max, pool);
+				cacheFlags |= PARTICLE_CACHE_MORTON_SORTED;
+				std::cout << "Morton sort: " << timer.getElapsedMilliseconds() << " ms" << std::endl;
+			}
+			memory.set(vPos.data(), vPos.size() / 4, min, max);
+			source = &memory;
+		}
+
+		if (!cParticleCache::write(filename, decimation, *source, cacheFlags))
+		{
+			std::cout << "Warning: particle cache could not be written next to " << filename << std::endl;
+		}
+		else if (stream && cache.open(filename, decimation))
+		{
+			// reading back the cache is cheaper than parsing the text a second time
+			source = &cache;
+		}
+	}
+#ifdef OPTIX_RENDERER
+	if (!cpu)
+	{
+		renderer = new cOptixParticlesRenderer (true);
+	}
+#endif
+	if (!renderer)
+	{
+		renderer = new cCpuParticlesRenderer ();
+	}
+	renderer->init( IMAGE_WIDTH, IMAGE_HEIGHT, source );
+
+	if (posterWidth > 0 || !cameraPath.empty())
 	{
-		std::cout << filename << " file not found. " << std::endl;
-		exit (0);
+		// offline, nothing is served
+		const unsigned int offlineSamples = samplesGiven && samples > 0 ? samples : OFFLINE_SAMPLES;
+		bool saved;
+		if (posterWidth > 0)
+		{
+			std::stringstream name;
+			name << "Sight_Poster_" << posterWidth << "x" << posterHeight << ".png";
+			saved = renderPoster (renderer, posterWidth, posterHeight, offlineSamples, name.str());
+		}
+		else
+		{
+			saved = renderBatch (renderer, cameraPath, offlineSamples);
+		}
+		delete renderer;
+		exit (saved ? 0 : 1);
 	}
-	renderer = new cOptixParticlesRenderer (true);
-	renderer->init( IMAGE_WIDTH, IMAGE_HEIGHT, &vPos, min, max );
 
 	mouseHandler 	= new cMouseHandler();
 	keyboardHandler = new cKeyboardHandler();
 	msgHandler 		= new cMessageHandler();
 	wsserver 		= new broadcast_server();
+#ifdef DYNAMIC_RESOLUTION
+	scheduler		= new cRenderScheduler(samples, RENDER_CONVERGED_CHANGE, RENDER_INTERACTIVE_SCALE);
+#else
+	scheduler		= new cRenderScheduler(samples);
+#endif
 
 }
 //
@@ -152,6 +359,7 @@ void setHandlers()
 	wsserver->setMessageHandler		(msgHandler);
 	renderer->setMouseHandler 		(mouseHandler);
 	renderer->setKeyboardHandler	(keyboardHandler);
+	wsserver->setWakeHandler		([] { scheduler->wake(); });
 }
 //
 //=======================================================================================
@@ -170,6 +378,11 @@ int main(int argc, char** argv)
 	srand (time(NULL));
 	signal(SIGINT, signalHandler);
 
+	if (argc >= 2 && strcmp(argv[1], "-bench") == 0)
+	{
+		return runBenchmark (argc - 2, argv + 2);
+	}
+
 	init (argc, argv);
 	setHandlers				(	);
 	std::thread wsserverThread	( webSocketServer );
@@ -185,6 +398,7 @@ int main(int argc, char** argv)
 	delete 	msgHandler;
 	delete 	wsserver;
 	delete	renderer;
+	delete	scheduler;
 
 	return 0;
 }
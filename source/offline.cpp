@@ -0,0 +1,225 @@
+/*
+ * Distributed under the OSI-approved Apache License, Version 2.0.  See
+ * accompanying file Copyright.txt for details.
+ */
+
+#include <stdio.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <vector>
+#include <string.h>
+#include <algorithm>
+#include "../frameserver/header/cTimer.h"
+#include "../frameserver/header/cParallelPngEncoder.h"
+#include "../frameserver/header/cSnapshotWriter.h"
+#include "../header/cParticlesRenderer.h"
+#include "../header/offline.h"
+
+bool renderPoster (cParticlesRenderer *renderer, int width, int height, unsigned int samples, const std::string &filename)
+{
+	// tiles of the full frame buffer
+	renderer->setRenderScale (100);
+	const int tileWidth		= std::min(renderer->renderWidth(), width);
+	const int tileHeight	= std::min(renderer->renderHeight(), height);
+	const int tilesX		= (width  + tileWidth  - 1) / tileWidth;
+	const int tilesY		= (height + tileHeight - 1) / tileHeight;
+
+	cParallelPngEncoder png;
+	png.setImageParams (width, height);
+	if (!png.initEncoder() || !png.open(filename))
+	{
+		return false;
+	}
+	std::cout << "Poster: " << width << "x" << height << " in " << tilesX << "x" << tilesY << " tiles of "
+			  << tileWidth << "x" << tileHeight << ", " << samples << " samples" << std::endl;
+
+	std::vector<unsigned char>	stripe((size_t) width * tileHeight * 3);
+	std::vector<unsigned char>	tile((size_t) tileWidth * tileHeight * 3);
+	cTimer						timer;
+	double						renderMs = 0.0, writeMs = 0.0;
+
+	for (int ty = 0; ty < tilesY; ty++)
+	{
+		const int y	= ty * tileHeight;
+		const int h	= std::min(tileHeight, height - y);
+
+		cTimer stripeTimer;
+		for (int tx = 0; tx < tilesX; tx++)
+		{
+			const int x	= tx * tileWidth;
+			const int w	= std::min(tileWidth, width - x);
+			if (!renderer->renderRegion(width, height, x, y, w, h, samples, tile.data()))
+			{
+				std::cout << "Poster: tile " << tx << "," << ty << " could not be rendered" << std::endl;
+				png.close();
+				return false;
+			}
+			for (int r = 0; r < h; r++)
+			{
+				memcpy(&stripe[((size_t) r * width + x) * 3], &tile[(size_t) r * w * 3], (size_t) w * 3);
+			}
+		}
+		const double stripeMs = stripeTimer.getElapsedMilliseconds();
+		renderMs += stripeMs;
+
+		if (!png.writeRows(stripe.data(), h))
+		{
+			std::cout << "Poster: " << filename << " could not be written" << std::endl;
+			png.close();
+			return false;
+		}
+		writeMs += stripeTimer.getElapsedMilliseconds() - stripeMs;
+		std::cout << "Poster: stripe " << ty + 1 << "/" << tilesY << " rendered in " << stripeMs << " ms" << std::endl;
+	}
+
+	if (!png.close())
+	{
+		std::cout << "Poster: " << filename << " could not be written" << std::endl;
+		return false;
+	}
+	std::cout << "Poster: " << filename << " saved in " << timer.getElapsedSeconds() << " s, render "
+			  << renderMs / 1000.0 << " s, PNG " << writeMs / 1000.0 << " s" << std::endl;
+	return true;
+}
+//
+//=======================================================================================
+//
+bool loadCameraPath (const std::string &filename, unsigned int samples, std::vector<sCameraKey> &keys)
+{
+	std::ifstream file(filename.c_str());
+	if (!file)
+	{
+		std::cout << "Batch: " << filename << " not found" << std::endl;
+		return false;
+	}
+
+	keys.clear();
+	std::string line;
+	for (int number = 1; std::getline(file, line); number++)
+	{
+		line = line.substr(0, line.find('#'));
+		if (line.find_first_not_of(" \t\r") == std::string::npos)
+			continue;
+
+		std::istringstream	in(line);
+		sCameraKey			key;
+		in >> key.frame >> key.eye[0] >> key.eye[1] >> key.eye[2] >> key.lookAt[0] >> key.lookAt[1] >> key.lookAt[2]
+		   >> key.up[0] >> key.up[1] >> key.up[2] >> key.fov;
+		if (!in || key.frame < 0 || (!keys.empty() && key.frame <= keys.back().frame))
+		{
+			std::cout << "Batch: " << filename << ":" << number << " is not a keyframe after the previous one" << std::endl;
+			return false;
+		}
+		if (!(in >> key.samples) || key.samples == 0)
+		{
+			key.samples = samples;
+		}
+		keys.push_back(key);
+	}
+	if (keys.empty())
+	{
+		std::cout << "Batch: no keyframes in " << filename << std::endl;
+		return false;
+	}
+	return true;
+}
+//
+//=======================================================================================
+//
+sCameraKey cameraAt (const std::vector<sCameraKey> &keys, int frame)
+{
+	size_t k = 0;
+	while (k + 1 < keys.size() && keys[k + 1].frame <= frame)
+	{
+		k++;
+	}
+
+	// the samples of the key before
+	sCameraKey key = keys[k];
+	if (k + 1 < keys.size() && frame > key.frame)
+	{
+		const sCameraKey	&next	= keys[k + 1];
+		const float			t		= (float)(frame - key.frame) / (float)(next.frame - key.frame);
+		for (int i = 0; i < 3; i++)
+		{
+			key.eye[i]		+= t * (next.eye[i] - key.eye[i]);
+			key.lookAt[i]	+= t * (next.lookAt[i] - key.lookAt[i]);
+			key.up[i]		+= t * (next.up[i] - key.up[i]);
+		}
+		key.fov += t * (next.fov - key.fov);
+	}
+	key.frame = frame;
+	return key;
+}
+//
+//=======================================================================================
+//
+bool renderBatch (cParticlesRenderer *renderer, const std::string &pathFile, unsigned int samples)
+{
+	std::vector<sCameraKey> keys;
+	if (!loadCameraPath(pathFile, samples, keys))
+	{
+		// a keyframe to start a path from
+		sCameraKey initial;
+		renderer->getCamera(initial.eye, initial.lookAt, initial.up, initial.fov);
+		std::cout << "Batch: the initial view is the keyframe\n0 "
+				  << initial.eye[0] << " " << initial.eye[1] << " " << initial.eye[2] << " "
+				  << initial.lookAt[0] << " " << initial.lookAt[1] << " " << initial.lookAt[2] << " "
+				  << initial.up[0] << " " << initial.up[1] << " " << initial.up[2] << " "
+				  << initial.fov << " " << samples << std::endl;
+		return false;
+	}
+
+	renderer->setRenderScale (100);
+	const int	width	= renderer->renderWidth();
+	const int	height	= renderer->renderHeight();
+	const int	frames	= keys.back().frame - keys.front().frame + 1;
+	std::cout << "Batch: " << frames << " frames of " << width << "x" << height << " from " << keys.size()
+			  << " keyframes, " << BATCH_WRITER_THREADS << " PNG writers" << std::endl;
+
+	std::vector<unsigned char>	img((size_t) width * height * 3);
+	cSnapshotWriter				writer(width, height, BATCH_WRITER_THREADS, BATCH_QUEUE_FRAMES);
+	cTimer						timer;
+	double						renderMs = 0.0, queueMs = 0.0;
+	uint64_t					rays = 0;
+
+	for (int f = keys.front().frame; f <= keys.back().frame; f++)
+	{
+		const sCameraKey key = cameraAt(keys, f);
+
+		cTimer stage;
+		renderer->setCamera(key.eye, key.lookAt, key.up, key.fov);
+		if (!renderer->renderRegion(width, height, 0, 0, width, height, key.samples, img.data()))
+		{
+			std::cout << "Batch: frame " << f << " could not be rendered" << std::endl;
+			return false;
+		}
+		const double frameMs = stage.getElapsedMilliseconds();
+		renderMs	+= frameMs;
+		rays		+= (uint64_t) width * height * std::max(key.samples, 1u);
+
+		char filename[64];
+		snprintf(filename, sizeof(filename), "Sight_Batch_%05d.png", f);
+		stage.reset();
+		// waits while all the buffers are being compressed, no frame is dropped; renderRegion()
+		// returns the rows top-down
+		writer.save(filename, img.data(), true, true);
+		queueMs += stage.getElapsedMilliseconds();
+		std::cout << "Batch: frame " << f << ", " << key.samples << " samples in " << frameMs << " ms" << std::endl;
+	}
+	writer.flush();
+
+	const double seconds = timer.getElapsedSeconds();
+	std::cout << "Batch: " << frames << " frames in " << seconds << " s, " << frames / seconds << " frames/s, "
+			  << rays / seconds / 1e6 << " M pixel samples/s" << std::endl;
+	std::cout << "Batch: per frame render " << renderMs / frames << " ms, hand-off " << queueMs / frames
+			  << " ms, PNG " << writer.writeMs(0.0f) << " ms, render to file " << writer.latencyMs(0.0f) << " ms" << std::endl;
+	if (writer.failed() > 0)
+	{
+		std::cout << "Batch: " << writer.failed() << " frames could not be written" << std::endl;
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,241 @@
+/*
+ * Distributed under the OSI-approved Apache License, Version 2.0.  See
+ * accompanying file Copyright.txt for details.
+ */
+
+#include <string.h>
+#include <algorithm>
+#include "../frameserver/header/cThreadPool.h"
+#include "../header/particleSort.h"
+
+#define MORTON_RADIX_BITS	10
+#define MORTON_RADIX_SIZE	(1 << MORTON_RADIX_BITS)
+
+void sParticleBounds::reset ( )
+{
+	for (int c = 0; c < 3; c++)
+	{
+		min[c] =  1e38f;
+		max[c] = -1e38f;
+	}
+}
+//
+//=======================================================================================
+//
+void sParticleBounds::grow (const float *p)
+{
+	for (int c = 0; c < 3; c++)
+	{
+		min[c] = std::min(min[c], p[c]);
+		max[c] = std::max(max[c], p[c]);
+	}
+}
+//
+//=======================================================================================
+//
+void sParticleBounds::grow (const sParticleBounds &b)
+{
+	for (int c = 0; c < 3; c++)
+	{
+		min[c] = std::min(min[c], b.min[c]);
+		max[c] = std::max(max[c], b.max[c]);
+	}
+}
+//
+//=======================================================================================
+//
+bool sParticleBounds::overlaps (const sParticleBounds &b) const
+{
+	for (int c = 0; c < 3; c++)
+	{
+		if (min[c] > b.max[c] || b.min[c] > max[c])
+			return false;
+	}
+	return true;
+}
+//
+//=======================================================================================
+//
+double sParticleBounds::volume ( ) const
+{
+	double v = 1.0;
+	for (int c = 0; c < 3; c++)
+	{
+		v *= std::max(0.0, (double)max[c] - (double)min[c]);
+	}
+	return v;
+}
+//
+//=======================================================================================
+//
+// Inserts two zero bits between each of the lower 10 bits of v
+static inline uint32_t expandBits (uint32_t v)
+{
+	v = (v * 0x00010001u) & 0xFF0000FFu;
+	v = (v * 0x00000101u) & 0x0F00F00Fu;
+	v = (v * 0x00000011u) & 0xC30C30C3u;
+	v = (v * 0x00000005u) & 0x49249249u;
+	return v;
+}
+//
+//=======================================================================================
+//
+uint32_t mortonCode (const float *p, const float *min, const float *max)
+{
+	const float	cells = (float)((1 << MORTON_BITS_PER_AXIS) - 1);
+	uint32_t	q[3];
+
+	for (int c = 0; c < 3; c++)
+	{
+		float extent	= max[c] - min[c];
+		float t			= extent > 0.0f ? (p[c] - min[c]) / extent : 0.0f;
+		q[c]			= (uint32_t) std::min(std::max(t * cells, 0.0f), cells);
+	}
+	return (expandBits(q[0]) << 2) | (expandBits(q[1]) << 1) | expandBits(q[2]);
+}
+//
+//=======================================================================================
+//
+void mortonKeys (const float *pos, uint64_t numParticles, const float *min, const float *max,
+				 std::vector<uint64_t> &items, cThreadPool &pool)
+{
+	items.resize(numParticles);
+	if (numParticles == 0)
+	{
+		return;
+	}
+
+	const unsigned int	numChunks	= (unsigned int) std::min<uint64_t>(pool.size() * 4, numParticles);
+	const uint64_t		chunkSize	= (numParticles + numChunks - 1) / numChunks;
+
+	std::vector<uint64_t>	tmp(numParticles);
+	std::vector<uint64_t>	offsets((size_t)numChunks * MORTON_RADIX_SIZE);
+
+	pool.run(numChunks, [&](unsigned int c)
+	{
+		uint64_t end = std::min(numParticles, (c + 1) * chunkSize);
+		for (uint64_t i = c * chunkSize; i < end; i++)
+		{
+			items[i] = ((uint64_t) mortonCode(pos + i * 4, min, max) << MORTON_INDEX_BITS) | i;
+		}
+	});
+
+	// one stable counting pass per 10 key bits; each chunk scatters into its own range of every bucket
+	for (int shift = MORTON_INDEX_BITS; shift < 64; shift += MORTON_RADIX_BITS)
+	{
+		pool.run(numChunks, [&](unsigned int c)
+		{
+			uint64_t	*count	= &offsets[(size_t)c * MORTON_RADIX_SIZE];
+			uint64_t	end		= std::min(numParticles, (c + 1) * chunkSize);
+
+			memset(count, 0, MORTON_RADIX_SIZE * sizeof(uint64_t));
+			for (uint64_t i = c * chunkSize; i < end; i++)
+			{
+				count[(items[i] >> shift) & (MORTON_RADIX_SIZE - 1)]++;
+			}
+		});
+
+		uint64_t sum = 0;
+		for (unsigned int b = 0; b < MORTON_RADIX_SIZE; b++)
+		{
+			for (unsigned int c = 0; c < numChunks; c++)
+			{
+				uint64_t n = offsets[(size_t)c * MORTON_RADIX_SIZE + b];
+				offsets[(size_t)c * MORTON_RADIX_SIZE + b] = sum;
+				sum += n;
+			}
+		}
+
+		pool.run(numChunks, [&](unsigned int c)
+		{
+			uint64_t	*offset	= &offsets[(size_t)c * MORTON_RADIX_SIZE];
+			uint64_t	end		= std::min(numParticles, (c + 1) * chunkSize);
+
+			for (uint64_t i = c * chunkSize; i < end; i++)
+			{
+				tmp[offset[(items[i] >> shift) & (MORTON_RADIX_SIZE - 1)]++] = items[i];
+			}
+		});
+		items.swap(tmp);
+	}
+}
+//
+//=======================================================================================
+//
+void mortonSort (float *pos, uint64_t numParticles, const float *min, const float *max, cThreadPool &pool)
+{
+	if (numParticles < 2)
+	{
+		return;
+	}
+
+	const unsigned int	numChunks	= (unsigned int) std::min<uint64_t>(pool.size() * 4, numParticles);
+	const uint64_t		chunkSize	= (numParticles + numChunks - 1) / numChunks;
+	const uint64_t		indexMask	= (1ull << MORTON_INDEX_BITS) - 1;
+
+	std::vector<uint64_t> items;
+	mortonKeys(pos, numParticles, min, max, items, pool);
+
+	// gather the particles in key order, then copy them back
+	std::vector<float> sorted(numParticles * 4);
+	pool.run(numChunks, [&](unsigned int c)
+	{
+		uint64_t end = std::min(numParticles, (c + 1) * chunkSize);
+		for (uint64_t i = c * chunkSize; i < end; i++)
+		{
+			memcpy(&sorted[i * 4], pos + (items[i] & indexMask) * 4, 4 * sizeof(float));
+		}
+	});
+	pool.run(numChunks, [&](unsigned int c)
+	{
+		uint64_t begin	= std::min(numParticles, c * chunkSize);
+		uint64_t end	= std::min(numParticles, (c + 1) * chunkSize);
+		memcpy(pos + begin * 4, &sorted[begin * 4], (end - begin) * 4 * sizeof(float));
+	});
+}
+//
+//=======================================================================================
+//
+sGroupOverlapStats groupOverlap (const std::vector<sParticleBounds> &groups)
+{
+	sGroupOverlapStats	stats;
+	sParticleBounds		scene;
+	double				groupVolume = 0.0;
+	uint64_t			overlapping = 0;
+
+	scene.reset();
+	for (size_t i = 0; i < groups.size(); i++)
+	{
+		scene.grow(groups[i]);
+		groupVolume += groups[i].volume();
+		for (size_t j = i + 1; j < groups.size(); j++)
+		{
+			if (groups[i].overlaps(groups[j]))
+				overlapping += 2;
+		}
+	}
+
+	stats.numGroups			= (unsigned int) groups.size();
+	stats.volumeRatio		= scene.volume() > 0.0 ? groupVolume / scene.volume() : 0.0;
+	stats.meanOverlapping	= groups.empty() ? 0.0 : (double)overlapping / groups.size();
+	return stats;
+}
+//
+//=======================================================================================
+//
+sGroupOverlapStats groupOverlap (const float *pos, uint64_t numParticles, uint64_t groupSize, cThreadPool &pool)
+{
+	const unsigned int				numGroups = (unsigned int) ((numParticles + groupSize - 1) / groupSize);
+	std::vector<sParticleBounds>	groups(numGroups);
+
+	pool.run(numGroups, [&](unsigned int g)
+	{
+		uint64_t end = std::min(numParticles, (g + 1) * groupSize);
+		groups[g].reset();
+		for (uint64_t i = g * groupSize; i < end; i++)
+		{
+			groups[g].grow(pos + i * 4);
+		}
+	});
+	return groupOverlap(groups);
+}
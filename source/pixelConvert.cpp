@@ -0,0 +1,131 @@
+/*
+ * Distributed under the OSI-approved Apache License, Version 2.0.  See
+ * accompanying file Copyright.txt for details.
+ */
+
+#include <algorithm>
+#include "../frameserver/header/cThreadPool.h"
+#include "../header/pixelConvert.h"
+
+static inline unsigned char toByte (float v)
+{
+	int p = static_cast<int>(v * 255.0f);
+	return static_cast<unsigned char>(p < 0 ? 0 : p > 0xff ? 0xff : p);
+}
+//
+//=======================================================================================
+//
+void convertRowScalar (const void *src, ePixelFormat format, unsigned int width, unsigned char *dst)
+{
+	switch (format)
+	{
+		case PIXEL_BGRA8:
+		{
+			const unsigned char *s = (const unsigned char*) src;
+			for (unsigned int i = 0; i < width; i++, s += 4)
+			{
+				*dst++ = s[2];
+				*dst++ = s[1];
+				*dst++ = s[0];
+			}
+			break;
+		}
+		case PIXEL_FLOAT:
+		{
+			const float *s = (const float*) src;
+			for (unsigned int i = 0; i < width; i++)
+			{
+				unsigned char v = toByte(*s++);
+				*dst++ = v;
+				*dst++ = v;
+				*dst++ = v;
+			}
+			break;
+		}
+		case PIXEL_FLOAT3:
+		{
+			const float *s = (const float*) src;
+			for (unsigned int i = 0; i < width * 3; i++)
+			{
+				*dst++ = toByte(*s++);
+			}
+			break;
+		}
+		case PIXEL_FLOAT4:
+		{
+			const float *s = (const float*) src;
+			for (unsigned int i = 0; i < width; i++, s += 4)
+			{
+				*dst++ = toByte(s[0]);
+				*dst++ = toByte(s[1]);
+				*dst++ = toByte(s[2]);
+			}
+			break;
+		}
+	}
+}
+//
+//=======================================================================================
+//
+bool pixelConvertSupportsAVX2 ( )
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_cpu_supports("avx2");
+#else
+	return false;
+#endif
+}
+//
+//=======================================================================================
+//
+static inline unsigned int pixelBytes (ePixelFormat format)
+{
+	switch (format)
+	{
+		case PIXEL_BGRA8:	return 4;
+		case PIXEL_FLOAT:	return sizeof(float);
+		case PIXEL_FLOAT3:	return 3 * sizeof(float);
+		case PIXEL_FLOAT4:	return 4 * sizeof(float);
+	}
+	return 0;
+}
+//
+//=======================================================================================
+//
+void convertToRGB8 (const void *src, ePixelFormat format, unsigned int width, unsigned int height,
+					unsigned char *dst, cThreadPool *pool, bool simd, unsigned int srcWidth)
+{
+	void			(*convertRow)(const void*, ePixelFormat, unsigned int, unsigned char*) =
+					simd && pixelConvertSupportsAVX2() ? convertRowAVX2 : convertRowScalar;
+	const size_t	srcPitch	= (size_t) std::max(width, srcWidth) * pixelBytes(format);
+	const size_t	dstPitch	= (size_t) width * 3;
+	const unsigned	numTasks	= (height + PIXEL_CONVERT_ROWS_PER_TASK - 1) / PIXEL_CONVERT_ROWS_PER_TASK;
+
+	// the buffer is upside down: source row j is image row height - 1 - j
+	auto task = [&](unsigned int t)
+	{
+		unsigned int end = std::min(height, (t + 1) * PIXEL_CONVERT_ROWS_PER_TASK);
+		for (unsigned int y = t * PIXEL_CONVERT_ROWS_PER_TASK; y < end; y++)
+		{
+			convertRow((const unsigned char*) src + (height - 1 - y) * srcPitch, format, width, dst + y * dstPitch);
+		}
+	};
+
+	if (pool)
+	{
+		pool->run(numTasks, task);
+	}
+	else
+	{
+		for (unsigned int t = 0; t < numTasks; t++)
+			task(t);
+	}
+}
+//
+//=======================================================================================
+//
+cThreadPool* pixelConvertPool ( )
+{
+	static cThreadPool pool;
+	return &pool;
+}
@@ -0,0 +1,123 @@
+/*
+ * Distributed under the OSI-approved Apache License, Version 2.0.  See
+ * accompanying file Copyright.txt for details.
+ */
+
+// Standard headers are included before the target pragma so no library code is compiled for AVX2
+#include "../header/pixelConvert.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#include <immintrin.h>
+
+// 32 floats to 32 bytes in order, truncated and saturated to [0, 255] like the scalar path
+static inline __m256i floatsToBytes (const float *s)
+{
+	const __m256	scale	= _mm256_set1_ps(255.0f);
+	__m256i			a		= _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_loadu_ps(s),      scale));
+	__m256i			b		= _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_loadu_ps(s + 8),  scale));
+	__m256i			c		= _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_loadu_ps(s + 16), scale));
+	__m256i			d		= _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_loadu_ps(s + 24), scale));
+	// the packs work per 128 bit lane, the permute restores the order of the 4 byte groups
+	__m256i			bytes	= _mm256_packus_epi16(_mm256_packs_epi32(a, b), _mm256_packs_epi32(c, d));
+	return _mm256_permutevar8x32_epi32(bytes, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+}
+
+static inline unsigned char toByte (float v)
+{
+	int p = static_cast<int>(v * 255.0f);
+	return static_cast<unsigned char>(p < 0 ? 0 : p > 0xff ? 0xff : p);
+}
+
+// 8 four byte pixels to 24 RGB bytes. Each lane is stored with 16 bytes, so the caller keeps
+// 4 bytes of slack after the output.
+static inline void storeRGB (unsigned char *dst, __m256i pixels, __m256i mask)
+{
+	__m256i rgb = _mm256_shuffle_epi8(pixels, mask);
+	_mm_storeu_si128((__m128i*) dst,        _mm256_castsi256_si128(rgb));
+	_mm_storeu_si128((__m128i*)(dst + 12),  _mm256_extracti128_si256(rgb, 1));
+}
+//
+//=======================================================================================
+//
+void convertRowAVX2 (const void *src, ePixelFormat format, unsigned int width, unsigned char *dst)
+{
+	unsigned int i = 0;
+
+	switch (format)
+	{
+		case PIXEL_BGRA8:
+		{
+			const unsigned char	*s		= (const unsigned char*) src;
+			const __m256i		mask	= _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+															2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+			for (; i + 10 <= width; i += 8)
+			{
+				storeRGB(dst + i * 3, _mm256_loadu_si256((const __m256i*)(s + i * 4)), mask);
+			}
+			convertRowScalar(s + i * 4, format, width - i, dst + i * 3);
+			break;
+		}
+		case PIXEL_FLOAT4:
+		{
+			const float		*s		= (const float*) src;
+			const __m256i	mask	= _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+														0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+			for (; i + 10 <= width; i += 8)
+			{
+				storeRGB(dst + i * 3, floatsToBytes(s + i * 4), mask);
+			}
+			convertRowScalar(s + i * 4, format, width - i, dst + i * 3);
+			break;
+		}
+		case PIXEL_FLOAT3:
+		{
+			// channels are converted in place, 32 at a time
+			const float			*s	= (const float*) src;
+			const unsigned int	n	= width * 3;
+			for (; i + 32 <= n; i += 32)
+			{
+				_mm256_storeu_si256((__m256i*)(dst + i), floatsToBytes(s + i));
+			}
+			for (; i < n; i++)
+			{
+				dst[i] = toByte(s[i]);
+			}
+			break;
+		}
+		case PIXEL_FLOAT:
+		{
+			const float		*s	= (const float*) src;
+			const __m128i	m0	= _mm_setr_epi8(0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5);
+			const __m128i	m1	= _mm_setr_epi8(5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10);
+			const __m128i	m2	= _mm_setr_epi8(10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15);
+			for (; i + 32 <= width; i += 32)
+			{
+				__m256i			bytes	= floatsToBytes(s + i);
+				unsigned char	*d		= dst + i * 3;
+				for (int h = 0; h < 2; h++, d += 48)
+				{
+					__m128i v = h ? _mm256_extracti128_si256(bytes, 1) : _mm256_castsi256_si128(bytes);
+					_mm_storeu_si128((__m128i*) d,        _mm_shuffle_epi8(v, m0));
+					_mm_storeu_si128((__m128i*)(d + 16),  _mm_shuffle_epi8(v, m1));
+					_mm_storeu_si128((__m128i*)(d + 32),  _mm_shuffle_epi8(v, m2));
+				}
+			}
+			convertRowScalar(s + i, format, width - i, dst + i * 3);
+			break;
+		}
+	}
+}
+
+#pragma GCC pop_options
+
+#else
+
+void convertRowAVX2 (const void *src, ePixelFormat format, unsigned int width, unsigned char *dst)
+{
+	convertRowScalar(src, format, width, dst);
+}
+
+#endif
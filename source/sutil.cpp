@@ -28,6 +28,7 @@
 
 
 #include "../header/sutil.h"
+#include "../header/pixelConvert.h"
 //#include <sutil/HDRLoader.h>
 //#include <sutil/PPMLoader.h>
 //#include <sampleConfig.h>
@@ -185,76 +186,19 @@ void sutil::displayBufferPPM( const char* filename, RTbuffer buffer)
     RTformat buffer_format;
     RT_CHECK_ERROR( rtBufferGetFormat(buffer, &buffer_format) );
 
+    // Data is upside down, BGRA buffers are swizzled to RGB
+    ePixelFormat format;
     switch(buffer_format) {
-        case RT_FORMAT_UNSIGNED_BYTE4:
-            // Data is BGRA and upside down, so we need to swizzle to RGB
-            for(int j = height-1; j >= 0; --j) {
-                unsigned char *dst = &pix[0] + (3*width*(height-1-j));
-                unsigned char *src = ((unsigned char*)imageData) + (4*width*j);
-                for(int i = 0; i < width; i++) {
-                    *dst++ = *(src + 2);
-                    *dst++ = *(src + 1);
-                    *dst++ = *(src + 0);
-                    src += 4;
-                }
-            }
-            break;
-
-        case RT_FORMAT_FLOAT:
-            // This buffer is upside down
-            for(int j = height-1; j >= 0; --j) {
-                unsigned char *dst = &pix[0] + width*(height-1-j);
-                float* src = ((float*)imageData) + (3*width*j);
-                for(int i = 0; i < width; i++) {
-                    int P = static_cast<int>((*src++) * 255.0f);
-                    unsigned int Clamped = P < 0 ? 0 : P > 0xff ? 0xff : P;
-
-                    // write the pixel to all 3 channels
-                    *dst++ = static_cast<unsigned char>(Clamped);
-                    *dst++ = static_cast<unsigned char>(Clamped);
-                    *dst++ = static_cast<unsigned char>(Clamped);
-                }
-            }
-            break;
-
-        case RT_FORMAT_FLOAT3:
-            // This buffer is upside down
-            for(int j = height-1; j >= 0; --j) {
-                unsigned char *dst = &pix[0] + (3*width*(height-1-j));
-                float* src = ((float*)imageData) + (3*width*j);
-                for(int i = 0; i < width; i++) {
-                    for(int elem = 0; elem < 3; ++elem) {
-                        int P = static_cast<int>((*src++) * 255.0f);
-                        unsigned int Clamped = P < 0 ? 0 : P > 0xff ? 0xff : P;
-                        *dst++ = static_cast<unsigned char>(Clamped);
-                    }
-                }
-            }
-            break;
-
-        case RT_FORMAT_FLOAT4:
-            // This buffer is upside down
-            for(int j = height-1; j >= 0; --j) {
-                unsigned char *dst = &pix[0] + (3*width*(height-1-j));
-                float* src = ((float*)imageData) + (4*width*j);
-                for(int i = 0; i < width; i++) {
-                    for(int elem = 0; elem < 3; ++elem) {
-                        int P = static_cast<int>((*src++) * 255.0f);
-                        unsigned int Clamped = P < 0 ? 0 : P > 0xff ? 0xff : P;
-                        *dst++ = static_cast<unsigned char>(Clamped);
-                    }
-
-                    // skip alpha
-                    src++;
-                }
-            }
-            break;
-
+        case RT_FORMAT_UNSIGNED_BYTE4:  format = PIXEL_BGRA8;   break;
+        case RT_FORMAT_FLOAT:           format = PIXEL_FLOAT;   break;
+        case RT_FORMAT_FLOAT3:          format = PIXEL_FLOAT3;  break;
+        case RT_FORMAT_FLOAT4:          format = PIXEL_FLOAT4;  break;
         default:
             fprintf(stderr, "Unrecognized buffer data type or format.\n");
             exit(2);
             break;
     }
+    convertToRGB8(imageData, format, width, height, &pix[0], pixelConvertPool());
 
     SavePPM(&pix[0], filename, width, height, 3);
 
@@ -270,108 +214,43 @@ void sutil::displayStreamBuffer( unsigned char *pix, RTbuffer buffer, unsigned i
 
 	    // In Optix 4.0.x a stream buffer format must be RT_FORMAT_UNSIGNED_BYTE4:
 	    // Data is BGRA and upside down, so we need to swizzle to RGB
-	    for(int j = height-1; j >= 0; --j) {
-	    	unsigned char *dst = pix + (3*width*(height-1-j));
-	        unsigned char *src = ((unsigned char*)imageData) + (4*width*j);
-	        for(int i = 0; i < width; i++)
-	        {
-	        	*dst++ = *(src + 2);
-	            *dst++ = *(src + 1);
-	            *dst++ = *(src + 0);
-	            src += 4;
-	        }
-	    }
+	    convertToRGB8(imageData, PIXEL_BGRA8, width, height, pix, pixelConvertPool());
 	    // Now unmap the buffer
 	    RT_CHECK_ERROR( rtBufferUnmap(buffer) );
 }
 
-void sutil::displayBuffer( unsigned char *pix, RTbuffer buffer)
+void sutil::displayBuffer( unsigned char *pix, RTbuffer buffer, unsigned int width, unsigned int height)
 {
-    unsigned int width, height;
     RTsize buffer_width, buffer_height;
 
     void* imageData;
     RT_CHECK_ERROR( rtBufferMap( buffer, &imageData) );
 
     RT_CHECK_ERROR( rtBufferGetSize2D(buffer, &buffer_width, &buffer_height) );
-    width  = static_cast<unsigned int>(buffer_width);
-    height = static_cast<unsigned int>(buffer_height);
+    if (width == 0 || height == 0)
+    {
+        width  = static_cast<unsigned int>(buffer_width);
+        height = static_cast<unsigned int>(buffer_height);
+    }
 
     //std::vector<unsigned char> pix(width * height * 3);
 
     RTformat buffer_format;
     RT_CHECK_ERROR( rtBufferGetFormat(buffer, &buffer_format) );
 
+    // Data is upside down, BGRA buffers are swizzled to RGB
+    ePixelFormat format;
     switch(buffer_format) {
-        case RT_FORMAT_UNSIGNED_BYTE4:
-            // Data is BGRA and upside down, so we need to swizzle to RGB
-            for(int j = height-1; j >= 0; --j) {
-                unsigned char *dst = pix + (3*width*(height-1-j));
-                unsigned char *src = ((unsigned char*)imageData) + (4*width*j);
-                for(int i = 0; i < width; i++) {
-                    *dst++ = *(src + 2);
-                    *dst++ = *(src + 1);
-                    *dst++ = *(src + 0);
-                    src += 4;
-                }
-            }
-            break;
-
-        case RT_FORMAT_FLOAT:
-            // This buffer is upside down
-            for(int j = height-1; j >= 0; --j) {
-                unsigned char *dst = &pix[0] + width*(height-1-j);
-                float* src = ((float*)imageData) + (3*width*j);
-                for(int i = 0; i < width; i++) {
-                    int P = static_cast<int>((*src++) * 255.0f);
-                    unsigned int Clamped = P < 0 ? 0 : P > 0xff ? 0xff : P;
-
-                    // write the pixel to all 3 channels
-                    *dst++ = static_cast<unsigned char>(Clamped);
-                    *dst++ = static_cast<unsigned char>(Clamped);
-                    *dst++ = static_cast<unsigned char>(Clamped);
-                }
-            }
-            break;
-
-        case RT_FORMAT_FLOAT3:
-            // This buffer is upside down
-            for(int j = height-1; j >= 0; --j) {
-                unsigned char *dst = &pix[0] + (3*width*(height-1-j));
-                float* src = ((float*)imageData) + (3*width*j);
-                for(int i = 0; i < width; i++) {
-                    for(int elem = 0; elem < 3; ++elem) {
-                        int P = static_cast<int>((*src++) * 255.0f);
-                        unsigned int Clamped = P < 0 ? 0 : P > 0xff ? 0xff : P;
-                        *dst++ = static_cast<unsigned char>(Clamped);
-                    }
-                }
-            }
-            break;
-
-        case RT_FORMAT_FLOAT4:
-            // This buffer is upside down
-            for(int j = height-1; j >= 0; --j) {
-                unsigned char *dst = &pix[0] + (3*width*(height-1-j));
-                float* src = ((float*)imageData) + (4*width*j);
-                for(int i = 0; i < width; i++) {
-                    for(int elem = 0; elem < 3; ++elem) {
-                        int P = static_cast<int>((*src++) * 255.0f);
-                        unsigned int Clamped = P < 0 ? 0 : P > 0xff ? 0xff : P;
-                        *dst++ = static_cast<unsigned char>(Clamped);
-                    }
-
-                    // skip alpha
-                    src++;
-                }
-            }
-            break;
-
+        case RT_FORMAT_UNSIGNED_BYTE4:  format = PIXEL_BGRA8;   break;
+        case RT_FORMAT_FLOAT:           format = PIXEL_FLOAT;   break;
+        case RT_FORMAT_FLOAT3:          format = PIXEL_FLOAT3;  break;
+        case RT_FORMAT_FLOAT4:          format = PIXEL_FLOAT4;  break;
         default:
             fprintf(stderr, "Unrecognized buffer data type or format.\n");
             exit(2);
             break;
     }
+    convertToRGB8(imageData, format, width, height, pix, pixelConvertPool(), true, static_cast<unsigned int>(buffer_width));
 
      // Now unmap the buffer
     RT_CHECK_ERROR( rtBufferUnmap(buffer) );